@@ -15,17 +15,9 @@ static const char *TAG = "mini_beam_esp32";
 static const uint8_t app_program[] = {
     MB_OP_RECV_CMD, 0, 1, 2, 3, 4,
 
-    MB_OP_CONST_I32, 5, I32LE(MB_CMD_GPIO_WRITE),
-    MB_OP_SUB, 6, 0, 5,
-    MB_OP_JMP_IF_ZERO, 6, I32LE(21),
-
-    MB_OP_CONST_I32, 5, I32LE(MB_CMD_PWM_SET_DUTY),
-    MB_OP_SUB, 6, 0, 5,
-    MB_OP_JMP_IF_ZERO, 6, I32LE(15),
-
-    MB_OP_CONST_I32, 5, I32LE(MB_CMD_I2C_READ),
-    MB_OP_SUB, 6, 0, 5,
-    MB_OP_JMP_IF_ZERO, 6, I32LE(9),
+    /* GPIO_WRITE, PWM_SET_DUTY, I2C_READ; other types halt */
+    MB_OP_JUMP_TABLE, 0, 3, I32LE(MB_CMD_GPIO_WRITE), I32LE(0),
+    I32LE(1), I32LE(8), I32LE(15),
 
     MB_OP_HALT,
 
@@ -40,7 +32,7 @@ static const uint8_t app_program[] = {
 };
 
 void app_main(void) {
-    mb_vm_t vm;
+    static mb_vm_t vm; /* embeds a full process; keep it off the task stack */
     mb_command_t cmd;
     int rc;
 
@@ -59,9 +51,9 @@ void app_main(void) {
 
     rc = mb_vm_run(&vm, 128);
     if (rc != MB_OK) {
-        ESP_LOGE(TAG, "vm failed: err=%d pc=%u", rc, (unsigned)vm.pc);
+        ESP_LOGE(TAG, "vm failed: err=%d pc=%u", rc, (unsigned)vm.proc->pc);
         return;
     }
 
-    ESP_LOGI(TAG, "vm done: last_error=%d", vm.last_error);
+    ESP_LOGI(TAG, "vm done: last_error=%d", vm.proc->last_error);
 }
@@ -0,0 +1,77 @@
+#ifndef MB_ARENA_H
+#define MB_ARENA_H
+
+/**
+ * @file mb_arena.h
+ * @brief Board-level memory arena that process heaps are carved from.
+ *
+ * The board gives the scheduler one region of words (a static array, a
+ * linker section, a malloc'd block on the host) and each process takes
+ * the heap it asks for at spawn, instead of every process carrying the
+ * same compile-time heap.
+ *
+ * Blocks come in size classes of 2^k and 3 * 2^(k-1) words, from
+ * MB_ARENA_MIN_WORDS up, so a request is rounded up by less than half.
+ * A freed block goes onto its class's free list (slab style) and serves
+ * the next request of that class; otherwise a block is cut from the
+ * untouched top of the region.  Blocks are never split or merged: an
+ * application that spawns and exits processes of a few sizes reaches a
+ * steady state in which every spawn reuses a freed block.
+ *
+ * Not thread-safe; the scheduler and its processes run on one thread.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mb_term.h"
+
+#define MB_ARENA_MIN_WORDS 8
+#define MB_ARENA_CLASSES   51  /* 8 .. 2^28 words: the reach of a term offset */
+
+typedef struct {
+    mb_term_t *base;
+    size_t     words;     /* region size */
+    size_t     top;       /* words cut from the region so far */
+    size_t     in_use;    /* words in allocated blocks */
+    uint32_t   free_head[MB_ARENA_CLASSES];  /* word offset + 1 of a free block, 0: none */
+} mb_arena_t;
+
+/**
+ * @brief Hand the arena a region of @p words words (all free).
+ *
+ * @p mem may be NULL with @p words 0: every allocation then fails.
+ */
+void mb_arena_init(mb_arena_t *arena, mb_term_t *mem, size_t words);
+
+/**
+ * @brief Size of the class that holds @p words words.
+ *
+ * @return Block size in words, or 0 if @p words is 0 or exceeds the
+ *         largest class.
+ */
+size_t mb_arena_round(size_t words);
+
+/**
+ * @brief Size of the largest class of at most @p words words, 0 if
+ *        @p words is below MB_ARENA_MIN_WORDS.
+ */
+size_t mb_arena_round_down(size_t words);
+
+/**
+ * @brief Allocate a block of at least @p words words.
+ *
+ * @param granted Output: the block's size (mb_arena_round(@p words)).
+ * @return The block (contents undefined), or NULL if @p words is 0 or
+ *         the region has no room for it.
+ */
+mb_term_t *mb_arena_alloc(mb_arena_t *arena, size_t words, size_t *granted);
+
+/**
+ * @brief Return a block to its class's free list.
+ *
+ * @param granted The size mb_arena_alloc() granted for @p block.
+ */
+void mb_arena_free(mb_arena_t *arena, mb_term_t *block, size_t granted);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef MB_BIF_H
+#define MB_BIF_H
+
+/**
+ * @file mb_bif.h
+ * @brief BIF table and native function registration.
+ *
+ * CALL_BIF indexes a dense table by BIF id.  Each entry carries the
+ * function, its fixed arity and the reductions a call costs.  The seven
+ * HAL BIFs of mb_bif_t are pre-registered (cost 1); applications add
+ * their own natives (checksums, filters, packet codecs) with
+ * mb_bif_register() at startup, before any program that calls them is
+ * spawned, so the verifier can check their arity at load time.
+ *
+ * A native receives the process and its argument terms, copied from the
+ * argument registers.  It writes @p result (the destination register)
+ * only when it returns MB_OK; any other status faults the process with
+ * that status, as for the built-in BIFs.  A native may allocate on
+ * `proc->heap` and must return MB_HEAP_OOM when that fails.
+ *
+ * The scheduler charges the entry's cost instead of one reduction, so an
+ * expensive native shortens the caller's slice; the slice may end past
+ * its budget by up to cost - 1 reductions.
+ *
+ * Long-running natives (a register burst, a checksum over a buffer)
+ * charge their work as they go with mb_bif_consume().  When it fails the
+ * slice is used up: the native saves its position in `proc->bif_state`
+ * and returns MB_BIF_TRAP without writing @p result.  The process stays
+ * ready with `pc` on the CALL_BIF, and the next slice calls the native
+ * again with the same arguments and the saved state.  `bif_state` is all
+ * zero on the first entry of each call, and the VM clears it when the
+ * call returns anything but MB_BIF_TRAP.  It is not a GC root: keep
+ * counters and offsets there, not heap terms.
+ */
+
+#include <stdint.h>
+
+#include "mb_process.h"
+#include "mb_term.h"
+#include "mb_types.h"
+
+#ifndef MB_BIF_MAX
+#define MB_BIF_MAX 32  /* table size: ids 1 .. MB_BIF_MAX - 1 */
+#endif
+
+#define MB_BIF_MAX_ARITY 8  /* CALL_BIF packs argument registers as nibbles */
+
+typedef int (*mb_bif_fn)(mb_process_t *proc, const mb_term_t *args, mb_term_t *result);
+
+typedef struct {
+    const char *name;
+    mb_bif_fn   fn;     /* NULL: id not registered */
+    uint8_t     arity;
+    uint8_t     cost;   /* reductions charged per call, >= 1 */
+} mb_bif_entry_t;
+
+/* Read by the interpreter; change it through mb_bif_register() only. */
+extern mb_bif_entry_t mb_bif_table[MB_BIF_MAX];
+
+/**
+ * @brief Charge @p reds reductions of native work to the running slice.
+ *
+ * Each entry into a native may use what is left of the slice, and at
+ * least one reduction.  Charge work in small units so a trapped call
+ * also progresses under mb_proc_step().
+ *
+ * @return 1 if charged, 0 if the slice has too few left (nothing is
+ *         charged; save state and return MB_BIF_TRAP).
+ */
+static inline int mb_bif_consume(mb_process_t *proc, uint32_t reds) {
+    if (proc->bif_reds < reds) {
+        return 0;
+    }
+    proc->bif_reds -= reds;
+    return 1;
+}
+
+/**
+ * @brief Register a native function under a free BIF id.
+ *
+ * Not thread-safe; call it before the scheduler runs.  Built-in ids
+ * cannot be replaced.
+ *
+ * @param id BIF id used by CALL_BIF, 1 .. MB_BIF_MAX - 1.
+ * @param name Name for diagnostics; must stay valid (a string literal).
+ * @param arity Argument count, 0 .. MB_BIF_MAX_ARITY.
+ * @param reduction_cost Reductions charged per call, >= 1.
+ * @param fn The native.
+ * @return MB_OK, MB_BAD_BIF (id out of range or already registered),
+ *         MB_BAD_ARGC (arity too large) or MB_BAD_ARGUMENT (NULL @p fn
+ *         or zero cost).
+ */
+int mb_bif_register(uint8_t id, const char *name, uint8_t arity,
+                    uint8_t reduction_cost, mb_bif_fn fn);
+
+/**
+ * @brief Table entry of @p id, or NULL if the id is not registered.
+ */
+const mb_bif_entry_t *mb_bif_lookup(uint8_t id);
+
+/**
+ * @brief Check a mailbox command against the argument ranges of the BIF
+ *        it drives (e.g. MB_CMD_PWM_SET_DUTY as MB_BIF_PWM_SET_DUTY).
+ *
+ * @return MB_OK, MB_BAD_ARGUMENT or MB_INVALID_COMMAND.
+ */
+int mb_bif_validate_command(const mb_command_t *cmd);
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef MB_CODE_H
+#define MB_CODE_H
+
+/**
+ * @file mb_code.h
+ * @brief Pre-decoded instruction stream built once per program.
+ *
+ * Bytecode is immutable once a process is spawned, so it is decoded a
+ * single time into fixed-width instructions: register operands are
+ * range-checked, constants are stored already tagged, and relative jump
+ * offsets are resolved to absolute instruction indices.  The interpreter
+ * then executes the decoded array without fetching or re-validating.
+ *
+ * Decoded images live in one store shared by all processes (mb_code_get()).
+ * A program is decoded once however many processes run it; each image
+ * is sized from its program (16 bytes per instruction, 8 per case entry)
+ * and carved from a pool of MB_CODE_POOL_WORDS words, and goes back to
+ * the pool when its last user lets go (mb_code_put()).
+ *
+ * Decode faults keep the lazy semantics of the byte-level interpreter:
+ * a bad instruction becomes a TRAP carrying the status the interpreter
+ * would have reported, and it only fires when execution reaches it.
+ * The stream always ends with an EOF trap, so running off the end of
+ * the program (or jumping outside it) reports MB_EOF.
+ *
+ * Two encodings decode to the same stream.  v1 (the contract) uses
+ * 32-bit immediates and jump offsets.  A program whose first byte is
+ * MB_CODE_COMPACT_MAGIC uses the compact encoding:
+ *
+ *   0xC0, uvarint n, n little-endian int32 literals, code
+ *
+ * Opcodes and register operands are as in v1, but integer immediates are
+ * zigzag varints (LEB128), jump offsets are int8, or int16 after a WIDE
+ * prefix, and CONST_LIT r, uvarint i loads literal i.  Offsets are still
+ * relative to the end of the instruction (prefix included).
+ *
+ * Decoding also verifies the program (see mb_verify_program()).  A
+ * verified image runs on the trusted interpreter path, which skips the
+ * per-call BIF id/arity checks; anything else stays on the checked path.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mb_term.h"
+
+#ifndef MB_CODE_POOL_WORDS
+#define MB_CODE_POOL_WORDS 2048  /* store for decoded images, 4 words per instruction */
+#endif
+
+#ifndef MB_CODE_IMAGES
+#define MB_CODE_IMAGES 16  /* programs decoded at the same time */
+#endif
+
+#ifndef MB_CODE_MAX_CASES
+#define MB_CODE_MAX_CASES 255  /* SELECT_VAL/JUMP_TABLE entries per program (max 255) */
+#endif
+
+/* First byte of a compact-encoded program; never a v1 opcode. */
+#define MB_CODE_COMPACT_MAGIC 0xC0
+
+/* Decoded-stream only opcode: fault with status in imm.  Never valid bytecode. */
+#define MB_INSN_TRAP 0xFE
+
+/**
+ * Fixed-width decoded instruction.
+ *
+ * Operand layout by opcode:
+ *   CONST_I32         r0=dst, imm=tagged constant
+ *   MOVE/ADD/SUB      r0=dst, r1=a, r2=b
+ *   MUL..XOR          r0=dst, r1=a, r2=b
+ *   MIN/MAX/QMUL      r0=dst, r1=a, r2=b
+ *   CLAMP             r0=dst, r1=src, r2=lo, r3=hi
+ *   LUT               r0=dst, r1=src, r2=mode, r3=shift, imm=byte offset of
+ *                     the entries, lit=entry count
+ *   ADD_IMM/SUB_IMM   r0=dst, r1=src, imm=raw int32 operand
+ *   CALL_BIF          r0=bif, r1=argc, r2=dst, imm=arg registers (4 bits each)
+ *   CALL              imm=target index
+ *   (DE)ALLOCATE      r0=number of Y slots
+ *   GET_Y/PUT_Y       r0=X register, r1=Y index
+ *   RECV_CMD          r0..r4 = type, a, b, c, d
+ *   SEND              r0=pid, r1..r5 = type, a, b, c, d
+ *   SELF, SLEEP_MS    r0
+ *   SPAWN             r0=dst, r1=entry, r2=first argument register, r3=argc
+ *   JMP               imm=target index
+ *   JMP_IF_ZERO       r0=reg, imm=target index
+ *   JMP_{EQ,NE,LT,GE} r0=a, r1=b, imm=target index
+ *   JMP_*_IMM         r0=a, lit=tagged constant, imm=target index
+ *   DJNZ              r0=counter, imm=target index
+ *   SELECT_VAL        r0=src, r1=n, r2=first case slot, imm=fail target index
+ *   JUMP_TABLE        r0=src, r1=n, r2=first case slot, imm=fail target index,
+ *                     lit=raw base value
+ *   MAKE_TUPLE        r0=dst, r1=arity, imm=byte offset of element registers
+ *   TUPLE_ELEM        r0=dst, r1=tuple, r2=index
+ *   CONS              r0=dst, r1=head, r2=tail
+ *   HEAD/TAIL         r0=dst, r1=cons
+ *   IS_INTEGER..IS_TUPLE  r0=term, imm=fail target index
+ *   TEST_ARITY        r0=term, r1=arity, imm=fail target index
+ *   IS_EQ_EXACT       r0=a, r1=b, imm=fail target index
+ *   GET_TUPLE_ELEMENTS r0=tuple, r1=first dst, r2=count
+ *   I2C_SAMPLE        r0..r2 = bus, addr, reg, r3=dst, r4=timestamp dst
+ *   SEND_WAIT         r0=pid, r1..r5 = type, a, b, c, d, r6=ms, imm=target index
+ *   RECV_PWM          r0..r4 = type, a, b, c, d, r5=rc dst, imm=target index
+ *   TRAP              imm=status
+ */
+typedef struct {
+    uint8_t  op;
+    uint8_t  r[7];
+    uint32_t imm;
+    uint32_t lit;  /* second immediate, for ops that also carry a target */
+} mb_insn_t;
+
+typedef struct {
+    const mb_insn_t *insns;  /* count + 1 slots: the stream, then the EOF trap */
+    uint32_t       count;    /* decoded instructions before the EOF trap */
+    /*
+     * Case tables of SELECT_VAL (values tagged, sorted per instruction for
+     * binary search) and JUMP_TABLE (targets only), as target indices.
+     */
+    const uint32_t *case_val;
+    const uint32_t *case_target;
+    uint8_t        ncases;
+    int            verify_status; /* MB_OK: verified, runs trusted */
+    const uint8_t *program;  /* source bytecode, with size and hash the store's key */
+    size_t         program_size;
+    uint32_t       hash;
+    uint16_t       refs;     /* users; 0: slot free */
+    mb_term_t     *mem;      /* pool block holding insns and the case tables */
+    size_t         words;
+} mb_code_t;
+
+/**
+ * @brief Get the decoded image of a bytecode program.
+ *
+ * Returns the image already in the store for the same buffer, size and
+ * contents, or decodes the program into a new one.  Each call takes a
+ * reference that mb_code_put() drops.  Decode faults do not fail the
+ * call; they become TRAPs in the image (see above).
+ *
+ * @param program Bytecode buffer (NULL allowed when program_size is 0).
+ *                Must outlive the image.
+ * @param program_size Size of the bytecode buffer in bytes.
+ * @return The image, never NULL.  When the store has no room the image
+ *         is a single MB_CODE_TOO_LARGE trap (also its verify_status).
+ */
+const mb_code_t *mb_code_get(const uint8_t *program, size_t program_size);
+
+/**
+ * @brief Drop a reference taken by mb_code_get().  NULL is ignored.
+ *
+ * The image goes back to the pool with its last reference.
+ */
+void mb_code_put(const mb_code_t *code);
+
+/**
+ * @brief Words of the image pool in use (for tests and sizing).
+ */
+size_t mb_code_pool_in_use(void);
+
+/**
+ * @brief Whether @p pc is the target of a backward branch (a loop head).
+ *
+ * Calls do not count.  Scans the stream; meant for rare checks such as
+ * hot-upgrade switch points, not the dispatch loop.
+ */
+int mb_code_is_loop_head(const mb_code_t *code, size_t pc);
+
+/**
+ * @brief Prove a bytecode program well-formed without running it.
+ *
+ * Checks that every opcode is known, every register operand is below
+ * MB_REG_COUNT, every jump lands on an instruction boundary inside the
+ * program, every CALL_BIF names a known BIF with matching arity, its
+ * case tables fit in MB_CODE_MAX_CASES, and its image fits in the store.
+ *
+ * Uses the program's image in the store, decoding it if no process holds
+ * one; an image decoded here is dropped again before returning.
+ *
+ * @return MB_OK if the program is verified, otherwise the first violation
+ *         (MB_BAD_OPCODE, MB_BAD_REG, MB_BAD_JUMP, MB_BAD_BIF, MB_BAD_ARGC,
+ *         MB_BAD_ARITY, MB_EOF for truncation, or MB_CODE_TOO_LARGE).
+ */
+int mb_verify_program(const uint8_t *program, size_t program_size);
+
+#endif
@@ -17,7 +17,17 @@ typedef enum {
     MB_PROC_TABLE_FULL = 12,
     MB_HEAP_OOM = 13,
     MB_BAD_TERM = 14,
-    MB_BAD_ARITY = 15
+    MB_BAD_ARITY = 15,
+    MB_CODE_TOO_LARGE = 16,
+    MB_BAD_JUMP = 17,
+    MB_BAD_ARITH = 18,
+    MB_STACK_OVERFLOW = 19,
+    MB_BAD_FRAME = 20,
+    MB_BAD_MODULE = 21,
+    MB_BAD_CRC = 22,
+    MB_UPGRADE_PENDING = 23,
+    MB_BIF_TRAP = 24,
+    MB_BAD_ENTRY = 25
 } mb_status_t;
 
 #endif
@@ -5,36 +5,203 @@
  * @file mb_heap.h
  * @brief Per-process semi-space heap with bump allocator and Cheney's GC.
  *
- * Each process owns two equal-sized spaces (A and B).  Allocation bumps
- * a pointer in the active (from) space.  When full, Cheney's copying GC
- * copies live data to the inactive (to) space and swaps.
+ * Each process owns two equal-sized spaces.  Allocation bumps a pointer
+ * in the active (from) space.  When full, Cheney's copying GC copies
+ * live data to the inactive (to) space and swaps.
+ *
+ * The spaces are not part of the heap structure: a scheduler process
+ * takes them from the scheduler's arena (mb_heap_init_arena(), sized
+ * per spawn), other users hand in a buffer (mb_heap_init()).  A heap of
+ * zero words is valid for a process that never allocates or calls.
+ *
+ * An arena heap starts at a fixed size.  Given limits
+ * (mb_heap_set_limits()), it adapts its size after each collection, like
+ * BEAM's: when less than a quarter is free once live data (and the
+ * allocation that triggered the collection) is in, both spaces grow to
+ * the next arena class that leaves a quarter free, roughly 1.4x a step
+ * as BEAM's Fibonacci sizes are 1.6x.  After MB_HEAP_SHRINK_GCS
+ * collections in a row with live data (and that allocation) under a
+ * quarter, they shrink to twice that.  Both stay within the limits and
+ * what the arena can give; a heap that cannot grow keeps its size and
+ * the allocation fails as before.  A heap over a caller's buffer has a
+ * fixed size.
+ *
+ * An arena heap can also be generational (mb_heap_set_fullsweep()).  The
+ * two spaces above are then the young generation (nursery); a separate
+ * arena block holds the old generation, addressed by term offsets with
+ * MB_HEAP_OLD_BIT set (mb_heap_ptr()).  A minor collection promotes the
+ * young objects that already survived one collection (those below the
+ * high-water mark `hwm`, as in BEAM) and copies the rest within the
+ * nursery; old objects are neither scanned nor moved, so its cost
+ * follows recent allocation, not total live data.  Data is immutable and
+ * promotion takes whole age groups, so an old object never points into
+ * the nursery.  Every `fullsweep_after` minor collections, or when the
+ * old block could not take the next promotions, a major collection
+ * copies both generations into a fresh old block.
+ *
+ * Half of the semi-space memory sits idle as to-space, yet on one
+ * scheduler thread only one heap collects at a time.  A shared heap
+ * (mb_heap_init_shared()) owns just its from-space and borrows the
+ * to-space from a scratch block shared by all of them, kept as large as
+ * the largest heap (mb_heap_scratch_t).  After the copy the two blocks
+ * trade roles when they are the same size; otherwise the survivors are
+ * copied back, which costs the live words once more.
+ *
+ * Where RAM is tighter than CPU, a compact heap (mb_heap_init_compact())
+ * has no to-space at all.  It collects in place with a sliding
+ * mark-compact (Lisp-2 order, forwarding addresses from a mark bitmap
+ * instead of a header word, which cons cells lack): a bit per word plus
+ * a live-word count per MB_COMPACT_CHUNK words, about 3.5% of the space.
+ * Marking needs no stack because terms are immutable and built from
+ * existing ones, so an object only refers to lower offsets: one pass
+ * down the heap marks everything.  Sliding keeps that order.  Compact
+ * heaps are never generational.
  *
  * Heap words are mb_term_t (uint32_t).  Tuples are stored as
  * [header, elem_0, ..., elem_{arity-1}].  Cons cells are [head, tail].
+ *
+ * As in BEAM, the process stack lives in the same block: it grows down
+ * from the top of from-space (`stop`) while the heap grows up (`hp`),
+ * so heap and stack share one per-process memory budget.  GC moves the
+ * stack to the top of the new space and treats every stack word as a root.
  */
 
 #include <stddef.h>
 
+#include "mb_arena.h"
 #include "mb_term.h"
 
 #ifndef MB_HEAP_WORDS
-#define MB_HEAP_WORDS 128  /* words per semi-space (512 bytes) */
+#define MB_HEAP_WORDS 128  /* default words per semi-space (512 bytes) */
 #endif
 
+/* Term offsets are 28 bits; the top one selects the old generation. */
+#define MB_HEAP_OLD_BIT   (1UL << 27)
+#define MB_HEAP_MAX_WORDS MB_HEAP_OLD_BIT
+
+#ifndef MB_HEAP_FULLSWEEP_AFTER
+#define MB_HEAP_FULLSWEEP_AFTER 0  /* spawn default; 0: not generational */
+#endif
+
+#ifndef MB_HEAP_MIN_WORDS
+#define MB_HEAP_MIN_WORDS 32  /* shrink floor per semi-space for adaptive heaps */
+#endif
+
+#ifndef MB_HEAP_SHRINK_GCS
+#define MB_HEAP_SHRINK_GCS 4  /* low-occupancy collections before a shrink */
+#endif
+
+/* Collection modes: which to-space a heap copies into. */
+#define MB_GC_SEMISPACE 0  /* its own, one per heap */
+#define MB_GC_SHARED    1  /* a scratch block shared by many heaps */
+#define MB_GC_COMPACT   2  /* none: mark-compact in place */
+
+#define MB_COMPACT_CHUNK 256  /* heap words per forwarding-table entry */
+
+#ifndef MB_HEAP_GC_MODE
+#define MB_HEAP_GC_MODE MB_GC_SEMISPACE  /* default for scheduler processes */
+#endif
+
+/* The to-space shared heaps borrow during a collection. */
+typedef struct {
+    mb_term_t *mem;
+    size_t     words;  /* the largest heap's capacity so far */
+} mb_heap_scratch_t;
+
 typedef struct {
-    mb_term_t  space_a[MB_HEAP_WORDS];
-    mb_term_t  space_b[MB_HEAP_WORDS];
-    mb_term_t *from;
-    mb_term_t *to;
-    size_t     hp;         /* next free word offset in from-space */
-    size_t     capacity;   /* = MB_HEAP_WORDS */
-    uint32_t   gc_count;
+    mb_term_t  *from;
+    mb_term_t  *to;
+    size_t      hp;         /* next free word offset in from-space */
+    size_t      stop;       /* stack top: stack is from[stop..capacity) */
+    size_t      capacity;   /* words per semi-space */
+    size_t      min_words;  /* resize limits per semi-space */
+    size_t      max_words;
+    uint32_t    gc_count;
+    uint32_t    resize_count;
+    uint8_t     low_gcs;    /* collections in a row under a quarter full */
+    mb_arena_t *arena;      /* owner of all spaces, NULL: caller's buffer */
+    mb_heap_scratch_t *scratch;  /* to-space lender, NULL: `to` is the heap's own */
+    mb_term_t  *marks;      /* MB_GC_COMPACT: bitmap and table after from-space */
+    /* Old generation; empty unless fullsweep_after != 0. */
+    mb_term_t  *old;
+    size_t      old_hp;
+    size_t      old_capacity;
+    size_t      hwm;        /* young objects below it survived a collection */
+    uint16_t    fullsweep_after;  /* minor collections per major, 0: no generations */
+    uint16_t    minor_gcs;  /* since the last major collection */
 } mb_heap_t;
 
 /**
- * @brief Initialize heap (both spaces zeroed, from=A, to=B).
+ * @brief Initialize a heap over a caller-provided buffer.
+ *
+ * @param mem Room for 2 * @p words words (both spaces, zeroed here); must
+ *            outlive the heap.  May be NULL with @p words 0.
+ * @param words Words per semi-space, <= MB_HEAP_MAX_WORDS.
+ */
+void mb_heap_init(mb_heap_t *heap, mb_term_t *mem, size_t words);
+
+/**
+ * @brief Initialize a heap with both spaces taken from @p arena.
+ *
+ * Each space is rounded up to its arena class (mb_arena_round()), and
+ * the heap uses all of it.  The heap keeps that size until
+ * mb_heap_set_limits() lets it adapt.  @p words 0 gives an empty heap,
+ * which stays empty.
+ *
+ * @return 0, or -1 if the arena has no room (the heap is then empty).
+ */
+int mb_heap_init_arena(mb_heap_t *heap, mb_arena_t *arena, size_t words);
+
+/**
+ * @brief Initialize a heap with one space from @p arena that collects
+ *        through @p scratch.
+ *
+ * @p scratch (all zero before its first use) grows in the same arena to
+ * the heap's size if it is smaller; it must outlive every heap using
+ * it, and the heaps must not collect concurrently.  `to` is NULL outside
+ * a collection.
+ *
+ * @return 0, or -1 if the arena has no room for the space or the
+ *         scratch (the heap is then empty).
+ */
+int mb_heap_init_shared(mb_heap_t *heap, mb_arena_t *arena,
+                        mb_heap_scratch_t *scratch, size_t words);
+
+/**
+ * @brief Initialize a heap with one space from @p arena, collected by
+ *        sliding mark-compact.
+ *
+ * The arena block also holds the mark bitmap and forwarding table, so
+ * the space has at least @p words words and `to` is always NULL.
+ *
+ * @return 0, or -1 if the arena has no room (the heap is then empty).
+ */
+int mb_heap_init_compact(mb_heap_t *heap, mb_arena_t *arena, size_t words);
+
+/**
+ * @brief Let an arena heap grow and shrink between @p min_words and
+ *        @p max_words words per semi-space after collections.
+ *
+ * The current size may lie outside the limits; it moves inside them as
+ * the heap adapts.
+ */
+void mb_heap_set_limits(mb_heap_t *heap, size_t min_words, size_t max_words);
+
+/**
+ * @brief Make an arena heap generational, with a major collection at
+ *        least every @p fullsweep_after minor ones (0: no generations).
+ *
+ * Heaps over a caller's buffer are never generational.  Call it before
+ * the first collection.
+ */
+void mb_heap_set_fullsweep(mb_heap_t *heap, uint16_t fullsweep_after);
+
+/**
+ * @brief Return an arena heap's spaces to its arena and empty the heap.
+ *
+ * A heap over a caller's buffer is only emptied.
  */
-void mb_heap_init(mb_heap_t *heap);
+void mb_heap_release(mb_heap_t *heap);
 
 /**
  * @brief Allocate n_words in from-space.
@@ -61,10 +228,50 @@ mb_term_t mb_heap_make_tuple(mb_heap_t *heap, const mb_term_t *elems, uint8_t ar
  */
 mb_term_t mb_heap_cons(mb_heap_t *heap, mb_term_t head, mb_term_t tail);
 
+#ifndef MB_EQ_MAX_DEPTH
+#define MB_EQ_MAX_DEPTH 16  /* nesting levels mb_heap_eq_exact() follows */
+#endif
+
+/**
+ * @brief Structural (=:=) comparison of two terms on @p heap.
+ *
+ * Iterative: a list's tail and a tuple's last element reuse the current
+ * level, so only nesting inside heads and other elements costs depth.
+ *
+ * @param equal Output: 1 if the terms are equal, 0 if not.
+ * @return 0, or -1 if the terms nest deeper than MB_EQ_MAX_DEPTH.
+ */
+int mb_heap_eq_exact(const mb_heap_t *heap, mb_term_t a, mb_term_t b, int *equal);
+
+/**
+ * @brief Push n_words stack slots, each initialised to nil.
+ *
+ * @return Pointer to the new stack top, or NULL if heap and stack would
+ *         overlap.  Caller must trigger GC on NULL and retry.
+ */
+mb_term_t *mb_heap_stack_alloc(mb_heap_t *heap, size_t n_words);
+
+/**
+ * @brief Pop n_words stack slots.
+ *
+ * @return 0 on success, -1 if the stack holds fewer than n_words.
+ */
+int mb_heap_stack_free(mb_heap_t *heap, size_t n_words);
+
+/**
+ * @brief Number of words currently on the stack.
+ */
+static inline size_t mb_heap_stack_depth(const mb_heap_t *heap) {
+    return heap->capacity - heap->stop;
+}
+
 /**
  * @brief Run Cheney's copying GC.
  *
- * Copies live data reachable from roots to the to-space, then swaps.
+ * Copies live data reachable from roots and from the stack to the
+ * to-space, moves the stack to the top of it, then swaps.  A compact
+ * heap slides live data down to offset 0 instead; the stack stays.  An arena heap
+ * then adapts its size (see above).
  *
  * @param heap Process heap.
  * @param roots Array of pointers to root terms (updated in place).
@@ -72,6 +279,25 @@ mb_term_t mb_heap_cons(mb_heap_t *heap, mb_term_t head, mb_term_t tail);
  */
 void mb_heap_gc(mb_heap_t *heap, mb_term_t **roots, size_t n_roots);
 
+/**
+ * @brief As mb_heap_gc(), for an allocation of @p need words that failed.
+ *
+ * Counts @p need as live when deciding whether to grow, so the retried
+ * allocation fits whenever the limits and the arena allow.
+ */
+void mb_heap_gc_need(mb_heap_t *heap, mb_term_t **roots, size_t n_roots, size_t need);
+
+/**
+ * @brief The object at term offset @p off (MB_GET_BOXED()/MB_GET_CONS()),
+ *        in whichever generation holds it.
+ */
+static inline mb_term_t *mb_heap_ptr(const mb_heap_t *heap, uint32_t off) {
+    if ((off & MB_HEAP_OLD_BIT) != 0) {
+        return &heap->old[off & ~MB_HEAP_OLD_BIT];
+    }
+    return &heap->from[off];
+}
+
 /**
  * @brief Get the word offset for a pointer into from-space.
  */
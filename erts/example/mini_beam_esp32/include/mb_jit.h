@@ -0,0 +1,53 @@
+#ifndef MB_JIT_H
+#define MB_JIT_H
+
+/**
+ * @file mb_jit.h
+ * @brief Host-only x86-64 template JIT for verified bytecode.
+ *
+ * Built only with the CMake option MB_JIT (host HAL, x86-64).  Each
+ * decoded instruction of a verified program is translated to a fixed
+ * machine-code template in an mmap'd region that is made executable
+ * once written (never writable and executable at the same time).
+ *
+ * Templates cover register arithmetic, logic, MIN/MAX and all branches.
+ * Every other instruction (BIFs, messaging, heap, frames, HALT, YIELD,
+ * traps) exits to the interpreter for exactly that instruction and
+ * re-enters the JIT code afterwards, so behaviour, reductions and fault
+ * reporting are those of the interpreter.  YIELD and SEND_WAIT can end
+ * the slice by exhausting the budget, so they finish the slice in the
+ * interpreter instead.
+ *
+ * Images are cached by program contents: many processes (simulated
+ * boards) running the same program share one image.  Images are never
+ * freed; the cache holds MB_JIT_CACHE_SLOTS programs, after which new
+ * programs stay interpreted.
+ */
+
+#include "mb_process.h"
+
+#ifndef MB_JIT_CACHE_SLOTS
+#define MB_JIT_CACHE_SLOTS 32
+#endif
+
+typedef struct mb_jit_image_s mb_jit_image_t;
+
+/**
+ * @brief Compile (or find in the cache) the process's program and run it
+ *        through the JIT from now on.
+ *
+ * Called by mb_proc_init() in MB_JIT builds.  Sets `proc->jit` and
+ * `proc->native` on success; leaves the process interpreted otherwise.
+ *
+ * @return MB_OK, MB_BAD_ARGUMENT for an empty or unverified program,
+ *         MB_CODE_TOO_LARGE if the cache or code buffer is full, or
+ *         MB_HEAP_OOM if executable memory could not be mapped.
+ */
+int mb_jit_attach(mb_process_t *proc);
+
+/**
+ * @brief mb_native_fn entry for JIT-attached processes.
+ */
+int mb_jit_run(mb_process_t *proc, void *sched, uint32_t max_steps);
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef MB_MODULE_H
+#define MB_MODULE_H
+
+/**
+ * @file mb_module.h
+ * @brief Versioned binary module (`.mbm`) loader.
+ *
+ * A module packs the programs of one application (e.g. every process of
+ * a flow) with the resources they need.  All fields are little-endian;
+ * the header and entry table are 4-byte aligned so a module can be read
+ * straight out of memory-mapped flash.
+ *
+ *   off  size  field
+ *     0     4  magic "MBM\0"
+ *     4     2  version (MB_MODULE_VERSION)
+ *     6     2  flags (MB_MODULE_F_*)
+ *     8     4  total module size in bytes
+ *    12     4  CRC-32 (IEEE 802.3) of bytes 16 .. size-1
+ *    16     1  registers used (<= MB_REG_COUNT)
+ *    17     1  entry count (1 .. MB_MAX_PROCESSES)
+ *    18     2  mailbox depth needed (<= MB_MAILBOX_CAPACITY)
+ *    20     4  heap words per process, per semi-space (<= MB_HEAP_MAX_WORDS)
+ *    24     4  code section offset
+ *    28     4  code section size
+ *    32   8*n  entry table: u32 offset (into the code section), u32 size
+ *
+ * With MB_MODULE_F_ARGS the entry table is followed by each entry's spawn
+ * arguments, in entry order: u32 argc (<= registers used), then argc
+ * i32 small integers for r0..r(argc-1).
+ *
+ * Each process spawned from the module gets the declared heap, carved
+ * from the scheduler's arena (mb_sched_spawn_opts()); 0 spawns processes
+ * without a heap, for code that never allocates or calls.
+ *
+ * Each entry point is one complete bytecode program (v1 or compact, see
+ * mb_code.h), spawned as one process.  A compact program carries its
+ * literal pool at its start, so the pool stays next to the code that
+ * indexes it.  Entries may share a program (same offset and size) and
+ * differ only in their arguments; it is stored and verified once.
+ *
+ * mb_module_load() checks the header, the CRC, the section bounds, the
+ * declared needs and verifies every entry, once.  The module then refers
+ * to the caller's buffer in place: nothing is copied, and processes
+ * spawned from it decode straight from that memory (flash on a device,
+ * an mmap'd file on the host).  The buffer must outlive the module and
+ * every process spawned from it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mb_scheduler.h"
+
+#define MB_MODULE_MAGIC       0x004D424DU  /* "MBM\0" read as u32 LE */
+#define MB_MODULE_VERSION     1
+#define MB_MODULE_HEADER_SIZE 32
+#define MB_MODULE_ENTRY_SIZE  8
+
+#define MB_MODULE_F_ARGS      0x0001U  /* spawn arguments follow the entries */
+
+typedef struct {
+    const uint8_t *image;      /* whole module, referenced in place */
+    size_t         size;       /* the module's own size (header offset 8) */
+    size_t         map_size;   /* mb_module_map_file() mapping length, else 0 */
+    const uint8_t *code;       /* code section */
+    const uint8_t *args;       /* spawn arguments, NULL without MB_MODULE_F_ARGS */
+    uint32_t       code_size;
+    uint32_t       heap_words;
+    uint16_t       mailbox_depth;
+    uint8_t        reg_count;
+    uint8_t        entry_count;
+} mb_module_t;
+
+/**
+ * @brief Validate a module image and reference it in place.
+ *
+ * @param mod Output; untouched unless MB_OK is returned.
+ * @param image Module bytes.  Must outlive @p mod.
+ * @param size Size of the buffer holding the image; may exceed the
+ *             module's own size (e.g. a flash partition).
+ * @return MB_OK, MB_BAD_MODULE (magic, version, layout or declared needs),
+ *         MB_BAD_CRC, or the mb_verify_program() status of the first
+ *         entry that fails to verify.
+ */
+int mb_module_load(mb_module_t *mod, const uint8_t *image, size_t size);
+
+/**
+ * @brief Program bytes of entry @p index (0-based).
+ *
+ * @return MB_OK, or MB_BAD_ARGUMENT if @p index is out of range.
+ */
+int mb_module_entry(const mb_module_t *mod, uint8_t index,
+                    const uint8_t **program, size_t *program_size);
+
+/**
+ * @brief Spawn arguments of entry @p index as terms.
+ *
+ * @param args Output, room for MB_REG_COUNT terms.
+ * @param argc Output; 0 for a module without MB_MODULE_F_ARGS.
+ * @return MB_OK, or MB_BAD_ARGUMENT if @p index is out of range.
+ */
+int mb_module_entry_args(const mb_module_t *mod, uint8_t index,
+                         mb_term_t *args, uint8_t *argc);
+
+/**
+ * @brief Make the module's entry points the scheduler's SPAWN targets.
+ *
+ * Entry i becomes SPAWN entry id i (mb_sched_set_entry()) with the
+ * module's heap size, so a dispatcher can start workers from entries
+ * that are not spawned at boot.
+ */
+void mb_module_attach(const mb_module_t *mod, mb_scheduler_t *sched);
+
+/**
+ * @brief Attach the module and spawn one process per entry point, in
+ *        entry order.
+ *
+ * Entry i gets the i-th free pid, so a module written for an empty
+ * scheduler can address its processes by pid (entry 0 is pid 1).  Each
+ * process starts with its entry's spawn arguments.
+ * Entry i's pid is kept in `sched->entries[i].pid` for
+ * mb_module_upgrade().
+ *
+ * @return MB_OK, MB_PROC_TABLE_FULL if the process table ran out, or
+ *         MB_HEAP_OOM if the arena had no room for a heap.
+ */
+int mb_module_spawn_all(const mb_module_t *mod, mb_scheduler_t *sched);
+
+/**
+ * @brief Install a new version of a running module (hot upgrade).
+ *
+ * Entry i is staged for `sched->entries[i].pid`, the process
+ * mb_module_spawn_all() started from the previous version's entry i
+ * (see mb_sched_upgrade() for when each process switches), and for
+ * every process SPAWNed from the previous entry i.  Later SPAWNs start
+ * the new entries.  Halted processes stay halted.  Registers are kept
+ * across the switch, so spawn arguments are those the process was
+ * started with.
+ *
+ * As on BEAM, at most two versions are live: the current one, and the
+ * old one that processes not yet switched still run.  The old image must
+ * stay in memory until mb_sched_upgrades_pending() is 0, and a further
+ * upgrade is refused until then.
+ *
+ * @return MB_OK, MB_UPGRADE_PENDING, or MB_BAD_PID if a target pid is not
+ *         in use (nothing is staged then).
+ */
+int mb_module_upgrade(const mb_module_t *mod, mb_scheduler_t *sched);
+
+/**
+ * @brief CRC-32 as used in the module header (reflected, poly 0xEDB88320).
+ */
+uint32_t mb_module_crc32(const uint8_t *data, size_t len);
+
+/*
+ * Host builds only (src/mb_module_host.c): map a module file read-only
+ * and load it.  The mapping is the module image; nothing is copied.
+ */
+
+/**
+ * @brief mmap() @p path and mb_module_load() it.
+ *
+ * @return As mb_module_load(), or MB_BAD_ARGUMENT if the file cannot be
+ *         opened or mapped.
+ */
+int mb_module_map_file(mb_module_t *mod, const char *path);
+
+/**
+ * @brief Unmap a module loaded by mb_module_map_file().
+ *
+ * Processes spawned from it must not run afterwards.
+ */
+void mb_module_unmap(mb_module_t *mod);
+
+#endif
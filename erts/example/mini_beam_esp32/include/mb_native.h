@@ -0,0 +1,85 @@
+#ifndef MB_NATIVE_H
+#define MB_NATIVE_H
+
+/**
+ * @file mb_native.h
+ * @brief Runtime support for ahead-of-time compiled process loops.
+ *
+ * `tools/flow_compile.escript --aot` emits one C function per flow
+ * process (an `mb_native_fn`).  The function implements the same program
+ * as the process's bytecode against the same `mb_process_t` state:
+ * registers live in `proc->regs`, `pc` is the decoded instruction index,
+ * and every instruction retires one reduction.  It ends its slice at the
+ * same points as the interpreter (RECV_CMD on an empty mailbox, SLEEP_MS,
+ * YIELD, budget exhausted, fault), so mb_sched_tick() runs it unchanged.
+ *
+ * Generated code calls the helpers below instead of the HAL directly so
+ * BIF argument validation and mailbox handling stay in one place.  The
+ * host JIT (mb_jit.h) uses the same contract and falls back through
+ * mb_native_interp().
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mb_errors.h"
+#include "mb_hal.h"
+#include "mb_process.h"
+#include "mb_vm.h"
+
+/**
+ * @brief Call a BIF on registers, as CALL_BIF on the trusted path.
+ *
+ * The BIF id and argc are fixed by the generator; argument values are
+ * validated.  The result is written to regs[dst].  Generated code only
+ * calls built-in BIFs, so no reductions beyond the instruction's one are
+ * charged.
+ *
+ * @return MB_OK, MB_BAD_BIF or MB_BAD_ARGUMENT.
+ */
+int mb_native_call_bif(mb_process_t *proc, uint8_t bif_id, uint8_t argc,
+                       const uint8_t *argv, uint8_t dst);
+
+/**
+ * @brief RECV_CMD into regs[r[0..4]].
+ *
+ * @return MB_MAILBOX_EMPTY when the process must block (scheduler mode,
+ *         empty mailbox); otherwise MB_OK and the registers were written.
+ */
+int mb_native_recv(mb_process_t *proc, void *sched, const uint8_t *r);
+
+/**
+ * @brief SEND to the pid in regs[r[0]] with the command in regs[r[1..5]].
+ *
+ * @return The send status (MB_OK, MB_BAD_PID, MB_MAILBOX_FULL, ...).
+ */
+int mb_native_send(mb_process_t *proc, void *sched, const uint8_t *r);
+
+/**
+ * @brief Continue the current slice in the interpreter.
+ *
+ * Runs from `proc->pc` with @p red instructions already retired in this
+ * slice, until the slice has retired @p max_steps (or ends early, as any
+ * interpreter slice does).  `proc->reductions` is the slice total
+ * afterwards, so a slice that ended on block, sleep or halt leaves it at
+ * @p red.  Passing `red + 1` runs exactly one instruction, which is how
+ * native code falls back for instructions it does not implement.
+ *
+ * @return MB_OK, or the fault status (pc left as the interpreter leaves it).
+ */
+int mb_native_interp(mb_process_t *proc, void *sched, uint32_t red, uint32_t max_steps);
+
+/*
+ * Retire the current instruction and move pc to `next`; ends the slice
+ * when the budget is spent.  Generated functions declare `pc`, `red` and
+ * `max_steps` and provide a `slice_out` label, as mb_proc_slice() does.
+ */
+#define MB_NATIVE_NEXT(next)          \
+    do {                              \
+        pc = (next);                  \
+        if (++red >= max_steps) {     \
+            goto slice_out;           \
+        }                             \
+    } while (0)
+
+#endif
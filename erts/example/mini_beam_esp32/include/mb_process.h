@@ -8,16 +8,49 @@
  * Each process owns its own register file, program counter, and mailbox.
  * The scheduler (mb_scheduler.h) manages process state transitions and
  * round-robin dispatch.
+ *
+ * The bytecode is decoded at init into `code`, an image in the shared
+ * store that every process running the same program uses (see
+ * mb_code.h); `pc` is an index into that decoded instruction stream, not
+ * a byte offset.
+ *
+ * A process may instead run an ahead-of-time compiled native loop
+ * (`native`, see mb_native.h).  Native code keeps `pc` as an index into
+ * the same decoded stream, so a process can switch between native and
+ * interpreted execution at any slice boundary.
+ *
+ * New code can be staged in `next_program` (hot upgrade, see
+ * mb_sched_upgrade()); mb_proc_load() switches to it.
+ *
+ * A native BIF that runs out of reductions traps (see mb_bif.h): `pc`
+ * stays on its CALL_BIF and `bif_state` holds where it left off until
+ * the call completes on a later slice.
+ *
+ * A pid names a slot and an incarnation of it: the low MB_PID_SLOT_BITS
+ * hold slot + 1 and the bits above a generation that advances each time
+ * the slot is reused.  The first process in a slot has generation 0, so
+ * the pids of processes spawned at boot are 1 .. MB_MAX_PROCESSES.
  */
 
+#include "mb_code.h"
 #include "mb_heap.h"
 #include "mb_types.h"
 
 #define MB_MAX_PROCESSES 8
 #define MB_PID_NONE      0
 #define MB_REDUCTIONS    64
+#define MB_BIF_STATE_WORDS 4
+
+#define MB_PID_SLOT_BITS 4
+#define MB_PID_SLOT(pid) ((unsigned)(pid) & ((1U << MB_PID_SLOT_BITS) - 1U))
+#define MB_PID_GEN(pid)  ((unsigned)(pid) >> MB_PID_SLOT_BITS)
+#define MB_PID_MAX       0xFFFFU
 
-typedef uint8_t mb_pid_t;
+#if MB_MAX_PROCESSES >= (1 << MB_PID_SLOT_BITS)
+#error "MB_MAX_PROCESSES does not fit in MB_PID_SLOT_BITS"
+#endif
+
+typedef uint16_t mb_pid_t;
 
 typedef enum {
     MB_PROC_FREE     = 0,
@@ -27,11 +60,20 @@ typedef enum {
     MB_PROC_HALTED   = 4
 } mb_proc_state_t;
 
-typedef struct {
+struct mb_process_s;
+
+/**
+ * Native slice entry: same contract as mb_proc_run() (resume at `pc`,
+ * run up to max_steps instructions, write pc and reductions back).
+ */
+typedef int (*mb_native_fn)(struct mb_process_s *proc, void *sched, uint32_t max_steps);
+
+typedef struct mb_process_s {
     mb_pid_t          pid;
     mb_proc_state_t   state;
     const uint8_t    *program;
     size_t            program_size;
+    const mb_code_t  *code;
     size_t            pc;
     mb_term_t         regs[MB_REG_COUNT];
     mb_mailbox_t      mailbox;
@@ -40,14 +82,51 @@ typedef struct {
     mb_heap_t         heap;
     uint32_t          sleep_until_ms;
     uint32_t          reductions;
+    uint32_t          slice_budget;  /* max_steps of the running slice */
+    uint32_t          bif_reds;      /* left to the running native BIF */
+    uint32_t          bif_state[MB_BIF_STATE_WORDS];  /* trapped BIF's continuation */
+    uint8_t           bif_trapped;
+    mb_native_fn      native;  /* NULL: interpret `code` */
+    const uint8_t    *next_program;  /* staged upgrade, NULL if none */
+    size_t            next_program_size;
+#ifdef MB_JIT
+    const struct mb_jit_image_s *jit;  /* host JIT image, see mb_jit.h */
+#endif
 } mb_process_t;
 
 /**
  * @brief Initialize a process with a bytecode program.
+ *
+ * Takes the program's decoded image from the store (mb_code_get()),
+ * decoding it only if no other process runs it.  Decode faults do not
+ * fail init; they surface when execution reaches them.  The image is
+ * held until mb_proc_release().  The heap starts empty: a process that
+ * allocates or calls needs one set up with mb_heap_init() (the scheduler
+ * and mb_vm_init() do this).
  */
 void mb_proc_init(mb_process_t *proc, mb_pid_t pid,
                   const uint8_t *program, size_t program_size);
 
+/**
+ * @brief Switch a live process to new code.
+ *
+ * Takes the new program's image and drops the old one, then restarts the
+ * process at its first instruction.
+ * Registers, heap, mailbox and state are kept.  Call frames are dropped
+ * (their return addresses point into the old code), and so is any native
+ * loop, which implemented the old code; MB_JIT builds compile the new
+ * code instead.  Clears a staged upgrade.
+ */
+void mb_proc_load(mb_process_t *proc, const uint8_t *program, size_t program_size);
+
+/**
+ * @brief Drop the process's decoded image (mb_sched_exit() does this).
+ *
+ * Call before initializing the process again.  The process must not run
+ * until it is.
+ */
+void mb_proc_release(mb_process_t *proc);
+
 /**
  * @brief Execute one instruction on a process.
  *
@@ -60,6 +139,10 @@ int mb_proc_step(mb_process_t *proc, void *sched);
 /**
  * @brief Execute up to max_steps instructions on a process.
  *
+ * Runs the whole slice inside the interpreter loop, or in `native` when
+ * set, and writes pc and `reductions` (instructions retired) back when
+ * the slice ends.
+ *
  * @param proc Process to run.
  * @param sched Scheduler context (NULL for single-process compat mode).
  * @param max_steps Maximum instruction count.
@@ -11,30 +11,201 @@
  * RECV_CMD finds an empty mailbox (woken on message arrival) or to
  * SLEEPING when SLEEP_MS is executed (woken when monotonic time passes
  * the deadline).
+ *
+ * Processes can also be started by bytecode: SPAWN starts one of the
+ * scheduler's registered entry points (mb_sched_set_entry(), or every
+ * entry of a module, see mb_module_attach()) and EXIT frees the caller's
+ * slot.  Free slots are kept on a stack, so spawning takes the most
+ * recently freed slot without scanning the table, and each reuse gives
+ * the slot a new pid generation: a stale pid still held in a register no
+ * longer names a live process and SEND to it fails with MB_BAD_PID.
+ *
+ * Process heaps are carved from the scheduler's arena (mb_arena.h) at
+ * spawn, sized per process (mb_sched_spawn_opts()), and go back to it
+ * when the process exits.  By default the arena is a region of
+ * MB_SCHED_ARENA_WORDS words inside the scheduler, enough for every slot
+ * to hold a MB_HEAP_WORDS heap; a board with a memory region of its own
+ * builds with MB_SCHED_ARENA_WORDS=0 and passes it to
+ * mb_sched_init_arena().
+ *
+ * Processes spawned with MB_GC_SHARED hold one space each and collect
+ * through the scheduler's scratch block, also carved from the arena and
+ * kept as large as the largest such heap spawned or grown so far.
+ * MB_GC_COMPACT processes hold one space and need no to-space at all.
  */
 
+#include "mb_arena.h"
 #include "mb_process.h"
 #include "mb_types.h"
 
+#define MB_SCHED_MAX_ENTRIES MB_MAX_PROCESSES  /* SPAWN entry ids 0 .. max - 1 */
+
+#ifndef MB_SCHED_ARENA_WORDS
+#define MB_SCHED_ARENA_WORDS (MB_MAX_PROCESSES * 2 * MB_HEAP_WORDS)
+#endif
+
+/* A program SPAWN can start (NULL program: id not registered). */
+typedef struct {
+    const uint8_t *program;
+    size_t         size;
+    size_t         heap_words;  /* per semi-space for each spawned process */
+    mb_pid_t       pid;         /* started by mb_module_spawn_all(), MB_PID_NONE: none */
+} mb_sched_entry_t;
+
 typedef struct mb_scheduler_s {
-    mb_process_t procs[MB_MAX_PROCESSES];
-    uint8_t      current;
-    uint8_t      count;
+    mb_process_t     procs[MB_MAX_PROCESSES];
+    mb_sched_entry_t entries[MB_SCHED_MAX_ENTRIES];
+    uint8_t          free_slots[MB_MAX_PROCESSES];  /* stack, top = next slot */
+    uint8_t          nfree;
+    uint8_t          current;
+    uint8_t          count;
+    mb_arena_t       arena;
+    mb_heap_scratch_t scratch;  /* to-space of MB_GC_SHARED heaps */
+#if MB_SCHED_ARENA_WORDS > 0
+    mb_term_t        arena_mem[MB_SCHED_ARENA_WORDS];
+#endif
 } mb_scheduler_t;
 
+/* Per-spawn options; start from MB_SPAWN_OPTS_INIT. */
+typedef struct {
+    const mb_term_t *args;        /* copied to r0..r(argc-1) */
+    uint8_t          argc;
+    mb_native_fn     native;      /* see mb_sched_spawn_native() */
+    size_t           heap_words;  /* initial, per semi-space; 0: no heap */
+    size_t           heap_min_words;  /* adaptive sizing limits, see mb_heap.h; */
+    size_t           heap_max_words;  /* 0: the starting size; both 0: fixed size */
+    uint16_t         fullsweep_after; /* generational GC, see mb_heap_set_fullsweep() */
+    uint8_t          gc_mode;     /* MB_GC_*: own to-space, scheduler's scratch or none */
+} mb_spawn_opts_t;
+
+/* Fixed size, not generational: growth and generations are opt-in. */
+#define MB_SPAWN_OPTS_INIT { NULL, 0, NULL, MB_HEAP_WORDS, 0, 0, MB_HEAP_FULLSWEEP_AFTER, \
+                             MB_HEAP_GC_MODE }
+
 /**
- * @brief Initialize the scheduler (all slots free).
+ * @brief Initialize the scheduler (all slots free) over its built-in
+ *        arena of MB_SCHED_ARENA_WORDS words.
  */
 void mb_sched_init(mb_scheduler_t *sched);
 
+/**
+ * @brief Initialize the scheduler with process heaps carved from the
+ *        board's region @p mem of @p words words.
+ *
+ * @p mem must outlive the scheduler.  The built-in arena, if any, is
+ * left unused.
+ */
+void mb_sched_init_arena(mb_scheduler_t *sched, mb_term_t *mem, size_t words);
+
 /**
  * @brief Spawn a new process running the given bytecode.
  *
- * @return PID (1..MB_MAX_PROCESSES) on success, MB_PID_NONE if table full.
+ * The process gets a heap of MB_HEAP_WORDS words per space.
+ *
+ * @return PID on success, MB_PID_NONE if table full or the arena has no
+ *         room for the heap.
  */
 mb_pid_t mb_sched_spawn(mb_scheduler_t *sched,
                         const uint8_t *program, size_t program_size);
 
+/**
+ * @brief Spawn a process that runs an ahead-of-time compiled loop.
+ *
+ * The bytecode is still decoded (native code resumes at the same
+ * instruction indices); @p native must implement that same program.
+ * A NULL @p native spawns a process as mb_sched_spawn() does (interpreted,
+ * or JIT-compiled in MB_JIT builds).
+ *
+ * @return As mb_sched_spawn().
+ */
+mb_pid_t mb_sched_spawn_native(mb_scheduler_t *sched,
+                               const uint8_t *program, size_t program_size,
+                               mb_native_fn native);
+
+/**
+ * @brief Spawn a process with spawn arguments in r0..r(argc-1).
+ *
+ * Lets many processes share one program (e.g. every sensor of a flow)
+ * and differ only in their arguments.  A process spawned from the same
+ * program buffer as a live one shares its decoded, verified image
+ * instead of decoding again.  @p native as for mb_sched_spawn_native().
+ *
+ * @return PID on success, MB_PID_NONE if the table is full, the arena
+ *         has no room for the heap or @p argc exceeds MB_REG_COUNT.
+ */
+mb_pid_t mb_sched_spawn_args(mb_scheduler_t *sched,
+                             const uint8_t *program, size_t program_size,
+                             const mb_term_t *args, uint8_t argc,
+                             mb_native_fn native);
+
+/**
+ * @brief Spawn a process with explicit options, including its heap size.
+ *
+ * A sensor loop that never allocates or calls can run with no heap at
+ * all; a process that builds large terms can take more than
+ * MB_HEAP_WORDS.  The heap is carved from the scheduler's arena, each
+ * space rounded up to its arena class, and returned by mb_sched_exit().
+ * It keeps that size unless the options set heap limits, in which case
+ * it grows or shrinks within them after each collection as long as the
+ * arena has room.
+ * A NULL @p opts spawns with MB_SPAWN_OPTS_INIT.
+ *
+ * @return PID on success, MB_PID_NONE if the table is full, the arena
+ *         has no room for the heap, or argc exceeds MB_REG_COUNT.
+ */
+mb_pid_t mb_sched_spawn_opts(mb_scheduler_t *sched,
+                             const uint8_t *program, size_t program_size,
+                             const mb_spawn_opts_t *opts);
+
+/**
+ * @brief Register the program SPAWN starts for entry id @p entry.
+ *
+ * Registering an id again replaces its program for later spawns;
+ * processes already running keep theirs.  A NULL @p program unregisters
+ * the id.  The program must outlive every process spawned from it.
+ * Each process SPAWNed from the id gets @p heap_words words per space.
+ *
+ * @return MB_OK, or MB_BAD_ENTRY if @p entry >= MB_SCHED_MAX_ENTRIES.
+ */
+int mb_sched_set_entry(mb_scheduler_t *sched, uint8_t entry,
+                       const uint8_t *program, size_t program_size,
+                       size_t heap_words);
+
+/**
+ * @brief End a process and free its slot (the EXIT opcode).
+ *
+ * Its mailbox is dropped, its heap goes back to the arena, its decoded
+ * image is released and @p pid becomes stale.  A halted
+ * process can be freed too.  Native code calls this between ticks; a
+ * running process ends itself with EXIT.
+ *
+ * @return MB_OK, or MB_BAD_PID if @p pid is not a live process.
+ */
+int mb_sched_exit(mb_scheduler_t *sched, mb_pid_t pid);
+
+/**
+ * @brief Stage new code for a live process (hot upgrade).
+ *
+ * The process switches (mb_proc_load()) at its next switch point, which
+ * is checked now and after each of its slices: blocked in RECV_CMD,
+ * sleeping, or about to run a loop head (mb_code_is_loop_head()), e.g.
+ * after a YIELD back to the top of its loop.  A process blocked in
+ * RECV_CMD becomes READY to run the new code from its start; a sleeping
+ * one keeps its wake-up time.  Until it switches it runs the old code,
+ * which must stay in memory.  Staging again replaces the staged code.
+ *
+ * @return MB_OK, or MB_BAD_PID if @p pid is not a live (non-halted) process.
+ */
+int mb_sched_upgrade(mb_scheduler_t *sched, mb_pid_t pid,
+                     const uint8_t *program, size_t program_size);
+
+/**
+ * @brief Number of processes with staged code they have not switched to.
+ *
+ * Old code may be released once this is 0.
+ */
+uint8_t mb_sched_upgrades_pending(const mb_scheduler_t *sched);
+
 /**
  * @brief Run one scheduling round: pick a runnable process, execute up to
  *        MB_REDUCTIONS instructions.
@@ -56,7 +227,8 @@ int mb_sched_send(mb_scheduler_t *sched, mb_pid_t dst, mb_command_t cmd);
 /**
  * @brief Look up a process by PID.
  *
- * @return Pointer to process, or NULL if PID is invalid or slot is free.
+ * @return Pointer to process, or NULL if PID is invalid, its slot is free
+ *         or has been reused since (stale generation).
  */
 mb_process_t *mb_sched_proc(mb_scheduler_t *sched, mb_pid_t pid);
 
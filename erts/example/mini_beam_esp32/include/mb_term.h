@@ -39,7 +39,8 @@ typedef uint32_t mb_term_t;
 
 /* --- small integer --- */
 
-#define MB_MAKE_SMALLINT(v)  ((mb_term_t)(((int32_t)(v) << 4) | MB_TAG_SMALLINT))
+/* Shifted as unsigned: bits above the 28-bit payload drop out (wrap), no UB. */
+#define MB_MAKE_SMALLINT(v)  ((mb_term_t)(((uint32_t)(int32_t)(v) << 4) | MB_TAG_SMALLINT))
 #define MB_GET_SMALLINT(t)   ((int32_t)(t) >> 4)
 
 #define MB_SMALLINT_MIN  (-134217728)   /* -(1 << 27) */
@@ -34,30 +34,95 @@ typedef enum {
     MB_OP_MOVE = 0x02,
     MB_OP_ADD = 0x03,
     MB_OP_SUB = 0x04,
+    MB_OP_ADD_IMM = 0x05,
+    MB_OP_SUB_IMM = 0x06,
+    MB_OP_MUL = 0x07,
+    MB_OP_DIV = 0x08,
+    MB_OP_REM = 0x09,
+    MB_OP_SHL = 0x0A,
+    MB_OP_SHR = 0x0B,
+    MB_OP_AND = 0x0C,
+    MB_OP_OR = 0x0D,
+    MB_OP_XOR = 0x0E,
     MB_OP_CALL_BIF = 0x10,
+    MB_OP_CALL = 0x11,
+    MB_OP_RET = 0x12,
+    MB_OP_ALLOCATE = 0x13,
+    MB_OP_DEALLOCATE = 0x14,
+    MB_OP_GET_Y = 0x15,
+    MB_OP_PUT_Y = 0x16,
     MB_OP_RECV_CMD = 0x20,
     MB_OP_SEND = 0x21,
     MB_OP_SELF = 0x22,
     MB_OP_YIELD = 0x23,
+    MB_OP_SPAWN = 0x24,
+    MB_OP_EXIT = 0x25,
     MB_OP_JMP = 0x30,
     MB_OP_JMP_IF_ZERO = 0x31,
+    MB_OP_JMP_EQ = 0x32,
+    MB_OP_JMP_NE = 0x33,
+    MB_OP_JMP_LT = 0x34,
+    MB_OP_JMP_GE = 0x35,
+    MB_OP_JMP_EQ_IMM = 0x36,
+    MB_OP_JMP_NE_IMM = 0x37,
+    MB_OP_JMP_LT_IMM = 0x38,
+    MB_OP_JMP_GE_IMM = 0x39,
+    MB_OP_DJNZ = 0x3A,
+    /* Multi-way branch on a register value */
+    MB_OP_SELECT_VAL = 0x3B,
+    MB_OP_JUMP_TABLE = 0x3C,
     MB_OP_SLEEP_MS = 0x40,
     MB_OP_MAKE_TUPLE = 0x50,
     MB_OP_TUPLE_ELEM = 0x51,
     MB_OP_CONS = 0x52,
     MB_OP_HEAD = 0x53,
     MB_OP_TAIL = 0x54,
+    /* Term tests: fall through on success, jump to the fail target otherwise */
+    MB_OP_IS_INTEGER = 0x55,
+    MB_OP_IS_NIL = 0x56,
+    MB_OP_IS_CONS = 0x57,
+    MB_OP_IS_TUPLE = 0x58,
+    MB_OP_TEST_ARITY = 0x59,
+    MB_OP_IS_EQ_EXACT = 0x5A,
+    MB_OP_GET_TUPLE_ELEMENTS = 0x5B,
+    /* Fixed-point / signal helpers */
+    MB_OP_MIN = 0x60,
+    MB_OP_MAX = 0x61,
+    MB_OP_CLAMP = 0x62,
+    MB_OP_QMUL = 0x63,
+    MB_OP_LUT = 0x64,
+    /* Superinstructions for the loops emitted by tools/flow_compile.escript */
+    MB_OP_I2C_SAMPLE = 0x70,
+    MB_OP_SEND_WAIT = 0x71,
+    MB_OP_RECV_PWM = 0x72,
+    /* Compact encoding only (see mb_code.h) */
+    MB_OP_WIDE = 0xC1,
+    MB_OP_CONST_LIT = 0xC2,
     MB_OP_HALT = 0xFF
 } mb_opcode_t;
 
+/* LUT mode byte: entry width, signedness, interpolation. */
+#define MB_LUT_W8      0x00U
+#define MB_LUT_W16     0x01U
+#define MB_LUT_W32     0x02U
+#define MB_LUT_WIDTH   0x03U  /* mask */
+#define MB_LUT_SIGNED  0x04U  /* sign-extend 8/16-bit entries */
+#define MB_LUT_LERP    0x08U  /* interpolate between neighbouring entries */
+#define MB_LUT_MAX_SHIFT 16
+
+/**
+ * Single-process handle over a process, without a scheduler.
+ *
+ * The handle drives `proc` in place: stepping does not copy the process,
+ * so the heap, mailbox and decoded code persist across calls.  `proc`
+ * points at the embedded `own` process after mb_vm_init(), or at a
+ * borrowed process after mb_vm_attach().  Do not copy an mb_vm_t by value.
+ * The embedded process gets a heap of MB_HEAP_WORDS words per space.
+ */
 typedef struct {
-    const uint8_t *program;
-    size_t program_size;
-    size_t pc;
-    mb_term_t regs[MB_REG_COUNT];
-    mb_mailbox_t mailbox;
-    int halted;
-    int last_error;
+    mb_process_t  own;
+    mb_process_t *proc;
+    mb_term_t     heap_mem[2 * MB_HEAP_WORDS];
 } mb_vm_t;
 
 /**
@@ -69,6 +134,18 @@ typedef struct {
  */
 void mb_vm_init(mb_vm_t *vm, const uint8_t *program, size_t program_size);
 
+/**
+ * @brief Drive an existing process (e.g. a scheduler slot) through this handle.
+ *
+ * The process keeps its pid, heap and mailbox.  Stepping through the
+ * handle runs in compat mode: RECV_CMD does not block and SEND reports
+ * MB_BAD_ARGUMENT, exactly as for the embedded process.
+ *
+ * @param vm VM handle (its embedded process is left untouched).
+ * @param proc Process to borrow; must outlive the attachment.
+ */
+void mb_vm_attach(mb_vm_t *vm, mb_process_t *proc);
+
 /**
  * @brief Execute one VM instruction.
  *
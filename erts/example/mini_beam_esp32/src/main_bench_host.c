@@ -0,0 +1,223 @@
+/**
+ * Host interpreter microbenchmark.
+ *
+ * alu_loop:  one process, tight SUB/ADD/JMP_IF_ZERO/JMP loop, run through
+ *            mb_sched_tick() in MB_REDUCTIONS slices (dispatch cost).
+ * alu_djnz:  the same loop written with ADD_IMM + DJNZ (2 insns/iter).
+ * ping_pong: two processes bouncing a command via SEND/RECV_CMD, so every
+ *            round trip blocks twice (scheduler + slice entry/exit cost).
+ * gc:        Cheney's copying collector against sliding mark-compact on
+ *            the same heap: a live list at 10% and 50% of the space,
+ *            refilled with garbage before each collection.  Reports pause
+ *            per collection and the arena words the heap takes.
+ *
+ * Numbers are wall-clock on the build host and only meaningful relative
+ * to another build of the same tree on the same machine.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "mb_heap.h"
+#include "mb_vm.h"
+#include "mb_scheduler.h"
+
+#define I32LE(v) \
+    (uint8_t)((v) & 0xff), \
+    (uint8_t)(((v) >> 8) & 0xff), \
+    (uint8_t)(((v) >> 16) & 0xff), \
+    (uint8_t)(((v) >> 24) & 0xff)
+
+#define BENCH_ALU_ITERS   20000000
+#define BENCH_PING_ROUNDS 1000000
+#define BENCH_GC_WORDS    5900  /* both fill a 6144-word arena class */
+#define BENCH_GC_ROUNDS   2000
+
+static double bench_ms(clock_t start) {
+    return (double)(clock() - start) * 1000.0 / (double)CLOCKS_PER_SEC;
+}
+
+static int bench_alu_loop(void) {
+    mb_scheduler_t sched;
+    mb_process_t *p;
+    clock_t start;
+    double ms;
+    unsigned long ticks = 0;
+    double insns;
+    int rc;
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(BENCH_ALU_ITERS), /*  0: r0 = n        */
+        MB_OP_CONST_I32, 1, I32LE(1),               /*  6: r1 = 1        */
+        MB_OP_CONST_I32, 2, I32LE(0),               /* 12: r2 = 0        */
+        MB_OP_SUB, 0, 0, 1,                         /* 18: r0 -= 1       */
+        MB_OP_ADD, 2, 2, 1,                         /* 22: r2 += 1       */
+        MB_OP_JMP_IF_ZERO, 0, I32LE(5),             /* 26: done -> 37    */
+        MB_OP_JMP, I32LE(-19),                      /* 32: loop -> 18    */
+        MB_OP_HALT                                  /* 37                */
+    };
+
+    mb_sched_init(&sched);
+    p = mb_sched_proc(&sched, mb_sched_spawn(&sched, prog, sizeof(prog)));
+
+    start = clock();
+    while ((rc = mb_sched_tick(&sched)) == MB_OK) {
+        ticks++;
+    }
+    ms = bench_ms(start);
+
+    if (rc != MB_SCHED_IDLE || MB_GET_SMALLINT(p->regs[2]) != BENCH_ALU_ITERS) {
+        fprintf(stderr, "FAIL alu_loop rc=%d r2=%d\n", rc, (int)MB_GET_SMALLINT(p->regs[2]));
+        return 1;
+    }
+    insns = 4.0 * BENCH_ALU_ITERS;
+    printf("bench alu_loop:  %.0f insns, %lu ticks, %.1f ms, %.2f ns/insn, %.2f ns/iter\n",
+           insns, ticks, ms, ms * 1.0e6 / insns, ms * 1.0e6 / BENCH_ALU_ITERS);
+    return 0;
+}
+
+static int bench_alu_djnz(void) {
+    mb_scheduler_t sched;
+    mb_process_t *p;
+    clock_t start;
+    double ms;
+    unsigned long ticks = 0;
+    int rc;
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(BENCH_ALU_ITERS), /*  0: r0 = n        */
+        MB_OP_CONST_I32, 2, I32LE(0),               /*  6: r2 = 0        */
+        MB_OP_ADD_IMM, 2, 2, I32LE(1),              /* 12: r2 += 1       */
+        MB_OP_DJNZ, 0, I32LE(-13),                  /* 19: loop -> 12    */
+        MB_OP_HALT                                  /* 25                */
+    };
+
+    mb_sched_init(&sched);
+    p = mb_sched_proc(&sched, mb_sched_spawn(&sched, prog, sizeof(prog)));
+
+    start = clock();
+    while ((rc = mb_sched_tick(&sched)) == MB_OK) {
+        ticks++;
+    }
+    ms = bench_ms(start);
+
+    if (rc != MB_SCHED_IDLE || MB_GET_SMALLINT(p->regs[2]) != BENCH_ALU_ITERS) {
+        fprintf(stderr, "FAIL alu_djnz rc=%d r2=%d\n", rc, (int)MB_GET_SMALLINT(p->regs[2]));
+        return 1;
+    }
+    printf("bench alu_djnz:  %.0f insns, %lu ticks, %.1f ms, %.2f ns/iter\n",
+           2.0 * BENCH_ALU_ITERS, ticks, ms, ms * 1.0e6 / BENCH_ALU_ITERS);
+    return 0;
+}
+
+static int bench_ping_pong(void) {
+    mb_scheduler_t sched;
+    mb_process_t *a;
+    clock_t start;
+    double ms;
+    unsigned long ticks = 0;
+    int rc;
+    /* A: send GPIO_READ(2) to pid 2, wait for the echo, count down. */
+    static const uint8_t prog_a[] = {
+        MB_OP_CONST_I32, 0, I32LE(BENCH_PING_ROUNDS), /*  0: r0 = rounds   */
+        MB_OP_CONST_I32, 1, I32LE(1),                 /*  6: r1 = 1        */
+        MB_OP_CONST_I32, 3, I32LE(MB_CMD_GPIO_READ),  /* 12: r3 = type     */
+        MB_OP_CONST_I32, 4, I32LE(2),                 /* 18: r4 = pin      */
+        MB_OP_CONST_I32, 2, I32LE(2),                 /* 24: r2 = pid 2    */
+        MB_OP_SEND, 2, 3, 4, 5, 5, 5,                 /* 30: send          */
+        MB_OP_RECV_CMD, 6, 7, 8, 9, 10,               /* 37: wait echo     */
+        MB_OP_SUB, 0, 0, 1,                           /* 43: r0 -= 1       */
+        MB_OP_JMP_IF_ZERO, 0, I32LE(5),               /* 47: done -> 58    */
+        MB_OP_JMP, I32LE(-34),                        /* 53: loop -> 24    */
+        MB_OP_HALT                                    /* 58                */
+    };
+    /* B: echo every command back to pid 1, forever. */
+    static const uint8_t prog_b[] = {
+        MB_OP_CONST_I32, 0, I32LE(1),                 /*  0: r0 = 1        */
+        MB_OP_RECV_CMD, 1, 2, 3, 4, 5,                /*  6: wait          */
+        MB_OP_MOVE, 6, 0, 0,                          /* 12: r6 = pid 1    */
+        MB_OP_SEND, 6, 1, 2, 3, 4, 5,                 /* 16: echo          */
+        MB_OP_JMP, I32LE(-22)                         /* 23: loop -> 6     */
+    };
+
+    mb_sched_init(&sched);
+    a = mb_sched_proc(&sched, mb_sched_spawn(&sched, prog_a, sizeof(prog_a)));
+    (void)mb_sched_spawn(&sched, prog_b, sizeof(prog_b));
+
+    start = clock();
+    while ((rc = mb_sched_tick(&sched)) == MB_OK) {
+        ticks++;
+    }
+    ms = bench_ms(start);
+
+    if (rc != MB_SCHED_IDLE || a->state != MB_PROC_HALTED) {
+        fprintf(stderr, "FAIL ping_pong rc=%d state=%d\n", rc, (int)a->state);
+        return 1;
+    }
+    printf("bench ping_pong: %d rounds, %lu ticks, %.1f ms, %.1f ns/round\n",
+           BENCH_PING_ROUNDS, ticks, ms, ms * 1.0e6 / BENCH_PING_ROUNDS);
+    return 0;
+}
+
+static int bench_gc_mode(uint8_t mode, unsigned live_pct) {
+    static mb_term_t board[4 * BENCH_GC_WORDS];
+    mb_arena_t arena;
+    mb_heap_t heap;
+    mb_term_t list = MB_NIL;
+    mb_term_t *roots[1];
+    clock_t start, pause, max_pause = 0, total = 0;
+    size_t footprint, cells = BENCH_GC_WORDS * live_pct / 100 / 2, i;
+    int round, rc;
+
+    mb_arena_init(&arena, board, 4 * BENCH_GC_WORDS);
+    rc = (mode == MB_GC_COMPACT) ? mb_heap_init_compact(&heap, &arena, BENCH_GC_WORDS)
+                                 : mb_heap_init_arena(&heap, &arena, BENCH_GC_WORDS);
+    footprint = arena.in_use;
+    for (i = 0; i < cells && rc == 0; i++) {
+        list = mb_heap_cons(&heap, MB_MAKE_SMALLINT((int32_t)i), list);
+    }
+    roots[0] = &list;
+    for (round = 0; round < BENCH_GC_ROUNDS && rc == 0; round++) {
+        while (mb_heap_cons(&heap, MB_MAKE_SMALLINT(round), MB_NIL) != 0) {
+        }
+        start = clock();
+        mb_heap_gc(&heap, roots, 1);
+        pause = clock() - start;
+        total += pause;
+        if (pause > max_pause) {
+            max_pause = pause;
+        }
+    }
+    if (rc != 0 || heap.hp != 2 * cells) {
+        fprintf(stderr, "FAIL gc mode=%d rc=%d hp=%lu\n", (int)mode, rc, (unsigned long)heap.hp);
+        return 1;
+    }
+    printf("bench gc %-7s live %2u%%: %d gcs, %.2f us/gc (max %.0f us), %lu arena words\n",
+           (mode == MB_GC_COMPACT) ? "compact" : "cheney", live_pct, BENCH_GC_ROUNDS,
+           (double)total * 1.0e6 / CLOCKS_PER_SEC / BENCH_GC_ROUNDS,
+           (double)max_pause * 1.0e6 / CLOCKS_PER_SEC, (unsigned long)footprint);
+    return 0;
+}
+
+static int bench_gc(void) {
+    int failures = 0;
+
+    failures += bench_gc_mode(MB_GC_SEMISPACE, 10);
+    failures += bench_gc_mode(MB_GC_COMPACT, 10);
+    failures += bench_gc_mode(MB_GC_SEMISPACE, 50);
+    failures += bench_gc_mode(MB_GC_COMPACT, 50);
+    return failures;
+}
+
+int main(void) {
+    int failures = 0;
+
+    failures += bench_alu_loop();
+    failures += bench_alu_djnz();
+    failures += bench_ping_pong();
+    failures += bench_gc();
+
+    if (failures != 0) {
+        return 1;
+    }
+    printf("mini_beam_host_bench: done\n");
+    return 0;
+}
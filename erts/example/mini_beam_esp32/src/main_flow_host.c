@@ -1,18 +1,21 @@
 /**
- * P2 flow compiler verification: run generated bytecode on host.
+ * P2 flow compiler verification: run a compiled flow module on host.
  *
- * Loads the flow-compiled sensor + actuator programs, spawns both
- * in the scheduler, and verifies sensor reads are forwarded to
- * the actuator via SEND/RECV_CMD.
+ * Usage: mini_beam_host_flow [flow.mbm]
+ *
+ * Maps the module written by `flow_compile.escript --mbm`, spawns its
+ * entry points (sensors, then the actuator as the last pid) and verifies
+ * sensor reads are forwarded to the actuator via SEND/RECV_CMD.  A new
+ * flow only needs a new .mbm, not a rebuild.  Without an argument the
+ * flow compiled into flow_generated.h is spawned the same way.
  */
 
 #include <stdio.h>
 
-#include "mb_vm.h"
+#include "mb_module.h"
 #include "mb_scheduler.h"
-
-/* Include the generated flow header */
-#include "flow_generated.h"
+#include "mb_vm.h"
+#include "../zephyr_app/src/flow_generated.h"
 
 static int failures = 0;
 
@@ -23,59 +26,100 @@ static void check_int(const char *name, int expected, int actual) {
     }
 }
 
-int main(void) {
+/* Spawn the compiled-in flow: sensors, then the actuator as the last pid. */
+static mb_pid_t spawn_builtin(mb_scheduler_t *sched) {
+    mb_spawn_opts_t opts = MB_SPAWN_OPTS_INIT;
+    mb_pid_t pid;
+    unsigned i;
+
+    opts.heap_words = OS2_FLOW_HEAP_WORDS;
+    opts.argc = OS2_FLOW_SENSOR_ARGC;
+    for (i = 0; i < OS2_FLOW_SENSOR_COUNT; i++) {
+        opts.args = os2_flow_sensor_args[i];
+        opts.native = os2_flow_sensor_natives[i];
+        check_int("spawn_sensor", (int)(i + 1),
+                  (int)mb_sched_spawn_opts(sched, os2_flow_sensor_prog,
+                                           sizeof(os2_flow_sensor_prog), &opts));
+    }
+    opts.args = NULL;
+    opts.argc = 0;
+    opts.native = os2_flow_actuator_native;
+    pid = mb_sched_spawn_opts(sched, os2_flow_actuator_prog,
+                              sizeof(os2_flow_actuator_prog), &opts);
+    check_int("spawn_actuator", OS2_FLOW_PROCESS_COUNT, (int)pid);
+    return pid;
+}
+
+int main(int argc, char **argv) {
     mb_scheduler_t sched;
-    mb_pid_t pid_sensor, pid_actuator;
-    mb_process_t *ps, *pa;
+    mb_module_t mod = {0};
+    mb_process_t *pa;
+    mb_pid_t pid, nproc;
     int rc, ticks = 0;
 
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [flow.mbm]\n", argv[0]);
+        return 2;
+    }
     mb_sched_init(&sched);
-    pid_sensor = mb_sched_spawn(&sched, os2_flow_sensor_prog,
-                                 sizeof(os2_flow_sensor_prog));
-    pid_actuator = mb_sched_spawn(&sched, os2_flow_actuator_prog,
-                                   sizeof(os2_flow_actuator_prog));
-
-    check_int("sensor_pid", 1, pid_sensor);
-    check_int("actuator_pid", 2, pid_actuator);
-
-    ps = mb_sched_proc(&sched, pid_sensor);
-    pa = mb_sched_proc(&sched, pid_actuator);
+    if (argc == 2) {
+        rc = mb_module_map_file(&mod, argv[1]);
+        if (rc != MB_OK) {
+            fprintf(stderr, "%s: module rejected rc=%d\n", argv[1], rc);
+            return 1;
+        }
+        printf("flow_host: %s: %u entries, %lu code bytes, mailbox depth %u\n",
+               argv[1], mod.entry_count, (unsigned long)mod.code_size, mod.mailbox_depth);
+        check_int("spawn_all", MB_OK, mb_module_spawn_all(&mod, &sched));
+        nproc = mod.entry_count;
+    } else {
+        printf("flow_host: built-in flow: %u processes, %lu code bytes\n",
+               OS2_FLOW_PROCESS_COUNT,
+               (unsigned long)(sizeof(os2_flow_sensor_prog) + sizeof(os2_flow_actuator_prog)));
+        nproc = spawn_builtin(&sched);
+    }
+    pa = mb_sched_proc(&sched, nproc);
 
-    /* Run scheduler until both processes have executed at least one cycle */
+    /* Run scheduler until every sensor has sent at least one reading */
     while (ticks < 200) {
         rc = mb_sched_tick(&sched);
         if (rc == MB_SCHED_IDLE) {
             break;
         }
         if (rc != MB_OK) {
-            fprintf(stderr, "sched error rc=%d tick=%d\n"
-                    "  sensor:   state=%d err=%d pc=%zu\n"
-                    "  actuator: state=%d err=%d pc=%zu\n",
-                    rc, ticks,
-                    ps->state, ps->last_error, ps->pc,
-                    pa->state, pa->last_error, pa->pc);
+            fprintf(stderr, "sched error rc=%d tick=%d\n", rc, ticks);
+            for (pid = 1; pid <= nproc; pid++) {
+                mb_process_t *p = mb_sched_proc(&sched, pid);
+                fprintf(stderr, "  pid %u: state=%d err=%d pc=%zu\n",
+                        pid, p->state, p->last_error, p->pc);
+            }
+            mb_module_unmap(&mod);
             return 1;
         }
         ticks++;
     }
 
-    /* Sensor should have read I2C and sent to actuator.
-     * Stub HAL: i2c_read(bus=1, addr=0x39, reg=0x92) = 0x39 ^ 0x92 ^ 1 = 0xAA = 170
-     * Actuator should have received PWM_SET_DUTY and called pwm_set_duty. */
+    /* Sensors: r0..r2 = bus, addr, reg; r7 = reading.
+     * Stub HAL: i2c_read(bus, addr, reg) = addr ^ reg ^ bus. */
     printf("flow_host: %d ticks\n", ticks);
-    printf("  sensor:   state=%d r7(value)=%d r9(ts)=%d\n",
-           ps->state, MB_GET_SMALLINT(ps->regs[7]), MB_GET_SMALLINT(ps->regs[9]));
+    for (pid = 1; pid < nproc; pid++) {
+        mb_process_t *ps = mb_sched_proc(&sched, pid);
+        int expect = MB_GET_SMALLINT(ps->regs[1]) ^ MB_GET_SMALLINT(ps->regs[2]) ^
+                     MB_GET_SMALLINT(ps->regs[0]);
+        printf("  sensor %u: state=%d r7(value)=%d r9(ts)=%d\n",
+               pid, ps->state, MB_GET_SMALLINT(ps->regs[7]), MB_GET_SMALLINT(ps->regs[9]));
+        check_int("sensor_value", expect, MB_GET_SMALLINT(ps->regs[7]));
+    }
     printf("  actuator: state=%d r0(type)=%d r1(ch)=%d r2(duty)=%d r5(rc)=%d\n",
            pa->state, MB_GET_SMALLINT(pa->regs[0]),
            MB_GET_SMALLINT(pa->regs[1]), MB_GET_SMALLINT(pa->regs[2]),
            MB_GET_SMALLINT(pa->regs[5]));
 
-    /* Verify actuator received the right command */
+    /* Verify actuator received and applied a PWM command */
     check_int("actuator_cmd_type", 2, MB_GET_SMALLINT(pa->regs[0])); /* PWM_SET_DUTY */
-    check_int("actuator_channel", 0, MB_GET_SMALLINT(pa->regs[1]));
-    /* Stub: value = addr ^ reg ^ bus = 0x39 ^ 0x92 ^ 1 = 0xAA = 170 */
-    check_int("actuator_duty", 170, MB_GET_SMALLINT(pa->regs[2]));
+    check_int("actuator_rc", MB_OK, MB_GET_SMALLINT(pa->regs[5]));
 
+    mb_module_unmap(&mod);
     if (failures != 0) {
         fprintf(stderr, "flow_host failures=%d\n", failures);
         return 1;
@@ -1,5 +1,7 @@
 #include <stdio.h>
 
+#include "mb_module.h"
+#include "mb_scheduler.h"
 #include "mb_vm.h"
 
 #define I32LE(v) \
@@ -44,16 +46,50 @@ static const uint8_t demo_program[] = {
     MB_OP_HALT
 };
 
-int main(void) {
+/* `mini_beam_host <module.mbm>`: spawn every entry point and run until
+ * all processes are blocked or halted (or a tick limit), then report. */
+static int run_module(const char *path) {
+    static mb_scheduler_t sched;
+    mb_module_t mod;
+    mb_pid_t pid;
+    int rc, ticks;
+
+    rc = mb_module_map_file(&mod, path);
+    if (rc != MB_OK) {
+        fprintf(stderr, "%s: module rejected rc=%d\n", path, rc);
+        return 1;
+    }
+    mb_sched_init(&sched);
+    rc = mb_module_spawn_all(&mod, &sched);
+    for (ticks = 0; rc == MB_OK && ticks < 1000; ticks++) {
+        rc = mb_sched_tick(&sched);
+    }
+    printf("module %s: %u processes, %d ticks, rc=%d\n", path, mod.entry_count, ticks,
+           rc == MB_SCHED_IDLE ? MB_OK : rc);
+    for (pid = 1; pid <= mod.entry_count; pid++) {
+        const mb_process_t *p = mb_sched_proc(&sched, pid);
+        if (p != NULL) {
+            printf("  pid %u: state=%d err=%d pc=%zu\n", pid, p->state, p->last_error, p->pc);
+        }
+    }
+    mb_module_unmap(&mod);
+    return (rc == MB_OK || rc == MB_SCHED_IDLE) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
     mb_vm_t vm;
+
+    if (argc > 1) {
+        return run_module(argv[1]);
+    }
     mb_vm_init(&vm, demo_program, sizeof(demo_program));
 
     if (mb_vm_run(&vm, 1024) != 0) {
-        fprintf(stderr, "vm failed: err=%d pc=%zu\n", vm.last_error, vm.pc);
+        fprintf(stderr, "vm failed: err=%d pc=%zu\n", vm.proc->last_error, vm.proc->pc);
         return 1;
     }
 
     printf("vm done: i2c_value_reg7=%d gpio_level_reg10=%d\n",
-           MB_GET_SMALLINT(vm.regs[7]), MB_GET_SMALLINT(vm.regs[10]));
+           MB_GET_SMALLINT(vm.proc->regs[7]), MB_GET_SMALLINT(vm.proc->regs[10]));
     return 0;
 }
@@ -0,0 +1,385 @@
+/**
+ * Host JIT differential test (MB_JIT builds only).
+ *
+ * Runs every program twice, once interpreted and once through the JIT,
+ * in slices of varying budget, and compares the observable process state
+ * (status, pc, reductions, halted, last_error, registers) after every
+ * slice.  The corpus is a few hand-written programs plus seeded random
+ * programs mixing JIT templates with interpreter-only instructions.
+ *
+ * mini_beam_host_regression is the other half of the check: in an MB_JIT
+ * build its whole suite runs through the JIT as well.
+ */
+
+#include <stdio.h>
+
+#include "mb_jit.h"
+#include "mb_scheduler.h"
+#include "mb_vm.h"
+
+#define I32LE(v) \
+    (uint8_t)((v) & 0xff), \
+    (uint8_t)(((v) >> 8) & 0xff), \
+    (uint8_t)(((v) >> 16) & 0xff), \
+    (uint8_t)(((v) >> 24) & 0xff)
+
+#define DIFF_RANDOM_PROGRAMS 400
+#define DIFF_SLICES 48
+
+static int failures = 0;
+static unsigned long compared = 0;
+
+static void check_int(const char *name, int expected, int actual) {
+    if (expected != actual) {
+        fprintf(stderr, "FAIL %s: expected=%d actual=%d\n", name, expected, actual);
+        failures++;
+    }
+}
+
+static void check_same_proc(const char *name, const mb_process_t *ref, const mb_process_t *jit) {
+    uint8_t r;
+    check_int(name, (int)ref->pc, (int)jit->pc);
+    check_int(name, (int)ref->reductions, (int)jit->reductions);
+    check_int(name, ref->halted, jit->halted);
+    check_int(name, ref->state, jit->state);
+    check_int(name, ref->last_error, jit->last_error);
+    check_int(name, (int)ref->mailbox.count, (int)jit->mailbox.count);
+    for (r = 0; r < MB_REG_COUNT; r++) {
+        check_int(name, (int)ref->regs[r], (int)jit->regs[r]);
+    }
+    compared++;
+}
+
+static const uint32_t budgets[] = {1, 2, 5, MB_REDUCTIONS, 3, 1000};
+
+/* Compat mode (no scheduler): one process, interpreted vs JIT. */
+static void diff_program(const char *name, const uint8_t *prog, size_t size) {
+    static mb_process_t ref, jit;
+    static mb_term_t ref_heap[2 * MB_HEAP_WORDS], jit_heap[2 * MB_HEAP_WORDS];
+    int i;
+
+    mb_proc_release(&ref);
+    mb_proc_release(&jit);
+    mb_proc_init(&ref, MB_PID_NONE, prog, size);
+    mb_proc_init(&jit, MB_PID_NONE, prog, size);
+    mb_heap_init(&ref.heap, ref_heap, MB_HEAP_WORDS);
+    mb_heap_init(&jit.heap, jit_heap, MB_HEAP_WORDS);
+    ref.native = NULL;
+    if (jit.native != mb_jit_run) {
+        fprintf(stderr, "FAIL %s: not JIT-attached\n", name);
+        failures++;
+        return;
+    }
+
+    for (i = 0; i < DIFF_SLICES && !(ref.halted && jit.halted); i++) {
+        uint32_t n = budgets[i % (int)(sizeof(budgets) / sizeof(budgets[0]))];
+        check_int(name, mb_proc_run(&ref, NULL, n), mb_proc_run(&jit, NULL, n));
+        check_same_proc(name, &ref, &jit);
+    }
+}
+
+/* --- hand-written corpus --- */
+
+static void diff_fixed(void) {
+    /* Counted loop with every ALU template and a fall-out branch. */
+    static const uint8_t alu[] = {
+        MB_OP_CONST_I32, 0, I32LE(300),
+        MB_OP_CONST_I32, 1, I32LE(-7),
+        MB_OP_CONST_I32, 2, I32LE(0),
+        MB_OP_ADD, 2, 2, 0,            /* loop: */
+        MB_OP_SUB_IMM, 3, 2, I32LE(11),
+        MB_OP_XOR, 4, 3, 1,
+        MB_OP_AND, 5, 4, 0,
+        MB_OP_OR, 6, 5, 1,
+        MB_OP_MIN, 7, 6, 3,
+        MB_OP_MAX, 8, 6, 3,
+        MB_OP_CLAMP, 9, 4, 1, 0,
+        MB_OP_MOVE, 10, 9, 0,
+        MB_OP_JMP_LT_IMM, 2, I32LE(0), I32LE(1),
+        MB_OP_NOP,
+        MB_OP_DJNZ, 0, I32LE(-57),
+        MB_OP_HALT
+    };
+    /* Branch forms, a YIELD and interpreter-only math in the loop. */
+    static const uint8_t branches[] = {
+        MB_OP_CONST_I32, 0, I32LE(40),
+        MB_OP_CONST_I32, 1, I32LE(3),
+        MB_OP_CONST_I32, 2, I32LE(0),
+        MB_OP_MUL, 3, 0, 1,                        /* loop: */
+        MB_OP_JMP_EQ, 0, 1, I32LE(7),
+        MB_OP_ADD_IMM, 2, 2, I32LE(1),             /* skipped when r0 == r1 */
+        MB_OP_JMP_NE_IMM, 0, I32LE(20), I32LE(1),
+        MB_OP_YIELD,
+        MB_OP_JMP_GE, 0, 1, I32LE(1),
+        MB_OP_NOP,
+        MB_OP_SUB, 0, 0, 1,
+        MB_OP_ADD_IMM, 0, 0, I32LE(2),
+        MB_OP_JMP_IF_ZERO, 0, I32LE(5),
+        MB_OP_JMP, I32LE(-59),
+        MB_OP_HALT
+    };
+    /* Faults in the interpreter fallback are sticky in both modes. */
+    static const uint8_t div0[] = {
+        MB_OP_CONST_I32, 0, I32LE(5),
+        MB_OP_CONST_I32, 1, I32LE(0),
+        MB_OP_ADD, 2, 0, 0,
+        MB_OP_DIV, 3, 0, 1,
+        MB_OP_HALT
+    };
+    /* Subroutine frames (interpreted) around JIT arithmetic. */
+    static const uint8_t calls[] = {
+        MB_OP_CONST_I32, 0, I32LE(6),
+        MB_OP_CALL, I32LE(7),                      /* loop: */
+        MB_OP_DJNZ, 0, I32LE(-11),
+        MB_OP_HALT,
+        MB_OP_ALLOCATE, 1,                         /* sub: */
+        MB_OP_PUT_Y, 0, 0,
+        MB_OP_ADD_IMM, 1, 1, I32LE(5),
+        MB_OP_DEALLOCATE, 1,
+        MB_OP_RET
+    };
+
+    diff_program("jit_alu", alu, sizeof(alu));
+    diff_program("jit_branches", branches, sizeof(branches));
+    diff_program("jit_div0", div0, sizeof(div0));
+    diff_program("jit_calls", calls, sizeof(calls));
+}
+
+/* Scheduler mode: blocking RECV_CMD and SEND between JIT'd processes. */
+static void diff_sched(void) {
+    static mb_scheduler_t ref, jit;
+    static const uint8_t sender[] = {
+        MB_OP_CONST_I32, 0, I32LE(2),               /* r0 = receiver pid  */
+        MB_OP_CONST_I32, 1, I32LE(MB_CMD_GPIO_READ),
+        MB_OP_CONST_I32, 2, I32LE(0),
+        MB_OP_CONST_I32, 6, I32LE(100),
+        MB_OP_ADD_IMM, 2, 2, I32LE(1),              /* loop: r2 = pin     */
+        MB_OP_AND, 2, 2, 1,
+        MB_OP_SEND, 0, 1, 2, 3, 4, 5,
+        MB_OP_CONST_I32, 0, I32LE(2),               /* SEND wrote status  */
+        MB_OP_DJNZ, 6, I32LE(-30),
+        MB_OP_HALT
+    };
+    static const uint8_t receiver[] = {
+        MB_OP_RECV_CMD, 0, 1, 2, 3, 4,              /* loop: */
+        MB_OP_ADD, 5, 5, 0,
+        MB_OP_JMP, I32LE(-15)
+    };
+    uint8_t i;
+    int t;
+
+    mb_sched_init(&ref);
+    mb_sched_init(&jit);
+    (void)mb_sched_spawn(&ref, sender, sizeof(sender));
+    (void)mb_sched_spawn(&ref, receiver, sizeof(receiver));
+    (void)mb_sched_spawn(&jit, sender, sizeof(sender));
+    (void)mb_sched_spawn(&jit, receiver, sizeof(receiver));
+    ref.procs[0].native = NULL;
+    ref.procs[1].native = NULL;
+    check_int("jit_sched_attached", 1, jit.procs[1].native == mb_jit_run);
+
+    for (t = 0; t < 400; t++) {
+        check_int("jit_sched_tick", mb_sched_tick(&ref), mb_sched_tick(&jit));
+        for (i = 0; i < 2; i++) {
+            check_same_proc("jit_sched_proc", &ref.procs[i], &jit.procs[i]);
+        }
+    }
+    check_int("jit_sched_sender_halted", MB_PROC_HALTED, jit.procs[0].state);
+    /* 100 GPIO_READ commands delivered: r5 sums their type */
+    check_int("jit_sched_delivered", 100 * MB_CMD_GPIO_READ, MB_GET_SMALLINT(jit.procs[1].regs[5]));
+}
+
+/* --- seeded random programs --- */
+
+static uint32_t rng_state = 0x2545F491u;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+#define RND_REGS 8  /* random code touches r0..r7 */
+#define RND_MAX_INSNS (RND_REGS + 48 + 1)  /* register setup, body, HALT */
+
+typedef struct {
+    uint8_t  op;
+    uint8_t  r[4];
+    int32_t  imm;     /* ADD_IMM/SUB_IMM operand, CONST value or compare literal */
+    uint16_t target;  /* instruction index for jumps */
+} rnd_insn_t;
+
+static size_t rnd_size(uint8_t op) {
+    switch (op) {
+    case MB_OP_NOP:
+    case MB_OP_YIELD:
+    case MB_OP_HALT:
+        return 1;
+    case MB_OP_CONST_I32:
+    case MB_OP_JMP_IF_ZERO:
+    case MB_OP_DJNZ:
+        return 6;
+    case MB_OP_CLAMP:
+    case MB_OP_JMP:
+        return 5;
+    case MB_OP_ADD_IMM:
+    case MB_OP_SUB_IMM:
+    case MB_OP_JMP_EQ:
+    case MB_OP_JMP_NE:
+    case MB_OP_JMP_LT:
+    case MB_OP_JMP_GE:
+        return 7;
+    case MB_OP_JMP_EQ_IMM:
+    case MB_OP_JMP_NE_IMM:
+    case MB_OP_JMP_LT_IMM:
+    case MB_OP_JMP_GE_IMM:
+        return 10;
+    default:
+        return 4;  /* three-register forms */
+    }
+}
+
+static size_t rnd_program(uint8_t *out, size_t cap) {
+    static const uint8_t ops[] = {
+        MB_OP_NOP, MB_OP_MOVE, MB_OP_ADD, MB_OP_SUB, MB_OP_ADD_IMM, MB_OP_SUB_IMM,
+        MB_OP_AND, MB_OP_OR, MB_OP_XOR, MB_OP_MIN, MB_OP_MAX, MB_OP_CLAMP,
+        MB_OP_JMP, MB_OP_JMP_IF_ZERO, MB_OP_JMP_EQ, MB_OP_JMP_NE, MB_OP_JMP_LT,
+        MB_OP_JMP_GE, MB_OP_JMP_EQ_IMM, MB_OP_JMP_NE_IMM, MB_OP_JMP_LT_IMM,
+        MB_OP_JMP_GE_IMM, MB_OP_DJNZ,
+        /* interpreter fallback */
+        MB_OP_MUL, MB_OP_DIV, MB_OP_SHL, MB_OP_YIELD, MB_OP_CONST_I32
+    };
+    rnd_insn_t code[RND_MAX_INSNS];
+    size_t starts[RND_MAX_INSNS + 1];
+    size_t n = 0, len = 0, i, body = 8 + rng() % 40;
+    uint8_t r;
+
+    for (r = 0; r < RND_REGS; r++) {
+        code[n].op = MB_OP_CONST_I32;
+        code[n].r[0] = r;
+        code[n].imm = (int32_t)(rng() % 101) - 50;
+        n++;
+    }
+    while (n < RND_REGS + body) {
+        rnd_insn_t *in = &code[n++];
+        in->op = ops[rng() % sizeof(ops)];
+        for (r = 0; r < 4; r++) {
+            in->r[r] = (uint8_t)(rng() % RND_REGS);
+        }
+        in->imm = (int32_t)(rng() % 41) - 20;
+        /* Mostly forward jumps so programs tend to reach HALT. */
+        in->target = (uint16_t)((rng() % 4 == 0) ? rng() % n : n + rng() % (RND_REGS + body + 1 - n));
+    }
+    code[n].op = MB_OP_HALT;
+    n++;
+
+    for (i = 0; i < n; i++) {
+        starts[i] = len;
+        len += rnd_size(code[i].op);
+    }
+    starts[n] = len;
+    if (len > cap) {
+        return 0;
+    }
+
+    len = 0;
+    for (i = 0; i < n; i++) {
+        const rnd_insn_t *in = &code[i];
+        int32_t off = (int32_t)starts[in->target < n ? in->target : n - 1] - (int32_t)starts[i + 1];
+        uint8_t b[10];
+        size_t k = 0, j;
+
+        b[k++] = in->op;
+        switch (in->op) {
+        case MB_OP_NOP:
+        case MB_OP_YIELD:
+        case MB_OP_HALT:
+            break;
+        case MB_OP_CONST_I32: {
+            const uint8_t v[] = {I32LE(in->imm)};
+            b[k++] = in->r[0];
+            for (j = 0; j < 4; j++) b[k++] = v[j];
+            break;
+        }
+        case MB_OP_ADD_IMM:
+        case MB_OP_SUB_IMM: {
+            const uint8_t v[] = {I32LE(in->imm)};
+            b[k++] = in->r[0];
+            b[k++] = in->r[1];
+            for (j = 0; j < 4; j++) b[k++] = v[j];
+            break;
+        }
+        case MB_OP_JMP: {
+            const uint8_t v[] = {I32LE(off)};
+            for (j = 0; j < 4; j++) b[k++] = v[j];
+            break;
+        }
+        case MB_OP_JMP_IF_ZERO:
+        case MB_OP_DJNZ: {
+            const uint8_t v[] = {I32LE(off)};
+            b[k++] = in->r[0];
+            for (j = 0; j < 4; j++) b[k++] = v[j];
+            break;
+        }
+        case MB_OP_JMP_EQ:
+        case MB_OP_JMP_NE:
+        case MB_OP_JMP_LT:
+        case MB_OP_JMP_GE: {
+            const uint8_t v[] = {I32LE(off)};
+            b[k++] = in->r[0];
+            b[k++] = in->r[1];
+            for (j = 0; j < 4; j++) b[k++] = v[j];
+            break;
+        }
+        case MB_OP_JMP_EQ_IMM:
+        case MB_OP_JMP_NE_IMM:
+        case MB_OP_JMP_LT_IMM:
+        case MB_OP_JMP_GE_IMM: {
+            const uint8_t v[] = {I32LE(in->imm), I32LE(off)};
+            b[k++] = in->r[0];
+            for (j = 0; j < 8; j++) b[k++] = v[j];
+            break;
+        }
+        case MB_OP_CLAMP:
+            for (j = 0; j < 4; j++) b[k++] = in->r[j];
+            break;
+        default:
+            for (j = 0; j < 3; j++) b[k++] = in->r[j];
+            break;
+        }
+        for (j = 0; j < k; j++) {
+            out[len++] = b[j];
+        }
+    }
+    return len;
+}
+
+static void diff_random(void) {
+    uint8_t prog[512];
+    int i, verified = 0;
+
+    for (i = 0; i < DIFF_RANDOM_PROGRAMS; i++) {
+        size_t size = rnd_program(prog, sizeof(prog));
+        if (size == 0 || mb_verify_program(prog, size) != MB_OK) {
+            continue;
+        }
+        verified++;
+        diff_program("jit_random", prog, size);
+    }
+    check_int("jit_random_verified", 1, verified > DIFF_RANDOM_PROGRAMS / 2);
+}
+
+int main(void) {
+    diff_fixed();
+    diff_sched();
+    diff_random();
+
+    if (failures != 0) {
+        fprintf(stderr, "jit_diff failures=%d\n", failures);
+        return 1;
+    }
+
+    printf("mini_beam_host_jit_diff: %lu slices identical -- PASS\n", compared);
+    return 0;
+}
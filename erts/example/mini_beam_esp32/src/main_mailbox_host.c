@@ -28,14 +28,14 @@ int main(void) {
 
     rc = mb_vm_run(&vm, 8);
     if (rc != MB_OK) {
-        fprintf(stderr, "vm failed: err=%d pc=%zu\n", vm.last_error, vm.pc);
+        fprintf(stderr, "vm failed: err=%d pc=%zu\n", vm.proc->last_error, vm.proc->pc);
         return 1;
     }
 
     printf("mailbox recv: type=%d a=%d b=%d c=%d d=%d\n",
-           MB_GET_SMALLINT(vm.regs[0]), MB_GET_SMALLINT(vm.regs[1]),
-           MB_GET_SMALLINT(vm.regs[2]), MB_GET_SMALLINT(vm.regs[3]),
-           MB_GET_SMALLINT(vm.regs[4]));
+           MB_GET_SMALLINT(vm.proc->regs[0]), MB_GET_SMALLINT(vm.proc->regs[1]),
+           MB_GET_SMALLINT(vm.proc->regs[2]), MB_GET_SMALLINT(vm.proc->regs[3]),
+           MB_GET_SMALLINT(vm.proc->regs[4]));
 
     cmd.type = 999;
     cmd.a = 0;
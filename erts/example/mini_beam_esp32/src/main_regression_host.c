@@ -1,9 +1,16 @@
 #include <stdio.h>
+#include <string.h>
 
+#include "mb_bif.h"
 #include "mb_vm.h"
+#include "mb_module.h"
 #include "mb_scheduler.h"
 #include "mb_term.h"
 
+/* Native loops for every process of the generated Zephyr flow. */
+#define OS2_FLOW_NATIVE_MASK 0x1F
+#include "../zephyr_app/src/flow_generated.h"
+
 #define I32LE(v) \
     (uint8_t)((v) & 0xff), \
     (uint8_t)(((v) >> 8) & 0xff), \
@@ -82,8 +89,8 @@ static void test_recv_empty_is_nonfatal(void) {
 
     mb_vm_init(&vm, program, sizeof(program));
     check_int("recv_empty_run", MB_OK, mb_vm_run(&vm, 8));
-    check_int("recv_empty_type", MB_CMD_NONE, MB_GET_SMALLINT(vm.regs[0]));
-    check_int("recv_empty_status", MB_MAILBOX_EMPTY, MB_GET_SMALLINT(vm.regs[1]));
+    check_int("recv_empty_type", MB_CMD_NONE, MB_GET_SMALLINT(vm.proc->regs[0]));
+    check_int("recv_empty_status", MB_MAILBOX_EMPTY, MB_GET_SMALLINT(vm.proc->regs[1]));
 }
 
 /* ---- scheduler tests ---- */
@@ -123,6 +130,29 @@ static void test_sched_full_table(void) {
     check_int("spawn_full", MB_PID_NONE, pid);
 }
 
+static void test_sched_spawn_args(void) {
+    static mb_scheduler_t sched;
+    static const mb_term_t args[2] = { MB_MAKE_SMALLINT(7), MB_MAKE_SMALLINT(300) };
+    static const mb_term_t many[MB_REG_COUNT + 1];
+    mb_process_t *p1, *p2;
+
+    mb_sched_init(&sched);
+    check_int("spawn_args_pid", 1, mb_sched_spawn_args(&sched, os2_flow_sensor_prog,
+              sizeof(os2_flow_sensor_prog), args, 2, NULL));
+    check_int("spawn_args_twin", 2, mb_sched_spawn_args(&sched, os2_flow_sensor_prog,
+              sizeof(os2_flow_sensor_prog), args + 1, 1, NULL));
+    p1 = mb_sched_proc(&sched, 1);
+    p2 = mb_sched_proc(&sched, 2);
+    check_int("spawn_args_r0", 7, MB_GET_SMALLINT(p1->regs[0]));
+    check_int("spawn_args_r1", 300, MB_GET_SMALLINT(p1->regs[1]));
+    check_int("spawn_args_twin_r0", 300, MB_GET_SMALLINT(p2->regs[0]));
+    check_int("spawn_args_twin_r1", 0, (int)p2->regs[1]);  /* past argc: cleared */
+    /* the twin shares the decoded program, not just the bytes */
+    check_int("spawn_args_twin_code", 1, p2->code == p1->code);
+    check_int("spawn_args_too_many", MB_PID_NONE, mb_sched_spawn_args(&sched,
+              os2_flow_sensor_prog, sizeof(os2_flow_sensor_prog), many, MB_REG_COUNT + 1, NULL));
+}
+
 static void test_sched_send_ext(void) {
     mb_scheduler_t sched;
     mb_pid_t pid;
@@ -191,6 +221,86 @@ static void test_self_opcode(void) {
     check_int("self_pid", (int)MB_MAKE_PID(pid), (int)mb_sched_proc(&sched, pid)->regs[0]);
 }
 
+/* Worker (entry 1): r0 = parent pid, r1 = duty; reports PWM_SET_DUTY(0, duty), exits. */
+static const uint8_t spawn_worker_prog[] = {
+    MB_OP_CONST_I32, 2, I32LE(MB_CMD_PWM_SET_DUTY),
+    MB_OP_CONST_I32, 3, I32LE(0),
+    MB_OP_SEND, 0, 2, 3, 1, 3, 3,
+    MB_OP_EXIT
+};
+
+static void test_spawn_exit(void) {
+    static mb_scheduler_t sched;
+    /* Dispatcher: spawn a worker with (self, 100), wait for its report. */
+    static const uint8_t prog[] = {
+        MB_OP_SELF, 5,
+        MB_OP_CONST_I32, 6, I32LE(100),
+        MB_OP_SPAWN, 7, 1, 5, 2,
+        MB_OP_RECV_CMD, 0, 1, 2, 3, 4,
+        MB_OP_HALT
+    };
+    static const uint8_t bad_entry[] = { MB_OP_SPAWN, 0, 3, 0, 0, MB_OP_HALT };
+    static const uint8_t bad_args[] = { MB_OP_SPAWN, 0, 1, 12, 5, MB_OP_HALT };
+    static const uint8_t halt[] = { MB_OP_HALT };
+    mb_process_t *parent;
+    mb_pid_t pid, worker;
+    mb_command_t cmd = {0};
+    int t, i;
+
+    mb_sched_init(&sched);
+    check_int("spawn_entry_range", MB_BAD_ENTRY,
+              mb_sched_set_entry(&sched, MB_SCHED_MAX_ENTRIES, halt, sizeof(halt), 0));
+    check_int("spawn_entry_set", MB_OK,
+              mb_sched_set_entry(&sched, 1, spawn_worker_prog, sizeof(spawn_worker_prog),
+                                 MB_HEAP_WORDS));
+    pid = mb_sched_spawn(&sched, prog, sizeof(prog));
+    parent = mb_sched_proc(&sched, pid);
+    for (t = 0; t < 8; t++) {
+        (void)mb_sched_tick(&sched);
+    }
+    worker = (mb_pid_t)MB_GET_PID(parent->regs[7]);
+    check_int("spawn_pid_term", 1, MB_IS_PID(parent->regs[7]));
+    check_int("spawn_worker_pid", 2, worker);
+    check_int("spawn_report", 100, MB_GET_SMALLINT(parent->regs[2]));
+    check_int("spawn_parent_halted", MB_PROC_HALTED, parent->state);
+    check_int("exit_frees_slot", 1, mb_sched_proc(&sched, worker) == NULL);
+    check_int("exit_count", 1, sched.count);
+
+    /* The freed slot is reused under a new generation; the old pid is stale. */
+    pid = mb_sched_spawn(&sched, halt, sizeof(halt));
+    check_int("reuse_slot", (int)MB_PID_SLOT(worker), (int)MB_PID_SLOT(pid));
+    check_int("reuse_generation", 1, (int)MB_PID_GEN(pid));
+    cmd.type = MB_CMD_PWM_SET_DUTY;
+    check_int("stale_pid_send", MB_BAD_PID, mb_sched_send(&sched, worker, cmd));
+    check_int("stale_pid_exit", MB_BAD_PID, mb_sched_exit(&sched, worker));
+    check_int("native_exit", MB_OK, mb_sched_exit(&sched, pid));
+    check_int("native_exit_count", 1, sched.count);
+
+    /* A full table is not a fault: SPAWN writes small integer 0. */
+    for (i = 1; i < MB_MAX_PROCESSES; i++) {
+        (void)mb_sched_spawn(&sched, halt, sizeof(halt));
+    }
+    parent->state = MB_PROC_READY;
+    parent->halted = 0;
+    parent->pc = 2;
+    check_int("spawn_full_run", MB_OK, mb_proc_run(parent, &sched, 2));
+    check_int("spawn_full_zero", 1, parent->regs[7] == MB_MAKE_SMALLINT(0));
+
+    mb_sched_init(&sched);
+    pid = mb_sched_spawn(&sched, bad_entry, sizeof(bad_entry));
+    check_int("spawn_bad_entry", MB_BAD_ENTRY, mb_sched_tick(&sched));
+    check_int("spawn_args_regs", MB_BAD_REG, mb_verify_program(bad_args, sizeof(bad_args)));
+}
+
+static void test_exit_compat(void) {
+    mb_vm_t vm;
+    static const uint8_t prog[] = { MB_OP_EXIT, MB_OP_NOP };
+
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("exit_compat_run", MB_OK, mb_vm_run(&vm, 4));
+    check_int("exit_compat_halted", 1, vm.proc->halted);
+}
+
 static void test_yield_opcode(void) {
     mb_scheduler_t sched;
     mb_pid_t pid;
@@ -309,11 +419,13 @@ static void test_tuple_header(void) {
 
 /* ---- heap and GC tests ---- */
 
+static mb_term_t heap_mem[2 * MB_HEAP_WORDS];
+
 static void test_heap_alloc_basic(void) {
     mb_heap_t heap;
     mb_term_t *p1, *p2;
 
-    mb_heap_init(&heap);
+    mb_heap_init(&heap, heap_mem, MB_HEAP_WORDS);
     check_int("heap_hp_init", 0, (int)heap.hp);
 
     p1 = mb_heap_alloc(&heap, 3);
@@ -335,7 +447,7 @@ static void test_heap_make_tuple(void) {
     mb_term_t tup;
     mb_term_t *ptr;
 
-    mb_heap_init(&heap);
+    mb_heap_init(&heap, heap_mem, MB_HEAP_WORDS);
 
     elems[0] = MB_MAKE_SMALLINT(10);
     elems[1] = MB_MAKE_SMALLINT(20);
@@ -358,7 +470,7 @@ static void test_heap_cons(void) {
     mb_term_t cell;
     mb_term_t *ptr;
 
-    mb_heap_init(&heap);
+    mb_heap_init(&heap, heap_mem, MB_HEAP_WORDS);
 
     cell = mb_heap_cons(&heap, MB_MAKE_SMALLINT(1), MB_NIL);
     check_int("cons_is_cons", 1, MB_IS_CONS(cell));
@@ -375,7 +487,7 @@ static void test_gc_survives_live_data(void) {
     mb_term_t elems[2];
     mb_term_t *ptr;
 
-    mb_heap_init(&heap);
+    mb_heap_init(&heap, heap_mem, MB_HEAP_WORDS);
 
     elems[0] = MB_MAKE_SMALLINT(42);
     elems[1] = MB_MAKE_SMALLINT(99);
@@ -402,7 +514,7 @@ static void test_gc_reclaims_dead_data(void) {
     mb_term_t *roots[1];
     mb_term_t elems[2];
 
-    mb_heap_init(&heap);
+    mb_heap_init(&heap, heap_mem, MB_HEAP_WORDS);
 
     /* Allocate some dead data first */
     elems[0] = MB_MAKE_SMALLINT(1);
@@ -434,7 +546,7 @@ static void test_gc_nested_structures(void) {
     mb_term_t *ptr;
     mb_term_t *inner_ptr;
 
-    mb_heap_init(&heap);
+    mb_heap_init(&heap, heap_mem, MB_HEAP_WORDS);
 
     /* Build: {100, {200, 300}} */
     inner_elems[0] = MB_MAKE_SMALLINT(200);
@@ -526,30 +638,23 @@ static void test_opcode_cons_head_tail(void) {
      * TAIL r8, r6         -> r8 = nil
      * HALT
      */
-    /* Since we can't encode MB_NIL as CONST_I32, use the process API directly */
+    /* Since we can't encode MB_NIL as CONST_I32, preset registers directly */
+    static const uint8_t prog[] = {
+        MB_OP_CONS, 2, 0, 1,     /* r2 = cons(r0, r1) = [1|nil] */
+        MB_OP_CONS, 4, 3, 2,     /* r4 = cons(r3, r2) = [2, 1] */
+        MB_OP_HEAD, 5, 4,         /* r5 = hd(r4) = 2 */
+        MB_OP_TAIL, 6, 4,         /* r6 = tl(r4) = [1|nil] */
+        MB_OP_HEAD, 7, 6,         /* r7 = hd(r6) = 1 */
+        MB_OP_TAIL, 8, 6,         /* r8 = tl(r6) = nil */
+        MB_OP_HALT
+    };
+
     mb_sched_init(&sched);
-    pid = mb_sched_spawn(&sched, NULL, 0);
+    pid = mb_sched_spawn(&sched, prog, sizeof(prog));
     p = mb_sched_proc(&sched, pid);
-
-    /* Manually set up registers and run bytecode */
-    {
-        static const uint8_t prog2[] = {
-            MB_OP_CONS, 2, 0, 1,     /* r2 = cons(r0, r1) = [1|nil] */
-            MB_OP_CONS, 4, 3, 2,     /* r4 = cons(r3, r2) = [2, 1] */
-            MB_OP_HEAD, 5, 4,         /* r5 = hd(r4) = 2 */
-            MB_OP_TAIL, 6, 4,         /* r6 = tl(r4) = [1|nil] */
-            MB_OP_HEAD, 7, 6,         /* r7 = hd(r6) = 1 */
-            MB_OP_TAIL, 8, 6,         /* r8 = tl(r6) = nil */
-            MB_OP_HALT
-        };
-        p->program = prog2;
-        p->program_size = sizeof(prog2);
-        p->pc = 0;
-        p->state = MB_PROC_READY;
-        p->regs[0] = MB_MAKE_SMALLINT(1);
-        p->regs[1] = MB_NIL;
-        p->regs[3] = MB_MAKE_SMALLINT(2);
-    }
+    p->regs[0] = MB_MAKE_SMALLINT(1);
+    p->regs[1] = MB_NIL;
+    p->regs[3] = MB_MAKE_SMALLINT(2);
 
     while ((rc = mb_sched_tick(&sched)) == MB_OK) {}
     check_int("cons_idle", MB_SCHED_IDLE, rc);
@@ -563,6 +668,1902 @@ static void test_opcode_cons_head_tail(void) {
     check_int("cons_tail_nil", 1, p->regs[8] == MB_NIL);
 }
 
+/* ---- term test opcode tests ---- */
+
+/* Classify r0: 1 nil, 2 integer, 3 cons, 4 {A, B} (unpacked to r2, r3), 5 other tuple, 6 else. */
+static const uint8_t classify_prog[] = {
+    MB_OP_IS_NIL, 0, I32LE(7),
+    MB_OP_CONST_I32, 1, I32LE(1), MB_OP_HALT,
+    MB_OP_IS_INTEGER, 0, I32LE(7),
+    MB_OP_CONST_I32, 1, I32LE(2), MB_OP_HALT,
+    MB_OP_IS_CONS, 0, I32LE(7),
+    MB_OP_CONST_I32, 1, I32LE(3), MB_OP_HALT,
+    MB_OP_TEST_ARITY, 0, 2, I32LE(11),
+    MB_OP_GET_TUPLE_ELEMENTS, 0, 2, 2,
+    MB_OP_CONST_I32, 1, I32LE(4), MB_OP_HALT,
+    MB_OP_IS_TUPLE, 0, I32LE(7),
+    MB_OP_CONST_I32, 1, I32LE(5), MB_OP_HALT,
+    MB_OP_CONST_I32, 1, I32LE(6), MB_OP_HALT
+};
+
+/* r2 = 1 if r0 =:= r1, else 0. */
+static const uint8_t eq_exact_prog[] = {
+    MB_OP_IS_EQ_EXACT, 0, 1, I32LE(7),
+    MB_OP_CONST_I32, 2, I32LE(1), MB_OP_HALT,
+    MB_OP_CONST_I32, 2, I32LE(0), MB_OP_HALT
+};
+
+/* [n, n+1, ..., n+len-1] on the heap. */
+static mb_term_t make_seq(mb_heap_t *heap, int32_t n, int len) {
+    mb_term_t list = MB_NIL;
+    while (len-- > 0) {
+        list = mb_heap_cons(heap, MB_MAKE_SMALLINT(n + len), list);
+    }
+    return list;
+}
+
+/* Run @p prog in compat mode with r0/r1 preset; *vm keeps the result. */
+static int run_terms(mb_vm_t *vm, const uint8_t *prog, size_t size,
+                     mb_term_t (*build)(mb_heap_t *, int), int which) {
+    mb_vm_init(vm, prog, size);
+    vm->proc->regs[0] = build(&vm->proc->heap, which);
+    vm->proc->regs[1] = build(&vm->proc->heap, which + 100);
+    return mb_vm_run(vm, 32);
+}
+
+static mb_term_t build_classify(mb_heap_t *heap, int which) {
+    mb_term_t e[3] = { MB_MAKE_SMALLINT(7), MB_MAKE_SMALLINT(8), MB_MAKE_SMALLINT(9) };
+    switch (which) {
+    case 0: return MB_NIL;
+    case 1: return MB_MAKE_SMALLINT(4);
+    case 2: return make_seq(heap, 1, 2);
+    case 3: return mb_heap_make_tuple(heap, e, 2);
+    case 4: return mb_heap_make_tuple(heap, e, 3);
+    case 5: return MB_MAKE_PID(3);
+    default: return MB_NIL;
+    }
+}
+
+/* Pairs (which, which + 100) built separately, so equal terms never share cells. */
+static mb_term_t build_eq(mb_heap_t *heap, int which) {
+    mb_term_t e[2];
+    mb_term_t t = MB_NIL;
+    int i, other = which >= 100;
+
+    switch (which % 100) {
+    case 0:  /* {1, [2, 3]} =:= {1, [2, 3]} */
+        e[0] = MB_MAKE_SMALLINT(1);
+        e[1] = make_seq(heap, 2, 2);
+        return mb_heap_make_tuple(heap, e, 2);
+    case 1:  /* {1, [2, 3]} vs {1, [2, 4]} */
+        e[0] = MB_MAKE_SMALLINT(1);
+        e[1] = other ? mb_heap_cons(heap, MB_MAKE_SMALLINT(2),
+                                    mb_heap_cons(heap, MB_MAKE_SMALLINT(4), MB_NIL))
+                     : make_seq(heap, 2, 2);
+        return mb_heap_make_tuple(heap, e, 2);
+    case 2:  /* {1, 2} vs [1, 2] */
+        e[0] = MB_MAKE_SMALLINT(1);
+        e[1] = MB_MAKE_SMALLINT(2);
+        return other ? make_seq(heap, 1, 2) : mb_heap_make_tuple(heap, e, 2);
+    case 3:  /* {1} vs {1, 2}: arity differs */
+        e[0] = MB_MAKE_SMALLINT(1);
+        e[1] = MB_MAKE_SMALLINT(2);
+        return mb_heap_make_tuple(heap, e, other ? 2 : 1);
+    case 4:  /* 24-element lists: length costs no depth */
+        return make_seq(heap, 0, 24);
+    case 5:  /* [[[...[1]...]]] nested past MB_EQ_MAX_DEPTH in heads */
+        t = MB_MAKE_SMALLINT(1);
+        for (i = 0; i <= MB_EQ_MAX_DEPTH; i++) {
+            t = mb_heap_cons(heap, t, MB_NIL);
+        }
+        return t;
+    default:
+        return MB_MAKE_SMALLINT(5);
+    }
+}
+
+static void test_term_tests(void) {
+    static const uint8_t bad_arity[] = { MB_OP_TEST_ARITY, 0, 17, I32LE(0), MB_OP_HALT };
+    static const uint8_t bad_range[] = { MB_OP_GET_TUPLE_ELEMENTS, 0, 14, 3, MB_OP_HALT };
+    static const uint8_t unpack[] = { MB_OP_GET_TUPLE_ELEMENTS, 0, 2, 3, MB_OP_HALT };
+    static const int kinds[] = { 1, 2, 3, 4, 5, 6 };
+    mb_vm_t vm;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        check_int("term_test_run", MB_OK,
+                  run_terms(&vm, classify_prog, sizeof(classify_prog), build_classify, i));
+        check_int("term_test_class", kinds[i], MB_GET_SMALLINT(vm.proc->regs[1]));
+    }
+    (void)run_terms(&vm, classify_prog, sizeof(classify_prog), build_classify, 3);
+    check_int("get_tuple_elements_a", 7, MB_GET_SMALLINT(vm.proc->regs[2]));
+    check_int("get_tuple_elements_b", 8, MB_GET_SMALLINT(vm.proc->regs[3]));
+    check_int("term_tests_verified", MB_OK, mb_verify_program(classify_prog, sizeof(classify_prog)));
+
+    (void)run_terms(&vm, eq_exact_prog, sizeof(eq_exact_prog), build_eq, 0);
+    check_int("eq_exact_equal", 1, MB_GET_SMALLINT(vm.proc->regs[2]));
+    (void)run_terms(&vm, eq_exact_prog, sizeof(eq_exact_prog), build_eq, 1);
+    check_int("eq_exact_differs", 0, MB_GET_SMALLINT(vm.proc->regs[2]));
+    (void)run_terms(&vm, eq_exact_prog, sizeof(eq_exact_prog), build_eq, 2);
+    check_int("eq_exact_kinds", 0, MB_GET_SMALLINT(vm.proc->regs[2]));
+    (void)run_terms(&vm, eq_exact_prog, sizeof(eq_exact_prog), build_eq, 3);
+    check_int("eq_exact_arity", 0, MB_GET_SMALLINT(vm.proc->regs[2]));
+    check_int("eq_exact_long_run", MB_OK,
+              run_terms(&vm, eq_exact_prog, sizeof(eq_exact_prog), build_eq, 4));
+    check_int("eq_exact_long", 1, MB_GET_SMALLINT(vm.proc->regs[2]));
+    check_int("eq_exact_deep", MB_STACK_OVERFLOW,
+              run_terms(&vm, eq_exact_prog, sizeof(eq_exact_prog), build_eq, 5));
+
+    /* unpacking checks the shape it was not told to test */
+    check_int("get_tuple_elements_short", MB_BAD_ARITY,
+              run_terms(&vm, unpack, sizeof(unpack), build_classify, 3));
+    check_int("get_tuple_elements_term", MB_BAD_TERM,
+              run_terms(&vm, unpack, sizeof(unpack), build_classify, 2));
+    check_int("test_arity_decode", MB_BAD_ARITY, mb_verify_program(bad_arity, sizeof(bad_arity)));
+    check_int("get_tuple_elements_decode", MB_BAD_REG,
+              mb_verify_program(bad_range, sizeof(bad_range)));
+}
+
+/* ---- pre-decode tests ---- */
+
+static void test_decode_resolves_operands(void) {
+    const mb_code_t *code;
+    /* 0: CONST r3=42   1: JMP -> 3   2: NOP   3: HALT */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 3, I32LE(42),
+        MB_OP_JMP, I32LE(1),
+        MB_OP_NOP,
+        MB_OP_HALT
+    };
+
+    code = mb_code_get(prog, sizeof(prog));
+    check_int("decode_ok", MB_OK, code->verify_status);
+    check_int("decode_count", 4, (int)code->count);
+    check_int("decode_const_reg", 3, code->insns[0].r[0]);
+    check_int("decode_const_tagged", (int)MB_MAKE_SMALLINT(42), (int)code->insns[0].imm);
+    check_int("decode_jmp_target", 3, (int)code->insns[1].imm);
+    check_int("decode_eof_trap", MB_INSN_TRAP, code->insns[4].op);
+    check_int("decode_eof_status", MB_EOF, (int)code->insns[4].imm);
+    check_int("decode_shared", 1, mb_code_get(prog, sizeof(prog)) == code);
+    mb_code_put(code);
+    mb_code_put(code);
+}
+
+static void test_decode_fault_is_lazy(void) {
+    mb_scheduler_t sched;
+    mb_process_t *p;
+    mb_pid_t pid;
+    /* Valid prefix runs before the bad register operand is reached. */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(5),
+        MB_OP_CONST_I32, 77, I32LE(1),
+        MB_OP_HALT
+    };
+
+    mb_sched_init(&sched);
+    pid = mb_sched_spawn(&sched, prog, sizeof(prog));
+    p = mb_sched_proc(&sched, pid);
+
+    check_int("lazy_fault_rc", MB_BAD_REG, mb_sched_tick(&sched));
+    check_int("lazy_fault_prefix_ran", 5, MB_GET_SMALLINT(p->regs[0]));
+    check_int("lazy_fault_pc", 1, (int)p->pc);
+    /* Fault is sticky: the trap does not advance pc. */
+    check_int("lazy_fault_sticky", MB_BAD_REG, mb_proc_step(p, &sched));
+}
+
+static void test_decode_jump_off_boundary(void) {
+    mb_vm_t vm;
+    /* JMP lands inside the CONST_I32 operand bytes */
+    static const uint8_t prog[] = {
+        MB_OP_JMP, I32LE(2),
+        MB_OP_CONST_I32, 0, I32LE(1),
+        MB_OP_HALT
+    };
+
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("jump_off_boundary", MB_EOF, mb_vm_run(&vm, 8));
+}
+
+static void test_decode_long_program(void) {
+    static const uint8_t one[] = {I32LE(1)};
+    static uint8_t prog[7 * 200 + 1];
+    static uint8_t huge[MB_CODE_POOL_WORDS];
+    mb_scheduler_t sched;
+    const mb_code_t *code;
+    mb_process_t *p1, *p2;
+    size_t i, k = 0, in_use = mb_code_pool_in_use();
+
+    /* 200 x ADD_IMM r0, r0, 1, then HALT: the image is sized from the program */
+    for (i = 0; i < 200; i++) {
+        prog[k++] = MB_OP_ADD_IMM;
+        prog[k++] = 0;
+        prog[k++] = 0;
+        memcpy(&prog[k], one, sizeof(one));
+        k += sizeof(one);
+    }
+    prog[k++] = MB_OP_HALT;
+
+    mb_sched_init(&sched);
+    p1 = mb_sched_proc(&sched, mb_sched_spawn(&sched, prog, k));
+    p2 = mb_sched_proc(&sched, mb_sched_spawn(&sched, prog, k));
+    check_int("long_verified", MB_OK, p1->code->verify_status);
+    check_int("long_count", 201, (int)p1->code->count);
+    check_int("long_shared", 1, p1->code == p2->code);
+    for (i = 0; i < 16 && !(p1->halted && p2->halted); i++) {
+        check_int("long_tick", MB_OK, mb_sched_tick(&sched));
+    }
+    check_int("long_r0", 200, MB_GET_SMALLINT(p1->regs[0]));
+    check_int("long_twin_r0", 200, MB_GET_SMALLINT(p2->regs[0]));
+    check_int("long_exit", MB_OK, mb_sched_exit(&sched, p1->pid));
+    check_int("long_kept", 1, mb_code_pool_in_use() > in_use);
+    check_int("long_exit_twin", MB_OK, mb_sched_exit(&sched, p2->pid));
+    check_int("long_released", (int)in_use, (int)mb_code_pool_in_use());
+
+    /* More than the whole store: one trap, nothing taken from the pool */
+    memset(huge, MB_OP_NOP, sizeof(huge));
+    code = mb_code_get(huge, sizeof(huge));
+    check_int("decode_too_large", MB_CODE_TOO_LARGE, code->verify_status);
+    check_int("decode_too_large_trap", MB_CODE_TOO_LARGE, (int)code->insns[0].imm);
+    check_int("decode_too_large_pool", (int)in_use, (int)mb_code_pool_in_use());
+    mb_code_put(code);
+}
+
+static void test_decode_reused_pool(void) {
+    static const uint8_t ones[] = {
+        MB_OP_CONST_I32, 0, I32LE(0x07ffffff),
+        MB_OP_CONST_I32, 1, I32LE(0x07ffffff),
+        MB_OP_CONST_I32, 2, I32LE(0x07ffffff),
+        MB_OP_CONST_I32, 3, I32LE(0x07ffffff)
+    };
+    static const uint8_t bif[] = {
+        MB_OP_CONST_I32, 0, I32LE(2),
+        MB_OP_CONST_I32, 1, I32LE(1),
+        MB_OP_CALL_BIF, MB_BIF_GPIO_WRITE, 2, 0, 1, 2,
+        MB_OP_HALT
+    };
+    const mb_code_t *code;
+    const mb_insn_t *freed;
+
+    /* Same instruction count, so the CALL_BIF image reuses the freed block */
+    code = mb_code_get(ones, sizeof(ones));
+    freed = code->insns;
+    mb_code_put(code);
+    code = mb_code_get(bif, sizeof(bif));
+    check_int("reused_block", 1, code->insns == freed);
+    check_int("reused_verified", MB_OK, code->verify_status);
+    check_int("reused_bif_args", 0x10, (int)code->insns[2].imm);
+    mb_code_put(code);
+}
+
+/* ---- verifier tests ---- */
+
+static void test_verify_accepts_valid(void) {
+    mb_vm_t vm;
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(2),
+        MB_OP_CONST_I32, 1, I32LE(1),
+        MB_OP_CALL_BIF, MB_BIF_GPIO_WRITE, 2, 0, 1, 2,
+        MB_OP_JMP_IF_ZERO, 2, I32LE(0),   /* lands on HALT */
+        MB_OP_HALT
+    };
+
+    check_int("verify_ok", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("verify_ok_flag", MB_OK, vm.proc->code->verify_status);
+    check_int("verify_ok_run", MB_OK, mb_vm_run(&vm, 8));
+    check_int("verify_ok_halted", 1, vm.proc->halted);
+}
+
+static void test_verify_rejects(void) {
+    static const uint8_t bad_op[] = { MB_OP_NOP, 0x7E };
+    static const uint8_t bad_reg[] = { MB_OP_MOVE, 0, 16, 1, MB_OP_HALT };
+    static const uint8_t bad_jump[] = {
+        MB_OP_JMP, I32LE(2),
+        MB_OP_CONST_I32, 0, I32LE(1),
+        MB_OP_HALT
+    };
+    static const uint8_t jump_past_end[] = { MB_OP_JMP, I32LE(1), MB_OP_HALT };
+    static const uint8_t bad_bif[] = { MB_OP_CALL_BIF, 99, 0, 0, MB_OP_HALT };
+    static const uint8_t bad_argc[] = {
+        MB_OP_CALL_BIF, MB_BIF_GPIO_WRITE, 1, 0, 0, MB_OP_HALT
+    };
+    static const uint8_t truncated[] = { MB_OP_CONST_I32, 0, 1 };
+
+    check_int("verify_bad_op", MB_BAD_OPCODE, mb_verify_program(bad_op, sizeof(bad_op)));
+    check_int("verify_bad_reg", MB_BAD_REG, mb_verify_program(bad_reg, sizeof(bad_reg)));
+    check_int("verify_bad_jump", MB_BAD_JUMP, mb_verify_program(bad_jump, sizeof(bad_jump)));
+    check_int("verify_jump_past_end", MB_BAD_JUMP,
+              mb_verify_program(jump_past_end, sizeof(jump_past_end)));
+    check_int("verify_bad_bif", MB_BAD_BIF, mb_verify_program(bad_bif, sizeof(bad_bif)));
+    check_int("verify_bad_argc", MB_BAD_ARGC, mb_verify_program(bad_argc, sizeof(bad_argc)));
+    check_int("verify_truncated", MB_EOF, mb_verify_program(truncated, sizeof(truncated)));
+}
+
+static void test_unverified_keeps_checks(void) {
+    mb_vm_t vm;
+    /* Arity mismatch is still reported at run time on the checked path. */
+    static const uint8_t prog[] = {
+        MB_OP_CALL_BIF, MB_BIF_GPIO_WRITE, 1, 0, 0, MB_OP_HALT
+    };
+
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("unverified_flag", MB_BAD_ARGC, vm.proc->code->verify_status);
+    check_int("unverified_argc", MB_BAD_ARGC, mb_vm_step(&vm));
+}
+
+/* ---- native BIF registration ---- */
+
+#define TEST_BIF_SUM3 20
+
+/* Sum of three non-negative small integers; a stand-in for a checksum. */
+static int test_bif_sum3(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    int32_t a = MB_GET_SMALLINT(args[0]), b = MB_GET_SMALLINT(args[1]);
+    int32_t c = MB_GET_SMALLINT(args[2]);
+    (void)proc;
+    if (a < 0 || b < 0 || c < 0) {
+        return MB_BAD_ARGUMENT;
+    }
+    *result = MB_MAKE_SMALLINT(a + b + c);
+    return MB_OK;
+}
+
+static void test_bif_register(void) {
+    mb_vm_t vm;
+    const mb_bif_entry_t *bif;
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(3),
+        MB_OP_CONST_I32, 1, I32LE(4),
+        MB_OP_CONST_I32, 2, I32LE(5),
+        MB_OP_CALL_BIF, TEST_BIF_SUM3, 3, 0, 1, 2, 3,
+        MB_OP_CONST_I32, 1, I32LE(-1),
+        MB_OP_CALL_BIF, TEST_BIF_SUM3, 3, 0, 1, 2, 4,
+        MB_OP_HALT
+    };
+    static const uint8_t bad_argc[] = {
+        MB_OP_CALL_BIF, TEST_BIF_SUM3, 2, 0, 1, 3, MB_OP_HALT
+    };
+
+    check_int("bif_unregistered", MB_BAD_BIF, mb_verify_program(prog, sizeof(prog)));
+    check_int("bif_register", MB_OK,
+              mb_bif_register(TEST_BIF_SUM3, "sum3", 3, 5, test_bif_sum3));
+    check_int("bif_register_dup", MB_BAD_BIF,
+              mb_bif_register(TEST_BIF_SUM3, "sum3", 3, 5, test_bif_sum3));
+    check_int("bif_register_builtin", MB_BAD_BIF,
+              mb_bif_register(MB_BIF_GPIO_WRITE, "gw", 2, 1, test_bif_sum3));
+    check_int("bif_register_zero", MB_BAD_BIF, mb_bif_register(0, "z", 0, 1, test_bif_sum3));
+    check_int("bif_register_range", MB_BAD_BIF,
+              mb_bif_register(MB_BIF_MAX, "r", 0, 1, test_bif_sum3));
+    check_int("bif_register_arity", MB_BAD_ARGC,
+              mb_bif_register(TEST_BIF_SUM3 + 1, "a", MB_BIF_MAX_ARITY + 1, 1, test_bif_sum3));
+    check_int("bif_register_cost", MB_BAD_ARGUMENT,
+              mb_bif_register(TEST_BIF_SUM3 + 1, "c", 0, 0, test_bif_sum3));
+    check_int("bif_register_null", MB_BAD_ARGUMENT,
+              mb_bif_register(TEST_BIF_SUM3 + 1, "n", 0, 1, NULL));
+    check_int("bif_lookup_free", 1, mb_bif_lookup(TEST_BIF_SUM3 + 1) == NULL);
+    bif = mb_bif_lookup(TEST_BIF_SUM3);
+    check_int("bif_lookup", 1, bif != NULL && strcmp(bif->name, "sum3") == 0);
+
+    /* Arity is checked at load time against the table. */
+    check_int("bif_verify", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    check_int("bif_verify_argc", MB_BAD_ARGC, mb_verify_program(bad_argc, sizeof(bad_argc)));
+
+    /* The call costs 5 reductions, so a budget of 4 ends after it. */
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("bif_slice", MB_OK, mb_vm_run(&vm, 4));
+    check_int("bif_result", 12, MB_GET_SMALLINT(vm.proc->regs[3]));
+    check_int("bif_reductions", 3 + 5, (int)vm.proc->reductions);
+    check_int("bif_pc", 4, (int)vm.proc->pc);
+
+    /* A native's error faults the caller and leaves dst alone. */
+    check_int("bif_fault", MB_BAD_ARGUMENT, mb_vm_run(&vm, 64));
+    check_int("bif_fault_dst", 0, (int)vm.proc->regs[4]);
+}
+
+#define TEST_BIF_SUM_TO 21
+
+/* 1 + 2 + ... + n, one reduction per term; traps when the slice is spent.
+ * bif_state[0] = next term, bif_state[1] = partial sum. */
+static int test_bif_sum_to(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    int32_t n = MB_GET_SMALLINT(args[0]);
+    uint32_t *st = proc->bif_state;
+
+    if (st[0] == 0) {
+        st[0] = 1;
+    }
+    while ((int32_t)st[0] <= n) {
+        if (!mb_bif_consume(proc, 1)) {
+            return MB_BIF_TRAP;
+        }
+        st[1] += st[0]++;
+    }
+    *result = MB_MAKE_SMALLINT((int32_t)st[1]);
+    return MB_OK;
+}
+
+static void test_bif_trap(void) {
+    mb_scheduler_t sched;
+    mb_process_t *pa, *pb;
+    mb_pid_t a;
+    int ticks = 0, slices = 0;
+    uint32_t max_red = 0;
+    static const uint8_t sum_prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(200),
+        MB_OP_CALL_BIF, TEST_BIF_SUM_TO, 1, 0, 1,
+        MB_OP_CALL_BIF, TEST_BIF_SUM_TO, 1, 0, 2,   /* a second call starts afresh */
+        MB_OP_HALT
+    };
+    static const uint8_t spin_prog[] = {
+        MB_OP_ADD_IMM, 0, 0, I32LE(1),
+        MB_OP_JMP, I32LE(-12)
+    };
+
+    check_int("trap_register", MB_OK,
+              mb_bif_register(TEST_BIF_SUM_TO, "sum_to", 1, 1, test_bif_sum_to));
+    mb_sched_init(&sched);
+    a = mb_sched_spawn(&sched, sum_prog, sizeof(sum_prog));
+    mb_sched_spawn(&sched, spin_prog, sizeof(spin_prog));
+    pa = mb_sched_proc(&sched, a);
+    pb = mb_sched_proc(&sched, (mb_pid_t)(a + 1));
+    check_int("trap_verified", MB_OK, pa->code->verify_status);
+
+    /* The first slice runs CONST and 63 terms, then traps on the CALL_BIF. */
+    check_int("trap_tick", MB_OK, mb_sched_tick(&sched));
+    check_int("trap_ready", MB_PROC_READY, pa->state);
+    check_int("trap_pc", 1, (int)pa->pc);
+    check_int("trap_flag", 1, pa->bif_trapped);
+    check_int("trap_state", 64, (int)pa->bif_state[0]);
+    check_int("trap_reds", MB_REDUCTIONS, (int)pa->reductions);
+
+    while (pa->state != MB_PROC_HALTED && ticks < 100) {
+        check_int("trap_tick", MB_OK, mb_sched_tick(&sched));
+        if (pa->reductions > max_red) {
+            max_red = pa->reductions;
+        }
+        slices += (pa->reductions != 0);
+        pa->reductions = 0;
+        ticks++;
+    }
+    check_int("trap_done", MB_PROC_HALTED, pa->state);
+    check_int("trap_result", 20100, MB_GET_SMALLINT(pa->regs[1]));
+    check_int("trap_result2", 20100, MB_GET_SMALLINT(pa->regs[2]));
+    check_int("trap_cleared", 0, (int)(pa->bif_trapped | pa->bif_state[0] | pa->bif_state[1]));
+    /* Native work is held to the slice budget and other processes run. */
+    check_int("trap_budget", 1, max_red <= MB_REDUCTIONS);
+    check_int("trap_slices", 1, slices >= 6);
+    check_int("trap_fair", 1, MB_GET_SMALLINT(pb->regs[0]) >= 6 * (MB_REDUCTIONS / 2));
+}
+
+/* ---- compat handle tests ---- */
+
+static void test_vm_heap_persists(void) {
+    mb_vm_t vm;
+    /* Tuple built in one step must survive to be read in the next. */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(11),
+        MB_OP_CONST_I32, 1, I32LE(22),
+        MB_OP_MAKE_TUPLE, 2, 2, 0, 1,
+        MB_OP_TUPLE_ELEM, 3, 2, 1,
+        MB_OP_HALT
+    };
+    int i;
+
+    mb_vm_init(&vm, prog, sizeof(prog));
+    for (i = 0; i < 5; i++) {
+        check_int("vm_persist_step", MB_OK, mb_vm_step(&vm));
+    }
+    check_int("vm_persist_halted", 1, vm.proc->halted);
+    check_int("vm_persist_elem", 22, MB_GET_SMALLINT(vm.proc->regs[3]));
+    check_int("vm_persist_hp", 3, (int)vm.proc->heap.hp);
+}
+
+static void test_vm_attach_sched_proc(void) {
+    mb_scheduler_t sched;
+    mb_vm_t vm;
+    mb_process_t *p;
+    mb_command_t cmd = {0};
+    static const uint8_t prog[] = {
+        MB_OP_RECV_CMD, 0, 1, 2, 3, 4,
+        MB_OP_HALT
+    };
+
+    mb_sched_init(&sched);
+    p = mb_sched_proc(&sched, mb_sched_spawn(&sched, prog, sizeof(prog)));
+    mb_vm_init(&vm, NULL, 0);
+    mb_vm_attach(&vm, p);
+
+    cmd.type = MB_CMD_GPIO_READ;
+    cmd.a = 4;
+    check_int("vm_attach_push", MB_OK, mb_vm_mailbox_push(&vm, cmd));
+    check_int("vm_attach_mailbox", 1, (int)p->mailbox.count);
+    check_int("vm_attach_run", MB_OK, mb_vm_run(&vm, 8));
+    check_int("vm_attach_pin", 4, MB_GET_SMALLINT(p->regs[1]));
+    check_int("vm_attach_halted", MB_PROC_HALTED, p->state);
+    check_int("vm_attach_pid_kept", 1, p->pid);
+}
+
+/* ---- superinstruction tests ---- */
+
+static void test_super_sensor_actuator(void) {
+    mb_scheduler_t sched;
+    mb_process_t *ps, *pa;
+    int i;
+    /* Flow-compiler shaped loops: stub i2c value = 0x39 ^ 0x12 ^ 1 = 42 */
+    static const uint8_t sensor[] = {
+        MB_OP_CONST_I32, 0, I32LE(1),
+        MB_OP_CONST_I32, 1, I32LE(0x39),
+        MB_OP_CONST_I32, 2, I32LE(0x12),
+        MB_OP_CONST_I32, 3, I32LE(2),
+        MB_OP_CONST_I32, 4, I32LE(MB_CMD_PWM_SET_DUTY),
+        MB_OP_CONST_I32, 5, I32LE(0),
+        MB_OP_CONST_I32, 6, I32LE(0),
+        MB_OP_CONST_I32, 8, I32LE(0),
+        MB_OP_I2C_SAMPLE, 0, 1, 2, 7, 9,
+        MB_OP_SEND_WAIT, 3, 4, 5, 7, 8, 8, 6, I32LE(-18)
+    };
+    static const uint8_t actuator[] = {
+        MB_OP_RECV_PWM, 0, 1, 2, 3, 4, 5, I32LE(-11)
+    };
+
+    check_int("super_sensor_verified", MB_OK, mb_verify_program(sensor, sizeof(sensor)));
+    check_int("super_actuator_verified", MB_OK, mb_verify_program(actuator, sizeof(actuator)));
+
+    mb_sched_init(&sched);
+    ps = mb_sched_proc(&sched, mb_sched_spawn(&sched, sensor, sizeof(sensor)));
+    pa = mb_sched_proc(&sched, mb_sched_spawn(&sched, actuator, sizeof(actuator)));
+    pa->regs[5] = MB_MAKE_SMALLINT(99);
+
+    for (i = 0; i < 8; i++) {
+        check_int("super_tick", MB_OK, mb_sched_tick(&sched));
+    }
+
+    /* Sensor loops on I2C_SAMPLE (index 8) / SEND_WAIT; pid register kept. */
+    check_int("super_sensor_pc", 8, (int)ps->pc);
+    check_int("super_sensor_pid_kept", 2, MB_GET_SMALLINT(ps->regs[3]));
+    check_int("super_sensor_value", 42, MB_GET_SMALLINT(ps->regs[7]));
+    /* I2C_SAMPLE and SEND_WAIT each cost one, even though SEND_WAIT ends the slice */
+    check_int("super_sensor_reductions", 2, (int)ps->reductions);
+    check_int("super_actuator_type", MB_CMD_PWM_SET_DUTY, MB_GET_SMALLINT(pa->regs[0]));
+    check_int("super_actuator_duty", 42, MB_GET_SMALLINT(pa->regs[2]));
+    check_int("super_actuator_rc", 0, MB_GET_SMALLINT(pa->regs[5]));
+    check_int("super_actuator_waiting", MB_PROC_WAITING, pa->state);
+    check_int("super_actuator_pc", 0, (int)pa->pc);
+}
+
+static void test_super_recv_pwm_other_cmd(void) {
+    mb_vm_t vm;
+    mb_command_t cmd = {0};
+    static const uint8_t prog[] = {
+        MB_OP_RECV_PWM, 0, 1, 2, 3, 4, 5, I32LE(0),
+        MB_OP_HALT
+    };
+
+    mb_vm_init(&vm, prog, sizeof(prog));
+    cmd.type = MB_CMD_GPIO_READ;
+    cmd.a = 3;
+    check_int("recv_pwm_push", MB_OK, mb_vm_mailbox_push(&vm, cmd));
+    check_int("recv_pwm_run", MB_OK, mb_vm_run(&vm, 4));
+    check_int("recv_pwm_type", MB_CMD_GPIO_READ, MB_GET_SMALLINT(vm.proc->regs[0]));
+    check_int("recv_pwm_skipped", MB_INVALID_COMMAND, MB_GET_SMALLINT(vm.proc->regs[5]));
+    check_int("recv_pwm_halted", 1, vm.proc->halted);
+}
+
+/* ---- immediate / compare-and-branch tests ---- */
+
+static void test_imm_and_branches(void) {
+    mb_vm_t vm;
+    /* Taken branches skip an r9 error bump; fall-throughs count in r10. */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(5),
+        MB_OP_CONST_I32, 1, I32LE(7),
+        MB_OP_ADD_IMM, 2, 0, I32LE(10),          /* r2 = 15 */
+        MB_OP_SUB_IMM, 3, 1, I32LE(9),           /* r3 = -2 */
+        MB_OP_JMP_LT, 0, 1, I32LE(7),
+        MB_OP_ADD_IMM, 9, 9, I32LE(1),
+        MB_OP_JMP_GE, 0, 1, I32LE(7),
+        MB_OP_ADD_IMM, 10, 10, I32LE(1),
+        MB_OP_JMP_EQ_IMM, 2, I32LE(15), I32LE(7),
+        MB_OP_ADD_IMM, 9, 9, I32LE(1),
+        MB_OP_JMP_NE_IMM, 2, I32LE(15), I32LE(7),
+        MB_OP_ADD_IMM, 10, 10, I32LE(1),
+        MB_OP_JMP_LT_IMM, 3, I32LE(-1), I32LE(7),
+        MB_OP_ADD_IMM, 9, 9, I32LE(1),
+        MB_OP_JMP_GE_IMM, 3, I32LE(-1), I32LE(7),
+        MB_OP_ADD_IMM, 10, 10, I32LE(1),
+        MB_OP_JMP_NE, 0, 1, I32LE(7),
+        MB_OP_ADD_IMM, 9, 9, I32LE(1),
+        MB_OP_JMP_EQ, 0, 1, I32LE(7),
+        MB_OP_ADD_IMM, 10, 10, I32LE(1),
+        MB_OP_CONST_I32, 4, I32LE(3),
+        MB_OP_ADD_IMM, 5, 5, I32LE(2),           /* loop body */
+        MB_OP_DJNZ, 4, I32LE(-13),
+        MB_OP_HALT
+    };
+
+    check_int("imm_verified", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("imm_run", MB_OK, mb_vm_run(&vm, 64));
+    check_int("imm_halted", 1, vm.proc->halted);
+    check_int("imm_add", 15, MB_GET_SMALLINT(vm.proc->regs[2]));
+    check_int("imm_sub", -2, MB_GET_SMALLINT(vm.proc->regs[3]));
+    check_int("imm_taken", 0, MB_GET_SMALLINT(vm.proc->regs[9]));
+    check_int("imm_not_taken", 4, MB_GET_SMALLINT(vm.proc->regs[10]));
+    check_int("djnz_counter", 0, MB_GET_SMALLINT(vm.proc->regs[4]));
+    check_int("djnz_body", 6, MB_GET_SMALLINT(vm.proc->regs[5]));
+}
+
+static void test_imm_wraps(void) {
+    mb_vm_t vm;
+    /* Immediates outside the small-integer range wrap modulo 2^28, as ADD does. */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(MB_SMALLINT_MAX),
+        MB_OP_CONST_I32, 2, I32LE(-1),
+        MB_OP_CONST_I32, 4, I32LE(MB_SMALLINT_MIN),
+        MB_OP_ADD_IMM, 1, 0, I32LE(0x7FFFFFFF),  /* 2^31 - 1 = -1 mod 2^28 */
+        MB_OP_ADD, 3, 0, 2,
+        MB_OP_SUB_IMM, 5, 4, I32LE(0x7FFFFFFF),
+        MB_OP_ADD_IMM, 6, 0, I32LE(0x08000000),  /* MAX + 2^27 = 2^28 - 1 = -1 */
+        MB_OP_HALT
+    };
+
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("imm_wrap_run", MB_OK, mb_vm_run(&vm, 16));
+    check_int("imm_wrap_add", MB_SMALLINT_MAX - 1, MB_GET_SMALLINT(vm.proc->regs[1]));
+    check_int("imm_wrap_as_add", (int)vm.proc->regs[3], (int)vm.proc->regs[1]);
+    check_int("imm_wrap_sub", MB_SMALLINT_MIN + 1, MB_GET_SMALLINT(vm.proc->regs[5]));
+    check_int("imm_wrap_past_max", -1, MB_GET_SMALLINT(vm.proc->regs[6]));
+}
+
+/* ---- multi-way branch tests ---- */
+
+/* Run prog with the CONST_I32 at offset 0 loading value into r0; return r1. */
+static int32_t run_dispatch(const uint8_t *prog, size_t size, int32_t value) {
+    static uint8_t buf[128];
+    mb_vm_t vm;
+
+    memcpy(buf, prog, size);
+    buf[2] = (uint8_t)(value & 0xff);
+    buf[3] = (uint8_t)((value >> 8) & 0xff);
+    buf[4] = (uint8_t)((value >> 16) & 0xff);
+    buf[5] = (uint8_t)((value >> 24) & 0xff);
+    mb_vm_init(&vm, buf, size);
+    (void)mb_vm_run(&vm, 16);
+    return MB_GET_SMALLINT(vm.proc->regs[1]);
+}
+
+static void test_select_val(void) {
+    /* Unsorted values, a negative one, and a duplicate 3 (first wins). */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(0),
+        MB_OP_SELECT_VAL, 0, 5, I32LE(0),
+        I32LE(6), I32LE(7),
+        I32LE(1), I32LE(14),
+        I32LE(3), I32LE(21),
+        I32LE(-2), I32LE(28),
+        I32LE(3), I32LE(0),
+        MB_OP_CONST_I32, 1, I32LE(10), MB_OP_HALT,   /* fail */
+        MB_OP_CONST_I32, 1, I32LE(11), MB_OP_HALT,
+        MB_OP_CONST_I32, 1, I32LE(12), MB_OP_HALT,
+        MB_OP_CONST_I32, 1, I32LE(13), MB_OP_HALT,
+        MB_OP_CONST_I32, 1, I32LE(14), MB_OP_HALT
+    };
+
+    check_int("select_verified", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    check_int("select_6", 11, run_dispatch(prog, sizeof(prog), 6));
+    check_int("select_1", 12, run_dispatch(prog, sizeof(prog), 1));
+    check_int("select_3_first_wins", 13, run_dispatch(prog, sizeof(prog), 3));
+    check_int("select_neg", 14, run_dispatch(prog, sizeof(prog), -2));
+    check_int("select_miss_0", 10, run_dispatch(prog, sizeof(prog), 0));
+    check_int("select_miss_99", 10, run_dispatch(prog, sizeof(prog), 99));
+}
+
+static void test_jump_table(void) {
+    /* base 1: 1 -> 11, 2 -> hole (fail), 3 -> 12 */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(0),
+        MB_OP_JUMP_TABLE, 0, 3, I32LE(1), I32LE(0),
+        I32LE(7), I32LE(0), I32LE(14),
+        MB_OP_CONST_I32, 1, I32LE(10), MB_OP_HALT,   /* fail */
+        MB_OP_CONST_I32, 1, I32LE(11), MB_OP_HALT,
+        MB_OP_CONST_I32, 1, I32LE(12), MB_OP_HALT
+    };
+    mb_vm_t vm;
+
+    check_int("jtab_verified", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    check_int("jtab_1", 11, run_dispatch(prog, sizeof(prog), 1));
+    check_int("jtab_hole", 10, run_dispatch(prog, sizeof(prog), 2));
+    check_int("jtab_3", 12, run_dispatch(prog, sizeof(prog), 3));
+    check_int("jtab_below", 10, run_dispatch(prog, sizeof(prog), 0));
+    check_int("jtab_above", 10, run_dispatch(prog, sizeof(prog), 4));
+    check_int("jtab_neg", 10, run_dispatch(prog, sizeof(prog), -5));
+
+    /* A non-integer term takes the fail branch (SELF writes a pid). */
+    {
+        static uint8_t pid_prog[sizeof(prog)];
+        memcpy(pid_prog, prog, sizeof(prog));
+        pid_prog[0] = MB_OP_SELF;
+        pid_prog[1] = 0;
+        pid_prog[2] = MB_OP_NOP;
+        pid_prog[3] = MB_OP_NOP;
+        pid_prog[4] = MB_OP_NOP;
+        pid_prog[5] = MB_OP_NOP;
+        mb_vm_init(&vm, pid_prog, sizeof(pid_prog));
+        (void)mb_vm_run(&vm, 16);
+        check_int("jtab_non_int", 10, MB_GET_SMALLINT(vm.proc->regs[1]));
+    }
+}
+
+static void test_case_tables_verify(void) {
+    /* Case offset lands inside the CONST_I32 that follows. */
+    static const uint8_t mid_insn[] = {
+        MB_OP_SELECT_VAL, 0, 1, I32LE(0), I32LE(1), I32LE(2),
+        MB_OP_CONST_I32, 0, I32LE(1),
+        MB_OP_HALT
+    };
+    static const uint8_t truncated[] = {
+        MB_OP_JUMP_TABLE, 0, 2, I32LE(0), I32LE(0), I32LE(0)
+    };
+    uint8_t big[2 * (11 + 4 * 200) + 1];
+    size_t i, k = 0;
+
+    check_int("cases_bad_jump", MB_BAD_JUMP, mb_verify_program(mid_insn, sizeof(mid_insn)));
+    check_int("cases_truncated", MB_EOF, mb_verify_program(truncated, sizeof(truncated)));
+
+    /* Two 200-entry tables exceed MB_CODE_MAX_CASES (255). */
+    for (i = 0; i < 2; i++) {
+        size_t j;
+        big[k++] = MB_OP_JUMP_TABLE;
+        big[k++] = 0;
+        big[k++] = 200;
+        for (j = 0; j < 8 + 4 * 200; j++) {
+            big[k++] = 0;  /* base 0, fail and every case fall through */
+        }
+    }
+    big[k++] = MB_OP_HALT;
+    check_int("cases_too_many", MB_CODE_TOO_LARGE, mb_verify_program(big, k));
+}
+
+/* ---- lookup table tests ---- */
+
+static void test_lut(void) {
+    /* r1 = gamma[r0 >> 2] on 8-bit entries, interpolated */
+    static const uint8_t gamma[] = {
+        MB_OP_CONST_I32, 0, I32LE(0),
+        MB_OP_LUT, 1, 0, MB_LUT_W8 | MB_LUT_LERP, 2, 5, 0, 0, 10, 40, 90, 160,
+        MB_OP_HALT
+    };
+    static const uint8_t steps[] = {
+        MB_OP_CONST_I32, 0, I32LE(0),
+        MB_OP_LUT, 1, 0, MB_LUT_W8, 2, 5, 0, 0, 10, 40, 90, 160,
+        MB_OP_HALT
+    };
+    static const uint8_t signed16[] = {
+        MB_OP_CONST_I32, 0, I32LE(0),
+        MB_OP_LUT, 1, 0, MB_LUT_W16 | MB_LUT_SIGNED | MB_LUT_LERP, 4, 3, 0,
+        0x9C, 0xFF, 0x00, 0x00, 0x64, 0x00,  /* -100, 0, 100 */
+        MB_OP_HALT
+    };
+    static const uint8_t wide32[] = {
+        MB_OP_CONST_I32, 0, I32LE(0),
+        MB_OP_LUT, 1, 0, MB_LUT_W32, 0, 2, 0, I32LE(-7), I32LE(0x7FFFFFFF),
+        MB_OP_HALT
+    };
+    static const uint8_t bad_mode[] = { MB_OP_LUT, 1, 0, 3, 0, 1, 0, 0, MB_OP_HALT };
+    static const uint8_t bad_shift[] = { MB_OP_LUT, 1, 0, 0, 17, 1, 0, 0, MB_OP_HALT };
+    static const uint8_t empty[] = { MB_OP_LUT, 1, 0, 0, 0, 0, 0, MB_OP_HALT };
+    static const uint8_t short_table[] = { MB_OP_LUT, 1, 0, MB_LUT_W16, 0, 2, 0, 1, 2, 3 };
+    static const uint8_t bad_reg[] = { MB_OP_LUT, 16, 0, 0, 0, 1, 0, 0, MB_OP_HALT };
+
+    check_int("lut_first", 0, run_dispatch(gamma, sizeof(gamma), 0));
+    check_int("lut_exact", 40, run_dispatch(gamma, sizeof(gamma), 8));
+    check_int("lut_lerp", 17, run_dispatch(gamma, sizeof(gamma), 5));
+    check_int("lut_lerp_last", 142, run_dispatch(gamma, sizeof(gamma), 15));
+    check_int("lut_clamp_high", 160, run_dispatch(gamma, sizeof(gamma), 1000));
+    check_int("lut_clamp_low", 0, run_dispatch(gamma, sizeof(gamma), -3));
+    check_int("lut_steps", 10, run_dispatch(steps, sizeof(steps), 7));
+    check_int("lut_signed", -100, run_dispatch(signed16, sizeof(signed16), 0));
+    check_int("lut_signed_lerp", -25, run_dispatch(signed16, sizeof(signed16), 12));
+    check_int("lut_signed_mid", 50, run_dispatch(signed16, sizeof(signed16), 24));
+    check_int("lut_w32", -7, run_dispatch(wide32, sizeof(wide32), 0));
+    check_int("lut_w32_saturates", MB_SMALLINT_MAX, run_dispatch(wide32, sizeof(wide32), 1));
+    check_int("lut_verified", MB_OK, mb_verify_program(gamma, sizeof(gamma)));
+
+    check_int("lut_bad_mode", MB_BAD_ARGUMENT, mb_verify_program(bad_mode, sizeof(bad_mode)));
+    check_int("lut_bad_shift", MB_BAD_ARGUMENT, mb_verify_program(bad_shift, sizeof(bad_shift)));
+    check_int("lut_empty", MB_BAD_ARGUMENT, mb_verify_program(empty, sizeof(empty)));
+    check_int("lut_truncated", MB_EOF, mb_verify_program(short_table, sizeof(short_table)));
+    check_int("lut_bad_reg", MB_BAD_REG, mb_verify_program(bad_reg, sizeof(bad_reg)));
+}
+
+/* ---- compact encoding tests ---- */
+
+static void test_compact_encoding(void) {
+    mb_vm_t vm;
+    /* Same checks as test_imm_and_branches, in varints and short jumps. */
+    static const uint8_t prog[] = {
+        MB_CODE_COMPACT_MAGIC, 1, I32LE(100000000),
+        MB_OP_CONST_I32, 6, 0xCF, 0x0F,          /* r6 = -1000 (zigzag 1999) */
+        MB_OP_CONST_I32, 0, 0x0A,                /* r0 = 5 */
+        MB_OP_CONST_LIT, 1, 0,                   /* r1 = literal 0 */
+        MB_OP_ADD_IMM, 2, 0, 0x05,               /* r2 = r0 - 3 */
+        MB_OP_CONST_I32, 4, 0x06,                /* r4 = 3 */
+        MB_OP_ADD_IMM, 5, 5, 0x04,               /* loop: r5 += 2 */
+        MB_OP_DJNZ, 4, 0xF9,                     /* -7 */
+        MB_OP_WIDE, MB_OP_JMP_IF_ZERO, 4, 0x04, 0x00,
+        MB_OP_ADD_IMM, 9, 9, 0x02,
+        MB_OP_JMP_EQ_IMM, 2, 0x04, 0x04,
+        MB_OP_ADD_IMM, 9, 9, 0x02,
+        MB_OP_JUMP_TABLE, 2, 2, 0x02, 0x00, 0x00, 0x04,
+        MB_OP_ADD_IMM, 9, 9, 0x02,
+        MB_OP_HALT
+    };
+
+    check_int("compact_verified", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("compact_insns", 14, vm.proc->code->count);
+    check_int("compact_run", MB_OK, mb_vm_run(&vm, 64));
+    check_int("compact_halted", 1, vm.proc->halted);
+    check_int("compact_neg_varint", -1000, MB_GET_SMALLINT(vm.proc->regs[6]));
+    check_int("compact_literal", 100000000, MB_GET_SMALLINT(vm.proc->regs[1]));
+    check_int("compact_add_imm", 2, MB_GET_SMALLINT(vm.proc->regs[2]));
+    check_int("compact_djnz_body", 6, MB_GET_SMALLINT(vm.proc->regs[5]));
+    check_int("compact_taken", 0, MB_GET_SMALLINT(vm.proc->regs[9]));
+}
+
+static void test_compact_rejects(void) {
+    static const uint8_t lit_in_v1[] = { MB_OP_CONST_LIT, 0, 0, MB_OP_HALT };
+    static const uint8_t lit_range[] = {
+        MB_CODE_COMPACT_MAGIC, 1, I32LE(7), MB_OP_CONST_LIT, 0, 1, MB_OP_HALT
+    };
+    static const uint8_t wide_non_jump[] = {
+        MB_CODE_COMPACT_MAGIC, 0, MB_OP_WIDE, MB_OP_MOVE, 0, 1, 0, MB_OP_HALT
+    };
+    static const uint8_t short_truncated[] = {
+        MB_CODE_COMPACT_MAGIC, 0, MB_OP_WIDE, MB_OP_JMP, 0x00
+    };
+    static const uint8_t pool_truncated[] = { MB_CODE_COMPACT_MAGIC, 2, I32LE(7) };
+    static const uint8_t mid_insn[] = {
+        MB_CODE_COMPACT_MAGIC, 0, MB_OP_JMP, 0x01, MB_OP_CONST_I32, 0, 0x02, MB_OP_HALT
+    };
+    static const uint8_t into_pool[] = {
+        MB_CODE_COMPACT_MAGIC, 1, I32LE(7), MB_OP_JMP, 0xFB, MB_OP_HALT
+    };
+
+    check_int("compact_lit_in_v1", MB_BAD_OPCODE, mb_verify_program(lit_in_v1, sizeof(lit_in_v1)));
+    check_int("compact_lit_range", MB_BAD_ARGUMENT, mb_verify_program(lit_range, sizeof(lit_range)));
+    check_int("compact_wide_non_jump", MB_BAD_OPCODE,
+              mb_verify_program(wide_non_jump, sizeof(wide_non_jump)));
+    check_int("compact_short_truncated", MB_EOF,
+              mb_verify_program(short_truncated, sizeof(short_truncated)));
+    check_int("compact_pool_truncated", MB_EOF,
+              mb_verify_program(pool_truncated, sizeof(pool_truncated)));
+    check_int("compact_mid_insn", MB_BAD_JUMP, mb_verify_program(mid_insn, sizeof(mid_insn)));
+    check_int("compact_into_pool", MB_BAD_JUMP, mb_verify_program(into_pool, sizeof(into_pool)));
+}
+
+/* ---- module tests ---- */
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void seal_module(uint8_t *m) {
+    uint32_t size = (uint32_t)m[8] | ((uint32_t)m[9] << 8) |
+                    ((uint32_t)m[10] << 16) | ((uint32_t)m[11] << 24);
+    put_u32(m + 12, mb_module_crc32(m + 16, size - 16));
+}
+
+/*
+ * The generated Zephyr flow as a module: sensors sharing one program with
+ * their spawn arguments, then the actuator (no arguments).
+ */
+static size_t build_flow_module(uint8_t *m) {
+    uint32_t n = OS2_FLOW_PROCESS_COUNT;
+    uint32_t sensor_size = sizeof(os2_flow_sensor_prog);
+    uint32_t pos = MB_MODULE_HEADER_SIZE + n * MB_MODULE_ENTRY_SIZE, code;
+    uint32_t i, k;
+
+    memset(m, 0, MB_MODULE_HEADER_SIZE);
+    put_u32(m, MB_MODULE_MAGIC);
+    m[4] = MB_MODULE_VERSION;
+    m[6] = MB_MODULE_F_ARGS;
+    m[16] = 10;
+    m[17] = (uint8_t)n;
+    m[18] = OS2_FLOW_MAILBOX_DEPTH;
+    for (i = 0; i < n; i++) {
+        int sensor = i + 1 < n;
+        put_u32(m + MB_MODULE_HEADER_SIZE + i * 8, sensor ? 0 : sensor_size);
+        put_u32(m + MB_MODULE_HEADER_SIZE + i * 8 + 4,
+                sensor ? sensor_size : (uint32_t)sizeof(os2_flow_actuator_prog));
+        put_u32(m + pos, sensor ? OS2_FLOW_SENSOR_ARGC : 0);
+        pos += 4;
+        for (k = 0; sensor && k < OS2_FLOW_SENSOR_ARGC; k++, pos += 4) {
+            put_u32(m + pos, (uint32_t)MB_GET_SMALLINT(os2_flow_sensor_args[i][k]));
+        }
+    }
+    code = pos;
+    memcpy(m + code, os2_flow_sensor_prog, sensor_size);
+    memcpy(m + code + sensor_size, os2_flow_actuator_prog, sizeof(os2_flow_actuator_prog));
+    put_u32(m + 24, code);
+    put_u32(m + 28, sensor_size + (uint32_t)sizeof(os2_flow_actuator_prog));
+    put_u32(m + 8, code + sensor_size + (uint32_t)sizeof(os2_flow_actuator_prog));
+    seal_module(m);
+    return code + sensor_size + sizeof(os2_flow_actuator_prog);
+}
+
+static void test_module_load(void) {
+    static uint8_t m[512];
+    static mb_scheduler_t sched;
+    static const uint8_t check[] = "123456789";
+    mb_module_t mod;
+    const uint8_t *prog;
+    size_t size, len;
+    mb_term_t args[MB_REG_COUNT];
+    uint8_t argc;
+    mb_process_t *pa;
+    int t;
+
+    check_int("module_crc32", 1, mb_module_crc32(check, 9) == 0xCBF43926U);
+
+    size = build_flow_module(m);
+    /* the buffer may be larger than the module (a flash partition) */
+    check_int("module_load", MB_OK, mb_module_load(&mod, m, sizeof(m)));
+    check_int("module_entries", OS2_FLOW_PROCESS_COUNT, mod.entry_count);
+    check_int("module_size", (int)size, (int)mod.size);
+    check_int("module_regs", 10, mod.reg_count);
+    check_int("module_entry", MB_OK, mb_module_entry(&mod, 1, &prog, &len));
+    check_int("module_in_place", 1, mod.code == m + m[24] && prog == mod.code);
+    check_int("module_entry_size", (int)sizeof(os2_flow_sensor_prog), (int)len);
+    check_int("module_entry_range", MB_BAD_ARGUMENT,
+              mb_module_entry(&mod, OS2_FLOW_PROCESS_COUNT, &prog, &len));
+    check_int("module_args", MB_OK, mb_module_entry_args(&mod, 1, args, &argc));
+    check_int("module_argc", OS2_FLOW_SENSOR_ARGC, argc);
+    check_int("module_args_addr", 1, args[1] == os2_flow_sensor_args[1][1]);
+    check_int("module_args_actuator", MB_OK,
+              mb_module_entry_args(&mod, OS2_FLOW_PROCESS_COUNT - 1, args, &argc));
+    check_int("module_argc_actuator", 0, argc);
+
+    mb_sched_init(&sched);
+    check_int("module_spawn", MB_OK, mb_module_spawn_all(&mod, &sched));
+    check_int("module_spawn_in_place", 1, sched.procs[0].program == mod.code);
+    check_int("module_spawn_args", 1,
+              sched.procs[2].regs[3] == os2_flow_sensor_args[2][3]);
+    for (t = 0; t < 32; t++) {
+        (void)mb_sched_tick(&sched);
+    }
+    pa = mb_sched_proc(&sched, OS2_FLOW_PROCESS_COUNT);
+    check_int("module_actuator_cmd", MB_CMD_PWM_SET_DUTY, MB_GET_SMALLINT(pa->regs[0]));
+    check_int("module_actuator_rc", MB_OK, MB_GET_SMALLINT(pa->regs[5]));
+    check_int("module_spawn_full", MB_PROC_TABLE_FULL, mb_module_spawn_all(&mod, &sched));
+}
+
+static void test_module_rejects(void) {
+    static uint8_t m[512];
+    mb_module_t mod;
+    size_t size = build_flow_module(m);
+
+    check_int("module_short", MB_BAD_MODULE, mb_module_load(&mod, m, 16));
+    check_int("module_truncated", MB_BAD_MODULE, mb_module_load(&mod, m, size - 1));
+
+    m[0] ^= 1;
+    check_int("module_magic", MB_BAD_MODULE, mb_module_load(&mod, m, size));
+    size = build_flow_module(m);
+    m[4] = MB_MODULE_VERSION + 1;
+    seal_module(m);
+    check_int("module_version", MB_BAD_MODULE, mb_module_load(&mod, m, size));
+
+    size = build_flow_module(m);
+    m[size - 1] ^= 0x40;
+    check_int("module_crc", MB_BAD_CRC, mb_module_load(&mod, m, size));
+
+    /* declared needs beyond this firmware */
+    size = build_flow_module(m);
+    m[16] = MB_REG_COUNT + 1;
+    seal_module(m);
+    check_int("module_regs_need", MB_BAD_MODULE, mb_module_load(&mod, m, size));
+    size = build_flow_module(m);
+    put_u32(m + 20, MB_HEAP_MAX_WORDS + 1);
+    seal_module(m);
+    check_int("module_heap_need", MB_BAD_MODULE, mb_module_load(&mod, m, size));
+
+    /* entry past the code section */
+    size = build_flow_module(m);
+    put_u32(m + MB_MODULE_HEADER_SIZE + 4, 0x1000);
+    seal_module(m);
+    check_int("module_entry_bounds", MB_BAD_MODULE, mb_module_load(&mod, m, size));
+
+    /* spawn arguments: more than the registers used, or not a small integer */
+    size = build_flow_module(m);
+    put_u32(m + MB_MODULE_HEADER_SIZE + OS2_FLOW_PROCESS_COUNT * MB_MODULE_ENTRY_SIZE, 11);
+    seal_module(m);
+    check_int("module_args_argc", MB_BAD_MODULE, mb_module_load(&mod, m, size));
+    size = build_flow_module(m);
+    put_u32(m + MB_MODULE_HEADER_SIZE + OS2_FLOW_PROCESS_COUNT * MB_MODULE_ENTRY_SIZE + 4,
+            (uint32_t)MB_SMALLINT_MAX + 1);
+    seal_module(m);
+    check_int("module_args_range", MB_BAD_MODULE, mb_module_load(&mod, m, size));
+
+    /* entries are verified at load */
+    size = build_flow_module(m);
+    m[m[24] + 2] = 0xEE;  /* first opcode of entry 0, after the compact header */
+    seal_module(m);
+    check_int("module_entry_verify", MB_BAD_OPCODE, mb_module_load(&mod, m, size));
+}
+
+static void test_module_map_file(void) {
+    static uint8_t m[512];
+    static const char path[] = "mb_regression_module.mbm";
+    mb_module_t mod;
+    size_t size = build_flow_module(m);
+    FILE *f = fopen(path, "wb");
+
+    check_int("module_file_open", 1, f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    /* trailing bytes, as in a padded file: the module keeps its own size */
+    check_int("module_file_write", (int)size + 16, (int)fwrite(m, 1, size + 16, f));
+    fclose(f);
+
+    check_int("module_map", MB_OK, mb_module_map_file(&mod, path));
+    check_int("module_map_entries", OS2_FLOW_PROCESS_COUNT, mod.entry_count);
+    check_int("module_map_not_copied", 1, mod.image != m);
+    check_int("module_map_size", (int)size, (int)mod.size);
+    check_int("module_map_length", (int)size + 16, (int)mod.map_size);
+    mb_module_unmap(&mod);
+    check_int("module_unmapped", 1, mod.image == NULL && mod.map_size == 0);
+    check_int("module_map_missing", MB_BAD_ARGUMENT,
+              mb_module_map_file(&mod, "mb_regression_missing.mbm"));
+    remove(path);
+}
+
+/* Heaps sized per spawn from the scheduler's arena; exit returns them. */
+static void test_heap_arena(void) {
+    static mb_scheduler_t sched;
+    static mb_term_t board[4096];
+    static uint8_t m[512];
+    /* Cons r0 small integers onto the list in r1. */
+    static const uint8_t list_prog[] = {
+        MB_OP_CONS, 1, 0, 1,
+        MB_OP_DJNZ, 0, I32LE(-10),
+        MB_OP_HALT
+    };
+    static const uint8_t halt[] = { MB_OP_HALT };
+    const mb_term_t args[2] = { MB_MAKE_SMALLINT(600), MB_NIL };
+    mb_spawn_opts_t opts = MB_SPAWN_OPTS_INIT;
+    mb_module_t mod;
+    mb_process_t *p;
+    mb_term_t *block;
+    mb_pid_t big, pid;
+    int t;
+
+    check_int("arena_round_min", MB_ARENA_MIN_WORDS, (int)mb_arena_round(1));
+    check_int("arena_round_half", 12, (int)mb_arena_round(9));
+    check_int("arena_round_exact", MB_HEAP_WORDS, (int)mb_arena_round(MB_HEAP_WORDS));
+    check_int("arena_round_up", 192, (int)mb_arena_round(MB_HEAP_WORDS + 1));
+    check_int("arena_round_zero", 0, (int)mb_arena_round(0));
+
+    mb_sched_init_arena(&sched, board, 4096);
+    opts.heap_words = 0;
+    pid = mb_sched_spawn_opts(&sched, halt, sizeof(halt), &opts);
+    check_int("arena_no_heap", 0, (int)mb_sched_proc(&sched, pid)->heap.capacity);
+    check_int("arena_no_heap_in_use", 0, (int)sched.arena.in_use);
+
+    /* 600 cells need 1200 words: far beyond MB_HEAP_WORDS. */
+    opts.args = args;
+    opts.argc = 2;
+    opts.heap_words = 1300;
+    big = mb_sched_spawn_opts(&sched, list_prog, sizeof(list_prog), &opts);
+    p = mb_sched_proc(&sched, big);
+    check_int("arena_big_capacity", 1536, (int)p->heap.capacity);
+    for (t = 0; t < 64 && p->state != MB_PROC_HALTED; t++) {
+        (void)mb_sched_tick(&sched);
+    }
+    check_int("arena_big_halted", MB_PROC_HALTED, p->state);
+    check_int("arena_big_error", MB_OK, p->last_error);
+    check_int("arena_big_list", 1200, (int)p->heap.hp);
+
+    opts.argc = 0;
+    opts.heap_words = 512;
+    pid = mb_sched_spawn_opts(&sched, halt, sizeof(halt), &opts);
+    check_int("arena_fill", 1, pid != MB_PID_NONE);
+    check_int("arena_full_in_use", 4096, (int)sched.arena.in_use);
+    opts.heap_words = 8;
+    check_int("arena_full_spawn", MB_PID_NONE, mb_sched_spawn_opts(&sched, halt, sizeof(halt), &opts));
+    check_int("arena_full_count", 3, sched.count);
+
+    /* An exited process's spaces serve the next spawn of their class. */
+    block = p->heap.to;
+    check_int("arena_exit", MB_OK, mb_sched_exit(&sched, big));
+    check_int("arena_exit_in_use", 1024, (int)sched.arena.in_use);
+    opts.heap_words = 1536;
+    pid = mb_sched_spawn_opts(&sched, halt, sizeof(halt), &opts);
+    p = mb_sched_proc(&sched, pid);
+    check_int("arena_reuse", 1, p != NULL && (p->heap.from == block || p->heap.to == block));
+
+    /* The module header sizes every process spawned from the module. */
+    build_flow_module(m);
+    put_u32(m + 20, 64);
+    seal_module(m);
+    check_int("arena_module_load", MB_OK, mb_module_load(&mod, m, sizeof(m)));
+    mb_sched_init(&sched);
+    check_int("arena_module_spawn", MB_OK, mb_module_spawn_all(&mod, &sched));
+    check_int("arena_module_heap", 64, (int)mb_sched_proc(&sched, 1)->heap.capacity);
+    check_int("arena_module_entry", 64, (int)sched.entries[0].heap_words);
+    mb_sched_init_arena(&sched, board, 64);
+    check_int("arena_module_oom", MB_HEAP_OOM, mb_module_spawn_all(&mod, &sched));
+}
+
+/* Arena heaps grow with live data and shrink after it is gone. */
+static void test_heap_adaptive(void) {
+    static mb_scheduler_t sched;
+    static mb_term_t board[8192];
+    /* Cons r0 small integers onto r1; with r1 = r2 = nil, onto nil. */
+    static const uint8_t list_prog[] = {
+        MB_OP_CONS, 1, 0, 1,
+        MB_OP_DJNZ, 0, I32LE(-10),
+        MB_OP_HALT
+    };
+    static const uint8_t garbage_prog[] = {
+        MB_OP_CONS, 2, 0, 1,
+        MB_OP_DJNZ, 0, I32LE(-10),
+        MB_OP_HALT
+    };
+    const mb_term_t args[2] = { MB_MAKE_SMALLINT(600), MB_NIL };
+    const mb_term_t garbage_args[2] = { MB_MAKE_SMALLINT(2000), MB_NIL };
+    mb_spawn_opts_t opts = MB_SPAWN_OPTS_INIT;
+    mb_process_t *p;
+    int t;
+
+    /* By default a heap keeps its size and has one generation. */
+    mb_sched_init_arena(&sched, board, 8192);
+    opts.args = args;
+    opts.argc = 2;
+    opts.heap_words = 32;
+    p = mb_sched_proc(&sched, mb_sched_spawn_opts(&sched, list_prog, sizeof(list_prog), &opts));
+    for (t = 0; t < 64 && p->state != MB_PROC_HALTED; t++) {
+        if (mb_sched_tick(&sched) != MB_OK) {
+            break;
+        }
+    }
+    check_int("fixed_oom", MB_HEAP_OOM, p->last_error);
+    check_int("fixed_capacity", 32, (int)p->heap.capacity);
+    check_int("fixed_no_generations", 0, p->heap.fullsweep_after);
+
+    /* 1200 live words from a 32-word start, a class at a time. */
+    mb_sched_init_arena(&sched, board, 8192);
+    opts.heap_min_words = MB_HEAP_MIN_WORDS;  /* opt in to sizing */
+    opts.heap_max_words = MB_HEAP_MAX_WORDS;
+    p = mb_sched_proc(&sched, mb_sched_spawn_opts(&sched, list_prog, sizeof(list_prog), &opts));
+    for (t = 0; t < 64 && p->state != MB_PROC_HALTED; t++) {
+        (void)mb_sched_tick(&sched);
+    }
+    check_int("grow_halted", MB_PROC_HALTED, p->state);
+    check_int("grow_error", MB_OK, p->last_error);
+    check_int("grow_capacity", 1, p->heap.capacity >= 1200 && p->heap.capacity <= 2048);
+    check_int("grow_resized", 1, p->heap.resize_count >= 5);
+    check_int("grow_in_use", (int)(2 * p->heap.capacity), (int)sched.arena.in_use);
+
+    /* The limit holds even with room in the arena. */
+    mb_sched_init_arena(&sched, board, 8192);
+    opts.heap_max_words = 64;
+    p = mb_sched_proc(&sched, mb_sched_spawn_opts(&sched, list_prog, sizeof(list_prog), &opts));
+    for (t = 0; t < 64 && p->state != MB_PROC_HALTED; t++) {
+        if (mb_sched_tick(&sched) != MB_OK) {
+            break;
+        }
+    }
+    check_int("grow_max_oom", MB_HEAP_OOM, p->last_error);
+    check_int("grow_max_capacity", 64, (int)p->heap.capacity);
+
+    /* Garbage only: back down to the floor after MB_HEAP_SHRINK_GCS collections. */
+    mb_sched_init_arena(&sched, board, 8192);
+    opts.args = garbage_args;
+    opts.heap_words = 512;
+    opts.heap_max_words = 512;
+    p = mb_sched_proc(&sched, mb_sched_spawn_opts(&sched, garbage_prog, sizeof(garbage_prog), &opts));
+    for (t = 0; t < 128 && p->state != MB_PROC_HALTED; t++) {
+        (void)mb_sched_tick(&sched);
+    }
+    check_int("shrink_halted", MB_PROC_HALTED, p->state);
+    check_int("shrink_capacity", MB_HEAP_MIN_WORDS, (int)p->heap.capacity);
+    check_int("shrink_once", 1, (int)p->heap.resize_count);
+    check_int("shrink_in_use", 2 * MB_HEAP_MIN_WORDS, (int)sched.arena.in_use);
+}
+
+/* A shrink leaves room for the allocation that triggered the collection. */
+static void test_heap_shrink_need(void) {
+    static mb_term_t mem[512];
+    mb_arena_t arena;
+    mb_heap_t heap;
+    mb_term_t live = MB_NIL, *roots[1];
+    int i;
+
+    mb_arena_init(&arena, mem, 512);
+    (void)mb_heap_init_arena(&heap, &arena, 96);
+    mb_heap_set_limits(&heap, MB_HEAP_MIN_WORDS, 96);
+    for (i = 0; i < 8; i++) {
+        live = mb_heap_cons(&heap, MB_MAKE_SMALLINT(i), live);
+    }
+    roots[0] = &live;
+    /* 16 live words are under a quarter, but not with the 17 wanted */
+    for (i = 0; i < MB_HEAP_SHRINK_GCS; i++) {
+        mb_heap_gc_need(&heap, roots, 1, 17);
+    }
+    check_int("shrink_need_live", 16, (int)heap.hp);
+    check_int("shrink_need_fits", 1, mb_heap_alloc(&heap, 17) != NULL);
+    for (i = 0; i < MB_HEAP_SHRINK_GCS; i++) {
+        mb_heap_gc_need(&heap, roots, 1, 2);
+    }
+    check_int("shrink_need_small", 48, (int)heap.capacity);
+}
+
+/* Sum of a list of small integers, in whichever generations its cells live. */
+static int gen_list_sum(const mb_heap_t *heap, mb_term_t list) {
+    int sum = 0;
+
+    while (MB_IS_CONS(list)) {
+        const mb_term_t *cell = mb_heap_ptr(heap, MB_GET_CONS(list));
+        sum += MB_GET_SMALLINT(cell[0]);
+        list = cell[1];
+    }
+    return sum;
+}
+
+/* 1 if no old-generation word points into the nursery. */
+static int gen_old_is_closed(const mb_heap_t *heap) {
+    size_t i;
+
+    for (i = 0; i < heap->old_hp; i++) {
+        mb_term_t w = heap->old[i];
+        if ((MB_IS_CONS(w) && (MB_GET_CONS(w) & MB_HEAP_OLD_BIT) == 0) ||
+            (MB_IS_BOXED(w) && (MB_GET_BOXED(w) & MB_HEAP_OLD_BIT) == 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Survivors are promoted; minor collections leave the old generation alone. */
+static void test_heap_generational(void) {
+    static mb_term_t board[4096];
+    mb_arena_t arena;
+    mb_heap_t heap;
+    mb_term_t kept = MB_NIL, young = MB_NIL, *old_block;
+    mb_term_t *roots[2];
+    size_t old_hp;
+    int i, gc;
+
+    roots[0] = &kept;
+    roots[1] = &young;
+    mb_arena_init(&arena, board, 4096);
+    check_int("gen_init", 0, mb_heap_init_arena(&heap, &arena, 64));
+    mb_heap_set_fullsweep(&heap, 4);
+    for (i = 1; i <= 10; i++) {
+        kept = mb_heap_cons(&heap, MB_MAKE_SMALLINT(i), kept);
+    }
+
+    /* First collection: nothing has survived one yet, all stays young. */
+    mb_heap_gc(&heap, roots, 2);
+    check_int("gen_first_young", 0, (int)(MB_GET_CONS(kept) & MB_HEAP_OLD_BIT));
+    check_int("gen_first_hwm", 20, (int)heap.hwm);
+    /* Second: the list survived, and the empty old generation forces a major. */
+    mb_heap_gc(&heap, roots, 2);
+    check_int("gen_promoted", 1, (MB_GET_CONS(kept) & MB_HEAP_OLD_BIT) != 0);
+    check_int("gen_promoted_hp", 0, (int)heap.hp);
+    check_int("gen_promoted_old_hp", 20, (int)heap.old_hp);
+    check_int("gen_promoted_sum", 55, gen_list_sum(&heap, kept));
+
+    /* Churn garbage: minors copy nothing, the old generation stays put. */
+    old_block = heap.old;
+    old_hp = heap.old_hp;
+    for (gc = 0; gc < 4; gc++) {
+        mb_term_t before = kept;
+        while (mb_heap_cons(&heap, MB_MAKE_SMALLINT(gc), MB_NIL) != 0) {
+        }
+        mb_heap_gc(&heap, roots, 2);
+        check_int("gen_minor_root", 1, kept == before);
+        check_int("gen_minor_hp", 0, (int)heap.hp);
+        check_int("gen_minor_old", 1, heap.old == old_block && heap.old_hp == old_hp);
+    }
+    check_int("gen_minor_count", 4, (int)heap.minor_gcs);
+    /* fullsweep_after minors done: the next collection is major. */
+    mb_heap_gc(&heap, roots, 2);
+    check_int("gen_major_count", 0, (int)heap.minor_gcs);
+    check_int("gen_major_old_hp", 20, (int)heap.old_hp);
+    check_int("gen_major_sum", 55, gen_list_sum(&heap, kept));
+
+    /* A young list built on an old one: the young part is promoted on its
+       second collection, never leaving an old cell pointing into the nursery. */
+    young = kept;
+    for (i = 11; i <= 15; i++) {
+        young = mb_heap_cons(&heap, MB_MAKE_SMALLINT(i), young);
+    }
+    mb_heap_gc(&heap, roots, 2);
+    check_int("gen_young_stays", 0, (int)(MB_GET_CONS(young) & MB_HEAP_OLD_BIT));
+    check_int("gen_young_hp", 10, (int)heap.hp);
+    young = mb_heap_cons(&heap, MB_MAKE_SMALLINT(16), young);
+    mb_heap_gc(&heap, roots, 2);
+    check_int("gen_young_head", 0, (int)(MB_GET_CONS(young) & MB_HEAP_OLD_BIT));
+    check_int("gen_young_hp_2", 2, (int)heap.hp);
+    check_int("gen_young_old_hp", 30, (int)heap.old_hp);
+    check_int("gen_young_sum", 136, gen_list_sum(&heap, young));
+    check_int("gen_old_closed", 1, gen_old_is_closed(&heap));
+
+    mb_heap_release(&heap);
+    check_int("gen_released", 0, (int)arena.in_use);
+}
+
+/* Shared heaps own one space and borrow the scratch block to collect. */
+static void test_heap_shared_scratch(void) {
+    static mb_term_t board[4096];
+    static mb_scheduler_t sched;
+    static const uint8_t garbage_prog[] = {
+        MB_OP_CONS, 2, 0, 1,
+        MB_OP_DJNZ, 0, I32LE(-10),
+        MB_OP_HALT
+    };
+    const mb_term_t args[2] = { MB_MAKE_SMALLINT(200), MB_NIL };
+    mb_spawn_opts_t opts = MB_SPAWN_OPTS_INIT;
+    mb_arena_t arena;
+    mb_heap_scratch_t scratch = { NULL, 0 };
+    mb_heap_t a, b;
+    mb_term_t la = MB_NIL, lb = MB_NIL, *home, *lent;
+    mb_term_t *roots[1];
+    int i, t;
+
+    mb_arena_init(&arena, board, 4096);
+    check_int("shared_init_a", 0, mb_heap_init_shared(&a, &arena, &scratch, 64));
+    check_int("shared_init_b", 0, mb_heap_init_shared(&b, &arena, &scratch, 128));
+    check_int("shared_scratch_words", 128, (int)scratch.words);
+    check_int("shared_in_use", 64 + 128 + 128, (int)arena.in_use);
+    check_int("shared_no_to", 1, a.to == NULL && b.to == NULL);
+
+    /* Smaller than the scratch: survivors are copied home. */
+    for (i = 1; i <= 10; i++) {
+        la = mb_heap_cons(&a, MB_MAKE_SMALLINT(i), la);
+    }
+    while (mb_heap_cons(&a, MB_NIL, MB_NIL) != 0) {
+    }
+    home = a.from;
+    roots[0] = &la;
+    mb_heap_gc(&a, roots, 1);
+    check_int("shared_copy_home", 1, a.from == home && a.to == NULL);
+    check_int("shared_copy_hp", 20, (int)a.hp);
+    check_int("shared_copy_sum", 55, gen_list_sum(&a, la));
+
+    /* Same size as the scratch: the blocks trade roles. */
+    for (i = 1; i <= 10; i++) {
+        lb = mb_heap_cons(&b, MB_MAKE_SMALLINT(i), lb);
+    }
+    home = b.from;
+    lent = scratch.mem;
+    roots[0] = &lb;
+    mb_heap_gc(&b, roots, 1);
+    check_int("shared_swap", 1, b.from == lent && scratch.mem == home && b.to == NULL);
+    check_int("shared_swap_sum", 55, gen_list_sum(&b, lb));
+
+    /* A heap grows only as far as the scratch can follow it. */
+    mb_heap_set_limits(&a, 32, 1024);
+    roots[0] = &la;
+    for (i = 0; i < 300; i++) {
+        mb_term_t cell = mb_heap_cons(&a, MB_MAKE_SMALLINT(1), la);
+        if (cell == 0) {
+            mb_heap_gc_need(&a, roots, 1, 2);
+            cell = mb_heap_cons(&a, MB_MAKE_SMALLINT(1), la);
+        }
+        la = cell;
+    }
+    check_int("shared_grow_sum", 355, gen_list_sum(&a, la));
+    check_int("shared_grow_scratch", (int)a.capacity, (int)scratch.words);
+    check_int("shared_grow_in_use", (int)(2 * a.capacity + 128), (int)arena.in_use);
+    mb_heap_release(&a);
+    mb_heap_release(&b);
+    check_int("shared_released", (int)scratch.words, (int)arena.in_use);
+
+    /* Four scheduler processes: five spaces instead of eight. */
+    mb_sched_init_arena(&sched, board, 4096);
+    opts.args = args;
+    opts.argc = 2;
+    opts.heap_words = 128;
+    opts.heap_max_words = 128;
+    opts.fullsweep_after = 0;
+    opts.gc_mode = MB_GC_SHARED;
+    for (i = 0; i < 4; i++) {
+        (void)mb_sched_spawn_opts(&sched, garbage_prog, sizeof(garbage_prog), &opts);
+    }
+    check_int("shared_sched_in_use", 5 * 128, (int)sched.arena.in_use);
+    for (t = 0; t < 64; t++) {
+        (void)mb_sched_tick(&sched);
+    }
+    for (i = 1; i <= 4; i++) {
+        const mb_process_t *p = mb_sched_proc(&sched, (mb_pid_t)i);
+        check_int("shared_sched_halted", MB_PROC_HALTED, p->state);
+        check_int("shared_sched_error", MB_OK, p->last_error);
+        check_int("shared_sched_gcs", 1, p->heap.gc_count > 0);
+    }
+}
+
+/* Mark-compact slides live data down in place, with no to-space. */
+static void test_heap_compact(void) {
+    static mb_term_t board[8192];
+    static mb_scheduler_t sched;
+    static const uint8_t list_prog[] = {
+        MB_OP_CONS, 1, 0, 1,
+        MB_OP_DJNZ, 0, I32LE(-10),
+        MB_OP_HALT
+    };
+    const mb_term_t args[2] = { MB_MAKE_SMALLINT(600), MB_NIL };
+    mb_spawn_opts_t opts = MB_SPAWN_OPTS_INIT;
+    mb_arena_t arena;
+    mb_heap_t heap;
+    mb_term_t list = MB_NIL, pair, elems[2], *ptr, *slot;
+    mb_term_t *roots[1];
+    mb_process_t *p;
+    int i, t;
+
+    mb_arena_init(&arena, board, 8192);
+    check_int("compact_init", 0, mb_heap_init_compact(&heap, &arena, 64));
+    check_int("compact_capacity", 1, heap.capacity >= 64 && heap.to == NULL);
+    check_int("compact_one_block", (int)mb_arena_round(heap.capacity), (int)arena.in_use);
+    mb_heap_set_fullsweep(&heap, 4);
+    check_int("compact_no_generations", 0, heap.fullsweep_after);
+
+    /* Live cells interleaved with garbage, a tuple on top, a stack slot. */
+    for (i = 1; i <= 10; i++) {
+        (void)mb_heap_make_tuple(&heap, elems, 0);
+        list = mb_heap_cons(&heap, MB_MAKE_SMALLINT(i), list);
+        (void)mb_heap_cons(&heap, list, MB_NIL);
+    }
+    elems[0] = list;
+    elems[1] = MB_MAKE_SMALLINT(7);
+    pair = mb_heap_make_tuple(&heap, elems, 2);
+    slot = mb_heap_stack_alloc(&heap, 1);
+    *slot = mb_heap_cons(&heap, MB_MAKE_SMALLINT(100), list);
+    check_int("compact_pre_hp", 55, (int)heap.hp);
+    roots[0] = &pair;
+    mb_heap_gc(&heap, roots, 1);
+    check_int("compact_gc_count", 1, (int)heap.gc_count);
+    check_int("compact_hp", 25, (int)heap.hp);
+    check_int("compact_pair_off", 20, (int)MB_GET_BOXED(pair));
+    ptr = mb_heap_ptr(&heap, MB_GET_BOXED(pair));
+    check_int("compact_pair_arity", 2, (int)MB_GET_TUPLE_ARITY(ptr[0]));
+    check_int("compact_pair_sum", 55, gen_list_sum(&heap, ptr[1]));
+    check_int("compact_pair_elem", 7, MB_GET_SMALLINT(ptr[2]));
+    check_int("compact_stack_off", 23, (int)MB_GET_CONS(heap.from[heap.stop]));
+    check_int("compact_stack_sum", 155, gen_list_sum(&heap, heap.from[heap.stop]));
+    check_int("compact_cleared", 1, heap.from[25] == 0 && heap.from[54] == 0);
+    mb_heap_release(&heap);
+    check_int("compact_released", 0, (int)arena.in_use);
+
+    /* A cons whose head is a raw 0 (a register never written) next to an
+     * empty tuple: both first words read as the header of {}. */
+    check_int("compact_zero_init", 0, mb_heap_init_compact(&heap, &arena, 64));
+    (void)mb_heap_cons(&heap, MB_NIL, MB_NIL);
+    list = mb_heap_cons(&heap, MB_MAKE_SMALLINT(5), MB_NIL);
+    (void)mb_heap_cons(&heap, MB_NIL, MB_NIL);
+    list = mb_heap_cons(&heap, 0, list);
+    elems[0] = mb_heap_make_tuple(&heap, elems, 0);
+    elems[1] = list;
+    pair = mb_heap_make_tuple(&heap, elems, 2);
+    roots[0] = &pair;
+    mb_heap_gc(&heap, roots, 1);
+    check_int("compact_zero_hp", 8, (int)heap.hp);
+    ptr = mb_heap_ptr(&heap, MB_GET_BOXED(pair));
+    check_int("compact_zero_empty", 1, *mb_heap_ptr(&heap, MB_GET_BOXED(ptr[1])) ==
+              MB_MAKE_TUPLE_HDR(0));
+    ptr = mb_heap_ptr(&heap, MB_GET_CONS(ptr[2]));
+    check_int("compact_zero_head", 0, (int)ptr[0]);
+    check_int("compact_zero_tail", 5, gen_list_sum(&heap, ptr[1]));
+    mb_heap_release(&heap);
+
+    /* A scheduler process grows one block at a time, never two. */
+    mb_sched_init_arena(&sched, board, 8192);
+    opts.args = args;
+    opts.argc = 2;
+    opts.heap_words = 32;
+    opts.heap_max_words = MB_HEAP_MAX_WORDS;
+    opts.gc_mode = MB_GC_COMPACT;
+    p = mb_sched_proc(&sched, mb_sched_spawn_opts(&sched, list_prog, sizeof(list_prog), &opts));
+    for (t = 0; t < 64 && p->state != MB_PROC_HALTED; t++) {
+        (void)mb_sched_tick(&sched);
+    }
+    check_int("compact_grow_halted", MB_PROC_HALTED, p->state);
+    check_int("compact_grow_error", MB_OK, p->last_error);
+    check_int("compact_grow_capacity", 1, p->heap.capacity >= 1200);
+    check_int("compact_grow_in_use", (int)mb_arena_round(p->heap.capacity),
+              (int)sched.arena.in_use);
+    check_int("compact_grow_sum", 600 * 601 / 2, gen_list_sum(&p->heap, p->regs[1]));
+}
+
+/* ---- hot upgrade tests ---- */
+
+/* Receive loop: r10 += step per command.  Loop head is the RECV_CMD. */
+#define UPG_RECV_LOOP(step) \
+    MB_OP_RECV_CMD, 0, 1, 2, 3, 4, \
+    MB_OP_ADD_IMM, 10, 10, I32LE(step), \
+    MB_OP_JMP, I32LE(-18)
+
+static const uint8_t upg_count_1[] = { UPG_RECV_LOOP(1) };
+static const uint8_t upg_count_100[] = { UPG_RECV_LOOP(100) };
+/* r11 = 7, then the receive loop: pc 0 is not a switch point */
+static const uint8_t upg_init_count_1[] = { MB_OP_CONST_I32, 11, I32LE(7), UPG_RECV_LOOP(1) };
+
+static mb_command_t upg_cmd(void) {
+    mb_command_t cmd = {0};
+    cmd.type = MB_CMD_GPIO_WRITE;
+    cmd.a = 2;
+    cmd.b = 1;
+    return cmd;
+}
+
+static void test_upgrade_blocked(void) {
+    static mb_scheduler_t sched;
+    mb_process_t *p;
+    mb_pid_t pid;
+
+    mb_sched_init(&sched);
+    pid = mb_sched_spawn(&sched, upg_count_1, sizeof(upg_count_1));
+    p = mb_sched_proc(&sched, pid);
+    (void)mb_sched_send(&sched, pid, upg_cmd());
+    (void)mb_sched_tick(&sched);
+    check_int("upg_blocked_old", 1, MB_GET_SMALLINT(p->regs[10]));
+    check_int("upg_blocked_waiting", MB_PROC_WAITING, p->state);
+
+    /* blocked in RECV_CMD: switches at once and runs the new code */
+    check_int("upg_blocked_stage", MB_OK, mb_sched_upgrade(&sched, pid, upg_count_100,
+                                                           sizeof(upg_count_100)));
+    check_int("upg_blocked_pending", 0, mb_sched_upgrades_pending(&sched));
+    check_int("upg_blocked_switched", 1, p->program == upg_count_100);
+    check_int("upg_blocked_ready", MB_PROC_READY, p->state);
+    (void)mb_sched_send(&sched, pid, upg_cmd());
+    (void)mb_sched_tick(&sched);
+    check_int("upg_blocked_regs_kept", 101, MB_GET_SMALLINT(p->regs[10]));
+    check_int("upg_bad_pid", MB_BAD_PID, mb_sched_upgrade(&sched, 5, upg_count_1,
+                                                           sizeof(upg_count_1)));
+}
+
+static void test_upgrade_running(void) {
+    static mb_scheduler_t sched;
+    mb_process_t *p;
+    mb_pid_t pid;
+
+    mb_sched_init(&sched);
+    pid = mb_sched_spawn(&sched, upg_init_count_1, sizeof(upg_init_count_1));
+    p = mb_sched_proc(&sched, pid);
+    (void)mb_sched_send(&sched, pid, upg_cmd());
+    (void)mb_sched_send(&sched, pid, upg_cmd());
+
+    /* READY at pc 0, not a switch point: old code runs until it blocks */
+    check_int("upg_running_stage", MB_OK, mb_sched_upgrade(&sched, pid, upg_count_100,
+                                                           sizeof(upg_count_100)));
+    check_int("upg_running_pending", 1, mb_sched_upgrades_pending(&sched));
+    check_int("upg_running_not_yet", 1, p->program == upg_init_count_1);
+    (void)mb_sched_tick(&sched);
+    check_int("upg_running_old_drained", 2, MB_GET_SMALLINT(p->regs[10]));
+    check_int("upg_running_switched", 1, p->program == upg_count_100);
+    check_int("upg_running_pending_done", 0, mb_sched_upgrades_pending(&sched));
+    check_int("upg_running_restart", 0, (int)p->pc);
+    (void)mb_sched_send(&sched, pid, upg_cmd());
+    (void)mb_sched_tick(&sched);
+    check_int("upg_running_new", 102, MB_GET_SMALLINT(p->regs[10]));
+    check_int("upg_running_r11_kept", 7, MB_GET_SMALLINT(p->regs[11]));
+}
+
+static void test_upgrade_sleeping(void) {
+    static mb_scheduler_t sched;
+    /* r11 += 1 and sleep inside a call frame, forever; never receives */
+    static const uint8_t sleeper[] = {
+        MB_OP_CONST_I32, 1, I32LE(1),
+        MB_OP_CALL, I32LE(1),
+        MB_OP_HALT,
+        MB_OP_ALLOCATE, 1,
+        MB_OP_ADD_IMM, 11, 11, I32LE(1),
+        MB_OP_SLEEP_MS, 1,
+        MB_OP_JMP, I32LE(-14)
+    };
+    mb_process_t *p;
+    mb_pid_t pid;
+    int t;
+
+    mb_sched_init(&sched);
+    pid = mb_sched_spawn(&sched, sleeper, sizeof(sleeper));
+    p = mb_sched_proc(&sched, pid);
+    (void)mb_sched_send(&sched, pid, upg_cmd());
+    (void)mb_sched_tick(&sched);
+    check_int("upg_sleep_state", MB_PROC_SLEEPING, p->state);
+    check_int("upg_sleep_frame", 1, p->heap.stop < p->heap.capacity);
+
+    check_int("upg_sleep_stage", MB_OK, mb_sched_upgrade(&sched, pid, upg_count_100,
+                                                         sizeof(upg_count_100)));
+    check_int("upg_sleep_switched", 1, p->program == upg_count_100);
+    check_int("upg_sleep_still_sleeping", MB_PROC_SLEEPING, p->state);
+    check_int("upg_sleep_frames_dropped", 1, p->heap.stop == p->heap.capacity);
+    check_int("upg_sleep_mailbox_kept", 1, (int)p->mailbox.count);
+
+    /* after the wake-up the new code receives the message queued before */
+    for (t = 0; t < 100000 && p->state != MB_PROC_WAITING; t++) {
+        (void)mb_sched_tick(&sched);
+    }
+    check_int("upg_sleep_new_code", 100, MB_GET_SMALLINT(p->regs[10]));
+    check_int("upg_sleep_regs_kept", 1, MB_GET_SMALLINT(p->regs[11]));
+}
+
+static void test_upgrade_module(void) {
+    static uint8_t v1[512], v2[512];
+    static mb_scheduler_t sched;
+    mb_module_t mod1, mod2;
+    uint8_t i;
+    int t;
+
+    (void)build_flow_module(v1);
+    (void)build_flow_module(v2);
+    check_int("upg_mod_load1", MB_OK, mb_module_load(&mod1, v1, sizeof(v1)));
+    check_int("upg_mod_load2", MB_OK, mb_module_load(&mod2, v2, sizeof(v2)));
+
+    mb_sched_init(&sched);
+    check_int("upg_mod_no_procs", MB_BAD_PID, mb_module_upgrade(&mod2, &sched));
+    check_int("upg_mod_spawn", MB_OK, mb_module_spawn_all(&mod1, &sched));
+
+    /* sensors sit at pc 0 (before their loop); the actuator's RECV_PWM
+     * is its own loop head and switches at once */
+    check_int("upg_mod_upgrade", MB_OK, mb_module_upgrade(&mod2, &sched));
+    check_int("upg_mod_pending", OS2_FLOW_SENSOR_COUNT, mb_sched_upgrades_pending(&sched));
+    check_int("upg_mod_two_versions", MB_UPGRADE_PENDING, mb_module_upgrade(&mod1, &sched));
+
+    /* sensors yield back to their loop head in SEND_WAIT */
+    for (t = 0; t < 32; t++) {
+        check_int("upg_mod_tick", MB_OK, mb_sched_tick(&sched));
+    }
+    check_int("upg_mod_pending_done", 0, mb_sched_upgrades_pending(&sched));
+    for (i = 0; i < OS2_FLOW_PROCESS_COUNT; i++) {
+        const mb_process_t *p = &sched.procs[i];
+        check_int("upg_mod_in_v2", 1, p->program >= v2 && p->program < v2 + sizeof(v2));
+    }
+    check_int("upg_mod_actuator_rc", MB_OK,
+              MB_GET_SMALLINT(sched.procs[OS2_FLOW_SENSOR_COUNT].regs[5]));
+
+    /* A reused slot gives entry 0 a newer pid generation; the upgrade
+     * follows the pid spawn_all recorded, not pid 1. */
+    mb_sched_init(&sched);
+    check_int("upg_mod_exit", MB_OK,
+              mb_sched_exit(&sched, mb_sched_spawn(&sched, upg_count_1, sizeof(upg_count_1))));
+    check_int("upg_mod_respawn", MB_OK, mb_module_spawn_all(&mod1, &sched));
+    check_int("upg_mod_new_gen", 1, sched.entries[0].pid != 1 &&
+              mb_sched_proc(&sched, sched.entries[0].pid) == &sched.procs[0]);
+    check_int("upg_mod_reused_upgrade", MB_OK, mb_module_upgrade(&mod2, &sched));
+    check_int("upg_mod_reused_pending", OS2_FLOW_SENSOR_COUNT,
+              mb_sched_upgrades_pending(&sched));
+}
+
+/* ================================================================
+ * Fixed-point math tests
+ * ================================================================ */
+
+static void test_math_ops(void) {
+    mb_vm_t vm;
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(-7),
+        MB_OP_CONST_I32, 1, I32LE(2),
+        MB_OP_CONST_I32, 2, I32LE(100000),
+        MB_OP_MUL, 3, 0, 1,                    /* -14 */
+        MB_OP_MUL, 4, 2, 2,                    /* saturates to MAX */
+        MB_OP_DIV, 5, 0, 1,                    /* -3 (toward zero) */
+        MB_OP_REM, 6, 0, 1,                    /* -1 (dividend sign) */
+        MB_OP_SHL, 7, 1, 1,                    /* 8 */
+        MB_OP_SHR, 8, 0, 1,                    /* -2 (arithmetic) */
+        MB_OP_SHR, 9, 1, 0,                    /* count -7 shifts left: 256 */
+        MB_OP_XOR, 10, 0, 1,                   /* -5 */
+        MB_OP_AND, 11, 0, 2,                   /* -7 & 100000 = 100000 */
+        MB_OP_OR, 12, 0, 1,                    /* -5 */
+        MB_OP_MIN, 13, 0, 1,
+        MB_OP_MAX, 14, 0, 1,
+        MB_OP_CONST_I32, 15, I32LE(0),
+        MB_OP_DIV, 15, 1, 15,                  /* fault */
+        MB_OP_HALT
+    };
+
+    check_int("math_verified", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("math_div_zero", MB_BAD_ARITH, mb_vm_run(&vm, 64));
+    check_int("math_div_zero_sticky", MB_BAD_ARITH, vm.proc->last_error);
+    check_int("math_mul", -14, MB_GET_SMALLINT(vm.proc->regs[3]));
+    check_int("math_mul_sat", MB_SMALLINT_MAX, MB_GET_SMALLINT(vm.proc->regs[4]));
+    check_int("math_div", -3, MB_GET_SMALLINT(vm.proc->regs[5]));
+    check_int("math_rem", -1, MB_GET_SMALLINT(vm.proc->regs[6]));
+    check_int("math_shl", 8, MB_GET_SMALLINT(vm.proc->regs[7]));
+    check_int("math_shr", -2, MB_GET_SMALLINT(vm.proc->regs[8]));
+    check_int("math_shr_neg_count", 256, MB_GET_SMALLINT(vm.proc->regs[9]));
+    check_int("math_xor", -5, MB_GET_SMALLINT(vm.proc->regs[10]));
+    check_int("math_and", 100000, MB_GET_SMALLINT(vm.proc->regs[11]));
+    check_int("math_or", -5, MB_GET_SMALLINT(vm.proc->regs[12]));
+    check_int("math_min", -7, MB_GET_SMALLINT(vm.proc->regs[13]));
+    check_int("math_max", 2, MB_GET_SMALLINT(vm.proc->regs[14]));
+}
+
+static void test_math_fixed_point(void) {
+    mb_vm_t vm;
+    /* Scale a raw I2C byte to PWM permille in the VM: raw * (1000/255). */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(0x92),       /* raw = 146 */
+        MB_OP_CONST_I32, 1, I32LE(257004),     /* 1000/255 in Q16.16 */
+        MB_OP_QMUL, 2, 0, 1,                   /* 572.55 -> 573 */
+        MB_OP_CONST_I32, 3, I32LE(98304),      /* 1.5 */
+        MB_OP_CONST_I32, 4, I32LE(-131072),    /* -2.0 */
+        MB_OP_QMUL, 5, 3, 4,                   /* -3.0 */
+        MB_OP_CONST_I32, 6, I32LE(1),
+        MB_OP_CONST_I32, 7, I32LE(32768),      /* 0.5 */
+        MB_OP_QMUL, 8, 6, 7,                   /* tie rounds up: 1 */
+        MB_OP_CONST_I32, 6, I32LE(-1),
+        MB_OP_QMUL, 9, 6, 7,                   /* tie rounds up: 0 */
+        MB_OP_CONST_I32, 10, I32LE(0),
+        MB_OP_CONST_I32, 11, I32LE(1000),
+        MB_OP_CONST_I32, 12, I32LE(1200),
+        MB_OP_CLAMP, 13, 12, 10, 11,           /* 1000 */
+        MB_OP_CLAMP, 14, 6, 10, 11,            /* 0 */
+        MB_OP_CLAMP, 15, 2, 10, 11,            /* 573 */
+        MB_OP_HALT
+    };
+
+    check_int("qmul_verified", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("qmul_run", MB_OK, mb_vm_run(&vm, 64));
+    check_int("qmul_halted", 1, vm.proc->halted);
+    check_int("qmul_scale", 573, MB_GET_SMALLINT(vm.proc->regs[2]));
+    check_int("qmul_neg", -196608, MB_GET_SMALLINT(vm.proc->regs[5]));
+    check_int("qmul_tie_pos", 1, MB_GET_SMALLINT(vm.proc->regs[8]));
+    check_int("qmul_tie_neg", 0, MB_GET_SMALLINT(vm.proc->regs[9]));
+    check_int("clamp_hi", 1000, MB_GET_SMALLINT(vm.proc->regs[13]));
+    check_int("clamp_lo", 0, MB_GET_SMALLINT(vm.proc->regs[14]));
+    check_int("clamp_in", 573, MB_GET_SMALLINT(vm.proc->regs[15]));
+}
+
+/* ================================================================
+ * Call/return and stack frame tests
+ * ================================================================ */
+
+static void test_call_ret_frames(void) {
+    mb_vm_t vm;
+    /* sub: r2 = 2 * r1, using Y0 to survive a clobbered r1 */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 1, I32LE(5),            /*  0 */
+        MB_OP_CALL, I32LE(14),                   /*  6: -> sub */
+        MB_OP_ADD, 4, 4, 2,                      /* 11 */
+        MB_OP_CALL, I32LE(5),                    /* 15: -> sub */
+        MB_OP_ADD, 4, 4, 2,                      /* 20 */
+        MB_OP_HALT,                              /* 24 */
+        MB_OP_ALLOCATE, 1,                       /* 25: sub */
+        MB_OP_PUT_Y, 1, 0,
+        MB_OP_ADD, 2, 1, 1,
+        MB_OP_CONST_I32, 1, I32LE(99),
+        MB_OP_GET_Y, 1, 0,
+        MB_OP_DEALLOCATE, 1,
+        MB_OP_RET
+    };
+
+    check_int("call_verified", MB_OK, mb_verify_program(prog, sizeof(prog)));
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("call_run", MB_OK, mb_vm_run(&vm, 64));
+    check_int("call_halted", 1, vm.proc->halted);
+    check_int("call_result", 20, MB_GET_SMALLINT(vm.proc->regs[4]));
+    check_int("call_y_restored", 5, MB_GET_SMALLINT(vm.proc->regs[1]));
+    check_int("call_stack_empty", 0, (int)mb_heap_stack_depth(&vm.proc->heap));
+}
+
+static void test_stack_gc_roots(void) {
+    mb_vm_t vm;
+    /* A tuple referenced only from Y0 must survive collections. */
+    static const uint8_t prog[] = {
+        MB_OP_CONST_I32, 0, I32LE(42),           /*  0 */
+        MB_OP_ALLOCATE, 1,                       /*  6 */
+        MB_OP_MAKE_TUPLE, 1, 1, 0,               /*  8 */
+        MB_OP_PUT_Y, 1, 0,                       /* 12 */
+        MB_OP_CONST_I32, 1, I32LE(0),            /* 15 */
+        MB_OP_CONST_I32, 3, I32LE(100),          /* 21 */
+        MB_OP_CONS, 2, 0, 0,                     /* 27: garbage */
+        MB_OP_DJNZ, 3, I32LE(-10),               /* 31: -> 27 */
+        MB_OP_GET_Y, 1, 0,                       /* 37 */
+        MB_OP_TUPLE_ELEM, 5, 1, 0,
+        MB_OP_DEALLOCATE, 1,
+        MB_OP_HALT
+    };
+
+    mb_vm_init(&vm, prog, sizeof(prog));
+    check_int("stack_gc_run", MB_OK, mb_vm_run(&vm, 1000));
+    check_int("stack_gc_halted", 1, vm.proc->halted);
+    check_int("stack_gc_ran", 1, vm.proc->heap.gc_count > 0);
+    check_int("stack_gc_survivor", 42, MB_GET_SMALLINT(vm.proc->regs[5]));
+}
+
+static void test_stack_faults(void) {
+    mb_vm_t vm;
+    static const uint8_t recurse[] = { MB_OP_CALL, I32LE(-5) };
+    static const uint8_t bare_ret[] = { MB_OP_RET };
+    static const uint8_t bad_y[] = { MB_OP_ALLOCATE, 1, MB_OP_GET_Y, 0, 1 };
+
+    mb_vm_init(&vm, recurse, sizeof(recurse));
+    check_int("stack_overflow", MB_STACK_OVERFLOW, mb_vm_run(&vm, 1000));
+    check_int("stack_overflow_depth", MB_HEAP_WORDS, (int)mb_heap_stack_depth(&vm.proc->heap));
+
+    mb_vm_init(&vm, bare_ret, sizeof(bare_ret));
+    check_int("ret_empty_stack", MB_BAD_FRAME, mb_vm_run(&vm, 8));
+
+    mb_vm_init(&vm, bad_y, sizeof(bad_y));
+    check_int("y_out_of_frame", MB_BAD_FRAME, mb_vm_run(&vm, 8));
+}
+
+/* ---- native (AOT) flow tests ---- */
+
+static void spawn_flow(mb_scheduler_t *sched, int native) {
+    int i;
+    mb_sched_init(sched);
+    for (i = 0; i < OS2_FLOW_SENSOR_COUNT; i++) {
+        (void)mb_sched_spawn_args(sched, os2_flow_sensor_prog, sizeof(os2_flow_sensor_prog),
+                                  os2_flow_sensor_args[i], OS2_FLOW_SENSOR_ARGC,
+                                  native ? os2_flow_sensor_natives[i] : NULL);
+    }
+    (void)mb_sched_spawn_native(sched, os2_flow_actuator_prog, sizeof(os2_flow_actuator_prog),
+                                native ? os2_flow_actuator_native : NULL);
+}
+
+/* Same observable state, except the timestamp register (r9). */
+static void check_same_proc(const char *name, const mb_process_t *a, const mb_process_t *b) {
+    uint8_t r;
+    check_int(name, (int)a->pc, (int)b->pc);
+    check_int(name, a->state, b->state);
+    check_int(name, (int)a->reductions, (int)b->reductions);
+    check_int(name, a->last_error, b->last_error);
+    check_int(name, (int)a->mailbox.count, (int)b->mailbox.count);
+    for (r = 0; r < MB_REG_COUNT; r++) {
+        if (r != 9) {
+            check_int(name, (int)a->regs[r], (int)b->regs[r]);
+        }
+    }
+}
+
+static void test_native_flow_lockstep(void) {
+    static mb_scheduler_t interp, native;
+    uint8_t i;
+    int t;
+
+    spawn_flow(&interp, 0);
+    spawn_flow(&native, 1);
+    check_int("native_flow_set", 1, native.procs[0].native != NULL);
+    check_int("native_flow_actuator_set", 1, native.procs[OS2_FLOW_SENSOR_COUNT].native != NULL);
+
+    for (t = 0; t < 64; t++) {
+        check_int("native_flow_tick", mb_sched_tick(&interp), mb_sched_tick(&native));
+        for (i = 0; i < OS2_FLOW_PROCESS_COUNT; i++) {
+            check_same_proc("native_flow_proc", &interp.procs[i], &native.procs[i]);
+        }
+    }
+    /* The native actuator consumed sensor messages. */
+    check_int("native_flow_actuator_ran", MB_CMD_PWM_SET_DUTY,
+              MB_GET_SMALLINT(native.procs[OS2_FLOW_SENSOR_COUNT].regs[0]));
+}
+
+static void test_native_resume_mixed(void) {
+    static mb_scheduler_t ref, mixed;
+    mb_process_t *pr, *pm;
+    int i;
+
+    /* Alternate native and interpreted single steps on one process: 4 inits, 10 sends. */
+    spawn_flow(&ref, 0);
+    spawn_flow(&mixed, 0);
+    pr = mb_sched_proc(&ref, 1);
+    pm = mb_sched_proc(&mixed, 1);
+    for (i = 0; i < 24; i++) {
+        pm->native = (i & 1) ? os2_flow_sensor_natives[0] : NULL;
+        check_int("native_mixed_step", mb_proc_step(pr, &ref), mb_proc_step(pm, &mixed));
+        check_same_proc("native_mixed_proc", pr, pm);
+        pr->state = MB_PROC_READY;
+        pm->state = MB_PROC_READY;
+    }
+    check_int("native_mixed_queued", 10, (int)mixed.procs[OS2_FLOW_SENSOR_COUNT].mailbox.count);
+}
+
 int main(void) {
     /* Original vm-compat tests */
     test_invalid_command_rejected();
@@ -575,10 +2576,13 @@ int main(void) {
     /* Scheduler tests */
     test_sched_spawn_and_halt();
     test_sched_full_table();
+    test_sched_spawn_args();
     test_sched_send_ext();
     test_sched_send_bad_pid();
     test_self_opcode();
     test_yield_opcode();
+    test_spawn_exit();
+    test_exit_compat();
     test_two_process_round_robin();
 
     /* Term tagging tests */
@@ -600,6 +2604,77 @@ int main(void) {
     test_opcode_make_tuple_and_elem();
     test_opcode_cons_head_tail();
 
+    /* Term test opcode tests */
+    test_term_tests();
+
+    /* Pre-decode tests */
+    test_decode_resolves_operands();
+    test_decode_fault_is_lazy();
+    test_decode_jump_off_boundary();
+    test_decode_long_program();
+    test_decode_reused_pool();
+
+    /* Verifier tests */
+    test_verify_accepts_valid();
+    test_verify_rejects();
+    test_unverified_keeps_checks();
+    test_bif_register();
+    test_bif_trap();
+
+    /* Compat handle tests */
+    test_vm_heap_persists();
+    test_vm_attach_sched_proc();
+
+    /* Superinstruction tests */
+    test_super_sensor_actuator();
+    test_super_recv_pwm_other_cmd();
+
+    /* Immediate and compare-and-branch tests */
+    test_imm_and_branches();
+    test_imm_wraps();
+
+    /* Multi-way branch tests */
+    test_select_val();
+    test_jump_table();
+    test_case_tables_verify();
+
+    /* Lookup table tests */
+    test_lut();
+
+    /* Compact encoding tests */
+    test_compact_encoding();
+    test_compact_rejects();
+
+    /* Module tests */
+    test_module_load();
+    test_module_rejects();
+    test_module_map_file();
+    test_heap_arena();
+    test_heap_adaptive();
+    test_heap_shrink_need();
+    test_heap_generational();
+    test_heap_shared_scratch();
+    test_heap_compact();
+
+    /* Hot upgrade tests */
+    test_upgrade_blocked();
+    test_upgrade_running();
+    test_upgrade_sleeping();
+    test_upgrade_module();
+
+    /* Fixed-point math tests */
+    test_math_ops();
+    test_math_fixed_point();
+
+    /* Call/return and stack frame tests */
+    test_call_ret_frames();
+    test_stack_gc_roots();
+    test_stack_faults();
+
+    /* Native (AOT) flow tests */
+    test_native_flow_lockstep();
+    test_native_resume_mixed();
+
     if (failures != 0) {
         fprintf(stderr, "regression failures=%d\n", failures);
         return 1;
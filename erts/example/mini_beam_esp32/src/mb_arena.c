@@ -0,0 +1,83 @@
+#include "mb_arena.h"
+
+#include <string.h>
+
+void mb_arena_init(mb_arena_t *arena, mb_term_t *mem, size_t words) {
+    memset(arena, 0, sizeof(*arena));
+    arena->base = mem;
+    arena->words = (mem != NULL) ? words : 0;
+}
+
+/* Class index of @p words and its block size; -1 if too large. */
+static int mb_arena_class(size_t words, size_t *size) {
+    size_t s = MB_ARENA_MIN_WORDS;
+    int c;
+
+    for (c = 0; c < MB_ARENA_CLASSES; c++) {
+        if (s >= words) {
+            *size = s;
+            return c;
+        }
+        /* 2^k -> 3 * 2^(k-1) -> 2^(k+1) */
+        s += (c & 1) ? s / 3 : s / 2;
+    }
+    return -1;
+}
+
+size_t mb_arena_round(size_t words) {
+    size_t size;
+    if (words == 0 || mb_arena_class(words, &size) < 0) {
+        return 0;
+    }
+    return size;
+}
+
+size_t mb_arena_round_down(size_t words) {
+    size_t s = MB_ARENA_MIN_WORDS, size = 0;
+    int c;
+
+    for (c = 0; c < MB_ARENA_CLASSES && s <= words; c++) {
+        size = s;
+        s += (c & 1) ? s / 3 : s / 2;
+    }
+    return size;
+}
+
+mb_term_t *mb_arena_alloc(mb_arena_t *arena, size_t words, size_t *granted) {
+    mb_term_t *block;
+    size_t size;
+    int c;
+
+    if (words == 0) {
+        return NULL;
+    }
+    c = mb_arena_class(words, &size);
+    if (c < 0) {
+        return NULL;
+    }
+    if (arena->free_head[c] != 0) {
+        block = &arena->base[arena->free_head[c] - 1U];
+        arena->free_head[c] = block[0];
+    } else if (arena->words - arena->top >= size) {
+        block = &arena->base[arena->top];
+        arena->top += size;
+    } else {
+        return NULL;
+    }
+    arena->in_use += size;
+    *granted = size;
+    return block;
+}
+
+void mb_arena_free(mb_arena_t *arena, mb_term_t *block, size_t granted) {
+    size_t size;
+    int c = mb_arena_class(granted, &size);
+
+    if (block == NULL || c < 0) {
+        return;
+    }
+    /* The free list is threaded through the blocks' first words. */
+    block[0] = arena->free_head[c];
+    arena->free_head[c] = (uint32_t)(block - arena->base) + 1U;
+    arena->in_use -= size;
+}
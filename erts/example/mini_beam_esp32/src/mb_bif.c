@@ -0,0 +1,180 @@
+#include "mb_bif.h"
+
+#include "mb_errors.h"
+#include "mb_hal.h"
+#include "mb_vm.h"
+
+#define MB_MAX_GPIO_PIN 39
+#define MB_MAX_PWM_CHANNEL 7
+#define MB_MAX_I2C_BUS 3
+#define MB_MAX_I2C_ADDR 0x7f
+#define MB_MAX_PWM_PERMILLE 1000
+#define MB_MAX_PWM_FREQUENCY_HZ 40000
+
+/* --- validation helpers (pure functions) --- */
+
+static int mb_validate_gpio_pin(int32_t pin) {
+    return pin >= 0 && pin <= MB_MAX_GPIO_PIN;
+}
+
+static int mb_validate_pwm_channel(int32_t channel) {
+    return channel >= 0 && channel <= MB_MAX_PWM_CHANNEL;
+}
+
+static int mb_validate_pwm_duty(int32_t permille) {
+    return permille >= 0 && permille <= MB_MAX_PWM_PERMILLE;
+}
+
+static int mb_validate_i2c_bus(int32_t bus) {
+    return bus >= 0 && bus <= MB_MAX_I2C_BUS;
+}
+
+static int mb_validate_i2c_addr(int32_t addr) {
+    return addr >= 0 && addr <= MB_MAX_I2C_ADDR;
+}
+
+static int mb_validate_u8_value(int32_t value) {
+    return value >= 0 && value <= 0xff;
+}
+
+static int mb_validate_pwm_frequency(int32_t frequency_hz) {
+    return frequency_hz > 0 && frequency_hz <= MB_MAX_PWM_FREQUENCY_HZ;
+}
+
+int mb_bif_validate_command(const mb_command_t *cmd) {
+    switch ((mb_command_type_t)cmd->type) {
+    case MB_CMD_NONE:
+        return MB_OK;
+    case MB_CMD_GPIO_WRITE:
+        return (mb_validate_gpio_pin(cmd->a) && (cmd->b == 0 || cmd->b == 1)) ? MB_OK : MB_BAD_ARGUMENT;
+    case MB_CMD_GPIO_READ:
+        return mb_validate_gpio_pin(cmd->a) ? MB_OK : MB_BAD_ARGUMENT;
+    case MB_CMD_PWM_SET_DUTY:
+        return (mb_validate_pwm_channel(cmd->a) && mb_validate_pwm_duty(cmd->b)) ? MB_OK : MB_BAD_ARGUMENT;
+    case MB_CMD_PWM_CONFIG:
+        return (mb_validate_pwm_channel(cmd->a) && mb_validate_pwm_frequency(cmd->b)) ? MB_OK : MB_BAD_ARGUMENT;
+    case MB_CMD_I2C_READ:
+        return (mb_validate_i2c_bus(cmd->a) && mb_validate_i2c_addr(cmd->b) && mb_validate_u8_value(cmd->c)) ? MB_OK : MB_BAD_ARGUMENT;
+    case MB_CMD_I2C_WRITE:
+        return (mb_validate_i2c_bus(cmd->a) && mb_validate_i2c_addr(cmd->b) &&
+                mb_validate_u8_value(cmd->c) && mb_validate_u8_value(cmd->d))
+                   ? MB_OK
+                   : MB_BAD_ARGUMENT;
+    default:
+        return MB_INVALID_COMMAND;
+    }
+}
+
+/* --- built-in HAL BIFs --- */
+
+/* Arguments are read as small integers; values are runtime data and are
+ * always validated, also for verified code. */
+#define ARG_INT(i) MB_GET_SMALLINT(args[(i)])
+
+static int mb_bif_gpio_write(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    int32_t pin = ARG_INT(0), level = ARG_INT(1);
+    (void)proc;
+    if (!mb_validate_gpio_pin(pin) || (level != 0 && level != 1))
+        return MB_BAD_ARGUMENT;
+    *result = MB_MAKE_SMALLINT(mb_hal_gpio_write((uint8_t)pin, (uint8_t)level));
+    return MB_OK;
+}
+
+static int mb_bif_gpio_read(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    int32_t pin = ARG_INT(0);
+    uint8_t level = 0;
+    int rc;
+    (void)proc;
+    if (!mb_validate_gpio_pin(pin)) return MB_BAD_ARGUMENT;
+    rc = mb_hal_gpio_read((uint8_t)pin, &level);
+    *result = MB_MAKE_SMALLINT((rc == 0) ? (int32_t)level : rc);
+    return MB_OK;
+}
+
+static int mb_bif_pwm_set_duty(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    int32_t ch = ARG_INT(0), duty = ARG_INT(1);
+    (void)proc;
+    if (!mb_validate_pwm_channel(ch) || !mb_validate_pwm_duty(duty))
+        return MB_BAD_ARGUMENT;
+    *result = MB_MAKE_SMALLINT(mb_hal_pwm_set_duty((uint8_t)ch, (uint16_t)duty));
+    return MB_OK;
+}
+
+static int mb_bif_pwm_config(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    int32_t ch = ARG_INT(0), freq = ARG_INT(1);
+    (void)proc;
+    if (!mb_validate_pwm_channel(ch) || !mb_validate_pwm_frequency(freq))
+        return MB_BAD_ARGUMENT;
+    *result = MB_MAKE_SMALLINT(mb_hal_pwm_config((uint8_t)ch, (uint32_t)freq));
+    return MB_OK;
+}
+
+static int mb_bif_i2c_read_reg(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    int32_t bus = ARG_INT(0), addr = ARG_INT(1), reg = ARG_INT(2);
+    uint8_t value = 0;
+    int rc;
+    (void)proc;
+    if (!mb_validate_i2c_bus(bus) || !mb_validate_i2c_addr(addr) ||
+        !mb_validate_u8_value(reg))
+        return MB_BAD_ARGUMENT;
+    rc = mb_hal_i2c_read_reg((uint8_t)bus, (uint8_t)addr, (uint8_t)reg, &value);
+    *result = MB_MAKE_SMALLINT((rc == 0) ? (int32_t)value : rc);
+    return MB_OK;
+}
+
+static int mb_bif_i2c_write_reg(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    int32_t bus = ARG_INT(0), addr = ARG_INT(1), reg = ARG_INT(2), val = ARG_INT(3);
+    (void)proc;
+    if (!mb_validate_i2c_bus(bus) || !mb_validate_i2c_addr(addr) ||
+        !mb_validate_u8_value(reg) || !mb_validate_u8_value(val))
+        return MB_BAD_ARGUMENT;
+    *result = MB_MAKE_SMALLINT(mb_hal_i2c_write_reg((uint8_t)bus, (uint8_t)addr,
+                                                    (uint8_t)reg, (uint8_t)val));
+    return MB_OK;
+}
+
+static int mb_bif_monotonic_ms(mb_process_t *proc, const mb_term_t *args, mb_term_t *result) {
+    (void)proc;
+    (void)args;
+    *result = MB_MAKE_SMALLINT((int32_t)mb_hal_monotonic_ms());
+    return MB_OK;
+}
+
+#undef ARG_INT
+
+/* --- table --- */
+
+mb_bif_entry_t mb_bif_table[MB_BIF_MAX] = {
+    [MB_BIF_GPIO_WRITE]    = {"gpio_write", mb_bif_gpio_write, 2, 1},
+    [MB_BIF_PWM_SET_DUTY]  = {"pwm_set_duty", mb_bif_pwm_set_duty, 2, 1},
+    [MB_BIF_I2C_READ_REG]  = {"i2c_read_reg", mb_bif_i2c_read_reg, 3, 1},
+    [MB_BIF_MONOTONIC_MS]  = {"monotonic_ms", mb_bif_monotonic_ms, 0, 1},
+    [MB_BIF_GPIO_READ]     = {"gpio_read", mb_bif_gpio_read, 1, 1},
+    [MB_BIF_I2C_WRITE_REG] = {"i2c_write_reg", mb_bif_i2c_write_reg, 4, 1},
+    [MB_BIF_PWM_CONFIG]    = {"pwm_config", mb_bif_pwm_config, 2, 1},
+};
+
+int mb_bif_register(uint8_t id, const char *name, uint8_t arity,
+                    uint8_t reduction_cost, mb_bif_fn fn) {
+    if (id == 0 || id >= MB_BIF_MAX || mb_bif_table[id].fn != NULL) {
+        return MB_BAD_BIF;
+    }
+    if (arity > MB_BIF_MAX_ARITY) {
+        return MB_BAD_ARGC;
+    }
+    if (fn == NULL || reduction_cost == 0) {
+        return MB_BAD_ARGUMENT;
+    }
+    mb_bif_table[id].name = name;
+    mb_bif_table[id].arity = arity;
+    mb_bif_table[id].cost = reduction_cost;
+    mb_bif_table[id].fn = fn;
+    return MB_OK;
+}
+
+const mb_bif_entry_t *mb_bif_lookup(uint8_t id) {
+    if (id >= MB_BIF_MAX || mb_bif_table[id].fn == NULL) {
+        return NULL;
+    }
+    return &mb_bif_table[id];
+}
@@ -0,0 +1,870 @@
+#include "mb_code.h"
+
+#include <string.h>
+
+#include "mb_arena.h"
+#include "mb_bif.h"
+#include "mb_errors.h"
+#include "mb_term.h"
+#include "mb_types.h"
+#include "mb_vm.h"
+
+#define MB_CODE_NO_TARGET 0xFFFFFFFFU
+
+/* --- byte cursor over the source program --- */
+
+typedef struct {
+    const uint8_t *program;
+    size_t         size;
+    size_t         pos;
+    uint32_t      *case_val;     /* receive the case tables, NULL: only count */
+    uint32_t      *case_target;
+    uint8_t        ncases;
+    /* compact encoding (see mb_code.h) */
+    int            compact;
+    int            wide;  /* WIDE prefix seen: 16-bit offsets */
+    const uint8_t *pool;  /* literal pool, npool little-endian int32s */
+    uint32_t       npool;
+} mb_decoder_t;
+
+static int mb_dec_u8(mb_decoder_t *d, uint8_t *out) {
+    if (d->pos >= d->size) {
+        return MB_EOF;
+    }
+    *out = d->program[d->pos++];
+    return MB_OK;
+}
+
+static int mb_dec_i32(mb_decoder_t *d, int32_t *out) {
+    uint32_t v;
+    if (d->size - d->pos < 4U) {
+        d->pos = d->size;
+        return MB_EOF;
+    }
+    v = (uint32_t)d->program[d->pos] |
+        ((uint32_t)d->program[d->pos + 1] << 8) |
+        ((uint32_t)d->program[d->pos + 2] << 16) |
+        ((uint32_t)d->program[d->pos + 3] << 24);
+    d->pos += 4;
+    *out = (int32_t)v;
+    return MB_OK;
+}
+
+/* LEB128, at most 5 bytes; a longer one is undecodable, as truncation. */
+static int mb_dec_uvarint(mb_decoder_t *d, uint32_t *out) {
+    uint32_t v = 0;
+    uint8_t b, shift;
+    for (shift = 0; shift < 35; shift = (uint8_t)(shift + 7U)) {
+        if (mb_dec_u8(d, &b) != MB_OK) {
+            return MB_EOF;
+        }
+        v |= (uint32_t)(b & 0x7FU) << shift;
+        if ((b & 0x80U) == 0) {
+            *out = v;
+            return MB_OK;
+        }
+    }
+    return MB_EOF;
+}
+
+/* Zigzag LEB128: 0, -1, 1, -2, ... encode as 0, 1, 2, 3, ... */
+static int mb_dec_varint(mb_decoder_t *d, int32_t *out) {
+    uint32_t v;
+    if (mb_dec_uvarint(d, &v) != MB_OK) {
+        return MB_EOF;
+    }
+    *out = (int32_t)((v >> 1) ^ (0U - (v & 1U)));
+    return MB_OK;
+}
+
+/* Integer immediate: int32 in v1, varint in compact code. */
+static int mb_dec_imm(mb_decoder_t *d, int32_t *out) {
+    return d->compact ? mb_dec_varint(d, out) : mb_dec_i32(d, out);
+}
+
+/* Jump offset: int32 in v1; int8, or int16 after WIDE, in compact code. */
+static int mb_dec_off(mb_decoder_t *d, int32_t *out) {
+    uint8_t lo, hi;
+    if (!d->compact) {
+        return mb_dec_i32(d, out);
+    }
+    if (mb_dec_u8(d, &lo) != MB_OK) {
+        return MB_EOF;
+    }
+    if (!d->wide) {
+        *out = (int8_t)lo;
+        return MB_OK;
+    }
+    if (mb_dec_u8(d, &hi) != MB_OK) {
+        return MB_EOF;
+    }
+    *out = (int16_t)(uint16_t)(lo | ((uint16_t)hi << 8));
+    return MB_OK;
+}
+
+static int mb_dec_valid_reg(uint8_t reg) {
+    return reg < MB_REG_COUNT;
+}
+
+/*
+ * Fetch n register operands, then validate them (fetch-all-then-check,
+ * so truncation wins over a bad register, as in the byte interpreter).
+ */
+static int mb_dec_regs(mb_decoder_t *d, mb_insn_t *in, uint8_t n, uint8_t n_checked, int *stop) {
+    uint8_t i;
+    for (i = 0; i < n; i++) {
+        if (mb_dec_u8(d, &in->r[i]) != MB_OK) {
+            *stop = 1;
+            return MB_EOF;
+        }
+    }
+    for (i = 0; i < n_checked; i++) {
+        if (!mb_dec_valid_reg(in->r[i])) {
+            return MB_BAD_REG;
+        }
+    }
+    return MB_OK;
+}
+
+/* Relative offset is taken from the byte after the instruction. */
+static uint32_t mb_dec_target(const mb_decoder_t *d, int32_t offset) {
+    int64_t target = (int64_t)d->pos + offset;
+    if (target < 0 || (uint64_t)target > (uint64_t)d->size) {
+        return MB_CODE_NO_TARGET;
+    }
+    return (uint32_t)target;
+}
+
+/* dst, src registers followed by a raw int32 operand. */
+static int mb_dec_regs_imm(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    int32_t val;
+    if (mb_dec_u8(d, &in->r[0]) != MB_OK || mb_dec_u8(d, &in->r[1]) != MB_OK ||
+        mb_dec_imm(d, &val) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    in->imm = (uint32_t)val;
+    if (!mb_dec_valid_reg(in->r[0]) || !mb_dec_valid_reg(in->r[1])) {
+        return MB_BAD_REG;
+    }
+    return MB_OK;
+}
+
+/* Register, int32 literal (stored tagged), relative jump offset. */
+static int mb_dec_reg_lit_jump(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    int32_t val, offset;
+    if (mb_dec_u8(d, &in->r[0]) != MB_OK || mb_dec_imm(d, &val) != MB_OK ||
+        mb_dec_off(d, &offset) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    in->lit = MB_MAKE_SMALLINT(val);
+    in->imm = mb_dec_target(d, offset);
+    return mb_dec_valid_reg(in->r[0]) ? MB_OK : MB_BAD_REG;
+}
+
+/* n register operands followed by a relative jump offset. */
+static int mb_dec_regs_jump(mb_decoder_t *d, mb_insn_t *in, uint8_t n, int *stop) {
+    int32_t offset;
+    uint8_t i;
+    for (i = 0; i < n; i++) {
+        if (mb_dec_u8(d, &in->r[i]) != MB_OK) {
+            *stop = 1;
+            return MB_EOF;
+        }
+    }
+    if (mb_dec_off(d, &offset) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    in->imm = mb_dec_target(d, offset);
+    for (i = 0; i < n; i++) {
+        if (!mb_dec_valid_reg(in->r[i])) {
+            return MB_BAD_REG;
+        }
+    }
+    return MB_OK;
+}
+
+static int mb_dec_call_bif(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    uint8_t argc, reg, i;
+    int st = MB_OK;
+
+    if (mb_dec_u8(d, &in->r[0]) != MB_OK || mb_dec_u8(d, &argc) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    if (argc > 8) {
+        *stop = 1;
+        return MB_BAD_ARGC;
+    }
+    in->r[1] = argc;
+    for (i = 0; i < argc; i++) {
+        if (mb_dec_u8(d, &reg) != MB_OK) {
+            *stop = 1;
+            return (st != MB_OK) ? st : MB_EOF;
+        }
+        if (!mb_dec_valid_reg(reg) && st == MB_OK) {
+            st = MB_BAD_REG;
+        }
+        in->imm |= (uint32_t)(reg & 0x0FU) << (4U * i);
+    }
+    if (mb_dec_u8(d, &in->r[2]) != MB_OK) {
+        *stop = 1;
+        return (st != MB_OK) ? st : MB_EOF;
+    }
+    if (st == MB_OK && !mb_dec_valid_reg(in->r[2])) {
+        st = MB_BAD_REG;
+    }
+    return st;
+}
+
+static int mb_dec_make_tuple(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    uint8_t arity, reg, i;
+    int st = MB_OK;
+
+    if (mb_dec_u8(d, &in->r[0]) != MB_OK || mb_dec_u8(d, &arity) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    if (arity > MB_MAX_TUPLE_ARITY) {
+        *stop = 1;
+        return MB_BAD_ARITY;
+    }
+    if (!mb_dec_valid_reg(in->r[0])) {
+        st = MB_BAD_REG;
+    }
+    in->r[1] = arity;
+    in->imm = (uint32_t)d->pos;
+    for (i = 0; i < arity; i++) {
+        if (mb_dec_u8(d, &reg) != MB_OK) {
+            *stop = 1;
+            return (st != MB_OK) ? st : MB_EOF;
+        }
+        if (!mb_dec_valid_reg(reg) && st == MB_OK) {
+            st = MB_BAD_REG;
+        }
+    }
+    return st;
+}
+
+/*
+ * LUT: dst, src, mode, shift, u16 n, then n entries of the mode's width
+ * (little-endian), read in place at run time.
+ */
+static int mb_dec_lut(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    uint8_t lo, hi;
+    uint32_t n, width;
+    int st = mb_dec_regs(d, in, 4, 2, stop);
+
+    if (*stop || mb_dec_u8(d, &lo) != MB_OK || mb_dec_u8(d, &hi) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    n = (uint32_t)lo | ((uint32_t)hi << 8);
+    if ((in->r[2] & MB_LUT_WIDTH) == 3U || (in->r[2] & ~0x0FU) != 0 || n == 0) {
+        *stop = 1;
+        return MB_BAD_ARGUMENT;
+    }
+    width = 1U << (in->r[2] & MB_LUT_WIDTH);
+    if (d->size - d->pos < n * width) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    in->imm = (uint32_t)d->pos;
+    in->lit = n;
+    d->pos += n * width;
+    if (st == MB_OK && in->r[3] > MB_LUT_MAX_SHIFT) {
+        st = MB_BAD_ARGUMENT;
+    }
+    return st;
+}
+
+/* TEST_ARITY: register, arity, fail offset. */
+static int mb_dec_test_arity(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    int32_t offset;
+
+    if (mb_dec_u8(d, &in->r[0]) != MB_OK || mb_dec_u8(d, &in->r[1]) != MB_OK ||
+        mb_dec_off(d, &offset) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    in->imm = mb_dec_target(d, offset);
+    if (!mb_dec_valid_reg(in->r[0])) {
+        return MB_BAD_REG;
+    }
+    return (in->r[1] > MB_MAX_TUPLE_ARITY) ? MB_BAD_ARITY : MB_OK;
+}
+
+/* GET_TUPLE_ELEMENTS: tuple, first destination, count. */
+static int mb_dec_get_tuple_elements(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    int st = mb_dec_regs(d, in, 3, 2, stop);
+    if (st != MB_OK) {
+        return st;
+    }
+    if (in->r[2] > MB_REG_COUNT - in->r[1]) {
+        return MB_BAD_REG;
+    }
+    return MB_OK;
+}
+
+/* SPAWN: dst, entry id, then argc registers starting at first. */
+static int mb_dec_spawn(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    int st = mb_dec_regs(d, in, 4, 1, stop);
+    if (st != MB_OK) {
+        return st;
+    }
+    if (in->r[3] > MB_REG_COUNT || in->r[2] > MB_REG_COUNT - in->r[3]) {
+        return MB_BAD_REG;
+    }
+    return MB_OK;
+}
+
+/*
+ * SELECT_VAL: src, n, fail offset, then n (value, offset) pairs.
+ * JUMP_TABLE: src, n, base, fail offset, then n offsets.
+ * Every offset is relative to the end of the whole instruction.  Values
+ * are stored tagged and sorted (stably, so the first of equal values
+ * wins) for the interpreter's binary search.
+ */
+static int mb_dec_cases(mb_decoder_t *d, mb_insn_t *in, int dense, int *stop) {
+    uint32_t *vals = d->case_val, *targets = d->case_target;
+    int32_t base = 0, fail, val = 0, offset;
+    uint8_t n, i, first = d->ncases;
+    int room;
+
+    if (mb_dec_u8(d, &in->r[0]) != MB_OK || mb_dec_u8(d, &n) != MB_OK ||
+        (dense && mb_dec_imm(d, &base) != MB_OK) || mb_dec_off(d, &fail) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    room = ((size_t)first + n <= MB_CODE_MAX_CASES);
+    for (i = 0; i < n; i++) {
+        if ((!dense && mb_dec_imm(d, &val) != MB_OK) || mb_dec_off(d, &offset) != MB_OK) {
+            *stop = 1;
+            return MB_EOF;
+        }
+        if (room && vals != NULL) {
+            vals[first + i] = MB_MAKE_SMALLINT(val);
+            targets[first + i] = (uint32_t)offset;  /* raw offset for now */
+        }
+    }
+    if (!room) {
+        return MB_CODE_TOO_LARGE;
+    }
+
+    d->ncases = (uint8_t)(first + n);
+    for (i = 0; i < n && vals != NULL; i++) {
+        targets[first + i] = mb_dec_target(d, (int32_t)targets[first + i]);
+    }
+    for (i = 1; i < n && !dense && vals != NULL; i++) {
+        uint32_t v = vals[first + i];
+        uint32_t t = targets[first + i];
+        uint8_t j = i;
+        while (j > 0 && vals[first + j - 1] > v) {
+            vals[first + j] = vals[first + j - 1];
+            targets[first + j] = targets[first + j - 1];
+            j--;
+        }
+        vals[first + j] = v;
+        targets[first + j] = t;
+    }
+
+    in->r[1] = n;
+    in->r[2] = first;
+    in->imm = mb_dec_target(d, fail);
+    in->lit = (uint32_t)base;
+    return mb_dec_valid_reg(in->r[0]) ? MB_OK : MB_BAD_REG;
+}
+
+static int mb_insn_is_jump(const mb_insn_t *in);
+
+/* CONST_LIT: register, pool index; decodes to CONST_I32. */
+static int mb_dec_const_lit(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    uint32_t idx;
+    const uint8_t *p;
+
+    if (!d->compact) {
+        *stop = 1;
+        return MB_BAD_OPCODE;
+    }
+    if (mb_dec_u8(d, &in->r[0]) != MB_OK || mb_dec_uvarint(d, &idx) != MB_OK) {
+        *stop = 1;
+        return MB_EOF;
+    }
+    if (idx >= d->npool) {
+        return MB_BAD_ARGUMENT;
+    }
+    if (!mb_dec_valid_reg(in->r[0])) {
+        return MB_BAD_REG;
+    }
+    p = d->pool + 4U * idx;
+    in->op = MB_OP_CONST_I32;
+    in->imm = MB_MAKE_SMALLINT((int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                                         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)));
+    return MB_OK;
+}
+
+/* Decode one instruction at d->pos; *stop is set when the length is unknown. */
+static int mb_dec_insn(mb_decoder_t *d, mb_insn_t *in, int *stop) {
+    int32_t val;
+
+    /* pool blocks are recycled: clear what the previous image left here */
+    memset(in, 0, sizeof(*in));
+    d->wide = 0;
+    (void)mb_dec_u8(d, &in->op);
+    if (d->compact && in->op == MB_OP_WIDE) {
+        /* prefix: 16-bit offsets for the jump that follows */
+        d->wide = 1;
+        if (mb_dec_u8(d, &in->op) != MB_OK) {
+            *stop = 1;
+            return MB_EOF;
+        }
+        if (!mb_insn_is_jump(in)) {
+            *stop = 1;
+            return MB_BAD_OPCODE;
+        }
+    }
+
+    switch ((mb_opcode_t)in->op) {
+    case MB_OP_NOP:
+    case MB_OP_YIELD:
+    case MB_OP_RET:
+    case MB_OP_EXIT:
+    case MB_OP_HALT:
+        return MB_OK;
+
+    case MB_OP_CONST_I32:
+        if (mb_dec_u8(d, &in->r[0]) != MB_OK || mb_dec_imm(d, &val) != MB_OK) {
+            *stop = 1;
+            return MB_EOF;
+        }
+        if (!mb_dec_valid_reg(in->r[0])) {
+            return MB_BAD_REG;
+        }
+        in->imm = MB_MAKE_SMALLINT(val);
+        return MB_OK;
+
+    case MB_OP_MOVE:
+    case MB_OP_ADD:
+    case MB_OP_SUB:
+    case MB_OP_MUL:
+    case MB_OP_DIV:
+    case MB_OP_REM:
+    case MB_OP_SHL:
+    case MB_OP_SHR:
+    case MB_OP_AND:
+    case MB_OP_OR:
+    case MB_OP_XOR:
+    case MB_OP_MIN:
+    case MB_OP_MAX:
+    case MB_OP_QMUL:
+    case MB_OP_CONS:
+        return mb_dec_regs(d, in, 3, 3, stop);
+
+    case MB_OP_CLAMP:
+        return mb_dec_regs(d, in, 4, 4, stop);
+
+    case MB_OP_LUT:
+        return mb_dec_lut(d, in, stop);
+
+    case MB_OP_CONST_LIT:
+        return mb_dec_const_lit(d, in, stop);
+
+    case MB_OP_ADD_IMM:
+    case MB_OP_SUB_IMM:
+        return mb_dec_regs_imm(d, in, stop);
+
+    case MB_OP_TUPLE_ELEM:
+        /* third operand is an element index, not a register */
+        return mb_dec_regs(d, in, 3, 2, stop);
+
+    case MB_OP_HEAD:
+    case MB_OP_TAIL:
+        return mb_dec_regs(d, in, 2, 2, stop);
+
+    case MB_OP_IS_INTEGER:
+    case MB_OP_IS_NIL:
+    case MB_OP_IS_CONS:
+    case MB_OP_IS_TUPLE:
+        return mb_dec_regs_jump(d, in, 1, stop);
+
+    case MB_OP_TEST_ARITY:
+        return mb_dec_test_arity(d, in, stop);
+
+    case MB_OP_IS_EQ_EXACT:
+        return mb_dec_regs_jump(d, in, 2, stop);
+
+    case MB_OP_GET_TUPLE_ELEMENTS:
+        return mb_dec_get_tuple_elements(d, in, stop);
+
+    case MB_OP_SELF:
+    case MB_OP_SLEEP_MS:
+        return mb_dec_regs(d, in, 1, 1, stop);
+
+    case MB_OP_ALLOCATE:
+    case MB_OP_DEALLOCATE:
+        /* slot count, not a register */
+        return mb_dec_regs(d, in, 1, 0, stop);
+
+    case MB_OP_GET_Y:
+    case MB_OP_PUT_Y:
+        /* Y index is checked against the live stack at run time */
+        return mb_dec_regs(d, in, 2, 1, stop);
+
+    case MB_OP_RECV_CMD:
+    case MB_OP_I2C_SAMPLE:
+        return mb_dec_regs(d, in, 5, 5, stop);
+
+    case MB_OP_SEND_WAIT:
+        return mb_dec_regs_jump(d, in, 7, stop);
+
+    case MB_OP_RECV_PWM:
+        return mb_dec_regs_jump(d, in, 6, stop);
+
+    case MB_OP_SEND:
+        return mb_dec_regs(d, in, 6, 6, stop);
+
+    case MB_OP_SPAWN:
+        return mb_dec_spawn(d, in, stop);
+
+    case MB_OP_CALL_BIF:
+        return mb_dec_call_bif(d, in, stop);
+
+    case MB_OP_MAKE_TUPLE:
+        return mb_dec_make_tuple(d, in, stop);
+
+    case MB_OP_JMP:
+    case MB_OP_CALL:
+        if (mb_dec_off(d, &val) != MB_OK) {
+            *stop = 1;
+            return MB_EOF;
+        }
+        in->imm = mb_dec_target(d, val);
+        return MB_OK;
+
+    case MB_OP_JMP_IF_ZERO:
+    case MB_OP_DJNZ:
+        return mb_dec_regs_jump(d, in, 1, stop);
+
+    case MB_OP_JMP_EQ:
+    case MB_OP_JMP_NE:
+    case MB_OP_JMP_LT:
+    case MB_OP_JMP_GE:
+        return mb_dec_regs_jump(d, in, 2, stop);
+
+    case MB_OP_JMP_EQ_IMM:
+    case MB_OP_JMP_NE_IMM:
+    case MB_OP_JMP_LT_IMM:
+    case MB_OP_JMP_GE_IMM:
+        return mb_dec_reg_lit_jump(d, in, stop);
+
+    case MB_OP_SELECT_VAL:
+        return mb_dec_cases(d, in, 0, stop);
+
+    case MB_OP_JUMP_TABLE:
+        return mb_dec_cases(d, in, 1, stop);
+
+    default:
+        *stop = 1;
+        return MB_BAD_OPCODE;
+    }
+}
+
+static void mb_code_trap(mb_insn_t *in, int status) {
+    memset(in, 0, sizeof(*in));
+    in->op = MB_INSN_TRAP;
+    in->imm = (uint32_t)status;
+}
+
+static int mb_insn_is_jump(const mb_insn_t *in) {
+    switch (in->op) {
+    case MB_OP_JMP:
+    case MB_OP_CALL:
+    case MB_OP_JMP_IF_ZERO:
+    case MB_OP_JMP_EQ:
+    case MB_OP_JMP_NE:
+    case MB_OP_JMP_LT:
+    case MB_OP_JMP_GE:
+    case MB_OP_JMP_EQ_IMM:
+    case MB_OP_JMP_NE_IMM:
+    case MB_OP_JMP_LT_IMM:
+    case MB_OP_JMP_GE_IMM:
+    case MB_OP_DJNZ:
+    case MB_OP_SEND_WAIT:
+    case MB_OP_RECV_PWM:
+    case MB_OP_SELECT_VAL:
+    case MB_OP_JUMP_TABLE:
+    case MB_OP_IS_INTEGER:
+    case MB_OP_IS_NIL:
+    case MB_OP_IS_CONS:
+    case MB_OP_IS_TUPLE:
+    case MB_OP_TEST_ARITY:
+    case MB_OP_IS_EQ_EXACT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Checks the interpreter would otherwise make on every CALL_BIF. */
+static int mb_code_verify_bif(const mb_insn_t *in) {
+    const mb_bif_entry_t *bif = mb_bif_lookup(in->r[0]);
+    if (bif == NULL) {
+        return MB_BAD_BIF;
+    }
+    return (bif->arity == in->r[1]) ? MB_OK : MB_BAD_ARGC;
+}
+
+/* Map a byte offset to the instruction starting there, or to the end trap. */
+static uint32_t mb_code_resolve(const uint32_t *starts, uint32_t count, uint32_t target) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2U;
+        if (starts[mid] < target) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < count && starts[lo] == target) {
+        return lo;
+    }
+    return count;
+}
+
+/*
+ * One pass over the program.  With @p insns NULL it only counts, the
+ * instructions and (in d->ncases) the case entries, so the image can be
+ * sized before the second pass decodes into it.  Returns the number of
+ * instructions before the EOF trap.
+ */
+static uint32_t mb_code_scan(mb_decoder_t *d, const uint8_t *program, size_t program_size,
+                             mb_insn_t *insns, uint32_t *starts, int *first_fault) {
+    mb_insn_t scratch;
+    uint32_t n = 0;
+    int stop = 0;
+
+    d->program = program;
+    d->size = (program != NULL) ? program_size : 0;
+    d->pos = 0;
+    d->ncases = 0;
+    d->compact = 0;
+    d->wide = 0;
+    d->pool = NULL;
+    d->npool = 0;
+    *first_fault = MB_OK;
+
+    /* Compact header: marker, literal count, literals; code follows. */
+    if (d->size > 0 && program[0] == MB_CODE_COMPACT_MAGIC) {
+        d->compact = 1;
+        d->pos = 1;
+        if (mb_dec_uvarint(d, &d->npool) != MB_OK || d->npool > (d->size - d->pos) / 4U) {
+            stop = 1;
+            *first_fault = MB_EOF;
+        } else {
+            d->pool = program + d->pos;
+            d->pos += 4U * d->npool;
+        }
+    }
+
+    while (!stop && d->pos < d->size) {
+        mb_insn_t *in = (insns != NULL) ? &insns[n] : &scratch;
+        int st;
+        if (starts != NULL) {
+            starts[n] = (uint32_t)d->pos;
+        }
+        st = mb_dec_insn(d, in, &stop);
+        if (st != MB_OK) {
+            mb_code_trap(in, st);
+            if (*first_fault == MB_OK) {
+                *first_fault = st;
+            }
+        }
+        n++;
+    }
+    if (insns != NULL) {
+        mb_code_trap(&insns[n], MB_EOF);
+    }
+    return n;
+}
+
+/*
+ * Resolve jumps and run the verifier checks in the same pass.  A jump
+ * that resolves to the end trap is legal for the checked interpreter
+ * (it reports MB_EOF) but disqualifies the program from trusted mode.
+ */
+static int mb_code_link(mb_insn_t *insns, uint32_t n, uint32_t *case_target,
+                        const uint32_t *starts, int first_fault) {
+    int status = first_fault;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        mb_insn_t *in = &insns[i];
+        int st = MB_OK;
+        if (mb_insn_is_jump(in)) {
+            in->imm = (in->imm == MB_CODE_NO_TARGET)
+                          ? n
+                          : mb_code_resolve(starts, n, in->imm);
+            if (in->imm == n) {
+                st = MB_BAD_JUMP;
+            }
+            if (in->op == MB_OP_SELECT_VAL || in->op == MB_OP_JUMP_TABLE) {
+                uint32_t *t = &case_target[in->r[2]];
+                uint8_t k;
+                for (k = 0; k < in->r[1]; k++) {
+                    t[k] = (t[k] == MB_CODE_NO_TARGET) ? n : mb_code_resolve(starts, n, t[k]);
+                    if (t[k] == n) {
+                        st = MB_BAD_JUMP;
+                    }
+                }
+            }
+        } else if (in->op == MB_OP_CALL_BIF) {
+            st = mb_code_verify_bif(in);
+        }
+        if (status == MB_OK) {
+            status = st;
+        }
+    }
+    return status;
+}
+
+/* --- image store --- */
+
+#define MB_INSN_WORDS (sizeof(mb_insn_t) / sizeof(mb_term_t))
+
+static mb_code_t  mb_code_images[MB_CODE_IMAGES];
+static mb_term_t  mb_code_mem[MB_CODE_POOL_WORDS];
+static mb_arena_t mb_code_arena;
+static int        mb_code_ready;
+
+/* Handed out when the store has no room: faults at the first instruction. */
+static const mb_insn_t mb_code_full_insn = {MB_INSN_TRAP, {0}, (uint32_t)MB_CODE_TOO_LARGE, 0};
+static const mb_code_t mb_code_full = {
+    &mb_code_full_insn, 0, NULL, NULL, 0, MB_CODE_TOO_LARGE, NULL, 0, 0, 0, NULL, 0
+};
+
+static mb_arena_t *mb_code_pool(void) {
+    if (!mb_code_ready) {
+        mb_arena_init(&mb_code_arena, mb_code_mem, MB_CODE_POOL_WORDS);
+        mb_code_ready = 1;
+    }
+    return &mb_code_arena;
+}
+
+/*
+ * FNV-1a over the bytecode.  Part of the key so that an image still held
+ * for a dead buffer (a process that was never released) is not handed
+ * to a different program that later occupies the same address.
+ */
+static uint32_t mb_code_hash(const uint8_t *program, size_t program_size) {
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    for (i = 0; program != NULL && i < program_size; i++) {
+        h = (h ^ program[i]) * 16777619U;
+    }
+    return h;
+}
+
+const mb_code_t *mb_code_get(const uint8_t *program, size_t program_size) {
+    mb_arena_t *pool = mb_code_pool();
+    uint32_t hash = mb_code_hash(program, program_size);
+    mb_code_t *code = NULL;
+    mb_decoder_t d;
+    mb_term_t *mem, *starts;
+    size_t words, starts_words;
+    uint32_t n;
+    int first_fault;
+    unsigned i;
+
+    for (i = 0; i < MB_CODE_IMAGES; i++) {
+        mb_code_t *img = &mb_code_images[i];
+        if (img->refs == 0) {
+            code = (code == NULL) ? img : code;
+        } else if (img->program == program && img->program_size == program_size &&
+                   img->hash == hash) {
+            img->refs++;
+            return img;
+        }
+    }
+    if (code == NULL) {
+        return &mb_code_full;
+    }
+
+    /* Size the image, then decode into it. */
+    d.case_val = NULL;
+    d.case_target = NULL;
+    n = mb_code_scan(&d, program, program_size, NULL, NULL, &first_fault);
+    mem = mb_arena_alloc(pool, (n + 1U) * MB_INSN_WORDS + 2U * d.ncases, &words);
+    starts = mb_arena_alloc(pool, (n > 0) ? n : 1U, &starts_words);
+    if (mem == NULL || starts == NULL) {
+        mb_arena_free(pool, mem, words);
+        mb_arena_free(pool, starts, starts_words);
+        return &mb_code_full;
+    }
+    d.case_val = mem + (n + 1U) * MB_INSN_WORDS;
+    d.case_target = d.case_val + d.ncases;
+    (void)mb_code_scan(&d, program, program_size, (mb_insn_t *)mem, starts, &first_fault);
+
+    code->insns = (const mb_insn_t *)mem;
+    code->count = n;
+    code->case_val = d.case_val;
+    code->case_target = d.case_target;
+    code->ncases = d.ncases;
+    code->verify_status = mb_code_link((mb_insn_t *)mem, n, d.case_target, starts, first_fault);
+    code->program = program;
+    code->program_size = program_size;
+    code->hash = hash;
+    code->refs = 1;
+    code->mem = mem;
+    code->words = words;
+    mb_arena_free(pool, starts, starts_words);
+    return code;
+}
+
+void mb_code_put(const mb_code_t *code) {
+    unsigned i;
+
+    for (i = 0; code != NULL && i < MB_CODE_IMAGES; i++) {
+        mb_code_t *img = &mb_code_images[i];
+        if (img == code && img->refs > 0 && --img->refs == 0) {
+            mb_arena_free(mb_code_pool(), img->mem, img->words);
+            memset(img, 0, sizeof(*img));
+        }
+    }
+}
+
+size_t mb_code_pool_in_use(void) {
+    return mb_code_pool()->in_use;
+}
+
+int mb_code_is_loop_head(const mb_code_t *code, size_t pc) {
+    size_t i;
+
+    for (i = pc; i < code->count; i++) {
+        const mb_insn_t *in = &code->insns[i];
+        if (!mb_insn_is_jump(in) || in->op == MB_OP_CALL) {
+            continue;
+        }
+        if (in->imm == pc) {
+            return 1;
+        }
+        if (in->op == MB_OP_SELECT_VAL || in->op == MB_OP_JUMP_TABLE) {
+            uint8_t k;
+            for (k = 0; k < in->r[1]; k++) {
+                if (code->case_target[in->r[2] + k] == pc) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int mb_verify_program(const uint8_t *program, size_t program_size) {
+    const mb_code_t *code = mb_code_get(program, program_size);
+    int status = code->verify_status;
+    mb_code_put(code);
+    return status;
+}
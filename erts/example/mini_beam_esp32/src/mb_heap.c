@@ -2,16 +2,155 @@
 
 #include <string.h>
 
-void mb_heap_init(mb_heap_t *heap) {
+void mb_heap_init(mb_heap_t *heap, mb_term_t *mem, size_t words) {
+    memset(heap, 0, sizeof(*heap));
+    if (mem == NULL || words == 0) {
+        return;
+    }
+    memset(mem, 0, 2 * words * sizeof(mb_term_t));
+    heap->from = mem;
+    heap->to = mem + words;
+    heap->capacity = words;
+    heap->stop = words;
+}
+
+int mb_heap_init_arena(mb_heap_t *heap, mb_arena_t *arena, size_t words) {
+    size_t granted = 0;
+
+    memset(heap, 0, sizeof(*heap));
+    if (words == 0) {
+        return 0;
+    }
+    heap->from = mb_arena_alloc(arena, words, &granted);
+    if (heap->from != NULL) {
+        heap->to = mb_arena_alloc(arena, words, &granted);
+    }
+    if (heap->to == NULL) {
+        mb_arena_free(arena, heap->from, granted);
+        heap->from = NULL;
+        return -1;
+    }
+    memset(heap->from, 0, granted * sizeof(mb_term_t));
+    memset(heap->to, 0, granted * sizeof(mb_term_t));
+    heap->arena = arena;
+    heap->capacity = granted;
+    heap->stop = granted;
+    heap->min_words = granted;
+    heap->max_words = granted;
+    return 0;
+}
+
+/*
+ * Make @p scratch at least @p words words.  The old block goes back to
+ * the arena first and, if the larger one does not fit, comes straight
+ * back (LIFO free lists), leaving the scratch as it was.
+ */
+static int mb_heap_scratch_reserve(mb_heap_scratch_t *scratch, mb_arena_t *arena,
+                                   size_t words) {
+    size_t granted = 0;
+    mb_term_t *mem;
+
+    if (scratch->words >= words) {
+        return 0;
+    }
+    mb_arena_free(arena, scratch->mem, scratch->words);
+    mem = mb_arena_alloc(arena, words, &granted);
+    if (mem == NULL) {
+        scratch->mem = mb_arena_alloc(arena, scratch->words, &granted);
+        return -1;
+    }
+    scratch->mem = mem;
+    scratch->words = granted;
+    return 0;
+}
+
+int mb_heap_init_shared(mb_heap_t *heap, mb_arena_t *arena,
+                        mb_heap_scratch_t *scratch, size_t words) {
+    size_t granted = 0;
+
+    memset(heap, 0, sizeof(*heap));
+    if (words == 0) {
+        return 0;
+    }
+    heap->from = mb_arena_alloc(arena, words, &granted);
+    if (heap->from == NULL) {
+        return -1;
+    }
+    if (mb_heap_scratch_reserve(scratch, arena, granted) != 0) {
+        mb_arena_free(arena, heap->from, granted);
+        heap->from = NULL;
+        return -1;
+    }
+    memset(heap->from, 0, granted * sizeof(mb_term_t));
+    heap->arena = arena;
+    heap->scratch = scratch;
+    heap->capacity = granted;
+    heap->stop = granted;
+    heap->min_words = granted;
+    heap->max_words = granted;
+    return 0;
+}
+
+/*
+ * Usable words of a compact heap in an arena block of @p block words;
+ * the rest holds a mark bit per block word and the forwarding table.
+ * It rounds back up to the block's class, so the arena calls take the
+ * capacity as the block size.
+ */
+static size_t mb_heap_compact_words(size_t block) {
+    return block - (block + 31) / 32 - (block + MB_COMPACT_CHUNK - 1) / MB_COMPACT_CHUNK;
+}
+
+int mb_heap_init_compact(mb_heap_t *heap, mb_arena_t *arena, size_t words) {
+    size_t granted = 0;
+    mb_term_t *block;
+
+    memset(heap, 0, sizeof(*heap));
+    if (words == 0) {
+        return 0;
+    }
+    block = mb_arena_alloc(arena, words, &granted);
+    if (block != NULL && mb_heap_compact_words(granted) < words) {
+        mb_arena_free(arena, block, granted);
+        block = mb_arena_alloc(arena, granted + 1, &granted);
+    }
+    if (block == NULL) {
+        return -1;
+    }
+    memset(block, 0, granted * sizeof(mb_term_t));
+    heap->from = block;
+    heap->arena = arena;
+    heap->capacity = mb_heap_compact_words(granted);
+    heap->marks = block + heap->capacity;
+    heap->stop = heap->capacity;
+    heap->min_words = heap->capacity;
+    heap->max_words = heap->capacity;
+    return 0;
+}
+
+void mb_heap_set_limits(mb_heap_t *heap, size_t min_words, size_t max_words) {
+    heap->min_words = min_words;
+    heap->max_words = (max_words < MB_HEAP_MAX_WORDS) ? max_words : MB_HEAP_MAX_WORDS;
+}
+
+void mb_heap_set_fullsweep(mb_heap_t *heap, uint16_t fullsweep_after) {
+    if (heap->arena != NULL && heap->marks == NULL) {
+        heap->fullsweep_after = fullsweep_after;
+    }
+}
+
+void mb_heap_release(mb_heap_t *heap) {
+    if (heap->arena != NULL) {
+        mb_arena_free(heap->arena, heap->from, heap->capacity);
+        mb_arena_free(heap->arena, heap->to, heap->capacity);
+        mb_arena_free(heap->arena, heap->old, heap->old_capacity);
+    }
     memset(heap, 0, sizeof(*heap));
-    heap->from = heap->space_a;
-    heap->to = heap->space_b;
-    heap->capacity = MB_HEAP_WORDS;
 }
 
 mb_term_t *mb_heap_alloc(mb_heap_t *heap, size_t n_words) {
     mb_term_t *ptr;
-    if (heap->hp + n_words > heap->capacity) {
+    if (heap->hp + n_words > heap->stop) {
         return NULL;
     }
     ptr = &heap->from[heap->hp];
@@ -19,6 +158,26 @@ mb_term_t *mb_heap_alloc(mb_heap_t *heap, size_t n_words) {
     return ptr;
 }
 
+mb_term_t *mb_heap_stack_alloc(mb_heap_t *heap, size_t n_words) {
+    size_t i;
+    if (heap->stop - heap->hp < n_words) {
+        return NULL;
+    }
+    heap->stop -= n_words;
+    for (i = 0; i < n_words; i++) {
+        heap->from[heap->stop + i] = MB_NIL;
+    }
+    return &heap->from[heap->stop];
+}
+
+int mb_heap_stack_free(mb_heap_t *heap, size_t n_words) {
+    if (mb_heap_stack_depth(heap) < n_words) {
+        return -1;
+    }
+    heap->stop += n_words;
+    return 0;
+}
+
 mb_term_t mb_heap_make_tuple(mb_heap_t *heap, const mb_term_t *elems, uint8_t arity) {
     size_t need = 1 + (size_t)arity;  /* header + elements */
     mb_term_t *ptr;
@@ -53,116 +212,529 @@ mb_term_t mb_heap_cons(mb_heap_t *heap, mb_term_t head, mb_term_t tail) {
     return MB_MAKE_CONS(offset);
 }
 
+/* --- structural equality --- */
+
+int mb_heap_eq_exact(const mb_heap_t *heap, mb_term_t a, mb_term_t b, int *equal) {
+    struct {
+        const mb_term_t *a, *b;
+        uint32_t left;
+    } stack[MB_EQ_MAX_DEPTH];
+    size_t depth = 0;
+
+    for (;;) {
+        if (a != b) {
+            const mb_term_t *pa, *pb;
+            uint32_t n;
+
+            if ((a & MB_TAG_MASK) != (b & MB_TAG_MASK) || MB_IS_IMMEDIATE(a)) {
+                *equal = 0;
+                return 0;
+            }
+            if (MB_IS_CONS(a)) {
+                pa = mb_heap_ptr(heap, MB_GET_CONS(a));
+                pb = mb_heap_ptr(heap, MB_GET_CONS(b));
+                n = 2;
+            } else {
+                pa = mb_heap_ptr(heap, MB_GET_BOXED(a));
+                pb = mb_heap_ptr(heap, MB_GET_BOXED(b));
+                if (pa[0] != pb[0]) {
+                    *equal = 0;
+                    return 0;
+                }
+                n = MB_GET_TUPLE_ARITY(pa[0]);
+                pa++;
+                pb++;
+            }
+            if (n > 0) {
+                if (depth == MB_EQ_MAX_DEPTH) {
+                    return -1;
+                }
+                stack[depth].a = pa;
+                stack[depth].b = pb;
+                stack[depth].left = n;
+                depth++;
+            }
+        }
+        if (depth == 0) {
+            *equal = 1;
+            return 0;
+        }
+        /* next pair; the last one of a level is compared in its parent's place */
+        a = *stack[depth - 1].a++;
+        b = *stack[depth - 1].b++;
+        if (--stack[depth - 1].left == 0) {
+            depth--;
+        }
+    }
+}
+
 /* --- Cheney's copying GC --- */
 
+/*
+ * A minor collection evacuates the young generation: objects below the
+ * high-water mark survived the previous collection and are promoted to
+ * the old generation, younger ones go to the young to-space, and old
+ * objects stay where they are.  A major collection evacuates both
+ * generations into a new old block.  A heap without generations only
+ * runs minor collections with nothing to promote: plain Cheney.
+ */
+typedef struct {
+    mb_heap_t *heap;
+    mb_term_t *young;  /* young space being evacuated */
+    mb_term_t *old;    /* old block being evacuated, NULL in a minor GC */
+    size_t     hwm;    /* young offsets below it are promoted */
+    int        major;
+} mb_gc_t;
+
 /**
- * Copy a single term from old from-space to new from-space.
+ * Copy a single term's object out of the spaces being evacuated.
  * Returns the updated term (with new offset if heap pointer).
  * If the object was already moved, follows the forwarding pointer.
  */
-static mb_term_t mb_gc_copy_term(mb_heap_t *heap,
-                                 mb_term_t *old_space,
-                                 mb_term_t term) {
-    size_t old_off, new_off, size;
-    mb_term_t *old_ptr;
-    mb_term_t hdr;
+static mb_term_t mb_gc_copy_term(mb_gc_t *gc, mb_term_t term) {
+    mb_heap_t *heap = gc->heap;
+    uint32_t off, new_off;
+    mb_term_t *src, *dst;
+    size_t size;
 
     /* Immediates (smallint, atom, pid) and zero need no copying. */
-    if (MB_IS_IMMEDIATE(term) || term == 0) {
+    if (MB_IS_IMMEDIATE(term) || term == 0 || (!MB_IS_BOXED(term) && !MB_IS_CONS(term))) {
         return term;
     }
+    off = MB_IS_BOXED(term) ? MB_GET_BOXED(term) : MB_GET_CONS(term);
+    if ((off & MB_HEAP_OLD_BIT) != 0) {
+        if (!gc->major) {
+            return term;
+        }
+        src = &gc->old[off & ~MB_HEAP_OLD_BIT];
+    } else {
+        src = &gc->young[off];
+    }
 
-    if (MB_IS_BOXED(term)) {
-        old_off = MB_GET_BOXED(term);
-        old_ptr = &old_space[old_off];
+    /* Already forwarded? */
+    if (MB_IS_MOVED(src[0])) {
+        new_off = src[1];
+    } else {
+        if (MB_IS_BOXED(term)) {
+            /* Tuple: header + arity elements */
+            if (!MB_IS_TUPLE_HDR(src[0])) {
+                return term; /* unknown boxed type, don't move */
+            }
+            size = 1 + MB_GET_TUPLE_ARITY(src[0]);
+        } else {
+            size = 2; /* head + tail */
+        }
 
-        /* Already forwarded? */
-        if (MB_IS_MOVED(old_ptr[0])) {
-            return MB_MAKE_BOXED(old_ptr[1]);
+        if (gc->major || off < gc->hwm) {
+            new_off = MB_HEAP_OLD_BIT | (uint32_t)heap->old_hp;
+            dst = &heap->old[heap->old_hp];
+            heap->old_hp += size;
+        } else {
+            new_off = (uint32_t)heap->hp;
+            dst = &heap->from[heap->hp];
+            heap->hp += size;
         }
+        memcpy(dst, src, size * sizeof(mb_term_t));
+
+        /* Leave forwarding pointer */
+        src[0] = MB_MOVED_MARKER;
+        src[1] = (mb_term_t)new_off;
+    }
+    return MB_IS_BOXED(term) ? MB_MAKE_BOXED(new_off) : MB_MAKE_CONS(new_off);
+}
+
+/* Cheney scan of the objects copied to space[*scan .. *top). */
+static void mb_gc_scan(mb_gc_t *gc, mb_term_t *space, size_t *scan, const size_t *top) {
+    while (*scan < *top) {
+        mb_term_t w = space[*scan];
 
-        /* Tuple: header + arity elements */
-        hdr = old_ptr[0];
-        if (!MB_IS_TUPLE_HDR(hdr)) {
-            return term; /* unknown boxed type, don't move */
+        /* A tuple header is skipped; its elements follow as words. */
+        if (!MB_IS_TUPLE_HDR(w)) {
+            space[*scan] = mb_gc_copy_term(gc, w);
         }
-        size = 1 + MB_GET_TUPLE_ARITY(hdr);
+        (*scan)++;
+    }
+}
 
-        /* Copy to new from-space */
-        new_off = heap->hp;
-        memcpy(&heap->from[new_off], old_ptr, size * sizeof(mb_term_t));
-        heap->hp += size;
+static void mb_heap_collect(mb_gc_t *gc, mb_term_t **roots, size_t n_roots) {
+    mb_heap_t *heap = gc->heap;
+    size_t scan = 0, old_scan = heap->old_hp;
+    size_t i;
 
-        /* Leave forwarding pointer */
-        old_ptr[0] = MB_MOVED_MARKER;
-        old_ptr[1] = (mb_term_t)new_off;
+    /* Swap spaces: to becomes the new from. */
+    heap->from = heap->to;
+    heap->to = gc->young;
+    heap->hp = 0;
+
+    /* Stack keeps its depth and moves to the top of the new space. */
+    memcpy(&heap->from[heap->stop], &gc->young[heap->stop],
+           mb_heap_stack_depth(heap) * sizeof(mb_term_t));
 
-        return MB_MAKE_BOXED(new_off);
+    /* Phase 1: copy root terms, then stack slots. */
+    for (i = 0; i < n_roots; i++) {
+        *roots[i] = mb_gc_copy_term(gc, *roots[i]);
+    }
+    for (i = heap->stop; i < heap->capacity; i++) {
+        heap->from[i] = mb_gc_copy_term(gc, heap->from[i]);
+    }
+
+    /* Phase 2: Cheney scan — BFS over copied objects, in both generations. */
+    while (scan < heap->hp || old_scan < heap->old_hp) {
+        mb_gc_scan(gc, heap->from, &scan, &heap->hp);
+        mb_gc_scan(gc, heap->old, &old_scan, &heap->old_hp);
     }
 
-    if (MB_IS_CONS(term)) {
-        old_off = MB_GET_CONS(term);
-        old_ptr = &old_space[old_off];
+    /* Clear the evacuated space for debugging visibility. */
+    memset(gc->young, 0, heap->capacity * sizeof(mb_term_t));
 
-        /* Already forwarded? */
-        if (MB_IS_MOVED(old_ptr[0])) {
-            return MB_MAKE_CONS(old_ptr[1]);
+    heap->gc_count++;
+}
+
+/*
+ * A shared heap's survivors are in the scratch block and its own space
+ * is empty: trade the blocks when they are the same size, otherwise
+ * copy the survivors home.
+ */
+static void mb_heap_scratch_return(mb_heap_t *heap) {
+    mb_heap_scratch_t *scratch = heap->scratch;
+    mb_term_t *home = heap->to;
+
+    if (scratch->words == heap->capacity) {
+        scratch->mem = home;
+    } else {
+        memcpy(home, heap->from, heap->hp * sizeof(mb_term_t));
+        memcpy(&home[heap->stop], &heap->from[heap->stop],
+               mb_heap_stack_depth(heap) * sizeof(mb_term_t));
+        heap->from = home;
+    }
+    heap->to = NULL;
+}
+
+/* --- generations --- */
+
+/*
+ * Start a major collection: a new old block large enough for every
+ * object in both generations.  Returns -1 if the arena has no room.
+ */
+static int mb_heap_major_begin(mb_heap_t *heap, mb_gc_t *gc, size_t *old_capacity) {
+    size_t bound = heap->old_hp + heap->hp, granted = 0;
+    mb_term_t *block = NULL;
+
+    if (bound != 0) {
+        block = mb_arena_alloc(heap->arena, bound, &granted);
+        if (block == NULL) {
+            return -1;
         }
+    }
+    gc->major = 1;
+    gc->old = heap->old;
+    *old_capacity = heap->old_capacity;
+    heap->old = block;
+    heap->old_hp = 0;
+    heap->old_capacity = granted;
+    return 0;
+}
 
-        size = 2; /* head + tail */
-        new_off = heap->hp;
-        memcpy(&heap->from[new_off], old_ptr, size * sizeof(mb_term_t));
-        heap->hp += size;
+/*
+ * After a major collection: free the evacuated block and size the new
+ * one to its live data plus half, and room for a young generation's
+ * worth of promotions.  Old offsets start at the block, so a memcpy
+ * keeps them.
+ */
+static void mb_heap_major_end(mb_heap_t *heap, mb_gc_t *gc, size_t old_capacity) {
+    size_t want = mb_arena_round(heap->old_hp + heap->old_hp / 2 + heap->capacity);
+    size_t granted;
+    mb_term_t *block;
 
-        /* Leave forwarding pointer */
-        old_ptr[0] = MB_MOVED_MARKER;
-        old_ptr[1] = (mb_term_t)new_off;
+    mb_arena_free(heap->arena, gc->old, old_capacity);
+    heap->minor_gcs = 0;
+    if (want == 0 || want == heap->old_capacity) {
+        return;
+    }
+    block = mb_arena_alloc(heap->arena, want, &granted);
+    if (block == NULL) {
+        return;
+    }
+    memcpy(block, heap->old, heap->old_hp * sizeof(mb_term_t));
+    mb_arena_free(heap->arena, heap->old, heap->old_capacity);
+    heap->old = block;
+    heap->old_capacity = granted;
+}
+
+/* --- sliding mark-compact --- */
+
+static inline int mb_mark_test(const mb_term_t *marks, size_t i) {
+    return (int)((marks[i / 32] >> (i % 32)) & 1U);
+}
+
+static inline void mb_mark_set(mb_term_t *marks, size_t i) {
+    marks[i / 32] |= (mb_term_t)1U << (i % 32);
+}
+
+static uint32_t mb_popcount(uint32_t w) {
+    w = w - ((w >> 1) & 0x55555555U);
+    w = (w & 0x33333333U) + ((w >> 2) & 0x33333333U);
+    w = (w + (w >> 4)) & 0x0F0F0F0FU;
+    return (w * 0x01010101U) >> 24;
+}
 
-        return MB_MAKE_CONS(new_off);
+/* Words of the object at @p p (a tuple header, or else a cons cell). */
+static size_t mb_compact_size(const mb_term_t *space, size_t p) {
+    return MB_IS_TUPLE_HDR(space[p]) ? 1 + MB_GET_TUPLE_ARITY(space[p]) : 2;
+}
+
+/* First field of the object at @p p: a tuple's header is no term. */
+static size_t mb_compact_fields(const mb_term_t *space, size_t p) {
+    return MB_IS_TUPLE_HDR(space[p]) ? p + 1 : p;
+}
+
+/*
+ * Objects are told apart by their first word, but a cons head can read
+ * as a tuple header: a raw 0 from a register never written is the
+ * header of {}.  Marking through a cons pointer disguises such a head
+ * with the unused tag 0x4 until the cell has slid.
+ */
+#define MB_COMPACT_DISGUISE        0x4U
+#define MB_COMPACT_IS_DISGUISED(w) (((w) & 0x3FU) == MB_COMPACT_DISGUISE)
+
+static void mb_compact_mark_term(mb_term_t *space, mb_term_t *marks, mb_term_t term) {
+    uint32_t off;
+
+    if (MB_IS_BOXED(term)) {
+        mb_mark_set(marks, MB_GET_BOXED(term));
+    } else if (MB_IS_CONS(term)) {
+        off = MB_GET_CONS(term);
+        mb_mark_set(marks, off);
+        if (MB_IS_TUPLE_HDR(space[off])) {
+            space[off] |= MB_COMPACT_DISGUISE;
+        }
     }
+}
+
+/*
+ * New offset of a term's object: the live words below it, from the
+ * table entry of its chunk plus the mark bits from there on.
+ */
+static mb_term_t mb_compact_forward(const mb_term_t *marks, const mb_term_t *table,
+                                    mb_term_t term) {
+    size_t off, w;
+    uint32_t n;
 
-    return term;
+    if (!MB_IS_BOXED(term) && !MB_IS_CONS(term)) {
+        return term;
+    }
+    off = MB_IS_BOXED(term) ? MB_GET_BOXED(term) : MB_GET_CONS(term);
+    n = table[off / MB_COMPACT_CHUNK];
+    for (w = (off / MB_COMPACT_CHUNK) * (MB_COMPACT_CHUNK / 32); w < off / 32; w++) {
+        n += mb_popcount(marks[w]);
+    }
+    n += mb_popcount(marks[off / 32] & (((mb_term_t)1U << (off % 32)) - 1U));
+    return MB_IS_BOXED(term) ? MB_MAKE_BOXED(n) : MB_MAKE_CONS(n);
 }
 
-void mb_heap_gc(mb_heap_t *heap, mb_term_t **roots, size_t n_roots) {
-    mb_term_t *old_space;
-    size_t scan;
-    size_t i;
+/*
+ * Mark, then slide live objects down in address order.  Every word of a
+ * live object is marked, so an object's new offset is the number of
+ * marked words below it.
+ */
+static void mb_heap_compact(mb_heap_t *heap, mb_term_t **roots, size_t n_roots) {
+    mb_term_t *space = heap->from, *marks = heap->marks;
+    mb_term_t *table = marks + (heap->capacity + 31) / 32;
+    size_t hp = heap->hp, p, j, size, end, live;
 
-    /* Swap spaces: to becomes the new from. */
-    old_space = heap->from;
-    heap->from = heap->to;
-    heap->to = old_space;
-    heap->hp = 0;
+    /* Mark: roots and stack, then one pass down the heap.  An object
+       only refers to older, lower ones, so every mark lands below the
+       scan; the bits of a live object's other words land above it. */
+    memset(marks, 0, ((hp + 31) / 32) * sizeof(mb_term_t));
+    for (j = 0; j < n_roots; j++) {
+        mb_compact_mark_term(space, marks, *roots[j]);
+    }
+    for (j = heap->stop; j < heap->capacity; j++) {
+        mb_compact_mark_term(space, marks, space[j]);
+    }
+    for (p = hp; p > 0;) {
+        p--;
+        if (marks[p / 32] == 0) {
+            p -= p % 32;  /* no live object starts in this bitmap word */
+            continue;
+        }
+        if (!mb_mark_test(marks, p)) {
+            continue;
+        }
+        end = p + mb_compact_size(space, p);
+        for (j = mb_compact_fields(space, p); j < end; j++) {
+            mb_compact_mark_term(space, marks, space[j]);
+        }
+        for (j = p + 1; j < end; j++) {
+            mb_mark_set(marks, j);
+        }
+    }
 
-    /* Phase 1: copy root terms. */
-    for (i = 0; i < n_roots; i++) {
-        *roots[i] = mb_gc_copy_term(heap, old_space, *roots[i]);
-    }
-
-    /* Phase 2: Cheney scan — BFS over copied objects. */
-    scan = 0;
-    while (scan < heap->hp) {
-        mb_term_t w = heap->from[scan];
-
-        if (MB_IS_TUPLE_HDR(w)) {
-            /* Scan tuple elements */
-            size_t arity = MB_GET_TUPLE_ARITY(w);
-            size_t j;
-            scan++; /* skip header */
-            for (j = 0; j < arity; j++) {
-                heap->from[scan] = mb_gc_copy_term(heap, old_space, heap->from[scan]);
-                scan++;
-            }
-        } else {
-            /* Cons cell or other: scan each word */
-            heap->from[scan] = mb_gc_copy_term(heap, old_space, heap->from[scan]);
-            scan++;
+    /* Forwarding table: live words below each chunk. */
+    live = 0;
+    for (p = 0; p < hp; p += MB_COMPACT_CHUNK) {
+        table[p / MB_COMPACT_CHUNK] = (mb_term_t)live;
+        for (j = p / 32; j < (p + MB_COMPACT_CHUNK) / 32 && j < (hp + 31) / 32; j++) {
+            live += mb_popcount(marks[j]);
         }
     }
 
-    /* Clear old space for debugging visibility. */
-    memset(old_space, 0, heap->capacity * sizeof(mb_term_t));
+    /* Update roots and stack, then each object's fields as it slides. */
+    for (j = 0; j < n_roots; j++) {
+        *roots[j] = mb_compact_forward(marks, table, *roots[j]);
+    }
+    for (j = heap->stop; j < heap->capacity; j++) {
+        space[j] = mb_compact_forward(marks, table, space[j]);
+    }
+    live = 0;
+    for (p = 0; p < hp;) {
+        if (marks[p / 32] == 0) {
+            p += 32 - p % 32;
+            continue;
+        }
+        if (!mb_mark_test(marks, p)) {
+            p++;
+            continue;
+        }
+        size = mb_compact_size(space, p);
+        for (j = mb_compact_fields(space, p); j < p + size; j++) {
+            space[j] = mb_compact_forward(marks, table, space[j]);
+        }
+        memmove(&space[live], &space[p], size * sizeof(mb_term_t));
+        if (MB_COMPACT_IS_DISGUISED(space[live])) {
+            space[live] &= ~(mb_term_t)MB_COMPACT_DISGUISE;
+        }
+        live += size;
+        p += size;
+    }
 
+    /* Clear the freed words for debugging visibility. */
+    memset(&space[live], 0, (hp - live) * sizeof(mb_term_t));
+    heap->hp = live;
     heap->gc_count++;
 }
+
+/* --- adaptive sizing --- */
+
+/*
+ * Move live data into spaces of @p words words.  The to-space is empty
+ * right after a collection, so it goes back to the arena first; if the
+ * new spaces do not fit, the same block comes straight back (free lists
+ * are LIFO and the new class differs) and the heap is unchanged.
+ */
+static void mb_heap_resize(mb_heap_t *heap, size_t words) {
+    mb_arena_t *arena = heap->arena;
+    size_t depth = mb_heap_stack_depth(heap);
+    size_t granted = 0, old_granted;
+    mb_term_t *from, *to = NULL;
+    int own_to = (heap->to != NULL), ok;
+
+    mb_arena_free(arena, heap->to, heap->capacity);  /* none for shared or compact */
+    from = mb_arena_alloc(arena, words, &granted);
+    ok = (from != NULL);
+    if (ok && heap->scratch != NULL) {
+        /* A shared heap may only grow as far as the scratch can follow. */
+        ok = (mb_heap_scratch_reserve(heap->scratch, arena, granted) == 0);
+    } else if (ok && own_to) {
+        to = mb_arena_alloc(arena, words, &granted);
+        ok = (to != NULL);
+    }
+    if (!ok) {
+        mb_arena_free(arena, from, granted);
+        if (own_to) {
+            heap->to = mb_arena_alloc(arena, heap->capacity, &old_granted);
+        }
+        return;
+    }
+    if (heap->marks != NULL) {
+        granted = mb_heap_compact_words(granted);
+        heap->marks = from + granted;
+    }
+    memcpy(from, heap->from, heap->hp * sizeof(mb_term_t));
+    memcpy(&from[granted - depth], &heap->from[heap->stop], depth * sizeof(mb_term_t));
+    mb_arena_free(arena, heap->from, heap->capacity);
+    heap->from = from;
+    heap->to = to;
+    heap->capacity = granted;
+    heap->stop = granted - depth;
+    heap->resize_count++;
+}
+
+static void mb_heap_adapt(mb_heap_t *heap, size_t need) {
+    size_t live = heap->hp + mb_heap_stack_depth(heap);
+    size_t want = live + need, size;
+    size_t block = mb_arena_round(heap->capacity);  /* more than it for a compact heap */
+    int grow;
+
+    if (want > heap->capacity - heap->capacity / 4) {
+        /* at least one class up, with a quarter free after @p need */
+        grow = 1;
+        heap->low_gcs = 0;
+        size = mb_arena_round(want + want / 3);
+        if (size != 0 && size <= block) {
+            size = mb_arena_round(block + 1);
+        }
+        if (size == 0 || size > heap->max_words) {
+            size = mb_arena_round_down(heap->max_words);
+        }
+    } else if (want < heap->capacity / 4 && heap->capacity > heap->min_words) {
+        if (++heap->low_gcs < MB_HEAP_SHRINK_GCS) {
+            return;
+        }
+        /* twice what must fit now, so the retried allocation still does */
+        grow = 0;
+        heap->low_gcs = 0;
+        size = mb_arena_round((2 * want > heap->min_words) ? 2 * want : heap->min_words);
+    } else {
+        heap->low_gcs = 0;
+        return;
+    }
+    if (grow ? size > block : (size != 0 && size < block)) {
+        mb_heap_resize(heap, size);
+    }
+}
+
+void mb_heap_gc_need(mb_heap_t *heap, mb_term_t **roots, size_t n_roots, size_t need) {
+    mb_gc_t gc;
+    size_t old_capacity = 0;
+
+    if (heap->capacity == 0) {
+        return;
+    }
+    if (heap->marks != NULL) {
+        mb_heap_compact(heap, roots, n_roots);
+        mb_heap_adapt(heap, need);
+        return;
+    }
+    memset(&gc, 0, sizeof(gc));
+    gc.heap = heap;
+    gc.young = heap->from;
+    if (heap->fullsweep_after != 0) {
+        /* Major when due, or when promotion could overflow the old block. */
+        if (heap->minor_gcs < heap->fullsweep_after &&
+            heap->old_capacity - heap->old_hp >= heap->hwm) {
+            gc.hwm = heap->hwm;
+            heap->minor_gcs++;
+        } else if (mb_heap_major_begin(heap, &gc, &old_capacity) != 0) {
+            /* No room for a new old block: every survivor stays young. */
+        }
+    }
+    if (heap->scratch != NULL) {
+        heap->to = heap->scratch->mem;
+    }
+    mb_heap_collect(&gc, roots, n_roots);
+    if (heap->scratch != NULL) {
+        mb_heap_scratch_return(heap);
+    }
+    if (gc.major) {
+        mb_heap_major_end(heap, &gc, old_capacity);
+    }
+    heap->hwm = heap->hp;
+    if (heap->arena != NULL) {
+        mb_heap_adapt(heap, need);
+    }
+}
+
+void mb_heap_gc(mb_heap_t *heap, mb_term_t **roots, size_t n_roots) {
+    mb_heap_gc_need(heap, roots, n_roots, 0);
+}
@@ -0,0 +1,530 @@
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+
+#include "mb_jit.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "mb_errors.h"
+#include "mb_native.h"
+#include "mb_term.h"
+#include "mb_vm.h"
+
+#define MB_JIT_INSN_BYTES 64   /* bound on one template plus its budget stub */
+#define MB_JIT_FIXED_BYTES 128 /* entry trampoline and exits */
+
+/*
+ * Machine state while JIT code runs:
+ *   rbx  = register file (mb_term_t *), X register n at [rbx + 4n]
+ *   r12d = reductions retired in this slice
+ *   r13d = slice budget (max_steps)
+ *   r14  = frame
+ * eax/ecx/edx are scratch.  Nothing is called from JIT code.
+ *
+ * Every instruction starts with `cmp r12d, r13d; jae <stub>`, so the
+ * budget check of the interpreter's MB_NEXT (after retiring) becomes a
+ * check before the next instruction; the pc reported is the same.
+ */
+typedef struct {
+    mb_term_t *regs;      /* in */
+    uint32_t   red;       /* in/out */
+    uint32_t   max_steps; /* in */
+    uint32_t   pc;        /* out */
+} mb_jit_frame_t;
+
+/* The templates hard-code these offsets. */
+typedef char mb_jit_frame_layout_check[
+    (offsetof(mb_jit_frame_t, red) == 8 && offsetof(mb_jit_frame_t, max_steps) == 12 &&
+     offsetof(mb_jit_frame_t, pc) == 16 && sizeof(mb_term_t) == 4) ? 1 : -1];
+
+#define MB_JIT_EXIT_BUDGET 0  /* budget spent before pc */
+#define MB_JIT_EXIT_INTERP 1  /* interpreter must run the instruction at pc */
+#define MB_JIT_EXIT_REST   2  /* interpreter finishes the slice from pc */
+
+typedef int (*mb_jit_entry_fn)(mb_jit_frame_t *frame, const uint8_t *target);
+
+struct mb_jit_image_s {
+    uint8_t  *program;       /* private copy, the cache key */
+    size_t    program_size;
+    uint8_t  *code;          /* read + exec mapping */
+    size_t    map_size;
+    uint32_t  count;         /* offs[0..count] are valid; count is the EOF trap */
+    uint32_t  offs[];
+};
+
+static mb_jit_image_t *mb_jit_cache[MB_JIT_CACHE_SLOTS];
+
+/* --- code buffer --- */
+
+/* Sized from the program: MB_JIT_INSN_BYTES and two fixups per instruction. */
+typedef struct {
+    uint8_t  *bytes;
+    size_t   cap;
+    size_t   len;
+    int      overflow;
+    /* rel32 fields to patch: target is an instruction index or a budget stub */
+    struct mb_jit_fix_s {
+        uint32_t at;
+        uint32_t insn;
+        uint8_t  stub;
+    } *fix;
+    uint32_t nfix;
+    uint32_t *stubs;
+} mb_jit_buf_t;
+
+static void mb_jit_u8(mb_jit_buf_t *b, uint8_t v) {
+    if (b->len >= b->cap) {
+        b->overflow = 1;
+        return;
+    }
+    b->bytes[b->len++] = v;
+}
+
+static void mb_jit_u32(mb_jit_buf_t *b, uint32_t v) {
+    mb_jit_u8(b, (uint8_t)v);
+    mb_jit_u8(b, (uint8_t)(v >> 8));
+    mb_jit_u8(b, (uint8_t)(v >> 16));
+    mb_jit_u8(b, (uint8_t)(v >> 24));
+}
+
+static void mb_jit_bytes(mb_jit_buf_t *b, const uint8_t *p, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        mb_jit_u8(b, p[i]);
+    }
+}
+
+static void mb_jit_patch32(mb_jit_buf_t *b, uint32_t at, uint32_t v) {
+    b->bytes[at] = (uint8_t)v;
+    b->bytes[at + 1] = (uint8_t)(v >> 8);
+    b->bytes[at + 2] = (uint8_t)(v >> 16);
+    b->bytes[at + 3] = (uint8_t)(v >> 24);
+}
+
+/* rel32 to a label emitted later (instruction body or budget stub) */
+static void mb_jit_fixup(mb_jit_buf_t *b, uint32_t insn, uint8_t stub) {
+    b->fix[b->nfix].at = (uint32_t)b->len;
+    b->fix[b->nfix].insn = insn;
+    b->fix[b->nfix].stub = stub;
+    b->nfix++;
+    mb_jit_u32(b, 0);
+}
+
+/* rel32 to an already emitted offset */
+static void mb_jit_rel32_to(mb_jit_buf_t *b, uint32_t target) {
+    mb_jit_u32(b, target - (uint32_t)(b->len + 4));
+}
+
+/* --- templates --- */
+
+#define X(r) ((uint8_t)((r) * 4))  /* disp8 of X register r from rbx */
+
+/* mov eax, [rbx + X(r)] */
+static void mb_jit_load_eax(mb_jit_buf_t *b, uint8_t r) {
+    const uint8_t c[] = {0x8B, 0x43, X(r)};
+    mb_jit_bytes(b, c, sizeof(c));
+}
+
+/* mov ecx, [rbx + X(r)] */
+static void mb_jit_load_ecx(mb_jit_buf_t *b, uint8_t r) {
+    const uint8_t c[] = {0x8B, 0x4B, X(r)};
+    mb_jit_bytes(b, c, sizeof(c));
+}
+
+/* mov [rbx + X(r)], eax */
+static void mb_jit_store_eax(mb_jit_buf_t *b, uint8_t r) {
+    const uint8_t c[] = {0x89, 0x43, X(r)};
+    mb_jit_bytes(b, c, sizeof(c));
+}
+
+/* MB_GET_SMALLINT into eax / ecx: load; sar 4 */
+static void mb_jit_untag_eax(mb_jit_buf_t *b, uint8_t r) {
+    const uint8_t c[] = {0xC1, 0xF8, 0x04};
+    mb_jit_load_eax(b, r);
+    mb_jit_bytes(b, c, sizeof(c));
+}
+
+static void mb_jit_untag_ecx(mb_jit_buf_t *b, uint8_t r) {
+    const uint8_t c[] = {0xC1, 0xF9, 0x04};
+    mb_jit_load_ecx(b, r);
+    mb_jit_bytes(b, c, sizeof(c));
+}
+
+/* MB_MAKE_SMALLINT(eax) into X(r): shl eax, 4; or eax, 0xF; store */
+static void mb_jit_tag_store(mb_jit_buf_t *b, uint8_t r) {
+    const uint8_t c[] = {0xC1, 0xE0, 0x04, 0x83, 0xC8, MB_TAG_SMALLINT};
+    mb_jit_bytes(b, c, sizeof(c));
+    mb_jit_store_eax(b, r);
+}
+
+/* inc r12d: retire the instruction */
+static void mb_jit_retire(mb_jit_buf_t *b) {
+    const uint8_t c[] = {0x41, 0xFF, 0xC4};
+    mb_jit_bytes(b, c, sizeof(c));
+}
+
+/* jcc rel32 (cc = second opcode byte) or jmp rel32 (cc = 0) to instruction */
+static void mb_jit_branch(mb_jit_buf_t *b, uint8_t cc, uint32_t target) {
+    if (cc == 0) {
+        mb_jit_u8(b, 0xE9);
+    } else {
+        mb_jit_u8(b, 0x0F);
+        mb_jit_u8(b, cc);
+    }
+    mb_jit_fixup(b, target, 0);
+}
+
+#define JCC_E  0x84
+#define JCC_NE 0x85
+#define JCC_L  0x8C
+#define JCC_GE 0x8D
+#define JCC_AE 0x83
+
+/* Emit the template for one instruction; 0 if it needs the interpreter. */
+static int mb_jit_insn(mb_jit_buf_t *b, const mb_insn_t *in) {
+    switch (in->op) {
+    case MB_OP_NOP:
+        break;
+
+    case MB_OP_CONST_I32: {
+        const uint8_t c[] = {0xC7, 0x43, X(in->r[0])};  /* mov dword [rbx+d], imm32 */
+        mb_jit_bytes(b, c, sizeof(c));
+        mb_jit_u32(b, in->imm);
+        break;
+    }
+
+    case MB_OP_MOVE:
+        mb_jit_load_eax(b, in->r[1]);
+        mb_jit_store_eax(b, in->r[0]);
+        break;
+
+    case MB_OP_ADD:
+    case MB_OP_SUB:
+    case MB_OP_AND:
+    case MB_OP_OR:
+    case MB_OP_XOR: {
+        /* add/sub/and/or/xor eax, ecx */
+        uint8_t op = (in->op == MB_OP_ADD) ? 0x01 : (in->op == MB_OP_SUB) ? 0x29
+                   : (in->op == MB_OP_AND) ? 0x21 : (in->op == MB_OP_OR) ? 0x09 : 0x31;
+        mb_jit_untag_eax(b, in->r[1]);
+        mb_jit_untag_ecx(b, in->r[2]);
+        mb_jit_u8(b, op);
+        mb_jit_u8(b, 0xC8);
+        mb_jit_tag_store(b, in->r[0]);
+        break;
+    }
+
+    case MB_OP_ADD_IMM:
+    case MB_OP_SUB_IMM:
+        mb_jit_untag_eax(b, in->r[1]);
+        mb_jit_u8(b, (in->op == MB_OP_ADD_IMM) ? 0x05 : 0x2D);  /* add/sub eax, imm32 */
+        mb_jit_u32(b, in->imm);
+        mb_jit_tag_store(b, in->r[0]);
+        break;
+
+    case MB_OP_MIN:
+    case MB_OP_MAX: {
+        /* tagged words compare in signed order: cmp eax, ecx; cmovg/cmovl eax, ecx */
+        const uint8_t c[] = {0x39, 0xC8, 0x0F, (in->op == MB_OP_MIN) ? 0x4F : 0x4C, 0xC1};
+        mb_jit_load_eax(b, in->r[1]);
+        mb_jit_load_ecx(b, in->r[2]);
+        mb_jit_bytes(b, c, sizeof(c));
+        mb_jit_store_eax(b, in->r[0]);
+        break;
+    }
+
+    case MB_OP_CLAMP: {
+        const uint8_t lo[] = {0x39, 0xC8, 0x0F, 0x4C, 0xC1};  /* cmp; cmovl */
+        const uint8_t hi[] = {0x39, 0xC8, 0x0F, 0x4F, 0xC1};  /* cmp; cmovg */
+        mb_jit_load_eax(b, in->r[1]);
+        mb_jit_load_ecx(b, in->r[2]);
+        mb_jit_bytes(b, lo, sizeof(lo));
+        mb_jit_load_ecx(b, in->r[3]);
+        mb_jit_bytes(b, hi, sizeof(hi));
+        mb_jit_store_eax(b, in->r[0]);
+        break;
+    }
+
+    /* Branches retire first: inc clobbers the flags the jcc needs. */
+    case MB_OP_JMP:
+        mb_jit_retire(b);
+        mb_jit_branch(b, 0, in->imm);
+        return 1;
+
+    case MB_OP_JMP_IF_ZERO:
+    case MB_OP_JMP_EQ_IMM:
+    case MB_OP_JMP_NE_IMM:
+    case MB_OP_JMP_LT_IMM:
+    case MB_OP_JMP_GE_IMM: {
+        /* cmp dword [rbx+d], imm32 */
+        const uint8_t c[] = {0x81, 0x7B, X(in->r[0])};
+        uint8_t cc = (in->op == MB_OP_JMP_IF_ZERO || in->op == MB_OP_JMP_EQ_IMM) ? JCC_E
+                   : (in->op == MB_OP_JMP_NE_IMM) ? JCC_NE
+                   : (in->op == MB_OP_JMP_LT_IMM) ? JCC_L : JCC_GE;
+        mb_jit_retire(b);
+        mb_jit_bytes(b, c, sizeof(c));
+        mb_jit_u32(b, (in->op == MB_OP_JMP_IF_ZERO) ? MB_MAKE_SMALLINT(0) : in->lit);
+        mb_jit_branch(b, cc, in->imm);
+        return 1;
+    }
+
+    case MB_OP_JMP_EQ:
+    case MB_OP_JMP_NE: {
+        const uint8_t c[] = {0x3B, 0x43, X(in->r[1])};  /* cmp eax, [rbx+d] */
+        mb_jit_retire(b);
+        mb_jit_load_eax(b, in->r[0]);
+        mb_jit_bytes(b, c, sizeof(c));
+        mb_jit_branch(b, (in->op == MB_OP_JMP_EQ) ? JCC_E : JCC_NE, in->imm);
+        return 1;
+    }
+
+    case MB_OP_JMP_LT:
+    case MB_OP_JMP_GE: {
+        const uint8_t c[] = {0x39, 0xC8};  /* cmp eax, ecx */
+        mb_jit_retire(b);
+        mb_jit_untag_eax(b, in->r[0]);
+        mb_jit_untag_ecx(b, in->r[1]);
+        mb_jit_bytes(b, c, sizeof(c));
+        mb_jit_branch(b, (in->op == MB_OP_JMP_LT) ? JCC_L : JCC_GE, in->imm);
+        return 1;
+    }
+
+    case MB_OP_DJNZ: {
+        /* n = untag - 1 (kept in ecx for the test); store tagged n */
+        const uint8_t dec[] = {0x83, 0xE8, 0x01, 0x89, 0xC1};  /* sub eax, 1; mov ecx, eax */
+        const uint8_t test[] = {0x85, 0xC9};                    /* test ecx, ecx */
+        mb_jit_untag_eax(b, in->r[0]);
+        mb_jit_bytes(b, dec, sizeof(dec));
+        mb_jit_tag_store(b, in->r[0]);
+        mb_jit_retire(b);
+        mb_jit_bytes(b, test, sizeof(test));
+        mb_jit_branch(b, JCC_NE, in->imm);
+        return 1;
+    }
+
+    default:
+        return 0;
+    }
+
+    mb_jit_retire(b);
+    return 1;
+}
+
+/*
+ * Layout: entry trampoline, the two exits, instruction bodies 0..count,
+ * then one budget stub per instruction.
+ */
+static int mb_jit_compile(mb_jit_image_t *img, const mb_code_t *code, mb_jit_buf_t *b) {
+    /* push rbx, r12, r13, r14; r14 = frame; load regs, red, max_steps; jmp target */
+    static const uint8_t entry[] = {
+        0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56,
+        0x49, 0x89, 0xFE,              /* mov r14, rdi        */
+        0x48, 0x8B, 0x1F,              /* mov rbx, [rdi]      */
+        0x44, 0x8B, 0x67, 0x08,        /* mov r12d, [rdi+8]   */
+        0x44, 0x8B, 0x6F, 0x0C,        /* mov r13d, [rdi+12]  */
+        0xFF, 0xE6                     /* jmp rsi             */
+    };
+    /* eax = pc, edx = reason */
+    static const uint8_t exit_rest[] = {
+        0xBA, MB_JIT_EXIT_REST, 0x00, 0x00, 0x00,    /* mov edx, 2 */
+        0xEB, 0x09                                   /* jmp exit_common */
+    };
+    static const uint8_t exit_interp[] = {
+        0xBA, MB_JIT_EXIT_INTERP, 0x00, 0x00, 0x00,  /* mov edx, 1 */
+        0xEB, 0x02                                   /* jmp exit_common */
+    };
+    static const uint8_t exit_budget[] = {
+        0x31, 0xD2,                    /* xor edx, edx        */
+        /* exit_common: */
+        0x41, 0x89, 0x46, 0x10,        /* mov [r14+16], eax   */
+        0x45, 0x89, 0x66, 0x08,        /* mov [r14+8], r12d   */
+        0x89, 0xD0,                    /* mov eax, edx        */
+        0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B,
+        0xC3
+    };
+    static const uint8_t head[] = {0x45, 0x39, 0xEC, 0x0F, JCC_AE};  /* cmp r12d, r13d; jae */
+    uint32_t at_rest, at_interp, at_budget;
+    uint32_t i;
+
+    mb_jit_bytes(b, entry, sizeof(entry));
+    at_rest = (uint32_t)b->len;
+    mb_jit_bytes(b, exit_rest, sizeof(exit_rest));
+    at_interp = (uint32_t)b->len;
+    mb_jit_bytes(b, exit_interp, sizeof(exit_interp));
+    at_budget = (uint32_t)b->len;
+    mb_jit_bytes(b, exit_budget, sizeof(exit_budget));
+
+    for (i = 0; i <= code->count; i++) {
+        img->offs[i] = (uint32_t)b->len;
+        mb_jit_bytes(b, head, sizeof(head));
+        mb_jit_fixup(b, i, 1);
+        if (!mb_jit_insn(b, &code->insns[i])) {
+            /*
+             * YIELD and SEND_WAIT may end the slice by exhausting the
+             * budget, which one-instruction fallback cannot report.
+             */
+            uint8_t op = code->insns[i].op;
+            mb_jit_u8(b, 0xB8);  /* mov eax, i; jmp exit_interp / exit_rest */
+            mb_jit_u32(b, i);
+            mb_jit_u8(b, 0xE9);
+            mb_jit_rel32_to(b, (op == MB_OP_YIELD || op == MB_OP_SEND_WAIT) ? at_rest : at_interp);
+        }
+    }
+
+    for (i = 0; i <= code->count; i++) {
+        b->stubs[i] = (uint32_t)b->len;
+        mb_jit_u8(b, 0xB8);      /* mov eax, i; jmp exit_budget */
+        mb_jit_u32(b, i);
+        mb_jit_u8(b, 0xE9);
+        mb_jit_rel32_to(b, at_budget);
+    }
+
+    if (b->overflow) {
+        return MB_CODE_TOO_LARGE;
+    }
+    for (i = 0; i < b->nfix; i++) {
+        uint32_t at = b->fix[i].at;
+        uint32_t n = b->fix[i].insn;
+        uint32_t target;
+        if (n > code->count) {
+            return MB_BAD_JUMP;  /* verified code never gets here */
+        }
+        target = b->fix[i].stub ? b->stubs[n] : img->offs[n];
+        mb_jit_patch32(b, at, target - (at + 4));
+    }
+    img->count = code->count;
+    return MB_OK;
+}
+
+static void mb_jit_buf_free(mb_jit_buf_t *b) {
+    free(b->bytes);
+    free(b->fix);
+    free(b->stubs);
+}
+
+static mb_jit_image_t *mb_jit_build(const mb_process_t *proc, int *status) {
+    const mb_code_t *code = proc->code;
+    size_t slots = (size_t)code->count + 1U;
+    mb_jit_image_t *img;
+    mb_jit_buf_t buf;
+    void *map;
+    int rc;
+
+    memset(&buf, 0, sizeof(buf));
+    img = (mb_jit_image_t *)calloc(1, sizeof(*img) + slots * sizeof(img->offs[0]));
+    buf.cap = MB_JIT_FIXED_BYTES + slots * MB_JIT_INSN_BYTES;
+    buf.bytes = (uint8_t *)malloc(buf.cap);
+    buf.fix = (struct mb_jit_fix_s *)malloc(2U * slots * sizeof(buf.fix[0]));
+    buf.stubs = (uint32_t *)malloc(slots * sizeof(buf.stubs[0]));
+    if (img == NULL || buf.bytes == NULL || buf.fix == NULL || buf.stubs == NULL) {
+        mb_jit_buf_free(&buf);
+        free(img);
+        *status = MB_HEAP_OOM;
+        return NULL;
+    }
+    rc = mb_jit_compile(img, code, &buf);
+    if (rc != MB_OK) {
+        mb_jit_buf_free(&buf);
+        free(img);
+        *status = rc;
+        return NULL;
+    }
+
+    /* Write while RW, then flip to RX: never writable and executable. */
+    img->map_size = buf.len;
+    map = mmap(NULL, img->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    img->program = (uint8_t *)malloc(proc->program_size);
+    if (map == MAP_FAILED || img->program == NULL) {
+        if (map != MAP_FAILED) {
+            munmap(map, img->map_size);
+        }
+        mb_jit_buf_free(&buf);
+        free(img->program);
+        free(img);
+        *status = MB_HEAP_OOM;
+        return NULL;
+    }
+    memcpy(map, buf.bytes, buf.len);
+    mb_jit_buf_free(&buf);
+    if (mprotect(map, img->map_size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(map, img->map_size);
+        free(img->program);
+        free(img);
+        *status = MB_HEAP_OOM;
+        return NULL;
+    }
+    img->code = (uint8_t *)map;
+    memcpy(img->program, proc->program, proc->program_size);
+    img->program_size = proc->program_size;
+    *status = MB_OK;
+    return img;
+}
+
+int mb_jit_attach(mb_process_t *proc) {
+    size_t i;
+    int rc;
+
+    if (proc->program_size == 0 || proc->code->verify_status != MB_OK) {
+        return MB_BAD_ARGUMENT;
+    }
+    for (i = 0; i < MB_JIT_CACHE_SLOTS; i++) {
+        mb_jit_image_t *img = mb_jit_cache[i];
+        if (img == NULL) {
+            img = mb_jit_build(proc, &rc);
+            if (img == NULL) {
+                return rc;
+            }
+            mb_jit_cache[i] = img;
+        } else if (img->program_size != proc->program_size ||
+                   memcmp(img->program, proc->program, proc->program_size) != 0) {
+            continue;
+        }
+        proc->jit = img;
+        proc->native = mb_jit_run;
+        return MB_OK;
+    }
+    return MB_CODE_TOO_LARGE;
+}
+
+int mb_jit_run(mb_process_t *proc, void *sched, uint32_t max_steps) {
+    const mb_jit_image_t *img = proc->jit;
+    mb_jit_entry_fn entry = (mb_jit_entry_fn)(void *)img->code;
+    mb_jit_frame_t frame;
+    uint32_t red = 0;
+    int rc;
+
+    proc->reductions = 0;
+    if (proc->halted || max_steps == 0) {
+        return MB_OK;
+    }
+    if (proc->pc > img->count) {
+        return mb_native_interp(proc, sched, 0, max_steps);
+    }
+
+    frame.regs = proc->regs;
+    frame.max_steps = max_steps;
+    for (;;) {
+        int why;
+
+        frame.red = red;
+        why = entry(&frame, img->code + img->offs[proc->pc]);
+        proc->pc = frame.pc;
+        red = frame.red;
+        if (why == MB_JIT_EXIT_BUDGET) {
+            proc->reductions = red;
+            return MB_OK;
+        }
+        if (why == MB_JIT_EXIT_REST) {
+            return mb_native_interp(proc, sched, red, max_steps);
+        }
+        /* Exactly one instruction in the interpreter, then back to JIT code. */
+        rc = mb_native_interp(proc, sched, red, red + 1);
+        if (rc != MB_OK || proc->reductions == red || proc->reductions >= max_steps ||
+            proc->pc > img->count) {
+            return rc;  /* fault, block, sleep, halt or budget: slice over */
+        }
+        red = proc->reductions;
+    }
+}
@@ -0,0 +1,265 @@
+#include "mb_module.h"
+
+#include "mb_code.h"
+#include "mb_errors.h"
+#include "mb_heap.h"
+#include "mb_term.h"
+#include "mb_types.h"
+
+#define MB_MODULE_CRC_START 16
+
+static uint16_t mb_rd_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t mb_rd_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Bitwise: runs once per load, so no 1 KB table in flash. */
+uint32_t mb_module_crc32(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xFFFFFFFFU;
+    size_t i;
+    uint8_t k;
+
+    for (i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+        }
+    }
+    return ~crc;
+}
+
+/*
+ * Check the spawn argument table at @p pos: every argc within the
+ * registers the module uses and every value a small integer.
+ */
+static int mb_module_check_args(const uint8_t *image, uint32_t mod_size, uint32_t pos,
+                                uint8_t n, uint8_t reg_count) {
+    uint8_t i;
+    uint32_t argc, k;
+
+    for (i = 0; i < n; i++) {
+        if (pos > mod_size - 4U) {
+            return MB_BAD_MODULE;
+        }
+        argc = mb_rd_u32(image + pos);
+        pos += 4U;
+        if (argc > reg_count || argc * 4U > mod_size - pos) {
+            return MB_BAD_MODULE;
+        }
+        for (k = 0; k < argc; k++, pos += 4U) {
+            int32_t v = (int32_t)mb_rd_u32(image + pos);
+            if (v < MB_SMALLINT_MIN || v > MB_SMALLINT_MAX) {
+                return MB_BAD_MODULE;
+            }
+        }
+    }
+    return MB_OK;
+}
+
+int mb_module_load(mb_module_t *mod, const uint8_t *image, size_t size) {
+    uint32_t mod_size, code_off, code_size, args_off;
+    uint16_t flags;
+    uint8_t n, i, j;
+
+    if (image == NULL || size < MB_MODULE_HEADER_SIZE ||
+        mb_rd_u32(image) != MB_MODULE_MAGIC ||
+        mb_rd_u16(image + 4) != MB_MODULE_VERSION ||
+        (mb_rd_u16(image + 6) & ~MB_MODULE_F_ARGS) != 0) {
+        return MB_BAD_MODULE;
+    }
+    flags = mb_rd_u16(image + 6);
+    mod_size = mb_rd_u32(image + 8);
+    n = image[17];
+    if (mod_size > size || n == 0 || n > MB_MAX_PROCESSES ||
+        mod_size < MB_MODULE_HEADER_SIZE + (uint32_t)n * MB_MODULE_ENTRY_SIZE) {
+        return MB_BAD_MODULE;
+    }
+    if (mb_module_crc32(image + MB_MODULE_CRC_START, mod_size - MB_MODULE_CRC_START) !=
+        mb_rd_u32(image + 12)) {
+        return MB_BAD_CRC;
+    }
+
+    /* Needs the firmware cannot meet would only fail later, at run time. */
+    if (image[16] > MB_REG_COUNT || mb_rd_u16(image + 18) > MB_MAILBOX_CAPACITY ||
+        mb_rd_u32(image + 20) > MB_HEAP_MAX_WORDS) {
+        return MB_BAD_MODULE;
+    }
+
+    args_off = MB_MODULE_HEADER_SIZE + (uint32_t)n * MB_MODULE_ENTRY_SIZE;
+    if ((flags & MB_MODULE_F_ARGS) != 0 &&
+        mb_module_check_args(image, mod_size, args_off, n, image[16]) != MB_OK) {
+        return MB_BAD_MODULE;
+    }
+
+    code_off = mb_rd_u32(image + 24);
+    code_size = mb_rd_u32(image + 28);
+    if (code_off > mod_size || code_size > mod_size - code_off) {
+        return MB_BAD_MODULE;
+    }
+    for (i = 0; i < n; i++) {
+        const uint8_t *e = image + MB_MODULE_HEADER_SIZE + (size_t)i * MB_MODULE_ENTRY_SIZE;
+        uint32_t off = mb_rd_u32(e), len = mb_rd_u32(e + 4);
+        int st;
+
+        if (off > code_size || len > code_size - off) {
+            return MB_BAD_MODULE;
+        }
+        /* A program shared by several entries is verified once. */
+        for (j = 0; j < i; j++) {
+            const uint8_t *f = image + MB_MODULE_HEADER_SIZE + (size_t)j * MB_MODULE_ENTRY_SIZE;
+            if (mb_rd_u32(f) == off && mb_rd_u32(f + 4) == len) {
+                break;
+            }
+        }
+        if (j < i) {
+            continue;
+        }
+        st = mb_verify_program(image + code_off + off, len);
+        if (st != MB_OK) {
+            return st;
+        }
+    }
+
+    mod->image = image;
+    mod->size = mod_size;
+    mod->map_size = 0;
+    mod->code = image + code_off;
+    mod->args = ((flags & MB_MODULE_F_ARGS) != 0) ? image + args_off : NULL;
+    mod->code_size = code_size;
+    mod->heap_words = mb_rd_u32(image + 20);
+    mod->mailbox_depth = mb_rd_u16(image + 18);
+    mod->reg_count = image[16];
+    mod->entry_count = n;
+    return MB_OK;
+}
+
+int mb_module_entry(const mb_module_t *mod, uint8_t index,
+                    const uint8_t **program, size_t *program_size) {
+    const uint8_t *e;
+
+    if (index >= mod->entry_count) {
+        return MB_BAD_ARGUMENT;
+    }
+    e = mod->image + MB_MODULE_HEADER_SIZE + (size_t)index * MB_MODULE_ENTRY_SIZE;
+    *program = mod->code + mb_rd_u32(e);
+    *program_size = mb_rd_u32(e + 4);
+    return MB_OK;
+}
+
+int mb_module_entry_args(const mb_module_t *mod, uint8_t index,
+                         mb_term_t *args, uint8_t *argc) {
+    const uint8_t *p = mod->args;
+    uint8_t i, k, n;
+
+    if (index >= mod->entry_count) {
+        return MB_BAD_ARGUMENT;
+    }
+    *argc = 0;
+    if (p == NULL) {
+        return MB_OK;
+    }
+    for (i = 0; i < index; i++) {
+        p += 4U + 4U * mb_rd_u32(p);
+    }
+    n = (uint8_t)mb_rd_u32(p);
+    for (k = 0; k < n; k++) {
+        args[k] = MB_MAKE_SMALLINT((int32_t)mb_rd_u32(p + 4U + 4U * k));
+    }
+    *argc = n;
+    return MB_OK;
+}
+
+void mb_module_attach(const mb_module_t *mod, mb_scheduler_t *sched) {
+    const uint8_t *program;
+    size_t program_size;
+    uint8_t i;
+
+    for (i = 0; i < mod->entry_count; i++) {
+        if (mb_module_entry(mod, i, &program, &program_size) == MB_OK) {
+            (void)mb_sched_set_entry(sched, i, program, program_size, mod->heap_words);
+        }
+    }
+}
+
+int mb_module_spawn_all(const mb_module_t *mod, mb_scheduler_t *sched) {
+    const uint8_t *program;
+    size_t program_size;
+    mb_term_t args[MB_REG_COUNT];
+    mb_spawn_opts_t opts = MB_SPAWN_OPTS_INIT;
+    mb_pid_t pid;
+    uint8_t i;
+
+    mb_module_attach(mod, sched);
+    opts.args = args;
+    opts.heap_words = mod->heap_words;
+    for (i = 0; i < mod->entry_count; i++) {
+        if (mb_module_entry(mod, i, &program, &program_size) != MB_OK ||
+            mb_module_entry_args(mod, i, args, &opts.argc) != MB_OK) {
+            return MB_BAD_ARGUMENT;
+        }
+        pid = mb_sched_spawn_opts(sched, program, program_size, &opts);
+        if (pid == MB_PID_NONE) {
+            return (sched->nfree == 0) ? MB_PROC_TABLE_FULL : MB_HEAP_OOM;
+        }
+        sched->entries[i].pid = pid;
+    }
+    return MB_OK;
+}
+
+/* 1 if @p pid is the process mb_module_spawn_all() started for an entry. */
+static int mb_module_is_boot_pid(const mb_module_t *mod, const mb_scheduler_t *sched,
+                                 mb_pid_t pid) {
+    uint8_t i;
+
+    for (i = 0; i < mod->entry_count; i++) {
+        if (sched->entries[i].pid == pid) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int mb_module_upgrade(const mb_module_t *mod, mb_scheduler_t *sched) {
+    const uint8_t *program;
+    size_t program_size;
+    const mb_process_t *boot;
+    uint8_t i, p;
+
+    if (mb_sched_upgrades_pending(sched) != 0) {
+        return MB_UPGRADE_PENDING;
+    }
+    for (i = 0; i < mod->entry_count; i++) {
+        if (mb_sched_proc(sched, sched->entries[i].pid) == NULL) {
+            return MB_BAD_PID;
+        }
+    }
+    for (i = 0; i < mod->entry_count; i++) {
+        boot = mb_sched_proc(sched, sched->entries[i].pid);
+        if (boot->state != MB_PROC_HALTED &&
+            mb_module_entry(mod, i, &program, &program_size) == MB_OK) {
+            (void)mb_sched_upgrade(sched, boot->pid, program, program_size);
+        }
+    }
+    /* Processes SPAWNed from an old entry follow that entry. */
+    for (p = 0; p < MB_MAX_PROCESSES; p++) {
+        mb_process_t *proc = &sched->procs[p];
+        if (proc->state == MB_PROC_FREE || proc->state == MB_PROC_HALTED ||
+            mb_module_is_boot_pid(mod, sched, proc->pid)) {
+            continue;
+        }
+        for (i = 0; i < mod->entry_count; i++) {
+            if (sched->entries[i].program != NULL && proc->program == sched->entries[i].program &&
+                proc->program_size == sched->entries[i].size &&
+                mb_module_entry(mod, i, &program, &program_size) == MB_OK) {
+                (void)mb_sched_upgrade(sched, proc->pid, program, program_size);
+                break;
+            }
+        }
+    }
+    mb_module_attach(mod, sched);
+    return MB_OK;
+}
@@ -0,0 +1,46 @@
+#define _DEFAULT_SOURCE /* fstat, mmap */
+
+#include "mb_module.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mb_errors.h"
+
+int mb_module_map_file(mb_module_t *mod, const char *path) {
+    struct stat st;
+    void *map;
+    int fd, rc;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return MB_BAD_ARGUMENT;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return MB_BAD_ARGUMENT;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  /* the mapping keeps the file referenced */
+    if (map == MAP_FAILED) {
+        return MB_BAD_ARGUMENT;
+    }
+
+    rc = mb_module_load(mod, (const uint8_t *)map, (size_t)st.st_size);
+    if (rc != MB_OK) {
+        munmap(map, (size_t)st.st_size);
+        return rc;
+    }
+    mod->map_size = (size_t)st.st_size;
+    return MB_OK;
+}
+
+void mb_module_unmap(mb_module_t *mod) {
+    if (mod->image != NULL) {
+        munmap((void *)(uintptr_t)mod->image, mod->map_size);
+        mod->image = NULL;
+        mod->map_size = 0;
+    }
+}
@@ -6,30 +6,140 @@
 #include "mb_hal.h"
 
 void mb_sched_init(mb_scheduler_t *sched) {
+    uint8_t i;
     memset(sched, 0, sizeof(*sched));
+    /* slot 0 on top: an empty scheduler hands out pids 1, 2, 3, ... */
+    for (i = 0; i < MB_MAX_PROCESSES; i++) {
+        sched->free_slots[i] = (uint8_t)(MB_MAX_PROCESSES - 1 - i);
+    }
+    sched->nfree = MB_MAX_PROCESSES;
+#if MB_SCHED_ARENA_WORDS > 0
+    mb_arena_init(&sched->arena, sched->arena_mem, MB_SCHED_ARENA_WORDS);
+#endif
+}
+
+void mb_sched_init_arena(mb_scheduler_t *sched, mb_term_t *mem, size_t words) {
+    mb_sched_init(sched);
+    mb_arena_init(&sched->arena, mem, words);
 }
 
 mb_pid_t mb_sched_spawn(mb_scheduler_t *sched,
                         const uint8_t *program, size_t program_size) {
+    return mb_sched_spawn_native(sched, program, program_size, NULL);
+}
+
+mb_pid_t mb_sched_spawn_native(mb_scheduler_t *sched,
+                               const uint8_t *program, size_t program_size,
+                               mb_native_fn native) {
+    return mb_sched_spawn_args(sched, program, program_size, NULL, 0, native);
+}
+
+mb_pid_t mb_sched_spawn_args(mb_scheduler_t *sched,
+                             const uint8_t *program, size_t program_size,
+                             const mb_term_t *args, uint8_t argc,
+                             mb_native_fn native) {
+    mb_spawn_opts_t opts = MB_SPAWN_OPTS_INIT;
+
+    opts.args = args;
+    opts.argc = argc;
+    opts.native = native;
+    return mb_sched_spawn_opts(sched, program, program_size, &opts);
+}
+
+mb_pid_t mb_sched_spawn_opts(mb_scheduler_t *sched,
+                             const uint8_t *program, size_t program_size,
+                             const mb_spawn_opts_t *opts) {
+    static const mb_spawn_opts_t defaults = MB_SPAWN_OPTS_INIT;
+    mb_process_t *proc;
+    mb_heap_t heap;
+    mb_pid_t pid;
     uint8_t i;
-    for (i = 0; i < MB_MAX_PROCESSES; i++) {
-        if (sched->procs[i].state == MB_PROC_FREE) {
-            mb_proc_init(&sched->procs[i], (mb_pid_t)(i + 1), program, program_size);
-            sched->count++;
-            return sched->procs[i].pid;
-        }
+    int rc;
+
+    if (opts == NULL) {
+        opts = &defaults;
+    }
+    if (opts->argc > MB_REG_COUNT || sched->nfree == 0) {
+        return MB_PID_NONE;
+    }
+    if (opts->gc_mode == MB_GC_SHARED) {
+        rc = mb_heap_init_shared(&heap, &sched->arena, &sched->scratch, opts->heap_words);
+    } else if (opts->gc_mode == MB_GC_COMPACT) {
+        rc = mb_heap_init_compact(&heap, &sched->arena, opts->heap_words);
+    } else {
+        rc = mb_heap_init_arena(&heap, &sched->arena, opts->heap_words);
+    }
+    if (rc != 0) {
+        return MB_PID_NONE;
+    }
+    if (opts->heap_min_words != 0 || opts->heap_max_words != 0) {
+        /* A heap starts fixed at its first size; a limit of 0 keeps that side. */
+        mb_heap_set_limits(&heap,
+                           (opts->heap_min_words != 0) ? opts->heap_min_words : heap.capacity,
+                           (opts->heap_max_words != 0) ? opts->heap_max_words : heap.capacity);
+    }
+    mb_heap_set_fullsweep(&heap, opts->fullsweep_after);
+    i = sched->free_slots[--sched->nfree];
+    proc = &sched->procs[i];
+    /* A freed slot keeps its last pid; the next incarnation is one generation on. */
+    pid = (mb_pid_t)(i + 1);
+    if (proc->pid != MB_PID_NONE) {
+        pid = (mb_pid_t)((((MB_PID_GEN(proc->pid) + 1U) << MB_PID_SLOT_BITS) | pid) & MB_PID_MAX);
+    }
+    mb_proc_init(proc, pid, program, program_size);
+    proc->heap = heap;
+    if (opts->argc > 0) {
+        memcpy(proc->regs, opts->args, (size_t)opts->argc * sizeof(opts->args[0]));
+    }
+    if (opts->native != NULL) {
+        proc->native = opts->native;
+    }
+    sched->count++;
+    return proc->pid;
+}
+
+int mb_sched_set_entry(mb_scheduler_t *sched, uint8_t entry,
+                       const uint8_t *program, size_t program_size,
+                       size_t heap_words) {
+    if (entry >= MB_SCHED_MAX_ENTRIES) {
+        return MB_BAD_ENTRY;
     }
-    return MB_PID_NONE;
+    sched->entries[entry].program = program;
+    sched->entries[entry].size = program_size;
+    sched->entries[entry].heap_words = heap_words;
+    return MB_OK;
+}
+
+int mb_sched_exit(mb_scheduler_t *sched, mb_pid_t pid) {
+    mb_process_t *proc = mb_sched_proc(sched, pid);
+
+    if (proc == NULL) {
+        return MB_BAD_PID;
+    }
+    /* pid stays behind as the slot's last generation; the rest is reset on reuse */
+    proc->state = MB_PROC_FREE;
+    proc->halted = 1;
+    proc->next_program = NULL;
+    proc->next_program_size = 0;
+    mb_heap_release(&proc->heap);
+    mb_proc_release(proc);
+    sched->free_slots[sched->nfree++] = (uint8_t)(MB_PID_SLOT(pid) - 1U);
+    sched->count--;
+    return MB_OK;
 }
 
 mb_process_t *mb_sched_proc(mb_scheduler_t *sched, mb_pid_t pid) {
-    if (pid == MB_PID_NONE || pid > MB_MAX_PROCESSES) {
+    unsigned slot = MB_PID_SLOT(pid);
+    mb_process_t *proc;
+
+    if (slot == 0 || slot > MB_MAX_PROCESSES) {
         return NULL;
     }
-    if (sched->procs[pid - 1].state == MB_PROC_FREE) {
+    proc = &sched->procs[slot - 1];
+    if (proc->state == MB_PROC_FREE || proc->pid != pid) {
         return NULL;
     }
-    return &sched->procs[pid - 1];
+    return proc;
 }
 
 int mb_sched_send(mb_scheduler_t *sched, mb_pid_t dst, mb_command_t cmd) {
@@ -47,6 +157,48 @@ int mb_sched_send(mb_scheduler_t *sched, mb_pid_t dst, mb_command_t cmd) {
     return rc;
 }
 
+/*
+ * Switch points, checked between slices: blocked in RECV_CMD, sleeping,
+ * or about to enter a loop head (a back-edge was just taken).  Never in
+ * the middle of a trapped BIF call.
+ */
+static void mb_sched_try_switch(mb_process_t *proc) {
+    if (proc->bif_trapped) {
+        return;
+    }
+    if (proc->state == MB_PROC_WAITING) {
+        mb_proc_load(proc, proc->next_program, proc->next_program_size);
+        proc->state = MB_PROC_READY;
+    } else if (proc->state == MB_PROC_SLEEPING ||
+               (proc->state == MB_PROC_READY && mb_code_is_loop_head(proc->code, proc->pc))) {
+        mb_proc_load(proc, proc->next_program, proc->next_program_size);
+    }
+}
+
+int mb_sched_upgrade(mb_scheduler_t *sched, mb_pid_t pid,
+                     const uint8_t *program, size_t program_size) {
+    mb_process_t *proc = mb_sched_proc(sched, pid);
+
+    if (proc == NULL || proc->state == MB_PROC_HALTED) {
+        return MB_BAD_PID;
+    }
+    proc->next_program = program;
+    proc->next_program_size = program_size;
+    mb_sched_try_switch(proc);
+    return MB_OK;
+}
+
+uint8_t mb_sched_upgrades_pending(const mb_scheduler_t *sched) {
+    uint8_t i, n = 0;
+    for (i = 0; i < MB_MAX_PROCESSES; i++) {
+        const mb_process_t *p = &sched->procs[i];
+        if (p->next_program != NULL && p->state != MB_PROC_FREE && p->state != MB_PROC_HALTED) {
+            n++;
+        }
+    }
+    return n;
+}
+
 static void mb_sched_wake_sleepers(mb_scheduler_t *sched) {
     uint8_t i;
     uint32_t now = mb_hal_monotonic_ms();
@@ -61,6 +213,7 @@ static void mb_sched_wake_sleepers(mb_scheduler_t *sched) {
 int mb_sched_tick(mb_scheduler_t *sched) {
     uint8_t i, start;
     mb_process_t *proc = NULL;
+    int rc;
 
     mb_sched_wake_sleepers(sched);
 
@@ -79,5 +232,9 @@ int mb_sched_tick(mb_scheduler_t *sched) {
         return MB_SCHED_IDLE;
     }
 
-    return mb_proc_run(proc, sched, MB_REDUCTIONS);
+    rc = mb_proc_run(proc, sched, MB_REDUCTIONS);
+    if (proc->next_program != NULL) {
+        mb_sched_try_switch(proc);
+    }
+    return rc;
 }
@@ -2,752 +2,1122 @@
 
 #include <string.h>
 
+#include "mb_bif.h"
 #include "mb_hal.h"
+#include "mb_native.h"
 #include "mb_scheduler.h"
 
-#define MB_MAX_GPIO_PIN 39
-#define MB_MAX_PWM_CHANNEL 7
-#define MB_MAX_I2C_BUS 3
-#define MB_MAX_I2C_ADDR 0x7f
-#define MB_MAX_PWM_PERMILLE 1000
-#define MB_MAX_PWM_FREQUENCY_HZ 40000
+#ifdef MB_JIT
+#include "mb_jit.h"
+#endif
 
-/* --- fetch helpers (operate on process) --- */
+/*
+ * BIF dispatch is instantiated twice, with `trusted` constant, so the
+ * checks guarded by !trusted fold away in the verified variant.
+ */
+#if defined(__GNUC__)
+#define MB_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define MB_ALWAYS_INLINE inline
+#endif
 
-static int mb_fetch_u8(mb_process_t *proc, uint8_t *out) {
-    if (proc->pc >= proc->program_size) {
-        return MB_EOF;
+/* --- mailbox helpers (operate on raw mailbox) --- */
+
+static int mb_mailbox_push_raw(mb_mailbox_t *mb, mb_command_t cmd) {
+    int status = mb_bif_validate_command(&cmd);
+
+    if (status != MB_OK) {
+        return status;
+    }
+
+    if (mb->count >= MB_MAILBOX_CAPACITY) {
+        return MB_MAILBOX_FULL;
     }
-    *out = proc->program[proc->pc++];
+
+    mb->items[mb->tail] = cmd;
+    mb->tail = (mb->tail + 1U) % MB_MAILBOX_CAPACITY;
+    mb->count++;
     return MB_OK;
 }
 
-static int mb_fetch_i32(mb_process_t *proc, int32_t *out) {
-    uint8_t b0, b1, b2, b3;
-    if (mb_fetch_u8(proc, &b0) != MB_OK ||
-        mb_fetch_u8(proc, &b1) != MB_OK ||
-        mb_fetch_u8(proc, &b2) != MB_OK ||
-        mb_fetch_u8(proc, &b3) != MB_OK) {
-        return MB_EOF;
+static int mb_mailbox_pop_raw(mb_mailbox_t *mb, mb_command_t *cmd) {
+    if (mb->count == 0) {
+        return MB_MAILBOX_EMPTY;
     }
-    *out = (int32_t)((uint32_t)b0 |
-                     ((uint32_t)b1 << 8) |
-                     ((uint32_t)b2 << 16) |
-                     ((uint32_t)b3 << 24));
+    *cmd = mb->items[mb->head];
+    mb->head = (mb->head + 1U) % MB_MAILBOX_CAPACITY;
+    mb->count--;
     return MB_OK;
 }
 
-/* --- validation helpers (pure functions) --- */
+/* --- BIF dispatch (operates on process, registers are tagged terms) --- */
 
-static int mb_vm_valid_reg(uint8_t reg) {
-    return reg < MB_REG_COUNT;
+/*
+ * BIF id and argc were proven against the BIF table (mb_bif.h) by
+ * mb_verify_program() for trusted code; argument values are runtime data
+ * and each native validates them.
+ */
+
+static MB_ALWAYS_INLINE int mb_call_bif(mb_process_t *proc, uint8_t bif_id, uint8_t argc,
+                                        const uint8_t *argv, uint8_t dst, int trusted) {
+    mb_term_t args[MB_BIF_MAX_ARITY];
+    const mb_bif_entry_t *bif;
+    uint8_t i;
+
+    if (!trusted) {
+        bif = mb_bif_lookup(bif_id);
+        if (bif == NULL) return MB_BAD_BIF;
+        if (argc != bif->arity) return MB_BAD_ARGC;
+    } else {
+        bif = &mb_bif_table[bif_id];
+    }
+    for (i = 0; i < argc; i++) {
+        args[i] = proc->regs[argv[i]];
+    }
+    return bif->fn(proc, args, &proc->regs[dst]);
 }
 
-static int mb_validate_gpio_pin(int32_t pin) {
-    return pin >= 0 && pin <= MB_MAX_GPIO_PIN;
-}
+/* --- process API --- */
 
-static int mb_validate_pwm_channel(int32_t channel) {
-    return channel >= 0 && channel <= MB_MAX_PWM_CHANNEL;
+static void mb_proc_reset(mb_process_t *proc, mb_pid_t pid,
+                          const uint8_t *program, size_t program_size) {
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = pid;
+    proc->state = MB_PROC_READY;
+    proc->program = program;
+    proc->program_size = program_size;
 }
 
-static int mb_validate_pwm_duty(int32_t permille) {
-    return permille >= 0 && permille <= MB_MAX_PWM_PERMILLE;
+static void mb_proc_start(mb_process_t *proc) {
+#ifdef MB_JIT
+    /* Verified programs run through the host JIT; others stay interpreted. */
+    (void)mb_jit_attach(proc);
+#else
+    (void)proc;
+#endif
 }
 
-static int mb_validate_i2c_bus(int32_t bus) {
-    return bus >= 0 && bus <= MB_MAX_I2C_BUS;
+void mb_proc_init(mb_process_t *proc, mb_pid_t pid,
+                  const uint8_t *program, size_t program_size) {
+    mb_proc_reset(proc, pid, program, program_size);
+    proc->code = mb_code_get(program, program_size);
+    mb_proc_start(proc);
 }
 
-static int mb_validate_i2c_addr(int32_t addr) {
-    return addr >= 0 && addr <= MB_MAX_I2C_ADDR;
+void mb_proc_release(mb_process_t *proc) {
+    mb_code_put(proc->code);
+    proc->code = NULL;
 }
 
-static int mb_validate_u8_value(int32_t value) {
-    return value >= 0 && value <= 0xff;
+void mb_proc_load(mb_process_t *proc, const uint8_t *program, size_t program_size) {
+    proc->program = program;
+    proc->program_size = program_size;
+    proc->next_program = NULL;
+    proc->next_program_size = 0;
+    mb_code_put(proc->code);
+    proc->code = mb_code_get(program, program_size);
+    proc->pc = 0;
+    proc->heap.stop = proc->heap.capacity;
+    proc->bif_trapped = 0;
+    memset(proc->bif_state, 0, sizeof(proc->bif_state));
+    proc->native = NULL;
+#ifdef MB_JIT
+    proc->jit = NULL;
+    (void)mb_jit_attach(proc);
+#endif
 }
 
-static int mb_validate_pwm_frequency(int32_t frequency_hz) {
-    return frequency_hz > 0 && frequency_hz <= MB_MAX_PWM_FREQUENCY_HZ;
+/* Collect for an allocation of @p need words that did not fit. */
+static void mb_proc_gc(mb_process_t *proc, size_t need) {
+    mb_term_t *roots[MB_REG_COUNT];
+    uint8_t i;
+    for (i = 0; i < MB_REG_COUNT; i++) roots[i] = &proc->regs[i];
+    mb_heap_gc_need(&proc->heap, roots, MB_REG_COUNT, need);
 }
 
-static int mb_validate_command(const mb_command_t *cmd) {
-    switch ((mb_command_type_t)cmd->type) {
-    case MB_CMD_NONE:
-        return MB_OK;
-    case MB_CMD_GPIO_WRITE:
-        return (mb_validate_gpio_pin(cmd->a) && (cmd->b == 0 || cmd->b == 1)) ? MB_OK : MB_BAD_ARGUMENT;
-    case MB_CMD_GPIO_READ:
-        return mb_validate_gpio_pin(cmd->a) ? MB_OK : MB_BAD_ARGUMENT;
-    case MB_CMD_PWM_SET_DUTY:
-        return (mb_validate_pwm_channel(cmd->a) && mb_validate_pwm_duty(cmd->b)) ? MB_OK : MB_BAD_ARGUMENT;
-    case MB_CMD_PWM_CONFIG:
-        return (mb_validate_pwm_channel(cmd->a) && mb_validate_pwm_frequency(cmd->b)) ? MB_OK : MB_BAD_ARGUMENT;
-    case MB_CMD_I2C_READ:
-        return (mb_validate_i2c_bus(cmd->a) && mb_validate_i2c_addr(cmd->b) && mb_validate_u8_value(cmd->c)) ? MB_OK : MB_BAD_ARGUMENT;
-    case MB_CMD_I2C_WRITE:
-        return (mb_validate_i2c_bus(cmd->a) && mb_validate_i2c_addr(cmd->b) &&
-                mb_validate_u8_value(cmd->c) && mb_validate_u8_value(cmd->d))
-                   ? MB_OK
-                   : MB_BAD_ARGUMENT;
-    default:
-        return MB_INVALID_COMMAND;
+/* Push n stack slots, collecting once if heap and stack have met. */
+static mb_term_t *mb_proc_stack_alloc(mb_process_t *proc, size_t n) {
+    mb_term_t *top = mb_heap_stack_alloc(&proc->heap, n);
+    if (top == NULL) {
+        mb_proc_gc(proc, n);
+        top = mb_heap_stack_alloc(&proc->heap, n);
     }
+    return top;
 }
 
-/* --- mailbox helpers (operate on raw mailbox) --- */
-
-static int mb_mailbox_push_raw(mb_mailbox_t *mb, mb_command_t cmd) {
-    int status = mb_validate_command(&cmd);
+/* Reductions a native called at @p red may consume (mb_bif_consume()). */
+static inline uint32_t mb_bif_budget(const mb_process_t *proc, uint32_t red) {
+    return (proc->slice_budget > red) ? proc->slice_budget - red : 1U;
+}
 
-    if (status != MB_OK) {
-        return status;
+static MB_ALWAYS_INLINE int mb_exec_call_bif(mb_process_t *proc, const mb_insn_t *in,
+                                             uint32_t red, int trusted) {
+    uint8_t args[8];
+    uint8_t i;
+    for (i = 0; i < in->r[1]; i++) {
+        args[i] = (uint8_t)((in->imm >> (4U * i)) & 0x0FU);
     }
+    proc->bif_reds = mb_bif_budget(proc, red);
+    return mb_call_bif(proc, in->r[0], in->r[1], args, in->r[2], trusted);
+}
 
-    if (mb->count >= MB_MAILBOX_CAPACITY) {
-        return MB_MAILBOX_FULL;
+/*
+ * RECV_CMD into r[0..4].  Returns MB_MAILBOX_EMPTY only when the caller
+ * must block (scheduler mode, empty mailbox); otherwise the registers
+ * were written (compat mode reports an empty mailbox as MB_CMD_NONE).
+ */
+static int mb_exec_recv(mb_process_t *proc, const uint8_t *r, int can_block) {
+    mb_term_t *regs = proc->regs;
+    mb_command_t cmd;
+    int rc;
+
+    rc = mb_mailbox_pop_raw(&proc->mailbox, &cmd);
+    if (rc == MB_OK) {
+        rc = mb_bif_validate_command(&cmd);
+        if (rc == MB_OK) {
+            regs[r[0]] = MB_MAKE_SMALLINT(cmd.type);
+            regs[r[1]] = MB_MAKE_SMALLINT(cmd.a);
+            regs[r[2]] = MB_MAKE_SMALLINT(cmd.b);
+            regs[r[3]] = MB_MAKE_SMALLINT(cmd.c);
+            regs[r[4]] = MB_MAKE_SMALLINT(cmd.d);
+            proc->last_error = MB_OK;
+            return MB_OK;
+        }
+    } else if (can_block) {
+        return MB_MAILBOX_EMPTY;
     }
 
-    mb->items[mb->tail] = cmd;
-    mb->tail = (mb->tail + 1U) % MB_MAILBOX_CAPACITY;
-    mb->count++;
+    regs[r[0]] = MB_MAKE_SMALLINT(MB_CMD_NONE);
+    regs[r[1]] = MB_MAKE_SMALLINT(rc);
+    regs[r[2]] = MB_MAKE_SMALLINT(0);
+    regs[r[3]] = MB_MAKE_SMALLINT(0);
+    regs[r[4]] = MB_MAKE_SMALLINT(0);
+    proc->last_error = rc;
     return MB_OK;
 }
 
-static int mb_mailbox_pop_raw(mb_mailbox_t *mb, mb_command_t *cmd) {
-    if (mb->count == 0) {
-        return MB_MAILBOX_EMPTY;
+/*
+ * Pid operand: a pid term (SELF, SPAWN) or a small integer (flow
+ * constants); both keep the pid above the 4-bit tag.
+ */
+static inline mb_pid_t mb_reg_pid(mb_term_t t) {
+    int32_t v = MB_GET_SMALLINT(t);
+    return (v > 0 && v <= (int32_t)MB_PID_MAX) ? (mb_pid_t)v : MB_PID_NONE;
+}
+
+/*
+ * SPAWN entry r[1] with argc r[3] arguments from r[2]; the new pid goes to
+ * r[0], or small integer 0 when the process table or the arena is full.
+ */
+static int mb_exec_spawn(mb_process_t *proc, void *sched, const uint8_t *r) {
+    mb_scheduler_t *s = (mb_scheduler_t *)sched;
+    const mb_sched_entry_t *e;
+    mb_pid_t pid;
+    mb_spawn_opts_t opts = MB_SPAWN_OPTS_INIT;
+
+    if (s == NULL) {
+        return MB_BAD_ARGUMENT;
     }
-    *cmd = mb->items[mb->head];
-    mb->head = (mb->head + 1U) % MB_MAILBOX_CAPACITY;
-    mb->count--;
+    if (r[1] >= MB_SCHED_MAX_ENTRIES || s->entries[r[1]].program == NULL) {
+        return MB_BAD_ENTRY;
+    }
+    e = &s->entries[r[1]];
+    opts.args = &proc->regs[r[2]];
+    opts.argc = r[3];
+    opts.heap_words = e->heap_words;
+    pid = mb_sched_spawn_opts(s, e->program, e->size, &opts);
+    proc->regs[r[0]] = (pid != MB_PID_NONE) ? MB_MAKE_PID(pid) : MB_MAKE_SMALLINT(0);
     return MB_OK;
 }
 
-/* --- BIF dispatch (operates on process, registers are tagged terms) --- */
+/* SEND to the pid in r[0] with the command in r[1..5]; returns the send status. */
+static int mb_exec_send(mb_process_t *proc, void *sched, const uint8_t *r) {
+    mb_scheduler_t *s = (mb_scheduler_t *)sched;
+    mb_term_t *regs = proc->regs;
+    mb_process_t *target;
+    mb_command_t cmd;
+    int rc;
 
-/* Helper: extract int32 from a tagged register for BIF arguments. */
-#define REG_INT(r) MB_GET_SMALLINT(proc->regs[(r)])
-
-static int mb_call_bif(mb_process_t *proc, uint8_t bif_id, uint8_t argc, uint8_t *argv, uint8_t dst) {
-    int rc = 0;
-    if (!mb_vm_valid_reg(dst)) {
-        return MB_BAD_REG;
-    }
-
-    switch ((mb_bif_t)bif_id) {
-    case MB_BIF_GPIO_WRITE: {
-        int32_t pin, level;
-        if (argc != 2) return MB_BAD_ARGC;
-        pin = REG_INT(argv[0]);
-        level = REG_INT(argv[1]);
-        if (!mb_validate_gpio_pin(pin) || (level != 0 && level != 1))
-            return MB_BAD_ARGUMENT;
-        rc = mb_hal_gpio_write((uint8_t)pin, (uint8_t)level);
-        proc->regs[dst] = MB_MAKE_SMALLINT(rc);
-        return MB_OK;
+    if (s == NULL) {
+        return MB_BAD_ARGUMENT;
     }
 
-    case MB_BIF_GPIO_READ: {
-        int32_t pin;
-        uint8_t level = 0;
-        if (argc != 1) return MB_BAD_ARGC;
-        pin = REG_INT(argv[0]);
-        if (!mb_validate_gpio_pin(pin)) return MB_BAD_ARGUMENT;
-        rc = mb_hal_gpio_read((uint8_t)pin, &level);
-        proc->regs[dst] = MB_MAKE_SMALLINT((rc == 0) ? (int32_t)level : rc);
-        return MB_OK;
+    target = mb_sched_proc(s, mb_reg_pid(regs[r[0]]));
+    if (target == NULL) {
+        return MB_BAD_PID;
     }
 
-    case MB_BIF_PWM_SET_DUTY: {
-        int32_t ch, duty;
-        if (argc != 2) return MB_BAD_ARGC;
-        ch = REG_INT(argv[0]);
-        duty = REG_INT(argv[1]);
-        if (!mb_validate_pwm_channel(ch) || !mb_validate_pwm_duty(duty))
-            return MB_BAD_ARGUMENT;
-        rc = mb_hal_pwm_set_duty((uint8_t)ch, (uint16_t)duty);
-        proc->regs[dst] = MB_MAKE_SMALLINT(rc);
-        return MB_OK;
-    }
+    /* Untag register values back to raw int32 for command ABI */
+    cmd.type = MB_GET_SMALLINT(regs[r[1]]);
+    cmd.a = MB_GET_SMALLINT(regs[r[2]]);
+    cmd.b = MB_GET_SMALLINT(regs[r[3]]);
+    cmd.c = MB_GET_SMALLINT(regs[r[4]]);
+    cmd.d = MB_GET_SMALLINT(regs[r[5]]);
 
-    case MB_BIF_PWM_CONFIG: {
-        int32_t ch, freq;
-        if (argc != 2) return MB_BAD_ARGC;
-        ch = REG_INT(argv[0]);
-        freq = REG_INT(argv[1]);
-        if (!mb_validate_pwm_channel(ch) || !mb_validate_pwm_frequency(freq))
-            return MB_BAD_ARGUMENT;
-        rc = mb_hal_pwm_config((uint8_t)ch, (uint32_t)freq);
-        proc->regs[dst] = MB_MAKE_SMALLINT(rc);
-        return MB_OK;
+    rc = mb_vm_mailbox_push_proc(target, cmd);
+    if (rc == MB_OK && target->state == MB_PROC_WAITING) {
+        target->state = MB_PROC_READY;
     }
+    return rc;
+}
 
-    case MB_BIF_I2C_READ_REG: {
-        int32_t bus, addr, reg;
-        uint8_t value = 0;
-        if (argc != 3) return MB_BAD_ARGC;
-        bus = REG_INT(argv[0]);
-        addr = REG_INT(argv[1]);
-        reg = REG_INT(argv[2]);
-        if (!mb_validate_i2c_bus(bus) || !mb_validate_i2c_addr(addr) ||
-            !mb_validate_u8_value(reg))
-            return MB_BAD_ARGUMENT;
-        rc = mb_hal_i2c_read_reg((uint8_t)bus, (uint8_t)addr, (uint8_t)reg, &value);
-        proc->regs[dst] = MB_MAKE_SMALLINT((rc == 0) ? (int32_t)value : rc);
-        return MB_OK;
-    }
+/* --- small-integer arithmetic (overflow saturates, see contract) --- */
 
-    case MB_BIF_I2C_WRITE_REG: {
-        int32_t bus, addr, reg, val;
-        if (argc != 4) return MB_BAD_ARGC;
-        bus = REG_INT(argv[0]);
-        addr = REG_INT(argv[1]);
-        reg = REG_INT(argv[2]);
-        val = REG_INT(argv[3]);
-        if (!mb_validate_i2c_bus(bus) || !mb_validate_i2c_addr(addr) ||
-            !mb_validate_u8_value(reg) || !mb_validate_u8_value(val))
-            return MB_BAD_ARGUMENT;
-        rc = mb_hal_i2c_write_reg((uint8_t)bus, (uint8_t)addr, (uint8_t)reg, (uint8_t)val);
-        proc->regs[dst] = MB_MAKE_SMALLINT(rc);
-        return MB_OK;
+static inline mb_term_t mb_sat_smallint(int64_t v) {
+    if (v > MB_SMALLINT_MAX) {
+        v = MB_SMALLINT_MAX;
+    } else if (v < MB_SMALLINT_MIN) {
+        v = MB_SMALLINT_MIN;
     }
+    return MB_MAKE_SMALLINT((int32_t)v);
+}
 
-    case MB_BIF_MONOTONIC_MS:
-        if (argc != 0) return MB_BAD_ARGC;
-        proc->regs[dst] = MB_MAKE_SMALLINT((int32_t)mb_hal_monotonic_ms());
-        return MB_OK;
-
+/* Entry i of a LUT table in program memory. */
+static int32_t mb_lut_entry(const uint8_t *t, uint8_t mode, uint32_t i) {
+    switch (mode & MB_LUT_WIDTH) {
+    case MB_LUT_W8:
+        return (mode & MB_LUT_SIGNED) ? (int32_t)(int8_t)t[i] : (int32_t)t[i];
+    case MB_LUT_W16: {
+        uint16_t v = (uint16_t)(t[2 * i] | (t[2 * i + 1] << 8));
+        return (mode & MB_LUT_SIGNED) ? (int32_t)(int16_t)v : (int32_t)v;
+    }
     default:
-        return MB_BAD_BIF;
+        return (int32_t)((uint32_t)t[4 * i] | ((uint32_t)t[4 * i + 1] << 8) |
+                         ((uint32_t)t[4 * i + 2] << 16) | ((uint32_t)t[4 * i + 3] << 24));
     }
 }
 
-#undef REG_INT
-
-/* --- process API --- */
+/*
+ * LUT: the index is x >> shift, clamped to the table.  With MB_LUT_LERP
+ * the low shift bits of x weight the next entry (truncating toward zero).
+ */
+static mb_term_t mb_lut(const uint8_t *t, uint8_t mode, uint8_t shift, uint32_t n, int32_t x) {
+    int64_t a;
+    uint32_t i, frac = 0;
 
-void mb_proc_init(mb_process_t *proc, mb_pid_t pid,
-                  const uint8_t *program, size_t program_size) {
-    memset(proc, 0, sizeof(*proc));
-    proc->pid = pid;
-    proc->state = MB_PROC_READY;
-    proc->program = program;
-    proc->program_size = program_size;
-    mb_heap_init(&proc->heap);
+    if (x < 0) {
+        x = 0;
+    }
+    i = (uint32_t)x >> shift;
+    if (i >= n - 1U) {
+        return mb_sat_smallint(mb_lut_entry(t, mode, n - 1U));
+    }
+    if (mode & MB_LUT_LERP) {
+        frac = (uint32_t)x & ((1U << shift) - 1U);
+    }
+    a = mb_lut_entry(t, mode, i);
+    if (frac != 0) {
+        a += ((int64_t)mb_lut_entry(t, mode, i + 1U) - a) * frac / ((int64_t)1 << shift);
+    }
+    return mb_sat_smallint(a);
 }
 
-int mb_proc_step(mb_process_t *proc, void *sched) {
-    uint8_t op;
-    int32_t val;
-    size_t pre_op_pc;
-
-    if (proc->halted) {
-        return MB_OK;
+/* Arithmetic shift left by n; a negative n shifts right (erlang:bsl/2). */
+static mb_term_t mb_shift_smallint(int32_t v, int32_t n) {
+    if (n >= 0) {
+        /* |v| < 2^27, so clamping n keeps the product inside int64 */
+        return mb_sat_smallint((int64_t)v * ((int64_t)1 << (n > 32 ? 32 : n)));
     }
+    return MB_MAKE_SMALLINT(v >> (n < -31 ? 31 : -n));
+}
 
-    pre_op_pc = proc->pc;
-
-    if (mb_fetch_u8(proc, &op) != MB_OK) {
-        proc->last_error = MB_EOF;
-        return proc->last_error;
+/*
+ * Dispatch.  With GCC/Clang each handler jumps straight to the next one
+ * through a label table (threaded code); elsewhere, or with
+ * MB_NO_COMPUTED_GOTO, the same handlers sit in a switch inside a loop.
+ * Handlers are written once against the MB_OP/MB_NEXT macros.
+ */
+#if defined(__GNUC__) && !defined(MB_NO_COMPUTED_GOTO)
+#define MB_THREADED 1
+#else
+#define MB_THREADED 0
+#endif
+
+#if MB_THREADED
+#define MB_OP(label, opcode) label
+#define MB_OP_DEFAULT(label) label
+#define MB_DISPATCH()            \
+    do {                         \
+        in = &insns[pc++];       \
+        goto *ops[in->op];       \
+    } while (0)
+/* Every opcode value has an entry; unknown ones land on op_bad. */
+#define MB_OP_TABLE(call_bif_label)                 \
+    {                                               \
+        [0 ... 255] = &&op_bad,                     \
+        [MB_OP_NOP] = &&op_nop,                     \
+        [MB_OP_CONST_I32] = &&op_const_i32,         \
+        [MB_OP_MOVE] = &&op_move,                   \
+        [MB_OP_ADD] = &&op_add,                     \
+        [MB_OP_SUB] = &&op_sub,                     \
+        [MB_OP_ADD_IMM] = &&op_add_imm,             \
+        [MB_OP_SUB_IMM] = &&op_sub_imm,             \
+        [MB_OP_MUL] = &&op_mul,                     \
+        [MB_OP_DIV] = &&op_div,                     \
+        [MB_OP_REM] = &&op_rem,                     \
+        [MB_OP_SHL] = &&op_shl,                     \
+        [MB_OP_SHR] = &&op_shr,                     \
+        [MB_OP_AND] = &&op_and,                     \
+        [MB_OP_OR] = &&op_or,                       \
+        [MB_OP_XOR] = &&op_xor,                     \
+        [MB_OP_CALL_BIF] = &&call_bif_label,        \
+        [MB_OP_CALL] = &&op_call,                   \
+        [MB_OP_RET] = &&op_ret,                     \
+        [MB_OP_ALLOCATE] = &&op_allocate,           \
+        [MB_OP_DEALLOCATE] = &&op_deallocate,       \
+        [MB_OP_GET_Y] = &&op_get_y,                 \
+        [MB_OP_PUT_Y] = &&op_put_y,                 \
+        [MB_OP_RECV_CMD] = &&op_recv_cmd,           \
+        [MB_OP_SEND] = &&op_send,                   \
+        [MB_OP_SELF] = &&op_self,                   \
+        [MB_OP_YIELD] = &&op_yield,                 \
+        [MB_OP_SPAWN] = &&op_spawn,                 \
+        [MB_OP_EXIT] = &&op_exit,                   \
+        [MB_OP_JMP] = &&op_jmp,                     \
+        [MB_OP_JMP_IF_ZERO] = &&op_jmp_if_zero,     \
+        [MB_OP_JMP_EQ] = &&op_jmp_eq,               \
+        [MB_OP_JMP_NE] = &&op_jmp_ne,               \
+        [MB_OP_JMP_LT] = &&op_jmp_lt,               \
+        [MB_OP_JMP_GE] = &&op_jmp_ge,               \
+        [MB_OP_JMP_EQ_IMM] = &&op_jmp_eq_imm,       \
+        [MB_OP_JMP_NE_IMM] = &&op_jmp_ne_imm,       \
+        [MB_OP_JMP_LT_IMM] = &&op_jmp_lt_imm,       \
+        [MB_OP_JMP_GE_IMM] = &&op_jmp_ge_imm,       \
+        [MB_OP_DJNZ] = &&op_djnz,                   \
+        [MB_OP_SELECT_VAL] = &&op_select_val,       \
+        [MB_OP_JUMP_TABLE] = &&op_jump_table,       \
+        [MB_OP_SLEEP_MS] = &&op_sleep_ms,           \
+        [MB_OP_MAKE_TUPLE] = &&op_make_tuple,       \
+        [MB_OP_TUPLE_ELEM] = &&op_tuple_elem,       \
+        [MB_OP_CONS] = &&op_cons,                   \
+        [MB_OP_HEAD] = &&op_head,                   \
+        [MB_OP_TAIL] = &&op_tail,                   \
+        [MB_OP_IS_INTEGER] = &&op_is_integer,       \
+        [MB_OP_IS_NIL] = &&op_is_nil,               \
+        [MB_OP_IS_CONS] = &&op_is_cons,             \
+        [MB_OP_IS_TUPLE] = &&op_is_tuple,           \
+        [MB_OP_TEST_ARITY] = &&op_test_arity,       \
+        [MB_OP_IS_EQ_EXACT] = &&op_is_eq_exact,     \
+        [MB_OP_GET_TUPLE_ELEMENTS] = &&op_get_tuple_elements, \
+        [MB_OP_MIN] = &&op_min,                     \
+        [MB_OP_MAX] = &&op_max,                     \
+        [MB_OP_CLAMP] = &&op_clamp,                 \
+        [MB_OP_QMUL] = &&op_qmul,                   \
+        [MB_OP_LUT] = &&op_lut,                     \
+        [MB_OP_I2C_SAMPLE] = &&op_i2c_sample,       \
+        [MB_OP_SEND_WAIT] = &&op_send_wait,         \
+        [MB_OP_RECV_PWM] = &&op_recv_pwm,           \
+        [MB_OP_HALT] = &&op_halt,                   \
+        [MB_INSN_TRAP] = &&op_trap,                 \
     }
-
-    switch ((mb_opcode_t)op) {
-    case MB_OP_NOP:
-        return MB_OK;
-
-    case MB_OP_CONST_I32: {
-        uint8_t dst;
-        if (mb_fetch_u8(proc, &dst) != MB_OK || mb_fetch_i32(proc, &val) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
-        }
-        if (!mb_vm_valid_reg(dst)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
-        }
-        proc->regs[dst] = MB_MAKE_SMALLINT(val);
+#else
+#define MB_OP(label, opcode) case opcode
+#define MB_OP_DEFAULT(label) default
+#define MB_DISPATCH() goto dispatch
+#endif
+
+/* Count the instruction just retired and continue or end the slice. */
+#define MB_NEXT()                    \
+    do {                             \
+        if (++red >= max_steps) {    \
+            goto slice_out;          \
+        }                            \
+        MB_DISPATCH();               \
+    } while (0)
+
+#define MB_FAULT(status) \
+    do {                 \
+        rc = (status);   \
+        goto slice_fault; \
+    } while (0)
+
+/*
+ * Run until the slice has retired max_steps instructions, counting the
+ * red0 already retired by native code in this slice (0 when the slice
+ * starts here).  pc, the reduction count and the register file pointer
+ * live in locals for the whole slice; pc and reductions are written back
+ * to the process only when the slice ends (budget spent, yield, block,
+ * halt or fault).
+ *
+ * Operands were range-checked by mb_code_get(), so handlers index the
+ * register file directly.  Faults found at decode time arrive as TRAP
+ * instructions; pc stays on the trap so the fault is sticky.  Verified
+ * code still ends in an EOF trap, so TRAP is handled in both modes.
+ */
+static int mb_proc_slice(mb_process_t *proc, void *sched, uint32_t red0, uint32_t max_steps) {
+    const mb_insn_t *const insns = proc->code->insns;
+    mb_term_t *const regs = proc->regs;
+    const int trusted = (proc->code->verify_status == MB_OK);
+    const mb_insn_t *in;
+    size_t pc = proc->pc;
+    uint32_t red = red0;
+    int rc;
+#if MB_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static const void *const checked_ops[256] = MB_OP_TABLE(op_call_bif);
+    static const void *const trusted_ops[256] = MB_OP_TABLE(op_call_bif_trusted);
+#pragma GCC diagnostic pop
+    const void *const *const ops = trusted ? trusted_ops : checked_ops;
+#endif
+
+    proc->reductions = red0;
+    if (proc->halted || red0 >= max_steps) {
         return MB_OK;
     }
 
-    case MB_OP_MOVE:
-    case MB_OP_ADD:
-    case MB_OP_SUB: {
-        uint8_t dst, a, b;
-        if (mb_fetch_u8(proc, &dst) != MB_OK ||
-            mb_fetch_u8(proc, &a) != MB_OK ||
-            mb_fetch_u8(proc, &b) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
-        }
-        if (!mb_vm_valid_reg(dst) || !mb_vm_valid_reg(a) || !mb_vm_valid_reg(b)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
-        }
-        if (op == MB_OP_MOVE) {
-            proc->regs[dst] = proc->regs[a];
-        } else if (op == MB_OP_ADD) {
-            proc->regs[dst] = MB_MAKE_SMALLINT(
-                MB_GET_SMALLINT(proc->regs[a]) + MB_GET_SMALLINT(proc->regs[b]));
-        } else {
-            proc->regs[dst] = MB_MAKE_SMALLINT(
-                MB_GET_SMALLINT(proc->regs[a]) - MB_GET_SMALLINT(proc->regs[b]));
+#if MB_THREADED
+    MB_DISPATCH();
+#else
+dispatch:
+    in = &insns[pc++];
+    switch (in->op) {
+#endif
+
+    MB_OP(op_nop, MB_OP_NOP):
+        MB_NEXT();
+
+    MB_OP(op_const_i32, MB_OP_CONST_I32):
+        regs[in->r[0]] = (mb_term_t)in->imm;
+        MB_NEXT();
+
+    MB_OP(op_move, MB_OP_MOVE):
+        regs[in->r[0]] = regs[in->r[1]];
+        MB_NEXT();
+
+    MB_OP(op_add, MB_OP_ADD):
+        regs[in->r[0]] = MB_MAKE_SMALLINT(
+            MB_GET_SMALLINT(regs[in->r[1]]) + MB_GET_SMALLINT(regs[in->r[2]]));
+        MB_NEXT();
+
+    MB_OP(op_sub, MB_OP_SUB):
+        regs[in->r[0]] = MB_MAKE_SMALLINT(
+            MB_GET_SMALLINT(regs[in->r[1]]) - MB_GET_SMALLINT(regs[in->r[2]]));
+        MB_NEXT();
+
+    /* The immediate is a full int32: sum in uint32_t, then wrap like ADD. */
+    MB_OP(op_add_imm, MB_OP_ADD_IMM):
+        regs[in->r[0]] = MB_MAKE_SMALLINT((uint32_t)MB_GET_SMALLINT(regs[in->r[1]]) + in->imm);
+        MB_NEXT();
+
+    MB_OP(op_sub_imm, MB_OP_SUB_IMM):
+        regs[in->r[0]] = MB_MAKE_SMALLINT((uint32_t)MB_GET_SMALLINT(regs[in->r[1]]) - in->imm);
+        MB_NEXT();
+
+    /*
+     * ADD/SUB wrap modulo 2^28 (v1 behaviour); MUL, DIV, SHL and QMUL
+     * saturate to [MB_SMALLINT_MIN, MB_SMALLINT_MAX].  DIV truncates
+     * toward zero and REM takes the sign of the dividend, as in C99.
+     */
+    MB_OP(op_mul, MB_OP_MUL):
+        regs[in->r[0]] = mb_sat_smallint((int64_t)MB_GET_SMALLINT(regs[in->r[1]]) *
+                                         MB_GET_SMALLINT(regs[in->r[2]]));
+        MB_NEXT();
+
+    MB_OP(op_div, MB_OP_DIV):
+    MB_OP(op_rem, MB_OP_REM): {
+        int32_t a = MB_GET_SMALLINT(regs[in->r[1]]);
+        int32_t b = MB_GET_SMALLINT(regs[in->r[2]]);
+
+        if (b == 0) {
+            MB_FAULT(MB_BAD_ARITH);
         }
-        return MB_OK;
+        /* MIN / -1 is the only quotient outside the range; it saturates */
+        regs[in->r[0]] = (in->op == MB_OP_DIV) ? mb_sat_smallint((int64_t)a / b)
+                                               : MB_MAKE_SMALLINT(a % b);
+        MB_NEXT();
     }
 
-    case MB_OP_CALL_BIF: {
-        uint8_t bif, argc, i, dst;
-        uint8_t args[8];
-        if (mb_fetch_u8(proc, &bif) != MB_OK || mb_fetch_u8(proc, &argc) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+    MB_OP(op_shl, MB_OP_SHL):
+        regs[in->r[0]] = mb_shift_smallint(MB_GET_SMALLINT(regs[in->r[1]]),
+                                           MB_GET_SMALLINT(regs[in->r[2]]));
+        MB_NEXT();
+
+    MB_OP(op_shr, MB_OP_SHR):
+        regs[in->r[0]] = mb_shift_smallint(MB_GET_SMALLINT(regs[in->r[1]]),
+                                           -MB_GET_SMALLINT(regs[in->r[2]]));
+        MB_NEXT();
+
+    MB_OP(op_and, MB_OP_AND):
+        regs[in->r[0]] = MB_MAKE_SMALLINT(
+            MB_GET_SMALLINT(regs[in->r[1]]) & MB_GET_SMALLINT(regs[in->r[2]]));
+        MB_NEXT();
+
+    MB_OP(op_or, MB_OP_OR):
+        regs[in->r[0]] = MB_MAKE_SMALLINT(
+            MB_GET_SMALLINT(regs[in->r[1]]) | MB_GET_SMALLINT(regs[in->r[2]]));
+        MB_NEXT();
+
+    MB_OP(op_xor, MB_OP_XOR):
+        regs[in->r[0]] = MB_MAKE_SMALLINT(
+            MB_GET_SMALLINT(regs[in->r[1]]) ^ MB_GET_SMALLINT(regs[in->r[2]]));
+        MB_NEXT();
+
+#if MB_THREADED
+    /* The trusted table routes CALL_BIF here; the choice costs nothing per op. */
+    op_call_bif_trusted:
+        rc = mb_exec_call_bif(proc, in, red, 1);
+        goto call_bif_done;
+    op_call_bif:
+        rc = mb_exec_call_bif(proc, in, red, 0);
+    call_bif_done:
+#else
+    case MB_OP_CALL_BIF:
+        rc = trusted ? mb_exec_call_bif(proc, in, red, 1) : mb_exec_call_bif(proc, in, red, 0);
+#endif
+        if (rc == MB_BIF_TRAP) {
+            /* The native used up the slice; call it again on the next one. */
+            pc--;
+            proc->bif_trapped = 1;
+            red = proc->slice_budget;
+            goto slice_out;
         }
-        if (argc > 8) {
-            proc->last_error = MB_BAD_ARGC;
-            return proc->last_error;
+        if (proc->bif_trapped) {
+            proc->bif_trapped = 0;
+            memset(proc->bif_state, 0, sizeof(proc->bif_state));
         }
-        for (i = 0; i < argc; i++) {
-            if (mb_fetch_u8(proc, &args[i]) != MB_OK) {
-                proc->last_error = MB_EOF;
-                return proc->last_error;
-            }
-            if (!mb_vm_valid_reg(args[i])) {
-                proc->last_error = MB_BAD_REG;
-                return proc->last_error;
-            }
+        proc->last_error = rc;
+        if (rc != MB_OK) {
+            goto slice_fault;
         }
-        if (mb_fetch_u8(proc, &dst) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+        /* The call's cost and the native's own work, beyond the one
+         * reduction MB_NEXT counts. */
+        red += mb_bif_table[in->r[0]].cost - 1U +
+               (mb_bif_budget(proc, red) - proc->bif_reds);
+        MB_NEXT();
+
+    /*
+     * Call frames live on the process stack (top of the heap block, see
+     * mb_heap.h).  CALL pushes the return index as a small integer, so the
+     * GC leaves it alone; ALLOCATE pushes nil-initialised Y slots on top.
+     * Y0 is the slot at the stack top.  Y indices and return addresses
+     * are runtime data and are checked in both interpreter modes.
+     */
+    MB_OP(op_call, MB_OP_CALL): {
+        mb_term_t *top = mb_proc_stack_alloc(proc, 1);
+        if (top == NULL) {
+            MB_FAULT(MB_STACK_OVERFLOW);
         }
-        proc->last_error = mb_call_bif(proc, bif, argc, args, dst);
-        return proc->last_error;
+        *top = MB_MAKE_SMALLINT((int32_t)pc);
+        pc = in->imm;
+        MB_NEXT();
     }
 
-    case MB_OP_RECV_CMD: {
-        uint8_t r_type, r_a, r_b, r_c, r_d;
-        mb_command_t cmd;
-        int rc;
+    MB_OP(op_ret, MB_OP_RET): {
+        mb_term_t cp;
+        if (mb_heap_stack_depth(&proc->heap) == 0) {
+            MB_FAULT(MB_BAD_FRAME);
+        }
+        cp = proc->heap.from[proc->heap.stop];
+        if (!MB_IS_SMALLINT(cp) || (uint32_t)MB_GET_SMALLINT(cp) > proc->code->count) {
+            MB_FAULT(MB_BAD_FRAME);
+        }
+        proc->heap.stop++;
+        pc = (size_t)MB_GET_SMALLINT(cp);
+        MB_NEXT();
+    }
 
-        if (mb_fetch_u8(proc, &r_type) != MB_OK ||
-            mb_fetch_u8(proc, &r_a) != MB_OK ||
-            mb_fetch_u8(proc, &r_b) != MB_OK ||
-            mb_fetch_u8(proc, &r_c) != MB_OK ||
-            mb_fetch_u8(proc, &r_d) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+    MB_OP(op_allocate, MB_OP_ALLOCATE):
+        if (mb_proc_stack_alloc(proc, in->r[0]) == NULL) {
+            MB_FAULT(MB_STACK_OVERFLOW);
         }
-        if (!mb_vm_valid_reg(r_type) || !mb_vm_valid_reg(r_a) ||
-            !mb_vm_valid_reg(r_b) || !mb_vm_valid_reg(r_c) || !mb_vm_valid_reg(r_d)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
+        MB_NEXT();
+
+    MB_OP(op_deallocate, MB_OP_DEALLOCATE):
+        if (mb_heap_stack_free(&proc->heap, in->r[0]) != 0) {
+            MB_FAULT(MB_BAD_FRAME);
         }
+        MB_NEXT();
 
-        rc = mb_mailbox_pop_raw(&proc->mailbox, &cmd);
-        if (rc == MB_OK) {
-            rc = mb_validate_command(&cmd);
-            if (rc == MB_OK) {
-                proc->regs[r_type] = MB_MAKE_SMALLINT(cmd.type);
-                proc->regs[r_a] = MB_MAKE_SMALLINT(cmd.a);
-                proc->regs[r_b] = MB_MAKE_SMALLINT(cmd.b);
-                proc->regs[r_c] = MB_MAKE_SMALLINT(cmd.c);
-                proc->regs[r_d] = MB_MAKE_SMALLINT(cmd.d);
-                proc->last_error = MB_OK;
-                return MB_OK;
-            }
-            proc->regs[r_type] = MB_MAKE_SMALLINT(MB_CMD_NONE);
-            proc->regs[r_a] = MB_MAKE_SMALLINT(rc);
-            proc->regs[r_b] = MB_MAKE_SMALLINT(0);
-            proc->regs[r_c] = MB_MAKE_SMALLINT(0);
-            proc->regs[r_d] = MB_MAKE_SMALLINT(0);
-            proc->last_error = rc;
-            return MB_OK;
+    MB_OP(op_get_y, MB_OP_GET_Y):
+        if (in->r[1] >= mb_heap_stack_depth(&proc->heap)) {
+            MB_FAULT(MB_BAD_FRAME);
         }
+        regs[in->r[0]] = proc->heap.from[proc->heap.stop + in->r[1]];
+        MB_NEXT();
 
-        if (sched != NULL) {
+    MB_OP(op_put_y, MB_OP_PUT_Y):
+        if (in->r[1] >= mb_heap_stack_depth(&proc->heap)) {
+            MB_FAULT(MB_BAD_FRAME);
+        }
+        proc->heap.from[proc->heap.stop + in->r[1]] = regs[in->r[0]];
+        MB_NEXT();
+
+    MB_OP(op_recv_cmd, MB_OP_RECV_CMD):
+        if (mb_exec_recv(proc, in->r, sched != NULL) != MB_OK) {
             /* Scheduler mode: block until a message arrives. */
-            proc->pc = pre_op_pc;
+            pc--;
             proc->state = MB_PROC_WAITING;
-            return MB_OK;
+            goto slice_out;
         }
-        /* Compat mode: non-blocking, return NONE. */
-        proc->regs[r_type] = MB_MAKE_SMALLINT(MB_CMD_NONE);
-        proc->regs[r_a] = MB_MAKE_SMALLINT(MB_MAILBOX_EMPTY);
-        proc->regs[r_b] = MB_MAKE_SMALLINT(0);
-        proc->regs[r_c] = MB_MAKE_SMALLINT(0);
-        proc->regs[r_d] = MB_MAKE_SMALLINT(0);
-        proc->last_error = MB_MAILBOX_EMPTY;
-        return MB_OK;
-    }
+        MB_NEXT();
 
-    case MB_OP_SEND: {
-        uint8_t r_pid, r_type, r_a, r_b, r_c, r_d;
-        mb_scheduler_t *s = (mb_scheduler_t *)sched;
-        mb_process_t *target;
-        mb_command_t cmd;
-        int rc;
+    MB_OP(op_send, MB_OP_SEND):
+        regs[in->r[0]] = MB_MAKE_SMALLINT(mb_exec_send(proc, sched, in->r));
+        MB_NEXT();
 
-        if (mb_fetch_u8(proc, &r_pid) != MB_OK ||
-            mb_fetch_u8(proc, &r_type) != MB_OK ||
-            mb_fetch_u8(proc, &r_a) != MB_OK ||
-            mb_fetch_u8(proc, &r_b) != MB_OK ||
-            mb_fetch_u8(proc, &r_c) != MB_OK ||
-            mb_fetch_u8(proc, &r_d) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
-        }
-        if (!mb_vm_valid_reg(r_pid) || !mb_vm_valid_reg(r_type) ||
-            !mb_vm_valid_reg(r_a) || !mb_vm_valid_reg(r_b) ||
-            !mb_vm_valid_reg(r_c) || !mb_vm_valid_reg(r_d)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
-        }
+    MB_OP(op_self, MB_OP_SELF):
+        regs[in->r[0]] = MB_MAKE_PID(proc->pid);
+        MB_NEXT();
 
-        if (s == NULL) {
-            proc->regs[r_pid] = MB_MAKE_SMALLINT(MB_BAD_ARGUMENT);
-            return MB_OK;
+    MB_OP(op_spawn, MB_OP_SPAWN):
+        rc = mb_exec_spawn(proc, sched, in->r);
+        if (rc != MB_OK) {
+            MB_FAULT(rc);
         }
+        MB_NEXT();
 
-        target = mb_sched_proc(s, (mb_pid_t)MB_GET_SMALLINT(proc->regs[r_pid]));
-        if (target == NULL) {
-            proc->regs[r_pid] = MB_MAKE_SMALLINT(MB_BAD_PID);
-            return MB_OK;
+    MB_OP(op_exit, MB_OP_EXIT):
+        if (sched != NULL) {
+            /* Frees the slot; slice_out then only writes to the dead process. */
+            (void)mb_sched_exit((mb_scheduler_t *)sched, proc->pid);
+            goto slice_out;
         }
+        proc->halted = 1;
+        proc->state = MB_PROC_HALTED;
+        goto slice_out;
 
-        /* Untag register values back to raw int32 for command ABI */
-        cmd.type = MB_GET_SMALLINT(proc->regs[r_type]);
-        cmd.a = MB_GET_SMALLINT(proc->regs[r_a]);
-        cmd.b = MB_GET_SMALLINT(proc->regs[r_b]);
-        cmd.c = MB_GET_SMALLINT(proc->regs[r_c]);
-        cmd.d = MB_GET_SMALLINT(proc->regs[r_d]);
+    MB_OP(op_yield, MB_OP_YIELD):
+        red = max_steps - 1; /* exhaust budget */
+        MB_NEXT();
 
-        rc = mb_vm_mailbox_push_proc(target, cmd);
-        if (rc == MB_OK && target->state == MB_PROC_WAITING) {
-            target->state = MB_PROC_READY;
+    MB_OP(op_jmp, MB_OP_JMP):
+        pc = in->imm;
+        MB_NEXT();
+
+    MB_OP(op_jmp_if_zero, MB_OP_JMP_IF_ZERO):
+        if (regs[in->r[0]] == MB_MAKE_SMALLINT(0)) {
+            pc = in->imm;
         }
-        proc->regs[r_pid] = MB_MAKE_SMALLINT(rc);
-        return MB_OK;
-    }
+        MB_NEXT();
+
+    /*
+     * Compare-and-branch.  EQ/NE compare terms exactly; LT/GE compare as
+     * small integers.  Tagging preserves signed order for small integers,
+     * so the immediate forms compare tagged words against a tagged literal.
+     */
+    MB_OP(op_jmp_eq, MB_OP_JMP_EQ):
+        if (regs[in->r[0]] == regs[in->r[1]]) {
+            pc = in->imm;
+        }
+        MB_NEXT();
 
-    case MB_OP_SELF: {
-        uint8_t r_dst;
-        if (mb_fetch_u8(proc, &r_dst) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+    MB_OP(op_jmp_ne, MB_OP_JMP_NE):
+        if (regs[in->r[0]] != regs[in->r[1]]) {
+            pc = in->imm;
         }
-        if (!mb_vm_valid_reg(r_dst)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
+        MB_NEXT();
+
+    MB_OP(op_jmp_lt, MB_OP_JMP_LT):
+        if (MB_GET_SMALLINT(regs[in->r[0]]) < MB_GET_SMALLINT(regs[in->r[1]])) {
+            pc = in->imm;
         }
-        proc->regs[r_dst] = MB_MAKE_PID(proc->pid);
-        return MB_OK;
-    }
+        MB_NEXT();
 
-    case MB_OP_YIELD:
-        proc->reductions = MB_REDUCTIONS; /* exhaust budget */
-        return MB_OK;
+    MB_OP(op_jmp_ge, MB_OP_JMP_GE):
+        if (MB_GET_SMALLINT(regs[in->r[0]]) >= MB_GET_SMALLINT(regs[in->r[1]])) {
+            pc = in->imm;
+        }
+        MB_NEXT();
 
-    case MB_OP_JMP: {
-        int32_t offset;
-        if (mb_fetch_i32(proc, &offset) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+    MB_OP(op_jmp_eq_imm, MB_OP_JMP_EQ_IMM):
+        if (regs[in->r[0]] == in->lit) {
+            pc = in->imm;
         }
-        if (offset < 0 && (size_t)(-offset) > proc->pc) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+        MB_NEXT();
+
+    MB_OP(op_jmp_ne_imm, MB_OP_JMP_NE_IMM):
+        if (regs[in->r[0]] != in->lit) {
+            pc = in->imm;
         }
-        proc->pc = (size_t)((int64_t)proc->pc + offset);
-        if (proc->pc > proc->program_size) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+        MB_NEXT();
+
+    MB_OP(op_jmp_lt_imm, MB_OP_JMP_LT_IMM):
+        if ((int32_t)regs[in->r[0]] < (int32_t)in->lit) {
+            pc = in->imm;
         }
-        return MB_OK;
-    }
+        MB_NEXT();
 
-    case MB_OP_JMP_IF_ZERO: {
-        uint8_t reg;
-        int32_t offset;
-        if (mb_fetch_u8(proc, &reg) != MB_OK || mb_fetch_i32(proc, &offset) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+    MB_OP(op_jmp_ge_imm, MB_OP_JMP_GE_IMM):
+        if ((int32_t)regs[in->r[0]] >= (int32_t)in->lit) {
+            pc = in->imm;
         }
-        if (!mb_vm_valid_reg(reg)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
+        MB_NEXT();
+
+    MB_OP(op_djnz, MB_OP_DJNZ): {
+        int32_t n = MB_GET_SMALLINT(regs[in->r[0]]) - 1;
+        regs[in->r[0]] = MB_MAKE_SMALLINT(n);
+        if (n != 0) {
+            pc = in->imm;
         }
-        if (proc->regs[reg] == MB_MAKE_SMALLINT(0)) {
-            if (offset < 0 && (size_t)(-offset) > proc->pc) {
-                proc->last_error = MB_EOF;
-                return proc->last_error;
-            }
-            proc->pc = (size_t)((int64_t)proc->pc + offset);
-            if (proc->pc > proc->program_size) {
-                proc->last_error = MB_EOF;
-                return proc->last_error;
+        MB_NEXT();
+    }
+
+    /*
+     * Multi-way branches: one dispatch however many cases.  SELECT_VAL
+     * binary-searches values sorted at decode time; JUMP_TABLE indexes
+     * by value - base.  Anything else goes to the fail target.
+     */
+    MB_OP(op_select_val, MB_OP_SELECT_VAL): {
+        const uint32_t *vals = &proc->code->case_val[in->r[2]];
+        mb_term_t v = regs[in->r[0]];
+        uint8_t lo = 0, hi = in->r[1];
+        while (lo < hi) {
+            uint8_t mid = (uint8_t)((lo + hi) / 2U);
+            if (vals[mid] < v) {
+                lo = (uint8_t)(mid + 1U);
+            } else {
+                hi = mid;
             }
         }
-        return MB_OK;
+        pc = (lo < in->r[1] && vals[lo] == v) ? proc->code->case_target[in->r[2] + lo] : in->imm;
+        MB_NEXT();
     }
 
-    case MB_OP_SLEEP_MS: {
-        uint8_t reg;
-        if (mb_fetch_u8(proc, &reg) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
-        }
-        if (!mb_vm_valid_reg(reg)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
-        }
+    MB_OP(op_jump_table, MB_OP_JUMP_TABLE): {
+        mb_term_t v = regs[in->r[0]];
+        uint32_t i = (uint32_t)MB_GET_SMALLINT(v) - in->lit;
+        pc = (MB_IS_SMALLINT(v) && i < in->r[1]) ? proc->code->case_target[in->r[2] + i] : in->imm;
+        MB_NEXT();
+    }
+
+    MB_OP(op_sleep_ms, MB_OP_SLEEP_MS):
         if (sched != NULL) {
             /* Scheduler mode: record wake time and yield. */
-            proc->sleep_until_ms = mb_hal_monotonic_ms() + (uint32_t)MB_GET_SMALLINT(proc->regs[reg]);
+            proc->sleep_until_ms = mb_hal_monotonic_ms() + (uint32_t)MB_GET_SMALLINT(regs[in->r[0]]);
             proc->state = MB_PROC_SLEEPING;
-        } else {
-            /* Compat mode: block directly. */
-            mb_hal_delay_ms((uint32_t)MB_GET_SMALLINT(proc->regs[reg]));
+            goto slice_out;
         }
-        return MB_OK;
-    }
+        /* Compat mode: block directly. */
+        mb_hal_delay_ms((uint32_t)MB_GET_SMALLINT(regs[in->r[0]]));
+        MB_NEXT();
 
-    case MB_OP_MAKE_TUPLE: {
-        uint8_t r_dst, arity, i;
+    MB_OP(op_make_tuple, MB_OP_MAKE_TUPLE): {
+        const uint8_t *elem_regs = &proc->program[in->imm];
+        uint8_t arity = in->r[1];
         mb_term_t elems[MB_MAX_TUPLE_ARITY];
         mb_term_t result;
-        mb_term_t *roots[MB_REG_COUNT];
+        uint8_t i;
 
-        if (mb_fetch_u8(proc, &r_dst) != MB_OK || mb_fetch_u8(proc, &arity) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
-        }
-        if (!mb_vm_valid_reg(r_dst) || arity > MB_MAX_TUPLE_ARITY) {
-            proc->last_error = (arity > MB_MAX_TUPLE_ARITY) ? MB_BAD_ARITY : MB_BAD_REG;
-            return proc->last_error;
-        }
         for (i = 0; i < arity; i++) {
-            uint8_t r;
-            if (mb_fetch_u8(proc, &r) != MB_OK) {
-                proc->last_error = MB_EOF;
-                return proc->last_error;
-            }
-            if (!mb_vm_valid_reg(r)) {
-                proc->last_error = MB_BAD_REG;
-                return proc->last_error;
-            }
-            elems[i] = proc->regs[r];
+            elems[i] = regs[elem_regs[i]];
         }
         result = mb_heap_make_tuple(&proc->heap, elems, arity);
         if (result == 0) {
-            /* GC and retry */
-            for (i = 0; i < MB_REG_COUNT; i++) roots[i] = &proc->regs[i];
-            mb_heap_gc(&proc->heap, roots, MB_REG_COUNT);
-            /* Re-read elems from (possibly moved) registers */
-            /* Note: the elem register indices are consumed, so we use
-             * the values already copied into elems[]. Immediate values
-             * in elems don't need updating. Heap pointers were updated
-             * via roots. Re-copy from registers. */
+            /* GC and retry; heap elements are re-read from the moved registers. */
+            mb_proc_gc(proc, 1U + arity);
+            for (i = 0; i < arity; i++) {
+                elems[i] = regs[elem_regs[i]];
+            }
             result = mb_heap_make_tuple(&proc->heap, elems, arity);
             if (result == 0) {
                 proc->last_error = MB_HEAP_OOM;
-                return proc->last_error;
+                MB_FAULT(MB_HEAP_OOM);
             }
         }
-        proc->regs[r_dst] = result;
-        return MB_OK;
+        regs[in->r[0]] = result;
+        MB_NEXT();
     }
 
-    case MB_OP_TUPLE_ELEM: {
-        uint8_t r_dst, r_tuple, index;
+    MB_OP(op_tuple_elem, MB_OP_TUPLE_ELEM): {
+        mb_term_t tuple = regs[in->r[1]];
         mb_term_t *ptr;
-        uint32_t arity;
 
-        if (mb_fetch_u8(proc, &r_dst) != MB_OK ||
-            mb_fetch_u8(proc, &r_tuple) != MB_OK ||
-            mb_fetch_u8(proc, &index) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
-        }
-        if (!mb_vm_valid_reg(r_dst) || !mb_vm_valid_reg(r_tuple)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
+        if (!MB_IS_BOXED(tuple)) {
+            MB_FAULT(MB_BAD_TERM);
         }
-        if (!MB_IS_BOXED(proc->regs[r_tuple])) {
-            proc->last_error = MB_BAD_TERM;
-            return proc->last_error;
-        }
-        ptr = &proc->heap.from[MB_GET_BOXED(proc->regs[r_tuple])];
+        ptr = mb_heap_ptr(&proc->heap, MB_GET_BOXED(tuple));
         if (!MB_IS_TUPLE_HDR(ptr[0])) {
-            proc->last_error = MB_BAD_TERM;
-            return proc->last_error;
+            MB_FAULT(MB_BAD_TERM);
         }
-        arity = MB_GET_TUPLE_ARITY(ptr[0]);
-        if (index >= arity) {
-            proc->last_error = MB_BAD_ARITY;
-            return proc->last_error;
+        if (in->r[2] >= MB_GET_TUPLE_ARITY(ptr[0])) {
+            MB_FAULT(MB_BAD_ARITY);
         }
-        proc->regs[r_dst] = ptr[1 + index];
-        return MB_OK;
+        regs[in->r[0]] = ptr[1 + in->r[2]];
+        MB_NEXT();
     }
 
-    case MB_OP_CONS: {
-        uint8_t r_dst, r_head, r_tail;
-        mb_term_t result;
-        mb_term_t *roots[MB_REG_COUNT];
-        uint8_t i;
-
-        if (mb_fetch_u8(proc, &r_dst) != MB_OK ||
-            mb_fetch_u8(proc, &r_head) != MB_OK ||
-            mb_fetch_u8(proc, &r_tail) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
-        }
-        if (!mb_vm_valid_reg(r_dst) || !mb_vm_valid_reg(r_head) || !mb_vm_valid_reg(r_tail)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
-        }
-        result = mb_heap_cons(&proc->heap, proc->regs[r_head], proc->regs[r_tail]);
+    MB_OP(op_cons, MB_OP_CONS): {
+        mb_term_t result = mb_heap_cons(&proc->heap, regs[in->r[1]], regs[in->r[2]]);
         if (result == 0) {
-            for (i = 0; i < MB_REG_COUNT; i++) roots[i] = &proc->regs[i];
-            mb_heap_gc(&proc->heap, roots, MB_REG_COUNT);
-            result = mb_heap_cons(&proc->heap, proc->regs[r_head], proc->regs[r_tail]);
+            mb_proc_gc(proc, 2);
+            result = mb_heap_cons(&proc->heap, regs[in->r[1]], regs[in->r[2]]);
             if (result == 0) {
-                proc->last_error = MB_HEAP_OOM;
-                return proc->last_error;
+                MB_FAULT(MB_HEAP_OOM);
             }
         }
-        proc->regs[r_dst] = result;
-        return MB_OK;
+        regs[in->r[0]] = result;
+        MB_NEXT();
     }
 
-    case MB_OP_HEAD: {
-        uint8_t r_dst, r_cons;
+    MB_OP(op_head, MB_OP_HEAD):
+    MB_OP(op_tail, MB_OP_TAIL): {
+        mb_term_t cell = regs[in->r[1]];
         mb_term_t *ptr;
 
-        if (mb_fetch_u8(proc, &r_dst) != MB_OK ||
-            mb_fetch_u8(proc, &r_cons) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+        if (!MB_IS_CONS(cell)) {
+            MB_FAULT(MB_BAD_TERM);
         }
-        if (!mb_vm_valid_reg(r_dst) || !mb_vm_valid_reg(r_cons)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
+        ptr = mb_heap_ptr(&proc->heap, MB_GET_CONS(cell));
+        regs[in->r[0]] = (in->op == MB_OP_HEAD) ? ptr[0] : ptr[1];
+        MB_NEXT();
+    }
+
+    /*
+     * Term tests fall through when the test holds and jump to the fail
+     * target otherwise, so a program can branch on a message's shape
+     * before taking it apart.
+     */
+    MB_OP(op_is_integer, MB_OP_IS_INTEGER):
+        if (!MB_IS_SMALLINT(regs[in->r[0]])) {
+            pc = in->imm;
         }
-        if (!MB_IS_CONS(proc->regs[r_cons])) {
-            proc->last_error = MB_BAD_TERM;
-            return proc->last_error;
+        MB_NEXT();
+
+    MB_OP(op_is_nil, MB_OP_IS_NIL):
+        if (regs[in->r[0]] != MB_NIL) {
+            pc = in->imm;
         }
-        ptr = &proc->heap.from[MB_GET_CONS(proc->regs[r_cons])];
-        proc->regs[r_dst] = ptr[0];
-        return MB_OK;
+        MB_NEXT();
+
+    MB_OP(op_is_cons, MB_OP_IS_CONS):
+        if (!MB_IS_CONS(regs[in->r[0]])) {
+            pc = in->imm;
+        }
+        MB_NEXT();
+
+    MB_OP(op_is_tuple, MB_OP_IS_TUPLE):
+        if (!MB_IS_BOXED(regs[in->r[0]])) {
+            pc = in->imm;
+        }
+        MB_NEXT();
+
+    MB_OP(op_test_arity, MB_OP_TEST_ARITY): {
+        mb_term_t t = regs[in->r[0]];
+        if (!MB_IS_BOXED(t) || *mb_heap_ptr(&proc->heap, MB_GET_BOXED(t)) != MB_MAKE_TUPLE_HDR(in->r[1])) {
+            pc = in->imm;
+        }
+        MB_NEXT();
     }
 
-    case MB_OP_TAIL: {
-        uint8_t r_dst, r_cons;
-        mb_term_t *ptr;
+    MB_OP(op_is_eq_exact, MB_OP_IS_EQ_EXACT): {
+        int equal;
+        if (mb_heap_eq_exact(&proc->heap, regs[in->r[0]], regs[in->r[1]], &equal) != 0) {
+            MB_FAULT(MB_STACK_OVERFLOW);
+        }
+        if (!equal) {
+            pc = in->imm;
+        }
+        MB_NEXT();
+    }
+
+    MB_OP(op_get_tuple_elements, MB_OP_GET_TUPLE_ELEMENTS): {
+        mb_term_t tuple = regs[in->r[0]];
+        const mb_term_t *ptr;
 
-        if (mb_fetch_u8(proc, &r_dst) != MB_OK ||
-            mb_fetch_u8(proc, &r_cons) != MB_OK) {
-            proc->last_error = MB_EOF;
-            return proc->last_error;
+        if (!MB_IS_BOXED(tuple)) {
+            MB_FAULT(MB_BAD_TERM);
         }
-        if (!mb_vm_valid_reg(r_dst) || !mb_vm_valid_reg(r_cons)) {
-            proc->last_error = MB_BAD_REG;
-            return proc->last_error;
+        ptr = mb_heap_ptr(&proc->heap, MB_GET_BOXED(tuple));
+        if (!MB_IS_TUPLE_HDR(ptr[0])) {
+            MB_FAULT(MB_BAD_TERM);
         }
-        if (!MB_IS_CONS(proc->regs[r_cons])) {
-            proc->last_error = MB_BAD_TERM;
-            return proc->last_error;
+        if (in->r[2] > MB_GET_TUPLE_ARITY(ptr[0])) {
+            MB_FAULT(MB_BAD_ARITY);
         }
-        ptr = &proc->heap.from[MB_GET_CONS(proc->regs[r_cons])];
-        proc->regs[r_dst] = ptr[1];
-        return MB_OK;
+        memcpy(&regs[in->r[1]], ptr + 1, (size_t)in->r[2] * sizeof(regs[0]));
+        MB_NEXT();
+    }
+
+    /* MIN/MAX/CLAMP compare tagged words; tagging preserves signed order. */
+    MB_OP(op_min, MB_OP_MIN):
+        regs[in->r[0]] = ((int32_t)regs[in->r[1]] <= (int32_t)regs[in->r[2]])
+                             ? regs[in->r[1]] : regs[in->r[2]];
+        MB_NEXT();
+
+    MB_OP(op_max, MB_OP_MAX):
+        regs[in->r[0]] = ((int32_t)regs[in->r[1]] >= (int32_t)regs[in->r[2]])
+                             ? regs[in->r[1]] : regs[in->r[2]];
+        MB_NEXT();
+
+    MB_OP(op_clamp, MB_OP_CLAMP): {
+        /* max(src, lo) then min(.., hi): hi wins when lo > hi */
+        mb_term_t v = regs[in->r[1]];
+        if ((int32_t)v < (int32_t)regs[in->r[2]]) {
+            v = regs[in->r[2]];
+        }
+        if ((int32_t)v > (int32_t)regs[in->r[3]]) {
+            v = regs[in->r[3]];
+        }
+        regs[in->r[0]] = v;
+        MB_NEXT();
+    }
+
+    MB_OP(op_qmul, MB_OP_QMUL):
+        /* Q16.16 product, rounded to nearest (ties toward +inf), saturated */
+        regs[in->r[0]] = mb_sat_smallint(
+            ((int64_t)MB_GET_SMALLINT(regs[in->r[1]]) * MB_GET_SMALLINT(regs[in->r[2]]) +
+             ((int64_t)1 << 15)) >> 16);
+        MB_NEXT();
+
+    MB_OP(op_lut, MB_OP_LUT):
+        regs[in->r[0]] = mb_lut(&proc->program[in->imm], in->r[2], in->r[3], in->lit,
+                                MB_GET_SMALLINT(regs[in->r[1]]));
+        MB_NEXT();
+
+    /*
+     * Superinstructions.  Each fuses one of the flow compiler's loop
+     * bodies so a sensor event costs two dispatches and an actuator
+     * event one.  The BIFs they call have fixed arity, so they always
+     * take the trusted BIF path.
+     */
+    MB_OP(op_i2c_sample, MB_OP_I2C_SAMPLE):
+        /* CALL_BIF I2C_READ_REG(bus, addr, reg) -> dst; CALL_BIF MONOTONIC_MS -> ts */
+        rc = mb_call_bif(proc, MB_BIF_I2C_READ_REG, 3, in->r, in->r[3], 1);
+        proc->last_error = rc;
+        if (rc != MB_OK) {
+            goto slice_fault;
+        }
+        regs[in->r[4]] = MB_MAKE_SMALLINT((int32_t)mb_hal_monotonic_ms());
+        MB_NEXT();
+
+    MB_OP(op_send_wait, MB_OP_SEND_WAIT): {
+        /*
+         * SEND; SLEEP_MS ms (YIELD when ms <= 0); JMP target.  The send
+         * status is dropped so the pid register survives the loop.
+         */
+        int32_t ms = MB_GET_SMALLINT(regs[in->r[6]]);
+
+        (void)mb_exec_send(proc, sched, in->r);
+        pc = in->imm;
+        if (sched != NULL) {
+            if (ms > 0) {
+                proc->sleep_until_ms = mb_hal_monotonic_ms() + (uint32_t)ms;
+                proc->state = MB_PROC_SLEEPING;
+            }
+            ++red; /* the slice ends here, but the send still cost one */
+            goto slice_out;
+        }
+        if (ms > 0) {
+            mb_hal_delay_ms((uint32_t)ms);
+        } else {
+            red = max_steps - 1;
+        }
+        MB_NEXT();
     }
 
-    case MB_OP_HALT:
+    MB_OP(op_recv_pwm, MB_OP_RECV_PWM):
+        /* RECV_CMD; PWM_SET_DUTY(a, b) -> rc if the command is one; JMP target */
+        if (mb_exec_recv(proc, in->r, sched != NULL) != MB_OK) {
+            pc--;
+            proc->state = MB_PROC_WAITING;
+            goto slice_out;
+        }
+        if (regs[in->r[0]] == MB_MAKE_SMALLINT(MB_CMD_PWM_SET_DUTY)) {
+            rc = mb_call_bif(proc, MB_BIF_PWM_SET_DUTY, 2, &in->r[1], in->r[5], 1);
+            proc->last_error = rc;
+            if (rc != MB_OK) {
+                goto slice_fault;
+            }
+        } else {
+            regs[in->r[5]] = MB_MAKE_SMALLINT(MB_INVALID_COMMAND);
+        }
+        pc = in->imm;
+        MB_NEXT();
+
+    MB_OP(op_halt, MB_OP_HALT):
         proc->halted = 1;
         proc->state = MB_PROC_HALTED;
-        return MB_OK;
+        goto slice_out;
 
-    default:
-        proc->last_error = MB_BAD_OPCODE;
-        return proc->last_error;
+    MB_OP(op_trap, MB_INSN_TRAP):
+        pc--;
+        MB_FAULT((int)in->imm);
+
+    MB_OP_DEFAULT(op_bad):
+        MB_FAULT(MB_BAD_OPCODE);
+
+#if !MB_THREADED
     }
+#endif
+
+slice_fault:
+    proc->last_error = rc;
+    proc->pc = pc;
+    proc->reductions = red;
+    return rc;
+
+slice_out:
+    proc->pc = pc;
+    proc->reductions = red;
+    return MB_OK;
+}
+
+#undef MB_FAULT
+#undef MB_NEXT
+#undef MB_DISPATCH
+#undef MB_OP_DEFAULT
+#undef MB_OP
+
+int mb_proc_step(mb_process_t *proc, void *sched) {
+    return mb_proc_run(proc, sched, 1);
 }
 
 int mb_proc_run(mb_process_t *proc, void *sched, uint32_t max_steps) {
-    proc->reductions = 0;
-    while (!proc->halted && proc->reductions < max_steps) {
-        int rc = mb_proc_step(proc, sched);
-        if (rc != MB_OK) {
-            return rc;
-        }
-        /* In scheduler mode, stop if process yielded/blocked. */
-        if (sched != NULL && proc->state != MB_PROC_READY) {
-            break;
-        }
-        proc->reductions++;
+    proc->slice_budget = max_steps;
+    if (proc->native != NULL) {
+        return proc->native(proc, sched, max_steps);
     }
-    return MB_OK;
+    return mb_proc_slice(proc, sched, 0, max_steps);
 }
 
-int mb_vm_mailbox_push_proc(mb_process_t *proc, mb_command_t cmd) {
-    return mb_mailbox_push_raw(&proc->mailbox, cmd);
+/* --- native (AOT, JIT) code support, see mb_native.h --- */
+
+int mb_native_interp(mb_process_t *proc, void *sched, uint32_t red, uint32_t max_steps) {
+    return mb_proc_slice(proc, sched, red, max_steps);
 }
 
-/* --- mb_vm_t compatibility layer --- */
+int mb_native_call_bif(mb_process_t *proc, uint8_t bif_id, uint8_t argc,
+                       const uint8_t *argv, uint8_t dst) {
+    return mb_call_bif(proc, bif_id, argc, argv, dst, 1);
+}
 
-static void mb_vm_to_proc(const mb_vm_t *vm, mb_process_t *proc) {
-    memset(proc, 0, sizeof(*proc));
-    proc->pid = MB_PID_NONE;
-    proc->state = vm->halted ? MB_PROC_HALTED : MB_PROC_READY;
-    proc->program = vm->program;
-    proc->program_size = vm->program_size;
-    proc->pc = vm->pc;
-    memcpy(proc->regs, vm->regs, sizeof(proc->regs));
-    proc->mailbox = vm->mailbox;
-    proc->halted = vm->halted;
-    proc->last_error = vm->last_error;
+int mb_native_recv(mb_process_t *proc, void *sched, const uint8_t *r) {
+    return mb_exec_recv(proc, r, sched != NULL);
+}
+
+int mb_native_send(mb_process_t *proc, void *sched, const uint8_t *r) {
+    return mb_exec_send(proc, sched, r);
 }
 
-static void mb_proc_to_vm(const mb_process_t *proc, mb_vm_t *vm) {
-    vm->pc = proc->pc;
-    memcpy(vm->regs, proc->regs, sizeof(vm->regs));
-    vm->mailbox = proc->mailbox;
-    vm->halted = proc->halted;
-    vm->last_error = proc->last_error;
+int mb_vm_mailbox_push_proc(mb_process_t *proc, mb_command_t cmd) {
+    return mb_mailbox_push_raw(&proc->mailbox, cmd);
 }
 
+/* --- mb_vm_t compatibility layer --- */
+
 void mb_vm_init(mb_vm_t *vm, const uint8_t *program, size_t program_size) {
-    memset(vm, 0, sizeof(*vm));
-    vm->program = program;
-    vm->program_size = program_size;
+    mb_proc_init(&vm->own, MB_PID_NONE, program, program_size);
+    mb_heap_init(&vm->own.heap, vm->heap_mem, MB_HEAP_WORDS);
+    vm->proc = &vm->own;
+}
+
+void mb_vm_attach(mb_vm_t *vm, mb_process_t *proc) {
+    vm->proc = proc;
 }
 
 int mb_vm_mailbox_push(mb_vm_t *vm, mb_command_t cmd) {
-    return mb_mailbox_push_raw(&vm->mailbox, cmd);
+    return mb_mailbox_push_raw(&vm->proc->mailbox, cmd);
 }
 
 int mb_vm_mailbox_pop(mb_vm_t *vm, mb_command_t *cmd) {
-    return mb_mailbox_pop_raw(&vm->mailbox, cmd);
+    return mb_mailbox_pop_raw(&vm->proc->mailbox, cmd);
 }
 
 int mb_vm_step(mb_vm_t *vm) {
-    mb_process_t proc;
-    int rc;
-    mb_vm_to_proc(vm, &proc);
-    rc = mb_proc_step(&proc, NULL);
-    mb_proc_to_vm(&proc, vm);
-    return rc;
+    return mb_proc_step(vm->proc, NULL);
 }
 
 int mb_vm_run(mb_vm_t *vm, uint32_t max_steps) {
-    mb_process_t proc;
-    int rc;
-    mb_vm_to_proc(vm, &proc);
-    rc = mb_proc_run(&proc, NULL, max_steps);
-    mb_proc_to_vm(&proc, vm);
-    return rc;
+    return mb_proc_run(vm->proc, NULL, max_steps);
 }
@@ -2,58 +2,190 @@
 #ifndef OS2_FLOW_GENERATED_H
 #define OS2_FLOW_GENERATED_H
 
+#include "mb_term.h"
+
 #define OS2_FLOW_SENSOR_COUNT 4
 #define OS2_FLOW_PROCESS_COUNT 5
 #define OS2_FLOW_MAILBOX_DEPTH 32
 #define OS2_FLOW_WATCHDOG_MS 6000
 #define OS2_FLOW_ON_FAIL "stop_actuator"
+#define OS2_FLOW_HEAP_WORDS 0  /* flow processes never allocate */
 
-static const uint8_t os2_flow_sensor_prog_1[72] = {
-    0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x01, 0x39, 0x00, 0x00, 0x00, 0x01,
-    0x02, 0x92, 0x00, 0x00, 0x00, 0x01, 0x03, 0x05, 0x00, 0x00, 0x00, 0x01,
-    0x04, 0x02, 0x00, 0x00, 0x00, 0x01, 0x05, 0x00, 0x00, 0x00, 0x00, 0x01,
-    0x06, 0x00, 0x00, 0x00, 0x00, 0x01, 0x08, 0x00, 0x00, 0x00, 0x00, 0x10,
-    0x03, 0x03, 0x00, 0x01, 0x02, 0x07, 0x10, 0x04, 0x00, 0x09, 0x21, 0x03,
-    0x04, 0x05, 0x07, 0x08, 0x08, 0x23, 0x30, 0xE8, 0xFF, 0xFF, 0xFF
-};
-static const uint8_t os2_flow_sensor_prog_2[72] = {
-    0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x01, 0x5F, 0x00, 0x00, 0x00, 0x01,
-    0x02, 0x0F, 0x00, 0x00, 0x00, 0x01, 0x03, 0x05, 0x00, 0x00, 0x00, 0x01,
-    0x04, 0x02, 0x00, 0x00, 0x00, 0x01, 0x05, 0x00, 0x00, 0x00, 0x00, 0x01,
-    0x06, 0x00, 0x00, 0x00, 0x00, 0x01, 0x08, 0x00, 0x00, 0x00, 0x00, 0x10,
-    0x03, 0x03, 0x00, 0x01, 0x02, 0x07, 0x10, 0x04, 0x00, 0x09, 0x21, 0x03,
-    0x04, 0x05, 0x07, 0x08, 0x08, 0x23, 0x30, 0xE8, 0xFF, 0xFF, 0xFF
-};
-static const uint8_t os2_flow_sensor_prog_3[72] = {
-    0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x01, 0x39, 0x00, 0x00, 0x00, 0x01,
-    0x02, 0x92, 0x00, 0x00, 0x00, 0x01, 0x03, 0x05, 0x00, 0x00, 0x00, 0x01,
-    0x04, 0x02, 0x00, 0x00, 0x00, 0x01, 0x05, 0x00, 0x00, 0x00, 0x00, 0x01,
-    0x06, 0x00, 0x00, 0x00, 0x00, 0x01, 0x08, 0x00, 0x00, 0x00, 0x00, 0x10,
-    0x03, 0x03, 0x00, 0x01, 0x02, 0x07, 0x10, 0x04, 0x00, 0x09, 0x21, 0x03,
-    0x04, 0x05, 0x07, 0x08, 0x08, 0x23, 0x30, 0xE8, 0xFF, 0xFF, 0xFF
-};
-static const uint8_t os2_flow_sensor_prog_4[72] = {
-    0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x01, 0x5F, 0x00, 0x00, 0x00, 0x01,
-    0x02, 0x0F, 0x00, 0x00, 0x00, 0x01, 0x03, 0x05, 0x00, 0x00, 0x00, 0x01,
-    0x04, 0x02, 0x00, 0x00, 0x00, 0x01, 0x05, 0x00, 0x00, 0x00, 0x00, 0x01,
-    0x06, 0x00, 0x00, 0x00, 0x00, 0x01, 0x08, 0x00, 0x00, 0x00, 0x00, 0x10,
-    0x03, 0x03, 0x00, 0x01, 0x02, 0x07, 0x10, 0x04, 0x00, 0x09, 0x21, 0x03,
-    0x04, 0x05, 0x07, 0x08, 0x08, 0x23, 0x30, 0xE8, 0xFF, 0xFF, 0xFF
+/* Every sensor runs this program with its row of os2_flow_sensor_args. */
+static const uint8_t os2_flow_sensor_prog[29] = {
+    0xC0, 0x00, 0x01, 0x04, 0x0A, 0x01, 0x05, 0x04, 0x01, 0x06, 0x00, 0x01, 0x08,
+    0x00, 0x70, 0x00, 0x01, 0x02, 0x07, 0x09, 0x71, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x08, 0x03, 0xF1
 };
 
-static const uint8_t *os2_flow_sensor_progs[] = {
-    os2_flow_sensor_prog_1,
-    os2_flow_sensor_prog_2,
-    os2_flow_sensor_prog_3,
-    os2_flow_sensor_prog_4
+/* Spawn arguments r0..r3: bus, addr, reg, poll_ms */
+#define OS2_FLOW_SENSOR_ARGC 4
+static const mb_term_t os2_flow_sensor_args[OS2_FLOW_SENSOR_COUNT][OS2_FLOW_SENSOR_ARGC] = {
+    {MB_MAKE_SMALLINT(1), MB_MAKE_SMALLINT(57), MB_MAKE_SMALLINT(146), MB_MAKE_SMALLINT(0)},
+    {MB_MAKE_SMALLINT(1), MB_MAKE_SMALLINT(95), MB_MAKE_SMALLINT(15), MB_MAKE_SMALLINT(0)},
+    {MB_MAKE_SMALLINT(1), MB_MAKE_SMALLINT(57), MB_MAKE_SMALLINT(146), MB_MAKE_SMALLINT(0)},
+    {MB_MAKE_SMALLINT(1), MB_MAKE_SMALLINT(95), MB_MAKE_SMALLINT(15), MB_MAKE_SMALLINT(0)}
 };
-static const size_t os2_flow_sensor_sizes[] = {
-    sizeof(os2_flow_sensor_prog_1), sizeof(os2_flow_sensor_prog_2), sizeof(os2_flow_sensor_prog_3), sizeof(os2_flow_sensor_prog_4)
+
+static const uint8_t os2_flow_actuator_prog[10] = {
+    0xC0, 0x00, 0x72, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0xF8
 };
 
-static const uint8_t os2_flow_actuator_prog[17] = {
-    0x20, 0x00, 0x01, 0x02, 0x03, 0x04, 0x10, 0x02, 0x02, 0x01, 0x02, 0x05, 0x30,
-    0xEF, 0xFF, 0xFF, 0xFF
+/*
+ * Native loops (flow_compile --aot).  Bit N-1 of OS2_FLOW_NATIVE_MASK
+ * runs pid N natively; the others are interpreted.
+ */
+#ifndef OS2_FLOW_NATIVE_MASK
+#define OS2_FLOW_NATIVE_MASK 0
+#endif
+
+#if OS2_FLOW_NATIVE_MASK
+#include "mb_native.h"
+
+static int os2_flow_sensor_loop(mb_process_t *proc, void *sched, uint32_t max_steps) {
+    static const uint8_t r4[] = {0, 1, 2};
+    static const uint8_t r5[] = {4, 5, 6, 7, 8, 8};
+    mb_term_t *const regs = proc->regs;
+    size_t pc = proc->pc;
+    uint32_t red = 0;
+    int rc;
+
+    proc->reductions = 0;
+    if (proc->halted || max_steps == 0) {
+        return MB_OK;
+    }
+
+    switch (pc) {
+    case 0: goto i0;
+    case 1: goto i1;
+    case 2: goto i2;
+    case 3: goto i3;
+    case 4: goto i4;
+    case 5: goto i5;
+    default: goto slice_eof;
+    }
+
+i0: /* CONST_I32 */
+    regs[4] = MB_MAKE_SMALLINT(5);
+    MB_NATIVE_NEXT(1);
+i1: /* CONST_I32 */
+    regs[5] = MB_MAKE_SMALLINT(2);
+    MB_NATIVE_NEXT(2);
+i2: /* CONST_I32 */
+    regs[6] = MB_MAKE_SMALLINT(0);
+    MB_NATIVE_NEXT(3);
+i3: /* CONST_I32 */
+    regs[8] = MB_MAKE_SMALLINT(0);
+    MB_NATIVE_NEXT(4);
+i4: /* I2C_SAMPLE */
+    rc = mb_native_call_bif(proc, MB_BIF_I2C_READ_REG, 3, r4, 7);
+    proc->last_error = rc;
+    if (rc != MB_OK) {
+        pc = 5;
+        goto slice_fault;
+    }
+    regs[9] = MB_MAKE_SMALLINT((int32_t)mb_hal_monotonic_ms());
+    MB_NATIVE_NEXT(5);
+i5: /* SEND_WAIT */ {
+    int32_t ms = MB_GET_SMALLINT(regs[3]);
+
+    (void)mb_native_send(proc, sched, r5);
+    pc = 4;
+    if (sched != NULL) {
+        if (ms > 0) {
+            proc->sleep_until_ms = mb_hal_monotonic_ms() + (uint32_t)ms;
+            proc->state = MB_PROC_SLEEPING;
+        }
+        ++red;
+        goto slice_out;
+    }
+    if (ms > 0) {
+        mb_hal_delay_ms((uint32_t)ms);
+    } else {
+        red = max_steps - 1;
+    }
+    MB_NATIVE_NEXT(4);
+    goto i4;
+}
+
+/* Past the last instruction: the interpreter's EOF trap. */
+slice_eof:
+    rc = MB_EOF;
+slice_fault:
+    proc->last_error = rc;
+    proc->pc = pc;
+    proc->reductions = red;
+    return rc;
+
+slice_out:
+    proc->pc = pc;
+    proc->reductions = red;
+    return MB_OK;
+}
+
+static int os2_flow_actuator_loop(mb_process_t *proc, void *sched, uint32_t max_steps) {
+    static const uint8_t r0[] = {0, 1, 2, 3, 4};
+    mb_term_t *const regs = proc->regs;
+    size_t pc = proc->pc;
+    uint32_t red = 0;
+    int rc;
+
+    proc->reductions = 0;
+    if (proc->halted || max_steps == 0) {
+        return MB_OK;
+    }
+
+    switch (pc) {
+    case 0: goto i0;
+    default: goto slice_eof;
+    }
+
+i0: /* RECV_PWM */
+    if (mb_native_recv(proc, sched, r0) != MB_OK) {
+        proc->state = MB_PROC_WAITING;
+        goto slice_out;
+    }
+    if (regs[0] == MB_MAKE_SMALLINT(MB_CMD_PWM_SET_DUTY)) {
+        rc = mb_native_call_bif(proc, MB_BIF_PWM_SET_DUTY, 2, &r0[1], 5);
+        proc->last_error = rc;
+        if (rc != MB_OK) {
+            pc = 1;
+            goto slice_fault;
+        }
+    } else {
+        regs[5] = MB_MAKE_SMALLINT(MB_INVALID_COMMAND);
+    }
+    MB_NATIVE_NEXT(0);
+    goto i0;
+
+/* Past the last instruction: the interpreter's EOF trap. */
+slice_eof:
+    rc = MB_EOF;
+slice_fault:
+    proc->last_error = rc;
+    proc->pc = pc;
+    proc->reductions = red;
+    return rc;
+
+slice_out:
+    proc->pc = pc;
+    proc->reductions = red;
+    return MB_OK;
+}
+
+#define OS2_FLOW_NATIVE_FN(bit, fn) ((OS2_FLOW_NATIVE_MASK & (bit)) ? (fn) : NULL)
+
+static const mb_native_fn os2_flow_sensor_natives[] = {
+    OS2_FLOW_NATIVE_FN(0x1, os2_flow_sensor_loop),
+    OS2_FLOW_NATIVE_FN(0x2, os2_flow_sensor_loop),
+    OS2_FLOW_NATIVE_FN(0x4, os2_flow_sensor_loop),
+    OS2_FLOW_NATIVE_FN(0x8, os2_flow_sensor_loop)
 };
+static const mb_native_fn os2_flow_actuator_native =
+    OS2_FLOW_NATIVE_FN(0x10, os2_flow_actuator_loop);
+#else
+static const mb_native_fn os2_flow_sensor_natives[4] = { NULL };
+static const mb_native_fn os2_flow_actuator_native = NULL;
+#endif
 
 #endif
@@ -17,9 +17,19 @@
 #endif
 
 #include "mb_vm.h"
+#include "mb_module.h"
 #include "mb_scheduler.h"
 #include "flow_generated.h"
 
+/*
+ * OS2_FLOW_MODULE_ADDR: address of a flow module (flow_compile --mbm)
+ * flashed separately from the firmware.  It runs in place from flash
+ * instead of the flow compiled into flow_generated.h.
+ */
+#ifndef OS2_FLOW_MODULE_MAX
+#define OS2_FLOW_MODULE_MAX 4096  /* bytes readable at OS2_FLOW_MODULE_ADDR */
+#endif
+
 /*
  * Module: OS/II Zephyr runtime (nRF52840 / Nano 33 BLE Sense path)
  *
@@ -57,8 +67,6 @@ LOG_MODULE_REGISTER(mini_beam_nrf52, LOG_LEVEL_INF);
 #define OS2_REG_EVT_BUS 11
 #define OS2_REG_EVT_ADDR 12
 #define OS2_REG_EVT_REG 13
-#define OS2_REG_CMD_PWM_SET_DUTY 14
-#define OS2_REG_TMP 15
 
 /* Mailbox backpressure policy (v1): reject new command when mailbox is full. */
 #define OS2_MB_POLICY_REJECT_NEW 1
@@ -74,6 +82,13 @@ LOG_MODULE_REGISTER(mini_beam_nrf52, LOG_LEVEL_INF);
 #ifndef OS2_ENABLE_TASK_WDT
 #define OS2_ENABLE_TASK_WDT 1
 #endif
+#ifndef OS2_ENABLE_UPLOAD
+#define OS2_ENABLE_UPLOAD 1
+#endif
+#ifndef OS2_UPLOAD_MAX
+#define OS2_UPLOAD_MAX 1024U  /* largest module accepted over serial */
+#endif
+#define OS2_UPLOAD_IDLE_MS 1000U  /* a partial upload is dropped after this gap */
 
 /* Locked board capability schema (v1), encoded as Erlang term text in logs. */
 #define OS2_CAPS_SCHEMA_VERSION 1U
@@ -279,19 +294,26 @@ static void os2_emit_i32(size_t *pc, int32_t value) {
     demo_program[(*pc)++] = (uint8_t)((value >> 24) & 0xff);
 }
 
-static void os2_patch_rel_i32(size_t patch_pos, size_t target_pc) {
-    int32_t rel = (int32_t)target_pc - (int32_t)(patch_pos + 4U);
+/* Patch a jump offset; it is relative to insn_end, the byte after the instruction. */
+static void os2_patch_rel_i32_from(size_t patch_pos, size_t insn_end, size_t target_pc) {
+    int32_t rel = (int32_t)target_pc - (int32_t)insn_end;
     demo_program[patch_pos + 0] = (uint8_t)(rel & 0xff);
     demo_program[patch_pos + 1] = (uint8_t)((rel >> 8) & 0xff);
     demo_program[patch_pos + 2] = (uint8_t)((rel >> 16) & 0xff);
     demo_program[patch_pos + 3] = (uint8_t)((rel >> 24) & 0xff);
 }
 
+/* Patch the trailing offset of a jump instruction. */
+static void os2_patch_rel_i32(size_t patch_pos, size_t target_pc) {
+    os2_patch_rel_i32_from(patch_pos, patch_pos + 4U, target_pc);
+}
+
 static size_t os2_build_cyclic_program(void) {
     size_t pc = 0;
     size_t loop_pc;
-    size_t jz_to_sleep_patch;
-    size_t jz_to_pwm_patch;
+    size_t case_sleep_patch;
+    size_t case_pwm_patch;
+    size_t dispatch_end;
     size_t jmp_over_pwm_patch;
     size_t jmp_to_loop_patch;
     size_t pwm_path_pc;
@@ -305,10 +327,6 @@ static size_t os2_build_cyclic_program(void) {
     os2_emit_u8(&pc, 10);
     os2_emit_i32(&pc, MB_CMD_NONE);
 
-    os2_emit_u8(&pc, MB_OP_CONST_I32);
-    os2_emit_u8(&pc, OS2_REG_CMD_PWM_SET_DUTY);
-    os2_emit_i32(&pc, MB_CMD_PWM_SET_DUTY);
-
     loop_pc = pc;
     /* recv -> r0:type r1:bus r2:addr r3:reg r4:sensor_id */
     os2_emit_u8(&pc, MB_OP_RECV_CMD);
@@ -318,22 +336,22 @@ static size_t os2_build_cyclic_program(void) {
     os2_emit_u8(&pc, 3);
     os2_emit_u8(&pc, 4);
 
-    /* if r0 == 0 then sleep path */
-    os2_emit_u8(&pc, MB_OP_JMP_IF_ZERO);
-    os2_emit_u8(&pc, 0);
-    jz_to_sleep_patch = pc;
-    os2_emit_i32(&pc, 0);
-
-    /* if r0 == MB_CMD_PWM_SET_DUTY jump to pwm path */
-    os2_emit_u8(&pc, MB_OP_SUB);
-    os2_emit_u8(&pc, OS2_REG_TMP);
+    /*
+     * One dispatch on the command type: NONE -> sleep path,
+     * PWM_SET_DUTY -> pwm path, any other type falls through to the
+     * I2C read below.
+     */
+    os2_emit_u8(&pc, MB_OP_JUMP_TABLE);
     os2_emit_u8(&pc, OS2_REG_CMD_TYPE);
-    os2_emit_u8(&pc, OS2_REG_CMD_PWM_SET_DUTY);
-
-    os2_emit_u8(&pc, MB_OP_JMP_IF_ZERO);
-    os2_emit_u8(&pc, OS2_REG_TMP);
-    jz_to_pwm_patch = pc;
-    os2_emit_i32(&pc, 0);
+    os2_emit_u8(&pc, MB_CMD_PWM_SET_DUTY + 1);
+    os2_emit_i32(&pc, MB_CMD_NONE);     /* base */
+    os2_emit_i32(&pc, 0);               /* other types: fall through */
+    case_sleep_patch = pc;
+    os2_emit_i32(&pc, 0);               /* MB_CMD_NONE */
+    os2_emit_i32(&pc, 0);               /* MB_CMD_GPIO_WRITE: fall through */
+    case_pwm_patch = pc;
+    os2_emit_i32(&pc, 0);               /* MB_CMD_PWM_SET_DUTY */
+    dispatch_end = pc;
 
     /* value/err in r7 */
     os2_emit_u8(&pc, MB_OP_CALL_BIF);
@@ -426,13 +444,13 @@ static size_t os2_build_cyclic_program(void) {
     os2_emit_i32(&pc, 0);
 
     /* sleep path */
-    os2_patch_rel_i32(jz_to_sleep_patch, pc);
+    os2_patch_rel_i32_from(case_sleep_patch, dispatch_end, pc);
     os2_emit_u8(&pc, MB_OP_SLEEP_MS);
     os2_emit_u8(&pc, 6);
     os2_emit_u8(&pc, MB_OP_JMP);
     os2_emit_i32(&pc, (int32_t)loop_pc - (int32_t)(pc + 4U));
 
-    os2_patch_rel_i32(jz_to_pwm_patch, pwm_path_pc);
+    os2_patch_rel_i32_from(case_pwm_patch, dispatch_end, pwm_path_pc);
     os2_patch_rel_i32(jmp_over_pwm_patch, loop_pc);
     os2_patch_rel_i32(jmp_to_loop_patch, loop_pc);
     return pc;
@@ -716,10 +734,87 @@ static void os2_log_caps_v1(void) {
         os2_caps_v1.wdt_timeout_ms);
 }
 
+#if OS2_ENABLE_UPLOAD
+/*
+ * Hot upgrade over the console link: a flow module (flow_compile --mbm)
+ * written raw to the serial port is collected here and installed with
+ * mb_module_upgrade(), with no reboot.  Processes keep their registers
+ * and mailboxes and switch at their next RECV/sleep/loop head.  Uploads
+ * alternate between two RAM slots, so the slot the old version runs from
+ * is never overwritten: a new upload is ignored while an upgrade is
+ * still pending.  The module CRC rejects corrupted transfers.
+ */
+typedef struct {
+    uint8_t  slot[2][OS2_UPLOAD_MAX] __aligned(4);
+    uint8_t  next;     /* slot the next upload is written to */
+    uint32_t len;      /* bytes collected */
+    uint32_t want;     /* module size, known after 12 header bytes */
+    uint32_t last_ms;
+} os2_upload_t;
+
+static os2_upload_t os2_upload;
+
+static void os2_upload_install(os2_upload_t *u, mb_scheduler_t *sched) {
+    mb_module_t mod;
+    int rc = mb_module_load(&mod, u->slot[u->next], u->len);
+
+    if (rc == MB_OK) {
+        rc = mb_module_upgrade(&mod, sched);
+    }
+    if (rc != MB_OK) {
+        LOG_ERR("upload: module rejected rc=%d (%u bytes)", rc, (unsigned)u->len);
+        return;
+    }
+    LOG_INF("upload: module installed (%u bytes, %u processes, %u switching)",
+            (unsigned)u->len, mod.entry_count, mb_sched_upgrades_pending(sched));
+    u->next ^= 1U;
+}
+
+static void os2_upload_poll(const struct device *uart, mb_scheduler_t *sched) {
+    static const uint8_t magic[4] = { 'M', 'B', 'M', 0 };
+    os2_upload_t *u = &os2_upload;
+    uint32_t now = k_uptime_get_32();
+    unsigned char c;
+
+    if (u->len != 0 && (now - u->last_ms) > OS2_UPLOAD_IDLE_MS) {
+        LOG_WRN("upload: timed out after %u bytes", (unsigned)u->len);
+        u->len = 0;
+    }
+    while (uart_poll_in(uart, &c) == 0) {
+        u->last_ms = now;
+        if (u->len < sizeof(magic) && c != magic[u->len]) {
+            u->len = 0;  /* not a module: resynchronise on the magic */
+            continue;
+        }
+        if (u->len == 0 && mb_sched_upgrades_pending(sched) != 0) {
+            LOG_WRN("upload: ignored, previous upgrade still pending");
+            continue;
+        }
+        u->slot[u->next][u->len++] = c;
+        if (u->len == 12U) {
+            const uint8_t *h = u->slot[u->next];
+            u->want = (uint32_t)h[8] | ((uint32_t)h[9] << 8) |
+                      ((uint32_t)h[10] << 16) | ((uint32_t)h[11] << 24);
+            if (u->want < MB_MODULE_HEADER_SIZE || u->want > OS2_UPLOAD_MAX) {
+                LOG_ERR("upload: bad module size %u", (unsigned)u->want);
+                u->len = 0;
+            }
+        } else if (u->len > 12U && u->len == u->want) {
+            os2_upload_install(u, sched);
+            u->len = 0;
+        }
+    }
+}
+#endif
+
 int main(void) {
     static mb_scheduler_t sched;
+#ifdef OS2_FLOW_MODULE_ADDR
+    static mb_module_t flow_mod;
+#endif
     mb_pid_t pid_sensor, pid_actuator;
     mb_process_t *proc_s, *proc_a;
+    mb_spawn_opts_t spawn_opts = MB_SPAWN_OPTS_INIT;
     int rc;
     os2_sensor_target_t targets[6];
     size_t target_count = 0;
@@ -779,17 +874,57 @@ int main(void) {
 
     /* Spawn flow-compiled processes */
     mb_sched_init(&sched);
+#ifdef OS2_FLOW_MODULE_ADDR
+    /* The module supersedes the compiled-in flow (and its native loops). */
+    ARG_UNUSED(os2_flow_sensor_prog);
+    ARG_UNUSED(os2_flow_sensor_args);
+    ARG_UNUSED(os2_flow_actuator_prog);
+    ARG_UNUSED(os2_flow_sensor_natives);
+    ARG_UNUSED(os2_flow_actuator_native);
+    ARG_UNUSED(spawn_opts);
+    rc = mb_module_load(&flow_mod, (const uint8_t *)OS2_FLOW_MODULE_ADDR, OS2_FLOW_MODULE_MAX);
+    if (rc == MB_OK) {
+        rc = mb_module_spawn_all(&flow_mod, &sched);
+    }
+    if (rc != MB_OK) {
+        LOG_ERR("flow module at 0x%08x rejected rc=%d", (unsigned)OS2_FLOW_MODULE_ADDR, rc);
+        return -EINVAL;
+    }
+    pid_sensor = 1;
+    proc_s = mb_sched_proc(&sched, pid_sensor);
+    pid_actuator = flow_mod.entry_count;
+    proc_a = mb_sched_proc(&sched, pid_actuator);
+    LOG_INF("flow: module at 0x%08x (XIP), %u processes, %u code bytes",
+            (unsigned)OS2_FLOW_MODULE_ADDR, flow_mod.entry_count, (unsigned)flow_mod.code_size);
+#else
+    /* Flow loops never allocate: no heap, so the arena stays free for others. */
+    spawn_opts.heap_words = OS2_FLOW_HEAP_WORDS;
+    spawn_opts.argc = OS2_FLOW_SENSOR_ARGC;
     for (i = 0; i < OS2_FLOW_SENSOR_COUNT; i++) {
-        mb_pid_t p = mb_sched_spawn(&sched, os2_flow_sensor_progs[i],
-                                     os2_flow_sensor_sizes[i]);
-        LOG_INF("flow: sensor pid=%u (%u bytes)", p, (unsigned)os2_flow_sensor_sizes[i]);
+        mb_pid_t p;
+
+        spawn_opts.args = os2_flow_sensor_args[i];
+        spawn_opts.native = os2_flow_sensor_natives[i];
+        p = mb_sched_spawn_opts(&sched, os2_flow_sensor_prog,
+                                sizeof(os2_flow_sensor_prog), &spawn_opts);
+        LOG_INF("flow: sensor pid=%u (bus %d addr 0x%02x%s)", p,
+                (int)MB_GET_SMALLINT(os2_flow_sensor_args[i][0]),
+                (unsigned)MB_GET_SMALLINT(os2_flow_sensor_args[i][1]),
+                os2_flow_sensor_natives[i] != NULL ? ", native" : "");
         if (i == 0) { pid_sensor = p; proc_s = mb_sched_proc(&sched, p); }
     }
-    pid_actuator = mb_sched_spawn(&sched, os2_flow_actuator_prog,
-                                   sizeof(os2_flow_actuator_prog));
+    LOG_INF("flow: %u sensors share one %u-byte program", OS2_FLOW_SENSOR_COUNT,
+            (unsigned)sizeof(os2_flow_sensor_prog));
+    spawn_opts.args = NULL;
+    spawn_opts.argc = 0;
+    spawn_opts.native = os2_flow_actuator_native;
+    pid_actuator = mb_sched_spawn_opts(&sched, os2_flow_actuator_prog,
+                                       sizeof(os2_flow_actuator_prog), &spawn_opts);
     proc_a = mb_sched_proc(&sched, pid_actuator);
-    LOG_INF("flow: actuator pid=%u, %u total processes",
-            pid_actuator, OS2_FLOW_PROCESS_COUNT);
+    LOG_INF("flow: actuator pid=%u%s, %u total processes",
+            pid_actuator, os2_flow_actuator_native != NULL ? " (native)" : "",
+            OS2_FLOW_PROCESS_COUNT);
+#endif
 
     /*
      * Main loop: the flow-compiled programs are self-driving.
@@ -862,6 +997,13 @@ int main(void) {
                 }
             }
 
+#if OS2_ENABLE_UPLOAD
+            /* the CDC ring buffer holds a whole module between polls */
+            if ((tick_count & 0xFFU) == 0U) {
+                os2_upload_poll(DEVICE_DT_GET(DT_CHOSEN(zephyr_console)), &sched);
+            }
+#endif
+
 #if OS2_ENABLE_TASK_WDT
             if (task_wdt_feed(wdt_channel) < 0) {
                 LOG_ERR("task_wdt feed failed");
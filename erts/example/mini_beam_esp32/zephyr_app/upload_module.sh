@@ -0,0 +1,30 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Hot-upgrade the running flow without reflashing.
+# - Sends a flow module (flow_compile.escript --mbm) over the console link
+# - The firmware installs it with mb_module_upgrade(); processes keep
+#   their registers and mailboxes (see OS2_ENABLE_UPLOAD in src/main.c)
+# - Result is logged by the board: "upload: module installed" or
+#   "upload: module rejected rc=..."
+#
+# Usage:
+#   ./upload_module.sh flow.mbm
+#   ./upload_module.sh --port /dev/ttyACM1 flow.mbm
+
+PORT="/dev/ttyACM0"
+BAUD="115200"
+
+if [[ "${1:-}" == "--port" ]]; then
+  PORT="$2"
+  shift 2
+fi
+MODULE="${1:-}"
+if [[ -z "$MODULE" || ! -f "$MODULE" ]]; then
+  echo "usage: $0 [--port <tty>] <flow.mbm>" >&2
+  exit 2
+fi
+
+stty -F "$PORT" "$BAUD" raw -echo
+cat "$MODULE" > "$PORT"
+echo "[upload] $(wc -c < "$MODULE") bytes -> $PORT"